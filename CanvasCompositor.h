@@ -0,0 +1,415 @@
+#pragma once
+#include <vector>
+#include "LineTool.h"
+#include "TriangleTool.h"
+#include "SquareTool.h"
+#include "CircleTool.h"
+#include "OvalTool.h"
+#include "FreehandTool.h"
+#include "EraserTool.h"
+#include "DocumentIO.h"
+#include "RectUtils.h"
+#include "TileRenderer.h"
+
+// Canvas compositing: the cached canvas holds every item up to gCanvasZ.
+// New commits are drawn straight onto it, deletions repaint a dirty
+// rectangle, and anything else is a full rebuild (on the tile pool when the
+// device allows). Items come out of the tools in z order through ZMerge.
+//
+// The scene (the seven tools) and the canvas device are defined by main.cpp
+// (gCanvas through EasyX) or by a headless driver such as the tests.
+
+enum Tool { TOOL_FREEHAND, TOOL_LINE, TOOL_TRIANGLE, TOOL_SQUARE, TOOL_CIRCLE, TOOL_OVAL, TOOL_ERASER, TOOL_COUNT };
+
+extern FreehandTool freehandTool;
+extern LineTool     lineTool;
+extern TriangleTool triangleTool;
+extern SquareTool   squareTool;
+extern CircleTool   circleTool;
+extern OvalTool     ovalTool;
+extern EraserTool   eraserTool;
+extern int          gZCounter;
+
+// ---- Canvas device ----
+bool canvasReady();                       // the canvas has pixels
+void createCanvas();                      // a white canvas
+int  canvasWidth();
+int  canvasHeight();
+void beginCanvas(bool background = false);   // gRender draws on the canvas (or the background layer) until endCanvas()
+void endCanvas();
+void paintCanvasBase(const RECT& area);   // white, then the background layer, under the current clip
+bool rebuildCanvasTiled();                // full rebuild on the tile pool; false: do it serially
+
+// ---- Canvas state ----
+extern bool gNeedsRebuild;      // full rebuild (deletions, loads, clears)
+extern int  gCanvasZ;           // highest z already composited into the canvas
+extern RECT gDirty;             // region to repaint after deletions
+extern bool gHasDirty;
+
+// Present damage: window areas that changed since the last present
+extern RECT gPresentDamage;     // canvas pixels changed
+extern bool gHasPresentDamage;
+extern bool gFullPresent;       // whole window (first frame, rebuilds, clears)
+
+inline void damageCanvas(const RECT& r) {
+    if (gHasPresentDamage) rectUnion(gPresentDamage, r);
+    else { gPresentDamage = r; gHasPresentDamage = true; }
+}
+
+inline void markDirty(const RECT& r) {
+    if (gHasDirty) rectUnion(gDirty, r);
+    else { gDirty = r; gHasDirty = true; }
+}
+
+// Window areas a present restores from the canvas, clipped to w x h: the
+// whole window after a full present, else the canvas damage, the area last
+// frame's preview covered ('shown') and this frame's ('preview'). Either may
+// be null. Returns how many of areas[3] are set.
+inline int presentAreas(const RECT* shown, const RECT* preview, int w, int h, RECT* areas) {
+    int n = 0;
+    if (gFullPresent) {
+        areas[n++] = makeRect(0, 0, w - 1, h - 1);
+    }
+    else {
+        if (gHasPresentDamage) areas[n++] = gPresentDamage;
+        if (shown)             areas[n++] = *shown;
+        if (preview)           areas[n++] = *preview;
+    }
+    int kept = 0;
+    for (int i = 0; i < n; ++i)
+        if (rectClip(areas[i], w, h)) areas[kept++] = areas[i];
+    return kept;
+}
+
+// ---- Items ----
+struct RenderRef { int z; Tool tool; size_t index; };
+
+inline size_t toolCount(Tool t) {
+    switch (t) {
+    case TOOL_FREEHAND: return freehandTool.getCount();
+    case TOOL_LINE:     return lineTool.getCount();
+    case TOOL_TRIANGLE: return triangleTool.getCount();
+    case TOOL_SQUARE:   return squareTool.getCount();
+    case TOOL_CIRCLE:   return circleTool.getCount();
+    case TOOL_OVAL:     return ovalTool.getCount();
+    case TOOL_ERASER:   return eraserTool.getCount();
+    default:            return 0;
+    }
+}
+
+inline int toolZ(Tool t, size_t i) {
+    switch (t) {
+    case TOOL_FREEHAND: return freehandTool.getZ(i);
+    case TOOL_LINE:     return lineTool.getZ(i);
+    case TOOL_TRIANGLE: return triangleTool.getZ(i);
+    case TOOL_SQUARE:   return squareTool.getZ(i);
+    case TOOL_CIRCLE:   return circleTool.getZ(i);
+    case TOOL_OVAL:     return ovalTool.getZ(i);
+    case TOOL_ERASER:   return eraserTool.getZ(i);
+    default:            return 0;
+    }
+}
+
+inline RECT toolBounds(Tool t, size_t i) {
+    switch (t) {
+    case TOOL_FREEHAND: return freehandTool.getBounds(i);
+    case TOOL_LINE:     return lineTool.getBounds(i);
+    case TOOL_TRIANGLE: return triangleTool.getBounds(i);
+    case TOOL_SQUARE:   return squareTool.getBounds(i);
+    case TOOL_CIRCLE:   return circleTool.getBounds(i);
+    case TOOL_OVAL:     return ovalTool.getBounds(i);
+    case TOOL_ERASER:   return eraserTool.getBounds(i);
+    default:            return makeRect(0, 0, -1, -1);
+    }
+}
+
+inline void toolDrawAt(Tool t, size_t i) {
+    switch (t) {
+    case TOOL_FREEHAND: freehandTool.drawAt(i); break;
+    case TOOL_LINE:     lineTool.drawAt(i);     break;
+    case TOOL_TRIANGLE: triangleTool.drawAt(i); break;
+    case TOOL_SQUARE:   squareTool.drawAt(i);   break;
+    case TOOL_CIRCLE:   circleTool.drawAt(i);   break;
+    case TOOL_OVAL:     ovalTool.drawAt(i);     break;
+    case TOOL_ERASER:   eraserTool.drawAt(i);   break;
+    default: break;
+    }
+}
+
+// The shape tools' rubber-band preview for this cursor position
+inline RECT toolPreviewBounds(Tool t, POINT mouse) {
+    switch (t) {
+    case TOOL_LINE:     return lineTool.previewBounds(mouse);
+    case TOOL_TRIANGLE: return triangleTool.previewBounds(mouse);
+    case TOOL_SQUARE:   return squareTool.previewBounds(mouse);
+    case TOOL_CIRCLE:   return circleTool.previewBounds(mouse);
+    case TOOL_OVAL:     return ovalTool.previewBounds(mouse);
+    default:            return makeRect(0, 0, -1, -1);
+    }
+}
+
+inline void toolDrawPreview(Tool t, POINT mouse, int* style) {
+    switch (t) {
+    case TOOL_LINE:     lineTool.drawPreview(mouse, style);     break;
+    case TOOL_TRIANGLE: triangleTool.drawPreview(mouse, style); break;
+    case TOOL_SQUARE:   squareTool.drawPreview(mouse, style);   break;
+    case TOOL_CIRCLE:   circleTool.drawPreview(mouse, style);   break;
+    case TOOL_OVAL:     ovalTool.drawPreview(mouse, style);     break;
+    default: break;
+    }
+}
+
+inline void toolEraseZs(Tool t, const int* zs, size_t n) {
+    switch (t) {
+    case TOOL_FREEHAND: freehandTool.eraseZs(zs, n); break;
+    case TOOL_ERASER:   eraserTool.eraseZs(zs, n);   break;
+    case TOOL_LINE:     lineTool.eraseZs(zs, n);     break;
+    case TOOL_TRIANGLE: triangleTool.eraseZs(zs, n); break;
+    case TOOL_SQUARE:   squareTool.eraseZs(zs, n);   break;
+    case TOOL_CIRCLE:   circleTool.eraseZs(zs, n);   break;
+    case TOOL_OVAL:     ovalTool.eraseZs(zs, n);     break;
+    default: break;
+    }
+}
+
+// Document section (DocumentIO.h) holding a tool's records
+inline int toolSection(Tool t) {
+    switch (t) {
+    case TOOL_FREEHAND: return DOC_FHST;
+    case TOOL_LINE:     return DOC_LINE;
+    case TOOL_TRIANGLE: return DOC_TRI;
+    case TOOL_SQUARE:   return DOC_SQR;
+    case TOOL_CIRCLE:   return DOC_CIRC;
+    case TOOL_OVAL:     return DOC_OVAL;
+    default:            return DOC_ERAS;
+    }
+}
+
+// ...and back: the tool whose records a section holds
+inline Tool sectionTool(int section) {
+    switch (section) {
+    case DOC_FHST: return TOOL_FREEHAND;
+    case DOC_LINE: return TOOL_LINE;
+    case DOC_TRI:  return TOOL_TRIANGLE;
+    case DOC_SQR:  return TOOL_SQUARE;
+    case DOC_CIRC: return TOOL_CIRCLE;
+    case DOC_OVAL: return TOOL_OVAL;
+    default:       return TOOL_ERASER;
+    }
+}
+
+// Highest z in the scene (below gZCounter after an undo)
+inline int sceneTopZ() {
+    int top = 0;
+    for (int t = 0; t < TOOL_COUNT; ++t) {
+        size_t n = toolCount(static_cast<Tool>(t));
+        if (n > 0 && toolZ(static_cast<Tool>(t), n - 1) > top) top = toolZ(static_cast<Tool>(t), n - 1);
+    }
+    return top;
+}
+
+// Streaming k-way merge over the tools' item lists. Each tool already keeps
+// its items in increasing z (appended with ++gZCounter, order-preserving
+// deletes), so a 7-entry min-heap of list heads yields the global z order
+// without gathering or sorting anything. Lives on the stack; no allocation.
+class ZMerge {
+public:
+    // Items with z <= minZ are skipped; with 'area' set, so are items whose
+    // bounds miss it.
+    ZMerge(int minZ, const RECT* area) : area(area), heapSize(0) {
+        for (int t = 0; t < TOOL_COUNT; ++t) {
+            Tool tool = static_cast<Tool>(t);
+            size_t i = toolCount(tool);
+            while (i > 0 && toolZ(tool, i - 1) > minZ) --i;   // z-sorted: items above minZ are a tail
+            pos[t] = i;
+            RenderRef head;
+            if (headOf(tool, head)) heap[heapSize++] = head;
+        }
+        for (int i = heapSize / 2 - 1; i >= 0; --i) siftDown(i);
+    }
+
+    bool next(RenderRef& out) {
+        if (heapSize == 0) return false;
+        out = heap[0];
+        pos[out.tool] = out.index + 1;
+        if (!headOf(out.tool, heap[0])) heap[0] = heap[--heapSize];
+        siftDown(0);
+        return true;
+    }
+
+private:
+    const RECT* area;
+    size_t      pos[TOOL_COUNT];
+    RenderRef   heap[TOOL_COUNT];
+    int         heapSize;
+
+    // Next drawable item of 'tool' at or after its cursor
+    bool headOf(Tool tool, RenderRef& out) {
+        size_t n = toolCount(tool);
+        size_t i = pos[tool];
+        if (area) {
+            while (i < n && !rectsOverlap(toolBounds(tool, i), *area)) ++i;
+            pos[tool] = i;
+        }
+        if (i >= n) return false;
+        out.z = toolZ(tool, i);
+        out.tool = tool;
+        out.index = i;
+        return true;
+    }
+
+    void siftDown(int i) {
+        for (;;) {
+            int l = 2 * i + 1, r = l + 1, m = i;
+            if (l < heapSize && heap[l].z < heap[m].z) m = l;
+            if (r < heapSize && heap[r].z < heap[m].z) m = r;
+            if (m == i) return;
+            RenderRef tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+            i = m;
+        }
+    }
+};
+
+// ---- Compositing ----
+
+// Draw every item with z > minZ through gRender, in z order.
+// With 'area' set, only items whose bounds overlap it are drawn.
+// Unclipped draws add each item's bounds to the present damage (clipped
+// repaints report their own area).
+inline void drawItems(int minZ, const RECT* area) {
+    gRender->setRop(R2_COPYPEN);
+    gRender->setLineColor(BLACK);
+
+    ZMerge merge(minZ, area);
+    RenderRef r;
+    while (merge.next(r)) {
+        toolDrawAt(r.tool, r.index);
+        if (!area) damageCanvas(toolBounds(r.tool, r.index));
+    }
+}
+
+inline void drawTileItem(int tag, size_t index) { toolDrawAt(Tool(tag), index); }
+
+// Bin every item in z order, then rasterize all tiles in parallel straight
+// into 'px' (w x h, background layer 'bg' at the origin if set). False (px
+// untouched) if the bins couldn't be allocated.
+inline bool renderTiled(TileRenderer& tiles, uint32_t* px, int w, int h, const uint32_t* bg, int bgW, int bgH) {
+    if (!tiles.begin(w, h)) return false;
+
+    ZMerge merge(0, nullptr);
+    RenderRef r;
+    while (merge.next(r))
+        if (!tiles.add(r.tool, r.index, toolBounds(r.tool, r.index))) return false;
+
+    tiles.render(px, w, bg, bgW, bgH, drawTileItem);
+    return true;
+}
+
+inline void rebuildCanvas() {
+    if (!canvasReady()) createCanvas();
+
+    if (!rebuildCanvasTiled()) {   // no tile pool, or out of memory for bins: one serial pass
+        beginCanvas();
+        // 1) Start clean with the background layer (if any)
+        paintCanvasBase(makeRect(0, 0, canvasWidth() - 1, canvasHeight() - 1));
+
+        // 2) Vector model on top
+        drawItems(0, nullptr);
+
+        endCanvas();
+    }
+    gNeedsRebuild = false;
+    gHasDirty = false;
+    gCanvasZ = gZCounter;
+    gFullPresent = true;
+}
+
+// Fast path: new commits always carry the highest z, so they can be drawn
+// straight onto the cached canvas. Same draw order as a full rebuild.
+inline void appendToCanvas() {
+    if (!canvasReady()) { rebuildCanvas(); return; }
+
+    beginCanvas();
+    drawItems(gCanvasZ, nullptr);
+    endCanvas();
+    gCanvasZ = gZCounter;
+}
+
+// A freehand stroke keeps one z while it grows, so segments added after it was
+// composited are drawn onto the canvas here, with the same state as drawItems().
+inline void compositeSegment(POINT a, POINT b) {
+    if (!canvasReady()) return;
+    beginCanvas();
+    gRender->setRop(R2_COPYPEN);
+    gRender->setLineColor(BLACK);
+    freehandTool.drawOpenSegment();
+    endCanvas();
+    damageCanvas(segmentBounds(a, b, 1));
+}
+
+// Partial repaint: clear gDirty, restore its background, redraw only the
+// shapes overlapping it, all clipped to the rectangle.
+inline void repairDirty() {
+    gHasDirty = false;
+    if (!canvasReady()) { rebuildCanvas(); return; }
+    if (!rectClip(gDirty, canvasWidth(), canvasHeight())) return;
+
+    beginCanvas();
+    gRender->setClip(&gDirty);
+    paintCanvasBase(gDirty);
+    drawItems(0, &gDirty);
+    endCanvas();
+    damageCanvas(gDirty);
+}
+
+inline void updateCanvas() {
+    if (gNeedsRebuild) { rebuildCanvas(); return; }
+    if (gCanvasZ < gZCounter) appendToCanvas();
+    if (gHasDirty) repairDirty();
+}
+
+// ---- Raster erase bake ----
+
+// The items the eraser stroke that just ended (capsules from 'first' on)
+// has to be baked with. Going down in z, an item is baked if its bounds
+// meet those of an item baked already, starting with the stroke's
+// capsules: what stays vector then draws the same over the new layer.
+// 'baked' comes out in descending z, 'area' is their bounds clipped to the
+// w x h canvas; false if that is empty (all off the canvas: leave it vector).
+inline bool selectBake(size_t first, int w, int h, std::vector<RenderRef>& baked, RECT& area) {
+    static std::vector<RenderRef> items;
+    static std::vector<RECT> boxes;            // bounds of the baked items
+
+    items.clear();
+    ZMerge merge(0, nullptr);
+    RenderRef r;
+    while (merge.next(r)) items.push_back(r);
+
+    baked.clear();
+    boxes.clear();
+    area = makeRect(0, 0, -1, -1);
+    for (size_t i = items.size(); i-- > 0;) {
+        const RenderRef& it = items[i];
+        RECT b = toolBounds(it.tool, it.index);
+        bool bake = it.tool == TOOL_ERASER && it.index >= first;
+        if (!bake && !boxes.empty() && rectsOverlap(b, area))
+            for (size_t k = 0; k < boxes.size() && !bake; ++k) bake = rectsOverlap(b, boxes[k]);
+        if (!bake) continue;
+        if (boxes.empty()) area = b;
+        else rectUnion(area, b);
+        boxes.push_back(b);
+        baked.push_back(it);
+    }
+    return rectClip(area, w, h);
+}
+
+// Draw the baked items (descending z, as selectBake() leaves them) onto the
+// background layer, clipped to 'area'
+inline void drawBaked(const std::vector<RenderRef>& baked, const RECT& area) {
+    beginCanvas(true);
+    gRender->setClip(&area);
+    gRender->setRop(R2_COPYPEN);
+    gRender->setLineColor(BLACK);
+    for (size_t i = baked.size(); i-- > 0;) toolDrawAt(baked[i].tool, baked[i].index);
+    endCanvas();
+}
@@ -1,10 +1,13 @@
 ﻿#pragma once
-#include <graphics.h>
-#include <windows.h>    // COLORREF
+#include "RenderBackend.h"
 #include <cmath>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 #include "LineUtils.h"  // style convention (0=solid, 1=dashed)
+#include "RectUtils.h"
+#include "ConicRaster.h"
 
 // Globals owned by main.cpp
 extern bool     fillEnabled;
@@ -13,12 +16,13 @@ extern COLORREF currentFillColor;   //set via RGB(r,g,b)
 
 class CircleTool {
 private:
-    // In-progress points
-    POINT* p1 = nullptr;   // center
-    POINT* p2 = nullptr;   // point on radius
+    // In-progress points (by value; pointCount says how many are set)
+    POINT p1 = { 0, 0 };   // center
+    POINT p2 = { 0, 0 };   // point on radius
+    int   pointCount = 0;
 
     struct StyledCircle {
-        POINT* center;   // committed center
+        POINT    center;   // committed center
         int      radius;   // committed radius
         int      style;    // 0 = solid, 1 = dashed
         bool     fill;     // fill the disk?
@@ -29,9 +33,11 @@ private:
     StyledCircle* circles = nullptr;
     int count = 0;
     int capacity = 0;
+    bool borrowed = false;   // circles points into a mapped document (read-only)
 
     void ensureCapacity(int need) {
         if (capacity >= need) return;
+        if (!ownRecords()) return;
 
         int newCap = capacity ? capacity * 2 : 16;
         if (newCap < need) newCap = need;
@@ -51,76 +57,52 @@ private:
         if (r <= 0) return;
 
         if (style == 0) {
-            circle(cx, cy, r);
+            gRender->circle(cx, cy, r);
             return;
         }
 
-        // dashed: draw small chord segments, skip every other chunk
-        const double TWO_PI = 6.283185307179586;
-        const int    SEG_DEG = 6;  // chord step (degrees)
-        const int    DASH_RUN = 3;  // draw 3 segments, skip 3
-        const int    GAP_RUN = 3;
-
-        int segCount = int(std::ceil(360.0 / SEG_DEG));
-        int runLen = DASH_RUN + GAP_RUN;
-
-        for (int s = 0; s < segCount; ++s) {
-            int posInRun = s % runLen;
-            bool drawThis = posInRun < DASH_RUN;
-            if (!drawThis) continue;
-
-            double a0 = (s * SEG_DEG) * (TWO_PI / 360.0);
-            double a1 = ((s + 1) * SEG_DEG) * (TWO_PI / 360.0);
-
-            int x0 = cx + int(std::lround(r * std::cos(a0)));
-            int y0 = cy + int(std::lround(r * std::sin(a0)));
-            int x1 = cx + int(std::lround(r * std::cos(a1)));
-            int y1 = cy + int(std::lround(r * std::sin(a1)));
-
-            line(x0, y0, x1, y1);
-        }
+        dashConic(cx, cy, circleQuadrant(r));   // dashes run on around the rim
     }
 
 public:
     ~CircleTool() {
-        reset();
-        for (int i = 0; i < count; ++i) {
-            delete circles[i].center;
-        }
-        std::free(circles);
+        if (!borrowed) std::free(circles);
     }
 
     void addPoint(POINT p) {
-        if (!p1)       p1 = new POINT{ p.x, p.y };
-        else if (!p2)  p2 = new POINT{ p.x, p.y };
+        if (pointCount == 0)      p1 = p;
+        else if (pointCount == 1) p2 = p;
+        else return;
+        ++pointCount;
     }
 
-    bool isReady() const { return p1 && p2; }
+    bool isReady() const { return pointCount == 2; }
 
     // Commit current circle; final draw in COPY mode; force BLACK edges; save/restore state.
     void drawAndReset(int* style) {
         if (!isReady()) return;
 
-        int r = distancei(*p1, *p2);
+        int r = distancei(p1, p2);
+        if (r <= 0) { reset(); return; }   // both clicks on one point: nothing to draw or store
 
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);  // never XOR on final render
+        gRender->setRop(R2_COPYPEN);  // never XOR on final render
 
         if (fillEnabled) {
-            setfillcolor(currentFillColor);
-            solidcircle(p1->x, p1->y, r);
+            gRender->setFillColor(currentFillColor);
+            gRender->solidCircle(p1.x, p1.y, r);
         }
 
-        setlinecolor(BLACK);  // deterministic outline color for final draw
-        drawCircleOutline(p1->x, p1->y, r, *style);
+        gRender->setLineColor(BLACK);  // deterministic outline color for final draw
+        drawCircleOutline(p1.x, p1.y, r, *style);
 
         // Restore state
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
 
         // Store committed circle
         ensureCapacity(count + 1);
@@ -134,9 +116,6 @@ public:
                 currentFillColor
             };
             ++count;
-
-            delete p2; p2 = nullptr;  // freeing memories after commiting
-            p1 = nullptr;             // ownership moved
         }
 
         reset(); 
@@ -147,28 +126,27 @@ public:
     size_t getCount() const { return size_t(count); }
     int    getZ(size_t i) const { return (i < getCount()) ? circles[i].z : 0; }
 
+    RECT getBounds(size_t i) const {
+        if (i >= getCount()) return makeRect(0, 0, -1, -1);
+        const auto& c = circles[i];
+        int r = c.radius + 1;
+        return makeRect(c.center.x - r, c.center.y - r, c.center.x + r, c.center.y + r);
+    }
+
     void drawAt(size_t i) const {
         if (i >= getCount()) return;
 
         const auto& c = circles[i];
 
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
-
-        setrop2(R2_COPYPEN);
+        gRender->setRop(R2_COPYPEN);
 
         if (c.fill) {
-            setfillcolor(c.fillColor);
-            solidcircle(c.center->x, c.center->y, c.radius);
+            gRender->setFillColor(c.fillColor);
+            gRender->solidCircle(c.center.x, c.center.y, c.radius);
         }
 
-        setlinecolor(BLACK);
-        drawCircleOutline(c.center->x, c.center->y, c.radius, c.style);
-
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
+        gRender->setLineColor(BLACK);
+        drawCircleOutline(c.center.x, c.center.y, c.radius, c.style);
     }
 
     void drawCompleted() const {
@@ -178,64 +156,160 @@ public:
 
     // Preview with COPY mode (no XOR) and LIGHTGRAY outline
     void drawPreview(POINT mouse, int* style) const {
-        if (!p1) return;
+        if (pointCount == 0) return;
 
-        int r = p2 ? distancei(*p1, *p2) : distancei(*p1, mouse);
+        int r = (pointCount >= 2) ? distancei(p1, p2) : distancei(p1, mouse);
 
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);     
-        setlinecolor(LIGHTGRAY); 
+        gRender->setRop(R2_COPYPEN);     
+        gRender->setLineColor(LIGHTGRAY); 
 
-        drawCircleOutline(p1->x, p1->y, r, *style);
+        drawCircleOutline(p1.x, p1.y, r, *style);
 
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setLineColor(oldLine);
+    }
+
+    // Area drawPreview() touches (empty if nothing is previewed)
+    RECT previewBounds(POINT mouse) const {
+        if (pointCount == 0) return makeRect(0, 0, -1, -1);
+        int r = ((pointCount >= 2) ? distancei(p1, p2) : distancei(p1, mouse)) + 1;
+        return makeRect(p1.x - r, p1.y - r, p1.x + r, p1.y + r);
     }
 
     // --- Memory management ---
 
     void reset() {
-        delete p1; delete p2;
-        p1 = p2 = nullptr;
+        pointCount = 0;
     }
 
     void resetAll() {
         reset();
-        for (int i = 0; i < count; ++i) {
-            delete circles[i].center;
-        }
-        std::free(circles);
+        if (!borrowed) std::free(circles);
         circles = nullptr;
+        borrowed = false;
         capacity = 0;
         count = 0;
     }
 
-    // --- Deletion ---
+    // ---- Bulk access (document save/load) ----
+    typedef StyledCircle Record;
+    const Record* records() const { return circles; }
+
+    // Drop everything and make room for n (> 0) records, marked
+    // as used; the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return nullptr;
+        ensureCapacity(int(n));
+        if (capacity < int(n)) return nullptr;
+        count = int(n);
+        return circles;
+    }
 
-    bool deleteCircleNear(POINT mouse, int threshold = 10) {
-        for (int i = 0; i < count; ++i) {
-            int cx = circles[i].center->x;
-            int cy = circles[i].center->y;
-            int r = circles[i].radius;
+    // Append one record as is (journal replay); its z must be above every stored z
+    bool appendRecord(const Record& r) {
+        ensureCapacity(count + 1);
+        if (capacity < count + 1) return false;
+        circles[count++] = r;
+        return true;
+    }
 
-            int dx = mouse.x - cx;
-            int dy = mouse.y - cy;
-            int d = int(std::lround(std::sqrt(double(dx) * dx + double(dy) * dy)));
+    // Use n records stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return;
+        circles = const_cast<Record*>(r);
+        count = capacity = int(n);
+        borrowed = true;
+    }
+
+    // Copy borrowed records to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* nb = std::malloc(size_t(count) * sizeof(Record));
+        if (!nb) return false;
+        std::memcpy(nb, circles, size_t(count) * sizeof(Record));
+        circles = (Record*)nb;
+        capacity = count;
+        borrowed = false;
+        return true;
+    }
 
-            if (std::abs(d - r) <= threshold) {
-                delete circles[i].center;
+    // Exchange stored records with another tool (undo keeps whole scenes
+    // this way); in-progress input stays where it is
+    void swapRecords(CircleTool& o) {
+        std::swap(circles, o.circles);
+        std::swap(count, o.count);
+        std::swap(capacity, o.capacity);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // --- Right-click removal (main.cpp finds candidates through the spatial index) ---
+
+    // First index whose z is >= z (items are z-sorted)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (circles[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the item with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && circles[i].z == z) ? i : getCount();
+    }
+
+    // Is mouse within threshold of the rim of circle i?
+    bool hitTest(size_t i, POINT mouse, int threshold = 10) const {
+        if (i >= getCount()) return false;
+        int dx = mouse.x - circles[i].center.x;
+        int dy = mouse.y - circles[i].center.y;
+        int d = int(std::lround(std::sqrt(double(dx) * dx + double(dy) * dy)));
+        return std::abs(d - circles[i].radius) <= threshold;
+    }
+
+    // Removes every item whose z is listed in zs (ascending) with a single
+    // order-preserving compaction pass starting at the first match.
+    // Returns how many items were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t w = lowerBoundZ(zs[0]);
+        size_t k = 0;
+        for (size_t r = w; r < getCount(); ++r) {
+            while (k < n && zs[k] < circles[r].z) ++k;
+            if (k < n && zs[k] == circles[r].z) { ++k; continue; }
+            circles[w++] = circles[r];
+        }
+        size_t removed = getCount() - w;
+        count = int(w);
+        return removed;
+    }
 
-                if (i < count - 1) {
-                    std::memmove(&circles[i],
-                        &circles[i + 1],
-                        size_t(count - i - 1) * sizeof(StyledCircle));
-                }
-                --count;
-                return true;
-            }
+    // Put back records taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the records above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (n > size_t(INT_MAX - count)) return false;
+        ensureCapacity(count + int(n));
+        if (capacity < count + int(n)) return false;
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = getCount(), dst = getCount() + n, k = n;
+        while (k > 0) {
+            if (src > lo && circles[src - 1].z > r[k - 1].z) circles[--dst] = circles[--src];
+            else circles[--dst] = r[--k];
         }
-        return false;
+        count += int(n);
+        return true;
     }
 };
@@ -0,0 +1,162 @@
+#pragma once
+#include "RenderBackend.h"
+#include <cstdlib>
+
+// Integer ellipse/circle rasterization shared by CircleTool and OvalTool.
+//
+// circleQuadrant()/ellipseQuadrant() walk one quadrant of the outline with
+// the midpoint algorithm (the same recurrences FramebufferBackend uses for
+// circle() and ellipse(), so fills meet the solid outlines exactly). The other three
+// quadrants are mirrors, so fillConic() and dashConic() both run off the
+// one table: fills become row spans, dashed outlines become "on" runs
+// walked once around the rim.
+
+// Radii are clamped to this before sizing scratch, so a stored radius can't
+// overflow the point counts (loaders reject larger ones anyway)
+static const int CONIC_MAX_RADIUS = 1 << 16;
+
+struct ConicQuadrant {
+    const POINT* pts;   // (x, y) offsets from the center, y = 0 .. ry, x falling
+    int          n;
+};
+
+// Per-thread scratch (tile workers rasterize in parallel); grows, never
+// shrinks, and is freed when its thread exits
+inline POINT* conicScratch(int need) {
+    struct Scratch {
+        POINT* buf = nullptr;
+        int    cap = 0;
+        ~Scratch() { std::free(buf); }
+    };
+    thread_local Scratch s;
+    if (s.cap < need) {
+        int newCap = s.cap ? s.cap * 2 : 256;
+        if (newCap < need) newCap = need;
+        void* nb = std::realloc(s.buf, size_t(newCap) * sizeof(POINT));
+        if (!nb) return nullptr;
+        s.buf = (POINT*)nb;
+        s.cap = newCap;
+    }
+    return s.buf;
+}
+
+// Circle quadrant in rim order from (r, 0) to (0, r): the first octant up to
+// the diagonal, then its mirror back out. Same pixels as backend circle().
+inline ConicQuadrant circleQuadrant(int r) {
+    ConicQuadrant q = { nullptr, 0 };
+    if (r <= 0) return q;
+    if (r > CONIC_MAX_RADIUS) r = CONIC_MAX_RADIUS;
+    POINT* out = conicScratch(2 * r + 4);
+    if (!out) return q;
+    int n = 0;
+    int x = r, y = 0, err = 1 - r;
+    while (x >= y) {
+        out[n++] = { x, y };
+        ++y;
+        if (err < 0) err += 2 * y + 1;
+        else { --x; err += 2 * (y - x) + 1; }
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        if (out[i].x == out[i].y) continue;
+        out[n++] = { out[i].y, out[i].x };
+    }
+    q.pts = out;
+    q.n = n;
+    return q;
+}
+
+// Ellipse quadrant in rim order from (rx, 0) to (0, ry). Generated from
+// (0, ry) outwards (scaled by 4 so the half-pixel terms stay exact), then
+// reversed. Same pixels as backend ellipse().
+inline ConicQuadrant ellipseQuadrant(int rx, int ry) {
+    ConicQuadrant q = { nullptr, 0 };
+    if (rx <= 0 || ry <= 0) return q;
+    if (rx > CONIC_MAX_RADIUS) rx = CONIC_MAX_RADIUS;
+    if (ry > CONIC_MAX_RADIUS) ry = CONIC_MAX_RADIUS;
+    POINT* out = conicScratch(rx + ry + 4);
+    if (!out) return q;
+    int n = 0;
+    long long a2 = (long long)rx * rx, b2 = (long long)ry * ry;
+    long long x = 0, y = ry;
+    long long d = 4 * b2 - 4 * a2 * ry + a2;
+    while (b2 * x <= a2 * y) {
+        out[n++] = { int(x), int(y) };
+        if (d < 0) d += 4 * b2 * (2 * x + 3);
+        else { d += 4 * b2 * (2 * x + 3) - 8 * a2 * (y - 1); --y; }
+        ++x;
+    }
+    d = b2 * (2 * x + 1) * (2 * x + 1) + 4 * a2 * (y - 1) * (y - 1) - 4 * a2 * b2;
+    while (y >= 0) {
+        out[n++] = { int(x), int(y) };
+        if (d > 0) d += 4 * a2 * (3 - 2 * y);
+        else { d += 4 * b2 * (2 * x + 2) + 4 * a2 * (3 - 2 * y); ++x; }
+        --y;
+    }
+    for (int i = 0, j = n - 1; i < j; ++i, --j) {
+        POINT t = out[i]; out[i] = out[j]; out[j] = t;
+    }
+    q.pts = out;
+    q.n = n;
+    return q;
+}
+
+// Fill inside the outline with the current fill color. Each row's span ends
+// at the outermost outline pixel; rows of equal width go out as one rectangle.
+inline void fillConic(int cx, int cy, ConicQuadrant q) {
+    int i = 0;
+    while (i < q.n) {
+        int w = q.pts[i].x, y0 = q.pts[i].y, y1 = y0;
+        while (i < q.n && q.pts[i].y == y1) ++i;             // rest of this row
+        while (i < q.n && q.pts[i].x == w) { y1 = q.pts[i].y; ++i; }   // same width below
+        while (i < q.n && q.pts[i].y == y1) ++i;
+        if (y0 == 0) gRender->solidRectangle(cx - w, cy - y1, cx + w, cy + y1);
+        else {
+            gRender->solidRectangle(cx - w, cy + y0, cx + w, cy + y1);
+            gRender->solidRectangle(cx - w, cy - y1, cx + w, cy - y0);
+        }
+    }
+}
+
+// Dashed outline in the current line color: the rim is split into 20 equal
+// runs of pixels starting at (cx + rx, cy) and going clockwise, every other
+// one drawn. Only the "on" runs are walked; each is one solid polyline, with
+// straight stretches merged into a single vertex pair.
+inline void dashConic(int cx, int cy, ConicQuadrant q) {
+    if (q.n < 2) return;
+    const int DASHES = 20;                  // on + off runs around the rim
+    const int MAXV = 64;
+    int m = q.n - 1;                        // quadrant ends are shared
+    int perimeter = 4 * m;
+    POINT run[MAXV];
+
+    for (int k = 0; k < DASHES; k += 2) {
+        // Pixels i with floor(i * DASHES / perimeter) == k
+        int i0 = (k * perimeter + DASHES - 1) / DASHES;
+        int i1 = ((k + 1) * perimeter + DASHES - 1) / DASHES;
+        int qd = i0 / m, j = i0 % m;
+        int nv = 0, ddx = 0, ddy = 0;
+        for (int i = i0; i < i1; ++i) {
+            // Quadrants clockwise on screen: +x+y forward, -x+y backward,
+            // -x-y forward, +x-y backward
+            const POINT& p = (qd & 1) ? q.pts[m - j] : q.pts[j];
+            int x = (qd == 1 || qd == 2) ? cx - p.x : cx + p.x;
+            int y = (qd >= 2) ? cy - p.y : cy + p.y;
+            if (++j == m) { j = 0; ++qd; }
+
+            if (nv >= 2 && x - run[nv - 1].x == ddx && y - run[nv - 1].y == ddy) {
+                run[nv - 1].x = x;          // same direction: stretch the last segment
+                run[nv - 1].y = y;
+                continue;
+            }
+            if (nv == MAXV) {
+                gRender->polyline(run, nv);
+                run[0] = run[nv - 1];
+                nv = 1;
+            }
+            if (nv >= 1) { ddx = x - run[nv - 1].x; ddy = y - run[nv - 1].y; }
+            run[nv++] = { x, y };
+        }
+        if (nv >= 2) gRender->polyline(run, nv);
+        else if (nv == 1) gRender->line(run[0].x, run[0].y, run[0].x, run[0].y);
+    }
+}
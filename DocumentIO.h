@@ -0,0 +1,656 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>      // malloc, free
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "FreehandTool.h"
+#include "LineTool.h"
+#include "TriangleTool.h"
+#include "SquareTool.h"
+#include "CircleTool.h"
+#include "OvalTool.h"
+#include "EraserTool.h"
+
+class SpatialGrid;
+
+// Drawing Pad document (.dpad): every tool's records, z values included.
+//
+//   DocHeader                 32 bytes
+//   DocSection[sectionCount]  24 bytes each
+//   payloads                  each starts on a 64-byte boundary, zero padded
+//
+// A payload is a tool's record array byte-for-byte as it sits in memory
+// (little-endian, Windows POINT/COLORREF layout, padding zeroed), so saving
+// is a straight fwrite per section and loading is one fread straight into
+// storage sized up front.
+// The alignment also lets a memory-mapped file be used in place
+// (mapDocument()).
+// recordSize pins the layout: a section whose record size differs from this
+// build's fails the load instead of being misread. Unknown tags are skipped,
+// so later versions can add sections without breaking older readers.
+
+static const uint32_t DOC_VERSION = 1;
+static const uint32_t DOC_ALIGN = 64;
+static const uint32_t DOC_MAX_SECTIONS = 64;
+static const int      DOC_MAX_BACKGROUND = 16384;   // per side, pixels
+static const int      DOC_MAX_COORD = 1 << 20;      // any coordinate, either sign
+
+inline uint32_t docTag(char a, char b, char c, char d) {
+    return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 |
+           uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+}
+
+struct DocHeader {
+    char     magic[4];       // "DPAD"
+    uint32_t version;
+    uint32_t sectionCount;
+    int32_t  zCounter;       // highest z handed out when saved
+    uint32_t bgWidth;        // background layer size (0 x 0 = none)
+    uint32_t bgHeight;
+    uint32_t journalGen;     // autosave snapshots: journals of lower generation are folded in
+    uint32_t reserved;
+};
+
+struct DocSection {
+    uint32_t tag;            // FourCC, see docTag()
+    uint32_t recordSize;
+    uint64_t count;          // records
+    uint64_t offset;         // from the start of the file
+};
+
+static_assert(sizeof(DocHeader) == 32, "DocHeader layout");
+static_assert(sizeof(DocSection) == 24, "DocSection layout");
+
+// Record layouts written by version 1
+static_assert(sizeof(FreehandTool::Record) == 32, "freehand stroke layout");
+static_assert(sizeof(POINT) == 8, "point layout");
+static_assert(sizeof(LineTool::Record) == 24, "line layout");
+static_assert(sizeof(TriangleTool::Record) == 40, "triangle layout");
+static_assert(sizeof(SquareTool::Record) == 32, "square layout");
+static_assert(sizeof(CircleTool::Record) == 28, "circle layout");
+static_assert(sizeof(OvalTool::Record) == 32, "oval layout");
+static_assert(sizeof(EraserTool::Record) == 24, "eraser layout");
+
+// What a document holds. Save reads the tools and the background pixels;
+// load refills the tools, sets zCounter and asks for a background buffer.
+struct DocScene {
+    FreehandTool* freehand;
+    LineTool*     line;
+    TriangleTool* triangle;
+    SquareTool*   square;
+    CircleTool*   circle;
+    OvalTool*     oval;
+    EraserTool*   eraser;
+
+    int      zCounter;
+    uint32_t journalGen;             // see DocHeader; 0 for ordinary documents
+
+    const uint32_t* background;      // save: w * h pixels, or nullptr; load: set to the loaded ones
+    int             bgWidth, bgHeight;   // load: set to the loaded size (0 = none)
+
+    // load: storage for a w x h background (tightly packed), nullptr on failure
+    uint32_t* (*allocBackground)(int w, int h);
+
+    // Undo only: hit-test index of the shape tools (tag = DocSectionId) to
+    // keep in step, or nullptr. indexStale: it gets rebuilt anyway.
+    SpatialGrid* index;
+    bool         indexStale;
+};
+
+// ---- 64-bit file positioning ----
+
+inline bool docSeek(FILE* f, uint64_t pos) {
+#ifdef _WIN32
+    return _fseeki64(f, (long long)pos, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)pos, SEEK_SET) == 0;
+#endif
+}
+
+inline bool docFileSize(FILE* f, uint64_t* size) {
+#ifdef _WIN32
+    if (_fseeki64(f, 0, SEEK_END) != 0) return false;
+    long long s = _ftelli64(f);
+#else
+    if (fseeko(f, 0, SEEK_END) != 0) return false;
+    long long s = (long long)ftello(f);
+#endif
+    if (s < 0) return false;
+    *size = uint64_t(s);
+    return true;
+}
+
+inline uint64_t docAlign(uint64_t v) {
+    return (v + DOC_ALIGN - 1) / DOC_ALIGN * DOC_ALIGN;
+}
+
+// ---- Save ----
+
+// The shape records carry three padding bytes after 'fill'. They go out
+// through a zeroed staging copy filled field by field, so the file holds
+// nothing but the scene (saving it twice gives the same bytes).
+inline void docPackRecord(const TriangleTool::Record& r, TriangleTool::Record& d) {
+    d.a = r.a; d.b = r.b; d.c = r.c;
+    d.style = r.style; d.fill = r.fill; d.z = r.z; d.fillColor = r.fillColor;
+}
+
+inline void docPackRecord(const SquareTool::Record& r, SquareTool::Record& d) {
+    d.a = r.a; d.b = r.b;
+    d.style = r.style; d.fill = r.fill; d.z = r.z; d.fillColor = r.fillColor;
+}
+
+inline void docPackRecord(const CircleTool::Record& r, CircleTool::Record& d) {
+    d.center = r.center; d.radius = r.radius;
+    d.style = r.style; d.fill = r.fill; d.z = r.z; d.fillColor = r.fillColor;
+}
+
+inline void docPackRecord(const OvalTool::Record& r, OvalTool::Record& d) {
+    d.center = r.center; d.rx = r.rx; d.ry = r.ry;
+    d.style = r.style; d.fill = r.fill; d.z = r.z; d.fillColor = r.fillColor;
+}
+
+typedef void (*DocPackFn)(const void* src, size_t n, void* dst);
+
+template <class R>
+void docPackRecords(const void* src, size_t n, void* dst) {
+    std::memset(dst, 0, n * sizeof(R));
+    for (size_t i = 0; i < n; ++i) docPackRecord(static_cast<const R*>(src)[i], static_cast<R*>(dst)[i]);
+}
+
+// Writes the whole scene to f (opened "wb"). Returns false on any write error.
+inline bool saveDocument(FILE* f, const DocScene& s) {
+    DocSection  sec[9];
+    const void* pay[9];
+    DocPackFn   pack[9];
+    uint32_t    n = 0;
+
+    auto add = [&](uint32_t tag, size_t size, size_t count, const void* data, DocPackFn pk = nullptr) {
+        if (count == 0 || !data) return;
+        sec[n] = { tag, uint32_t(size), uint64_t(count), 0 };
+        pay[n] = data;
+        pack[n] = pk;
+        ++n;
+    };
+
+    bool bg = s.background && s.bgWidth > 0 && s.bgHeight > 0;
+    if (bg) add(docTag('B', 'G', 'P', 'X'), sizeof(uint32_t), size_t(s.bgWidth) * s.bgHeight, s.background);
+    add(docTag('F', 'H', 'S', 'T'), sizeof(FreehandTool::Record), s.freehand->getCount(), s.freehand->records());
+    add(docTag('F', 'H', 'P', 'T'), sizeof(POINT), s.freehand->pointPoolSize(), s.freehand->pointPool());
+    add(docTag('L', 'I', 'N', 'E'), sizeof(LineTool::Record), s.line->getCount(), s.line->records());
+    add(docTag('T', 'R', 'I', ' '), sizeof(TriangleTool::Record), s.triangle->getCount(), s.triangle->records(),
+        docPackRecords<TriangleTool::Record>);
+    add(docTag('S', 'Q', 'R', ' '), sizeof(SquareTool::Record), s.square->getCount(), s.square->records(),
+        docPackRecords<SquareTool::Record>);
+    add(docTag('C', 'I', 'R', 'C'), sizeof(CircleTool::Record), s.circle->getCount(), s.circle->records(),
+        docPackRecords<CircleTool::Record>);
+    add(docTag('O', 'V', 'A', 'L'), sizeof(OvalTool::Record), s.oval->getCount(), s.oval->records(),
+        docPackRecords<OvalTool::Record>);
+    add(docTag('E', 'R', 'A', 'S'), sizeof(EraserTool::Record), s.eraser->getCount(), s.eraser->records());
+
+    uint64_t pos = docAlign(sizeof(DocHeader) + n * sizeof(DocSection));
+    for (uint32_t i = 0; i < n; ++i) {
+        sec[i].offset = pos;
+        pos = docAlign(pos + sec[i].count * sec[i].recordSize);
+    }
+
+    DocHeader h = {};
+    std::memcpy(h.magic, "DPAD", 4);
+    h.version = DOC_VERSION;
+    h.sectionCount = n;
+    h.zCounter = s.zCounter;
+    h.journalGen = s.journalGen;
+    h.bgWidth = bg ? uint32_t(s.bgWidth) : 0;
+    h.bgHeight = bg ? uint32_t(s.bgHeight) : 0;
+
+    static const char zeros[DOC_ALIGN] = {};
+    uint64_t at = 0;
+    auto put = [&](const void* p, uint64_t bytes) {
+        at += bytes;
+        return std::fwrite(p, 1, size_t(bytes), f) == size_t(bytes);
+    };
+    auto padTo = [&](uint64_t target) { return put(zeros, target - at); };
+    alignas(8) uint8_t stage[16384];
+    auto putPacked = [&](const DocSection& d, const void* p, DocPackFn pk) {
+        const uint8_t* src = static_cast<const uint8_t*>(p);
+        size_t per = sizeof(stage) / d.recordSize;
+        for (uint64_t done = 0; done < d.count;) {
+            size_t k = size_t(d.count - done < per ? d.count - done : per);
+            pk(src + done * d.recordSize, k, stage);
+            if (!put(stage, uint64_t(k) * d.recordSize)) return false;
+            done += k;
+        }
+        return true;
+    };
+
+    if (!put(&h, sizeof(h))) return false;
+    if (n && !put(sec, n * sizeof(DocSection))) return false;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (!padTo(sec[i].offset)) return false;
+        bool ok = pack[i] ? putPacked(sec[i], pay[i], pack[i]) : put(pay[i], sec[i].count * sec[i].recordSize);
+        if (!ok) return false;
+    }
+    return padTo(pos) && std::fflush(f) == 0;
+}
+
+// ---- Load ----
+
+inline void docClearTools(DocScene& s) {
+    s.freehand->resetAll();
+    s.line->resetAll();
+    s.triangle->resetAll();
+    s.square->resetAll();
+    s.circle->resetAll();
+    s.oval->resetAll();
+    s.eraser->resetAll();
+}
+
+// A whole scene held off the canvas: the other side of an undoable scene
+// swap, and its mirror while the journal replays
+struct DocSavedScene {
+    FreehandTool freehand;
+    LineTool     line;
+    TriangleTool triangle;
+    SquareTool   square;
+    CircleTool   circle;
+    OvalTool     oval;
+    EraserTool   eraser;
+    uint32_t*    background = nullptr;   // w * h pixels, or nullptr
+    int          bgWidth = 0, bgHeight = 0;
+
+    ~DocSavedScene() { std::free(background); }
+};
+
+// Copy of the live background, or nullptr (also when there is none)
+inline uint32_t* docCopyBackground(const DocScene& s) {
+    if (!s.background || s.bgWidth <= 0 || s.bgHeight <= 0) return nullptr;
+    size_t n = size_t(s.bgWidth) * s.bgHeight * sizeof(uint32_t);
+    uint32_t* px = (uint32_t*)std::malloc(n);
+    if (px) std::memcpy(px, s.background, n);
+    return px;
+}
+
+// Exchange the live scene (tools and background) with a saved one. False,
+// with nothing changed, if the live background can't be copied.
+inline bool docSwapScene(DocSavedScene& sc, DocScene& s) {
+    uint32_t* live = docCopyBackground(s);
+    if (!live && s.background && s.bgWidth > 0 && s.bgHeight > 0) return false;
+    int liveW = live ? s.bgWidth : 0, liveH = live ? s.bgHeight : 0;
+
+    s.freehand->swapRecords(sc.freehand);
+    s.line->swapRecords(sc.line);
+    s.triangle->swapRecords(sc.triangle);
+    s.square->swapRecords(sc.square);
+    s.circle->swapRecords(sc.circle);
+    s.oval->swapRecords(sc.oval);
+    s.eraser->swapRecords(sc.eraser);
+
+    s.background = nullptr;
+    s.bgWidth = s.bgHeight = 0;
+    if (sc.background) {
+        uint32_t* px = s.allocBackground ? s.allocBackground(sc.bgWidth, sc.bgHeight) : nullptr;
+        if (px) {
+            std::memcpy(px, sc.background, size_t(sc.bgWidth) * sc.bgHeight * sizeof(uint32_t));
+            s.background = px;
+            s.bgWidth = sc.bgWidth;
+            s.bgHeight = sc.bgHeight;
+        }
+    }
+    std::free(sc.background);
+    sc.background = live;
+    sc.bgWidth = liveW;
+    sc.bgHeight = liveH;
+    return true;
+}
+
+// Fields the rasterizers compute with. Coordinates stay inside
+// DOC_MAX_COORD, so bounds, edge deltas and spans stay in int range; radii
+// are in (0, cap], which bounds the conic and disc scratch; 'fill' must be a
+// valid bool.
+inline bool docPointOk(POINT p) {
+    return p.x >= -DOC_MAX_COORD && p.x <= DOC_MAX_COORD && p.y >= -DOC_MAX_COORD && p.y <= DOC_MAX_COORD;
+}
+
+inline bool docFillOk(const bool& fill) {
+    uint8_t b;
+    std::memcpy(&b, &fill, 1);
+    return b <= 1;
+}
+
+inline bool docRecordOk(const FreehandTool::Record& s) {
+    const int lim = DOC_MAX_COORD + 1;   // the box is the vertices' grown by 1
+    return s.box.left >= -lim && s.box.top >= -lim && s.box.right <= lim && s.box.bottom <= lim &&
+           s.box.left <= s.box.right && s.box.top <= s.box.bottom;
+}
+
+inline bool docRecordOk(const LineTool::Record& l) {
+    return docPointOk(l.start) && docPointOk(l.end);
+}
+
+inline bool docRecordOk(const TriangleTool::Record& t) {
+    return docPointOk(t.a) && docPointOk(t.b) && docPointOk(t.c) && docFillOk(t.fill);
+}
+
+inline bool docRecordOk(const SquareTool::Record& q) {
+    return docPointOk(q.a) && docPointOk(q.b) && docFillOk(q.fill);
+}
+
+inline bool docRecordOk(const CircleTool::Record& c) {
+    return c.radius > 0 && c.radius <= CONIC_MAX_RADIUS && docPointOk(c.center) && docFillOk(c.fill);
+}
+
+inline bool docRecordOk(const OvalTool::Record& o) {
+    return o.rx > 0 && o.rx <= CONIC_MAX_RADIUS && o.ry > 0 && o.ry <= CONIC_MAX_RADIUS &&
+           docPointOk(o.center) && docFillOk(o.fill);
+}
+
+inline bool docRecordOk(const EraserTool::Record& e) {
+    return e.radius > 0 && e.radius <= ERASER_MAX_RADIUS && docPointOk(e.a) && docPointOk(e.b);
+}
+
+// z must rise strictly within a tool (ZMerge relies on it) and stay at or
+// below the saved counter so new items still land on top; every record
+// must pass docRecordOk(). 'prev' is the z of the record before r[0].
+template <class R>
+bool docRecordsOk(const R* r, size_t n, int zCounter, int prev = 0) {
+    for (size_t i = 0; i < n; ++i) {
+        if (r[i].z <= prev || r[i].z > zCounter || !docRecordOk(r[i])) return false;
+        prev = r[i].z;
+    }
+    return true;
+}
+
+// Every stroke's vertices lie inside a pool of np points
+inline bool docStrokesInPool(const FreehandTool::Record* s, size_t ns, size_t np) {
+    for (size_t i = 0; i < ns; ++i)
+        if (s[i].first < 0 || s[i].count < 2 || uint64_t(s[i].first) + uint64_t(s[i].count) > np) return false;
+    return true;
+}
+
+inline bool docPointsOk(const POINT* p, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        if (!docPointOk(p[i])) return false;
+    return true;
+}
+
+// Reads one section into storage the tool just sized for it
+inline bool docReadSection(FILE* f, const DocSection& s, void* dst) {
+    if (!dst || !docSeek(f, s.offset)) return false;
+    size_t bytes = size_t(s.count * s.recordSize);
+    return std::fread(dst, 1, bytes, f) == bytes;
+}
+
+enum DocSectionId {
+    DOC_BGPX, DOC_FHST, DOC_FHPT, DOC_LINE, DOC_TRI, DOC_SQR, DOC_CIRC, DOC_OVAL, DOC_ERAS, DOC_KNOWN
+};
+
+inline bool docCheckHeader(const DocHeader& h) {
+    return std::memcmp(h.magic, "DPAD", 4) == 0 &&
+           h.version != 0 && h.version <= DOC_VERSION &&
+           h.sectionCount <= DOC_MAX_SECTIONS && h.zCounter >= 0;
+}
+
+// Picks the known sections out of the table: each at most once, with this
+// build's record size, inside a file of fileSize bytes. Also checks that the
+// freehand pair and the background agree with the header.
+inline bool docIndex(const DocHeader& h, const DocSection* sec, uint64_t fileSize,
+                     const DocSection* known[DOC_KNOWN]) {
+    static const uint32_t tags[DOC_KNOWN] = {
+        docTag('B', 'G', 'P', 'X'), docTag('F', 'H', 'S', 'T'), docTag('F', 'H', 'P', 'T'),
+        docTag('L', 'I', 'N', 'E'), docTag('T', 'R', 'I', ' '), docTag('S', 'Q', 'R', ' '),
+        docTag('C', 'I', 'R', 'C'), docTag('O', 'V', 'A', 'L'), docTag('E', 'R', 'A', 'S')
+    };
+    static const uint32_t sizes[DOC_KNOWN] = {
+        sizeof(uint32_t), sizeof(FreehandTool::Record), sizeof(POINT),
+        sizeof(LineTool::Record), sizeof(TriangleTool::Record), sizeof(SquareTool::Record),
+        sizeof(CircleTool::Record), sizeof(OvalTool::Record), sizeof(EraserTool::Record)
+    };
+    for (int k = 0; k < DOC_KNOWN; ++k) known[k] = nullptr;
+
+    for (uint32_t i = 0; i < h.sectionCount; ++i) {
+        const DocSection& d = sec[i];
+        if (d.recordSize == 0 || d.offset > fileSize) return false;
+        if (d.count > (fileSize - d.offset) / d.recordSize) return false;
+        for (int k = 0; k < DOC_KNOWN; ++k) {
+            if (d.tag != tags[k]) continue;
+            if (known[k] || d.recordSize != sizes[k] || d.count == 0) return false;
+            known[k] = &d;
+        }
+    }
+    if (!known[DOC_FHST] != !known[DOC_FHPT]) return false;
+
+    bool hasBg = h.bgWidth && h.bgHeight;
+    if (hasBg != (known[DOC_BGPX] != nullptr)) return false;
+    if (hasBg) {
+        if (h.bgWidth > DOC_MAX_BACKGROUND || h.bgHeight > DOC_MAX_BACKGROUND) return false;
+        if (known[DOC_BGPX]->count != uint64_t(h.bgWidth) * h.bgHeight) return false;
+    }
+    return true;
+}
+
+inline uint32_t* docBackground(DocScene& s, const DocHeader& h) {
+    s.background = nullptr;
+    s.bgWidth = s.bgHeight = 0;
+    if (!h.bgWidth || !s.allocBackground) return nullptr;
+    uint32_t* px = s.allocBackground(int(h.bgWidth), int(h.bgHeight));
+    if (px) {
+        s.background = px;
+        s.bgWidth = int(h.bgWidth);
+        s.bgHeight = int(h.bgHeight);
+    }
+    return px;
+}
+
+// Replaces the scene with the document in f (opened "rb"), reading every
+// record into tool-owned storage and validating it. On failure every tool is
+// left empty and false is returned.
+inline bool loadDocument(FILE* f, DocScene& s) {
+    docClearTools(s);
+
+    DocHeader h;
+    if (std::fread(&h, sizeof(h), 1, f) != 1 || !docCheckHeader(h)) return false;
+
+    DocSection sec[DOC_MAX_SECTIONS];
+    if (h.sectionCount && std::fread(sec, sizeof(DocSection), h.sectionCount, f) != h.sectionCount)
+        return false;
+
+    uint64_t fileSize = 0;
+    const DocSection* known[DOC_KNOWN];
+    if (!docFileSize(f, &fileSize) || !docIndex(h, sec, fileSize, known)) return false;
+
+    bool ok = true;
+    if (known[DOC_BGPX])
+        ok = docReadSection(f, *known[DOC_BGPX], docBackground(s, h));
+
+    if (ok && known[DOC_FHST]) {
+        FreehandTool::Record* strokes = nullptr;
+        POINT* pts = nullptr;
+        size_t ns = size_t(known[DOC_FHST]->count), np = size_t(known[DOC_FHPT]->count);
+        ok = s.freehand->replaceRecords(ns, np, &strokes, &pts) &&
+             docReadSection(f, *known[DOC_FHST], strokes) &&
+             docReadSection(f, *known[DOC_FHPT], pts) &&
+             docRecordsOk(strokes, ns, h.zCounter) &&
+             docStrokesInPool(strokes, ns, np) && docPointsOk(pts, np);
+    }
+
+    // The shape tools share one shape: size, read, check z
+#define DOC_LOAD_TOOL(K, tool)                                                   \
+    if (ok && known[K]) {                                                        \
+        size_t cnt = size_t(known[K]->count);                                    \
+        auto* r = (tool)->replaceRecords(cnt);                                   \
+        ok = docReadSection(f, *known[K], r) && docRecordsOk(r, cnt, h.zCounter); \
+    }
+    DOC_LOAD_TOOL(DOC_LINE, s.line)
+    DOC_LOAD_TOOL(DOC_TRI, s.triangle)
+    DOC_LOAD_TOOL(DOC_SQR, s.square)
+    DOC_LOAD_TOOL(DOC_CIRC, s.circle)
+    DOC_LOAD_TOOL(DOC_OVAL, s.oval)
+    DOC_LOAD_TOOL(DOC_ERAS, s.eraser)
+#undef DOC_LOAD_TOOL
+
+    if (!ok) {
+        docClearTools(s);
+        return false;
+    }
+    s.zCounter = h.zCounter;
+    s.journalGen = h.journalGen;
+    return true;
+}
+
+// Record checks for a mapped document (the same ones loadDocument() makes),
+// run by worker threads in chunks so the caller can go on with the rest of
+// a load meanwhile. wait() before anything draws, hit-tests or edits the
+// borrowed records; on false the records must be dropped unused.
+class DocCheck {
+private:
+    static const size_t CHUNK = 1 << 16;   // records per job
+
+    struct Job {
+        int         section;   // DocSectionId
+        const void* records;
+        size_t      lo, hi;
+    };
+
+    std::vector<Job>         jobs;
+    std::vector<std::thread> workers;
+    std::atomic<size_t>      nextJob{ 0 };
+    std::atomic<bool>        bad{ false };
+    int    zCounter = 0;
+    size_t poolSize = 0;                   // freehand vertices
+
+    template <class R>
+    bool run(const Job& j) const {
+        const R* r = static_cast<const R*>(j.records);
+        return docRecordsOk(r + j.lo, j.hi - j.lo, zCounter, j.lo ? r[j.lo - 1].z : 0);
+    }
+
+    bool run(const Job& j) const {
+        switch (j.section) {
+        case DOC_FHST: {
+            const FreehandTool::Record* st = static_cast<const FreehandTool::Record*>(j.records);
+            return run<FreehandTool::Record>(j) && docStrokesInPool(st + j.lo, j.hi - j.lo, poolSize);
+        }
+        case DOC_FHPT: return docPointsOk(static_cast<const POINT*>(j.records) + j.lo, j.hi - j.lo);
+        case DOC_LINE: return run<LineTool::Record>(j);
+        case DOC_TRI:  return run<TriangleTool::Record>(j);
+        case DOC_SQR:  return run<SquareTool::Record>(j);
+        case DOC_CIRC: return run<CircleTool::Record>(j);
+        case DOC_OVAL: return run<OvalTool::Record>(j);
+        case DOC_ERAS: return run<EraserTool::Record>(j);
+        default:       return false;
+        }
+    }
+
+    void work() {
+        for (size_t k = nextJob.fetch_add(1); k < jobs.size() && !bad; k = nextJob.fetch_add(1))
+            if (!run(jobs[k])) bad = true;
+    }
+
+public:
+    DocCheck() = default;
+    DocCheck(const DocCheck&) = delete;
+    DocCheck& operator=(const DocCheck&) = delete;
+    ~DocCheck() { wait(); }
+
+    // Queue the records of every known section of a document at 'base'
+    void add(const uint8_t* base, const DocSection* const known[DOC_KNOWN], int zc) {
+        zCounter = zc;
+        poolSize = known[DOC_FHPT] ? size_t(known[DOC_FHPT]->count) : 0;
+        for (int k = DOC_FHST; k < DOC_KNOWN; ++k) {
+            if (!known[k]) continue;
+            for (size_t lo = 0, n = size_t(known[k]->count); lo < n; lo += CHUNK)
+                jobs.push_back({ k, base + known[k]->offset, lo, (n - lo < CHUNK) ? n : lo + CHUNK });
+        }
+    }
+
+    // Run the queued checks: on 'threads' workers (0: every hardware
+    // thread), or right here if there is little to do or none start
+    void start(int threads = 0) {
+        if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+        if (size_t(threads) > jobs.size()) threads = int(jobs.size());
+        for (int i = 0; i < threads && jobs.size() > 1; ++i) {
+            try { workers.emplace_back(&DocCheck::work, this); }
+            catch (...) { break; }
+        }
+        if (workers.empty()) work();
+    }
+
+    // True if every record passed. Blocks until the checks are done.
+    bool wait() {
+        for (std::thread& t : workers) t.join();
+        workers.clear();
+        work();   // whatever no worker picked up
+        jobs.clear();
+        nextJob = 0;
+        return !bad;
+    }
+};
+
+// Zero-copy variant over a document already in memory (a MappedFile view):
+// the tools borrow their records straight from it and copy them only when
+// edited. Only the header and the section table are checked here, so the
+// cost doesn't grow with the records: their checks start on 'check's
+// workers (running beside the background copy and whatever the caller does
+// next), and check->wait() must pass before the records are used. With no
+// 'check' they are made in place, as loadDocument() does. Only the
+// background is copied. The memory must outlive the borrowed records.
+// On failure every tool is left empty and false is returned.
+inline bool mapDocument(const void* data, size_t size, DocScene& s, DocCheck* check = nullptr) {
+    docClearTools(s);
+    const uint8_t* base = static_cast<const uint8_t*>(data);
+
+    DocHeader h;
+    if (size < sizeof(h)) return false;
+    std::memcpy(&h, base, sizeof(h));
+    if (!docCheckHeader(h)) return false;
+
+    DocSection sec[DOC_MAX_SECTIONS];
+    if (size - sizeof(h) < h.sectionCount * sizeof(DocSection)) return false;
+    std::memcpy(sec, base + sizeof(h), h.sectionCount * sizeof(DocSection));
+
+    const DocSection* known[DOC_KNOWN];
+    if (!docIndex(h, sec, size, known)) return false;
+    for (int k = 0; k < DOC_KNOWN; ++k)
+        if (known[k] && known[k]->offset % 8 != 0) return false;   // records are used in place
+
+    if (check) {
+        check->add(base, known, h.zCounter);
+        check->start();
+    }
+    else {
+        DocCheck now;
+        now.add(base, known, h.zCounter);
+        if (!now.wait()) return false;
+    }
+
+    if (known[DOC_BGPX]) {
+        uint32_t* px = docBackground(s, h);
+        if (!px) {
+            if (check) check->wait();   // the workers read 'data', which the caller may drop now
+            return false;
+        }
+        std::memcpy(px, base + known[DOC_BGPX]->offset, size_t(known[DOC_BGPX]->count) * sizeof(uint32_t));
+    }
+
+    if (known[DOC_FHST])
+        s.freehand->borrowRecords((const FreehandTool::Record*)(base + known[DOC_FHST]->offset),
+                                  size_t(known[DOC_FHST]->count),
+                                  (const POINT*)(base + known[DOC_FHPT]->offset),
+                                  size_t(known[DOC_FHPT]->count));
+
+#define DOC_MAP_TOOL(K, tool, R) \
+    if (known[K]) (tool)->borrowRecords((const R*)(base + known[K]->offset), size_t(known[K]->count));
+    DOC_MAP_TOOL(DOC_LINE, s.line, LineTool::Record)
+    DOC_MAP_TOOL(DOC_TRI, s.triangle, TriangleTool::Record)
+    DOC_MAP_TOOL(DOC_SQR, s.square, SquareTool::Record)
+    DOC_MAP_TOOL(DOC_CIRC, s.circle, CircleTool::Record)
+    DOC_MAP_TOOL(DOC_OVAL, s.oval, OvalTool::Record)
+    DOC_MAP_TOOL(DOC_ERAS, s.eraser, EraserTool::Record)
+#undef DOC_MAP_TOOL
+
+    s.zCounter = h.zCounter;
+    s.journalGen = h.journalGen;
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <graphics.h>
+#include "RenderBackend.h"
+
+// RenderBackend on top of EasyX/GDI. Draws on whatever SetWorkingImage()
+// selected (the window by default); state lives in the EasyX device.
+class EasyXBackend : public RenderBackend {
+private:
+    int lineStyle = 0;
+
+public:
+    void     setLineColor(COLORREF c) override { setlinecolor(c); }
+    COLORREF getLineColor() const override { return getlinecolor(); }
+    void     setFillColor(COLORREF c) override { setfillcolor(c); }
+    COLORREF getFillColor() const override { return getfillcolor(); }
+    void     setRop(int rop) override { setrop2(rop); }
+    int      getRop() const override { return getrop2(); }
+
+    void setLineStyle(int style) override {
+        lineStyle = style;
+        setlinestyle(style == 0 ? PS_SOLID : PS_DASH, 1);
+    }
+
+    void setClip(const RECT* clip) override {
+        if (!clip) { setcliprgn(NULL); return; }
+        HRGN rgn = CreateRectRgn(clip->left, clip->top, clip->right + 1, clip->bottom + 1);
+        setcliprgn(rgn);
+        DeleteObject(rgn);
+    }
+
+    void line(int x0, int y0, int x1, int y1) override { ::line(x0, y0, x1, y1); }
+    void polyline(const POINT* pts, int n) override { ::polyline(pts, n); }
+    void circle(int cx, int cy, int r) override { ::circle(cx, cy, r); }
+    void ellipse(int cx, int cy, int rx, int ry) override { ::ellipse(cx - rx, cy - ry, cx + rx, cy + ry); }
+
+    void solidRectangle(int l, int t, int r, int b) override { ::solidrectangle(l, t, r, b); }
+    void solidCircle(int cx, int cy, int r) override { ::solidcircle(cx, cy, r); }
+    void solidPolygon(const POINT* pts, int n) override { ::solidpolygon(pts, n); }
+
+    // GDI polygon fills already follow a top-left convention
+    void solidTriangle(POINT a, POINT b, POINT c) override {
+        POINT pts[3] = { a, b, c };
+        ::solidpolygon(pts, 3);
+    }
+
+    // A capsule is exactly what a wide pen with round end caps sweeps, so GDI
+    // fills it in one line() call. Zero-length segments draw nothing with a
+    // wide pen and fall back to a disc.
+    void solidCapsule(POINT a, POINT b, int r) override {
+        if (a.x == b.x && a.y == b.y) {
+            ::solidcircle(a.x, a.y, r);
+            return;
+        }
+        COLORREF oldLine = getlinecolor();
+        setlinecolor(getfillcolor());
+        setlinestyle(PS_SOLID | PS_ENDCAP_ROUND, 2 * r + 1);
+        ::line(a.x, a.y, b.x, b.y);
+        setlinestyle(lineStyle == 0 ? PS_SOLID : PS_DASH, 1);
+        setlinecolor(oldLine);
+    }
+};
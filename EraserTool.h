@@ -1,135 +1,248 @@
 #pragma once
-#include <graphics.h>
+#include "RenderBackend.h"
 #include <cstdlib>   // malloc, realloc, free
+#include <cstring>   // memcpy
+#include <utility>   // swap
+#include "RectUtils.h"
 
 // Global z-order counter from main.cpp
 extern int gZCounter;
 
-// EraserTool: stores white circular "dabs" as a dynamic array allocated via malloc/realloc.
+static const int ERASER_MAX_RADIUS = 100;   // the largest eraser the UI offers
+
+// EraserTool: stores white "capsules" (a disc of the eraser radius swept from
+// a to b) as a dynamic array allocated via malloc/realloc. One capsule per
+// mouse sample segment, instead of one dab per pixel of travel.
 class EraserTool {
 private:
-    struct Dab {
-        POINT p;
+    struct Capsule {
+        POINT a;        // segment start
+        POINT b;        // segment end (== a for a single dab)
         int   radius;
         int   z;
     };
 
     // Dynamic storage (C-style)
-    Dab* dabs = nullptr;     // allocated block
-    size_t dabCount = 0;       // used length
-    size_t dabCap = 0;       // capacity (# of Dab slots)
+    Capsule* caps = nullptr;    // allocated block
+    size_t   capCount = 0;      // used length
+    size_t   capCap = 0;        // capacity (# of Capsule slots)
+    bool     borrowed = false;  // caps points into a mapped document (read-only)
 
     // Current stroke state
     bool  inStroke = false;
     int   currentRadius = 16;  // default
 
-    // --- tiny helpers (no std::max/min/round/abs) ---
-    static inline int iabs(int v) { return (v < 0) ? -v : v; }
-    static inline int iRound(float v) { return (int)(v + (v >= 0.0f ? 0.5f : -0.5f)); }
-
-    // Ensure we have room for at least one more dab
+    // Ensure we have room for at least one more capsule
     bool ensureCapacity() {
-        if (dabCount < dabCap) return true;
-        size_t newCap = (dabCap == 0) ? (size_t)4096 : (dabCap * 2);
+        if (capCount < capCap) return true;
+        if (!ownRecords()) return false;
+        size_t newCap = (capCap == 0) ? (size_t)1024 : (capCap * 2);
         // guard against overflow (very defensive; unlikely to hit)
-        if (newCap < dabCap || newCap >(size_t)100000000) return false;
+        if (newCap < capCap || newCap >(size_t)100000000) return false;
 
-        void* p = (dabCap == 0)
-            ? std::malloc(newCap * sizeof(Dab))
-            : std::realloc(dabs, newCap * sizeof(Dab));
+        void* p = (capCap == 0)
+            ? std::malloc(newCap * sizeof(Capsule))
+            : std::realloc(caps, newCap * sizeof(Capsule));
 
         if (!p) return false;
-        dabs = (Dab*)p;
-        dabCap = newCap;
+        caps = (Capsule*)p;
+        capCap = newCap;
         return true;
     }
 
-    // Push a single dab (drop silently if allocation fails)
-    inline void pushDab(POINT p, int r, int z) {
-        if (!ensureCapacity()) return;   // if we can't grow, skip this dab
-        dabs[dabCount].p = p;
-        dabs[dabCount].radius = r;
-        dabs[dabCount].z = z;
-        dabCount++;
+    // Push a single capsule (drop silently if allocation fails)
+    inline void pushCapsule(POINT a, POINT b, int r, int z) {
+        if (!ensureCapacity()) return;   // if we can't grow, skip this segment
+        caps[capCount].a = a;
+        caps[capCount].b = b;
+        caps[capCount].radius = r;
+        caps[capCount].z = z;
+        capCount++;
     }
 
 public:
     // ----- lifetime -----
     ~EraserTool() {
-        if (dabs) {
-            std::free(dabs);
-            dabs = nullptr;
-        }
-        dabCount = 0;
-        dabCap = 0;
+        if (caps && !borrowed) std::free(caps);
+        caps = nullptr;
+        borrowed = false;
+        capCount = 0;
+        capCap = 0;
         inStroke = false;
     }
 
     // ------------- Public API used by main.cpp -------------
     void setRadius(int r) {
         if (r < 1) r = 1;
+        if (r > ERASER_MAX_RADIUS) r = ERASER_MAX_RADIUS;
         currentRadius = r;
     }
 
     void beginStroke(int radius) {
-        if (radius > 0) currentRadius = radius;
+        if (radius > 0) setRadius(radius);
         inStroke = true;
-        // z is assigned per-dab
+        // z is assigned per segment
     }
 
+    // Single dab at p (a zero-length capsule)
     void addDab(POINT p) {
         if (!inStroke) return;
-        int z = ++gZCounter;  // newer dab above older ones
-        pushDab(p, currentRadius, z);
+        int z = ++gZCounter;  // newer segment above older ones
+        pushCapsule(p, p, currentRadius, z);
     }
 
-    // Add interpolated dabs between a -> b (simple DDA)
-    void addInterpolatedDabs(POINT a, POINT b) {
+    // Sweep the eraser from a to b as one capsule
+    void addSegment(POINT a, POINT b) {
         if (!inStroke) return;
-
-        int dx = b.x - a.x;
-        int dy = b.y - a.y;
-        int adx = iabs(dx);
-        int ady = iabs(dy);
-        int steps = (adx > ady) ? adx : ady;  // manual max
-
-        float x = (float)a.x;
-        float y = (float)a.y;
-        float ix = (steps != 0) ? ((float)dx / (float)steps) : 0.0f;
-        float iy = (steps != 0) ? ((float)dy / (float)steps) : 0.0f;
-
-        // start from first increment (caller usually already added a dab at 'a')
-        for (int i = 1; i <= steps; ++i) {
-            x += ix; y += iy;
-            POINT p{ iRound(x), iRound(y) };
-            int z = ++gZCounter;
-            pushDab(p, currentRadius, z);
-        }
+        if (a.x == b.x && a.y == b.y) return;   // covered by the previous segment's end
+        int z = ++gZCounter;
+        pushCapsule(a, b, currentRadius, z);
     }
 
     void endStroke() { inStroke = false; }
 
     // --------- Methods used by rebuild() ordering ----------
-    size_t getCount() const { return dabCount; }
+    size_t getCount() const { return capCount; }
 
     int getZ(size_t i) const {
-        return (i < dabCount) ? dabs[i].z : 0;
+        return (i < capCount) ? caps[i].z : 0;
+    }
+
+    RECT getBounds(size_t i) const {
+        if (i >= capCount) return makeRect(0, 0, -1, -1);
+        return segmentBounds(caps[i].a, caps[i].b, caps[i].radius + 1);
+    }
+
+    // Index of the first capsule with z >= the given one (capsules are in z order)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = capCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (caps[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the capsule with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < capCount && caps[i].z == z) ? i : capCount;
     }
 
     void drawAt(size_t i) const {
-        if (i >= dabCount) return;
-        setfillcolor(WHITE);
-        solidcircle(dabs[i].p.x, dabs[i].p.y, dabs[i].radius);
+        if (i >= capCount) return;
+        const Capsule& c = caps[i];
+        gRender->setFillColor(WHITE);
+        gRender->solidCapsule(c.a, c.b, c.radius);
     }
 
     void resetAll() {
         // Free all memory so we actually release RAM
-        if (dabs) {
-            std::free(dabs);
-            dabs = nullptr;
-        }
-        dabCount = 0;
-        dabCap = 0;
+        if (caps && !borrowed) std::free(caps);
+        caps = nullptr;
+        borrowed = false;
+        capCount = 0;
+        capCap = 0;
         inStroke = false;
     }
+
+    // ---- Bulk access (document save/load) ----
+    typedef Capsule Record;
+    const Record* records() const { return caps; }
+
+    // Drop everything and allocate exactly n (> 0) capsules, marked as used;
+    // the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > (size_t)100000000) return nullptr;
+        caps = (Capsule*)std::malloc(n * sizeof(Capsule));
+        if (!caps) return nullptr;
+        capCount = n;
+        capCap = n;
+        return caps;
+    }
+
+    // Append capsules as is (journal replay); their z must be above every stored z
+    bool appendRecords(const Record* r, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (!ensureCapacity()) return false;
+            caps[capCount++] = r[i];
+        }
+        return true;
+    }
+
+    // Put back capsules taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the capsules above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (!ownRecords() || n > (size_t)100000000 - capCount) return false;
+        if (capCount + n > capCap) {
+            size_t newCap = capCap ? capCap : 1024;
+            while (newCap < capCount + n) newCap *= 2;
+            void* p = std::realloc(caps, newCap * sizeof(Capsule));
+            if (!p) return false;
+            caps = (Capsule*)p;
+            capCap = newCap;
+        }
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = capCount, dst = capCount + n, k = n;
+        while (k > 0) {
+            if (src > lo && caps[src - 1].z > r[k - 1].z) caps[--dst] = caps[--src];
+            else caps[--dst] = r[--k];
+        }
+        capCount += n;
+        return true;
+    }
+
+    // Use n capsules stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0) return;
+        caps = const_cast<Capsule*>(r);
+        capCount = n;
+        capCap = n;
+        borrowed = true;
+    }
+
+    // Copy borrowed capsules to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* p = std::malloc(capCount * sizeof(Capsule));
+        if (!p) return false;
+        std::memcpy(p, caps, capCount * sizeof(Capsule));
+        caps = (Capsule*)p;
+        capCap = capCount;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange capsules with another tool (undo keeps whole scenes this way)
+    void swapRecords(EraserTool& o) {
+        std::swap(caps, o.caps);
+        std::swap(capCount, o.capCount);
+        std::swap(capCap, o.capCap);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // Removes every capsule whose z is listed in zs (ascending) in one
+    // order-preserving pass from the first match; dropping the newest
+    // stroke's capsules only shortens the array. Returns how many were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t lo = lowerBoundZ(zs[0]);
+        size_t w = lo, k = 0;
+        for (size_t r = lo; r < capCount; ++r) {
+            while (k < n && zs[k] < caps[r].z) ++k;
+            if (k < n && zs[k] == caps[r].z) { ++k; continue; }
+            caps[w++] = caps[r];
+        }
+        size_t removed = capCount - w;
+        capCount = w;
+        return removed;
+    }
 };
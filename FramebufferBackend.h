@@ -0,0 +1,546 @@
+#pragma once
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>      // malloc, free
+#include <cstring>
+#include <utility>      // swap
+#include "RenderBackend.h"
+#include "SpanFill.h"
+
+// Pure-CPU RenderBackend. Writes 32-bit pixels (0x00RRGGBB, the EasyX
+// GetImageBuffer() layout) into its own buffer or into caller memory, so it
+// runs headless and can draw straight into an IMAGE's pixels.
+//
+// Rasterization: pixel (x, y) is the unit square centered on (x, y). Lines are
+// a rounded DDA with both endpoints, outlines are midpoint circles/ellipses, fills
+// cover the pixels whose centers lie inside the shape. Dashed pens use an
+// 18-on / 6-off pattern like GDI's PS_DASH.
+class FramebufferBackend : public RenderBackend {
+private:
+    static const int DASH_ON = 18;
+    static const int DASH_PERIOD = 24;
+
+    uint32_t* pixels = nullptr;
+    int  w = 0, h = 0;
+    int  pitch = 0;             // row stride in pixels
+    bool owned = false;
+
+    COLORREF lineColor = BLACK, fillColor = WHITE;
+    uint32_t linePx = 0, fillPx = 0x00FFFFFF;
+    int  rop = R2_COPYPEN;
+    int  lineStyle = 0;
+    int  clipL = 0, clipT = 0, clipR = -1, clipB = -1;   // inclusive
+
+    SpanFn copySpan = spanKernels().copy;      // SIMD level picked at startup
+    SpanFn xorSpan = spanKernels().xorWith;
+
+    // Disc half-widths per row offset, hw[0, r], for the last few radii used.
+    // Eraser strokes replay thousands of dabs of one radius.
+    struct DiscSpans {
+        int  r;
+        int* hw;
+    };
+    static const int DISC_CACHE = 4;
+    DiscSpans discs[DISC_CACHE] = {};
+    int       discNext = 0;
+
+    void resetClip() { clipL = 0; clipT = 0; clipR = w - 1; clipB = h - 1; }
+
+    void plot(int x, int y, uint32_t px) {
+        if (x < clipL || x > clipR || y < clipT || y > clipB) return;
+        uint32_t& d = pixels[size_t(y) * pitch + x];
+        d = (rop == R2_XORPEN) ? (d ^ px) : px;
+    }
+
+    // Horizontal run [x0, x1] on row y
+    void span(int x0, int x1, int y, uint32_t px) {
+        if (y < clipT || y > clipB) return;
+        if (x0 < clipL) x0 = clipL;
+        if (x1 > clipR) x1 = clipR;
+        if (x0 > x1) return;
+        uint32_t* d = pixels + size_t(y) * pitch + x0;
+        int n = x1 - x0 + 1;
+        if (rop == R2_XORPEN) xorSpan(d, n, px);
+        else if (n <= 8)      { for (int i = 0; i < n; ++i) d[i] = px; }   // small discs: skip the SIMD setup
+        else                  copySpan(d, n, px);
+    }
+
+    // Largest hw with hw^2 + dy^2 <= r^2 for dy = 0..r, or nullptr if the
+    // table can't be allocated. Built by walking x in from r, no sqrt.
+    const int* discSpans(int r) {
+        for (int i = 0; i < DISC_CACHE; ++i)
+            if (discs[i].hw && discs[i].r == r) return discs[i].hw;
+        int* hw = (int*)std::malloc((size_t(r) + 1) * sizeof(int));
+        if (!hw) return nullptr;
+        long long r2 = (long long)r * r;
+        int x = r;
+        for (int dy = 0; dy <= r; ++dy) {
+            while ((long long)x * x + (long long)dy * dy > r2) --x;
+            hw[dy] = x;
+        }
+        DiscSpans& slot = discs[discNext];
+        discNext = (discNext + 1) % DISC_CACHE;
+        std::free(slot.hw);
+        slot.r = r;
+        slot.hw = hw;
+        return hw;
+    }
+
+    // floor()/ceil() without the libm call; fine for pixel coordinates
+    static int floorI(double v) { int i = int(v); return i - (v < i); }
+    static int ceilI(double v)  { int i = int(v); return i + (v > i); }
+
+    // Line from (x0, y0) to (x1, y1), both ends included: n = max(|dx|, |dy|)
+    // steps, step i at minor offset round(i * minorLen / n). The closed form
+    // lets a clipped call jump straight to the steps inside the clip, so the
+    // cost is the visible length and the pixels never depend on the clip.
+    // 'phase' is the dash position and carries over between calls (polyline).
+    void stroke(int x0, int y0, int x1, int y1, int& phase, bool skipFirst) {
+        int dx = x1 - x0, dy = y1 - y0;
+        int adx = std::abs(dx), ady = std::abs(dy);
+        bool xMajor = adx >= ady;
+        int n = xMajor ? adx : ady;                 // last step index
+        int first = skipFirst ? 1 : 0;
+        int phase0 = phase - first;                 // phase of step 0
+        phase = int((phase0 + (long long)n + 1) % DASH_PERIOD);
+        if (n == 0) {
+            if (!skipFirst && dashOn(phase0)) plot(x0, y0, linePx);
+            return;
+        }
+
+        // Steps whose major coordinate lies inside the clip
+        int m0 = xMajor ? x0 : y0, sm = (xMajor ? dx : dy) < 0 ? -1 : 1;
+        int lo = xMajor ? clipL : clipT, hi = xMajor ? clipR : clipB;
+        int iLo, iHi;
+        if (sm > 0) { iLo = lo - m0; iHi = hi - m0; }
+        else        { iLo = m0 - hi; iHi = m0 - lo; }
+        if (iLo < first) iLo = first;
+        if (iHi > n) iHi = n;
+
+        // ... and whose minor offset does too (the offset never decreases with i)
+        int minorLen = xMajor ? ady : adx, sn = (xMajor ? dy : dx) < 0 ? -1 : 1;
+        if (minorLen > 0) {
+            int n0 = xMajor ? y0 : x0;
+            int mlo = xMajor ? clipT : clipL, mhi = xMajor ? clipB : clipR;
+            long long oLo = (sn > 0) ? mlo - n0 : n0 - mhi;
+            long long oHi = (sn > 0) ? mhi - n0 : n0 - mlo;
+            // off(i) >= oLo  <=>  i >= ceil((2n*oLo - n) / 2m)
+            // off(i) <= oHi  <=>  i <= floor((2n*(oHi + 1) - n - 1) / 2m)
+            long long den = 2LL * minorLen;
+            long long a = floorDiv(2LL * n * oLo - n + den - 1, den);
+            long long b = floorDiv(2LL * n * (oHi + 1) - n - 1, den);
+            if (a > iLo) iLo = (a > n) ? n + 1 : int(a);
+            if (b < iHi) iHi = (b < -1) ? -1 : int(b);
+        }
+        else if ((xMajor ? y0 < clipT || y0 > clipB : x0 < clipL || x0 > clipR)) {
+            return;
+        }
+
+        if (iLo > iHi) return;
+        // Bresenham from step iLo: off = num / den2, stepping num by 2 * minorLen
+        long long den2 = 2LL * n;
+        long long num = 2LL * iLo * minorLen + n;
+        int off = int(num / den2);
+        long long rem = num - off * den2;
+        int ph = int((phase0 + iLo) % DASH_PERIOD);
+        for (int i = iLo; i <= iHi; ++i) {
+            if (dashOn(ph)) {
+                if (xMajor) plot(x0 + sm * i, y0 + sn * off, linePx);
+                else        plot(x0 + sn * off, y0 + sm * i, linePx);
+            }
+            if (++ph == DASH_PERIOD) ph = 0;
+            rem += 2 * minorLen;
+            if (rem >= den2) { rem -= den2; ++off; }
+        }
+    }
+
+    static long long floorDiv(long long a, long long b) {   // b > 0
+        return (a >= 0) ? a / b : -((-a + b - 1) / b);
+    }
+
+    // Dash test for outlines that advance one step at a time
+    bool dashOn(int phase) const { return lineStyle == 0 || phase < DASH_ON; }
+
+    // Largest h with h*h <= v (v >= 0)
+    static int isqrt(long long v) {
+        if (v <= 0) return 0;
+        long long r = (long long)std::sqrt((double)v);
+        while (r * r > v) --r;
+        while ((r + 1) * (r + 1) <= v) ++r;
+        return int(r);
+    }
+
+public:
+    FramebufferBackend() {}
+    FramebufferBackend(int width, int height) { allocate(width, height); }
+    ~FramebufferBackend() {
+        release();
+        for (int i = 0; i < DISC_CACHE; ++i) std::free(discs[i].hw);
+    }
+
+    FramebufferBackend(const FramebufferBackend&) = delete;
+    FramebufferBackend& operator=(const FramebufferBackend&) = delete;
+
+    // Own a width x height buffer (cleared to white)
+    bool allocate(int width, int height) {
+        release();
+        pixels = (uint32_t*)std::malloc(size_t(width) * height * sizeof(uint32_t));
+        if (!pixels) return false;
+        owned = true;
+        w = width; h = height; pitch = width;
+        resetClip();
+        clear(WHITE);
+        return true;
+    }
+
+    // Draw into caller memory (e.g. GetImageBuffer(&img)); stride in pixels
+    void attach(uint32_t* mem, int width, int height, int stride) {
+        release();
+        pixels = mem;
+        w = width; h = height; pitch = stride;
+        resetClip();
+    }
+
+    void release() {
+        if (owned) std::free(pixels);
+        pixels = nullptr;
+        owned = false;
+        w = h = pitch = 0;
+        resetClip();
+    }
+
+    uint32_t*       data()         { return pixels; }
+    const uint32_t* data() const   { return pixels; }
+    int width() const  { return w; }
+    int height() const { return h; }
+    int stride() const { return pitch; }
+
+    static uint32_t toPixel(COLORREF c) {
+        return (uint32_t(GetRValue(c)) << 16) | (uint32_t(GetGValue(c)) << 8) | GetBValue(c);
+    }
+
+    // Fill the clip rect with c (ignores ROP)
+    void clear(COLORREF c) {
+        uint32_t px = toPixel(c);
+        if (clipL > clipR) return;
+        for (int y = clipT; y <= clipB; ++y)
+            copySpan(pixels + size_t(y) * pitch + clipL, clipR - clipL + 1, px);
+    }
+
+    // Copy a srcW x srcH pixel block to (0, 0), limited to the clip rect
+    void blit(const uint32_t* src, int srcW, int srcH, int srcStride) {
+        int r = (srcW - 1 < clipR) ? srcW - 1 : clipR;
+        int b = (srcH - 1 < clipB) ? srcH - 1 : clipB;
+        if (r < clipL) return;
+        for (int y = clipT; y <= b; ++y)
+            std::memcpy(pixels + size_t(y) * pitch + clipL, src + size_t(y) * srcStride + clipL,
+                        size_t(r - clipL + 1) * sizeof(uint32_t));
+    }
+
+    // --- State ---
+    void     setLineColor(COLORREF c) override { lineColor = c; linePx = toPixel(c); }
+    COLORREF getLineColor() const override { return lineColor; }
+    void     setFillColor(COLORREF c) override { fillColor = c; fillPx = toPixel(c); }
+    COLORREF getFillColor() const override { return fillColor; }
+    void     setRop(int r) override { rop = r; }
+    int      getRop() const override { return rop; }
+    void     setLineStyle(int style) override { lineStyle = style; }
+
+    void setClip(const RECT* clip) override {
+        resetClip();
+        if (!clip) return;
+        if (clip->left > clipL)   clipL = clip->left;
+        if (clip->top > clipT)    clipT = clip->top;
+        if (clip->right < clipR)  clipR = clip->right;
+        if (clip->bottom < clipB) clipB = clip->bottom;
+    }
+
+    // --- Outlines ---
+    void line(int x0, int y0, int x1, int y1) override {
+        int phase = 0;
+        stroke(x0, y0, x1, y1, phase, false);
+    }
+
+    // Shared vertices are plotted once, and the dash pattern runs on across
+    // segments like a GDI polyline.
+    // Unit steps (pixel chains from the conic walks, dense freehand) skip the
+    // clip setup in stroke() and plot directly.
+    void polyline(const POINT* pts, int n) override {
+        int phase = 0;
+        for (int i = 1; i < n; ++i) {
+            int dx = pts[i].x - pts[i - 1].x, dy = pts[i].y - pts[i - 1].y;
+            if (i > 1 && dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1 && (dx | dy)) {
+                if (dashOn(phase)) plot(pts[i].x, pts[i].y, linePx);
+                if (++phase == DASH_PERIOD) phase = 0;
+                continue;
+            }
+            stroke(pts[i - 1].x, pts[i - 1].y, pts[i].x, pts[i].y, phase, i > 1);
+        }
+    }
+
+    // Midpoint circle; the eight octants are walked in parallel, so dashes
+    // come out mirror-symmetric rather than continuous around the rim.
+    void circle(int cx, int cy, int r) override {
+        if (r <= 0) { plot(cx, cy, linePx); return; }
+        if (cx + r < clipL || cx - r > clipR || cy + r < clipT || cy - r > clipB) return;
+        int x = r, y = 0, err = 1 - r;
+        int phase = 0;
+        while (x >= y) {
+            if (dashOn(phase)) {
+                plot(cx + x, cy + y, linePx);
+                plot(cx - x, cy + y, linePx);
+                if (y != 0) {
+                    plot(cx + x, cy - y, linePx);
+                    plot(cx - x, cy - y, linePx);
+                }
+                if (x != y) {
+                    plot(cx + y, cy + x, linePx);
+                    plot(cx + y, cy - x, linePx);
+                    if (y != 0) {
+                        plot(cx - y, cy + x, linePx);
+                        plot(cx - y, cy - x, linePx);
+                    }
+                }
+            }
+            if (++phase == DASH_PERIOD) phase = 0;
+            ++y;
+            if (err < 0) err += 2 * y + 1;
+            else { --x; err += 2 * (y - x) + 1; }
+        }
+    }
+
+    // Midpoint ellipse (integer, scaled by 4 so the half-pixel terms stay exact)
+    void ellipse(int cx, int cy, int rx, int ry) override {
+        if (rx <= 0 || ry <= 0) {
+            line(cx - rx, cy - ry, cx + rx, cy + ry);
+            return;
+        }
+        if (cx + rx < clipL || cx - rx > clipR || cy + ry < clipT || cy - ry > clipB) return;
+        long long a2 = (long long)rx * rx, b2 = (long long)ry * ry;
+        long long x = 0, y = ry;
+        int phase = 0;
+
+        auto plot4 = [&](int px, int py) {
+            if (dashOn(phase)) {
+                plot(cx + px, cy + py, linePx);
+                if (px != 0) plot(cx - px, cy + py, linePx);
+                if (py != 0) plot(cx + px, cy - py, linePx);
+                if (px != 0 && py != 0) plot(cx - px, cy - py, linePx);
+            }
+            if (++phase == DASH_PERIOD) phase = 0;
+        };
+
+        // Region 1: slope magnitude < 1, step x
+        long long d = 4 * b2 - 4 * a2 * ry + a2;
+        while (b2 * x <= a2 * y) {
+            plot4(int(x), int(y));
+            if (d < 0) d += 4 * b2 * (2 * x + 3);
+            else { d += 4 * b2 * (2 * x + 3) - 8 * a2 * (y - 1); --y; }
+            ++x;
+        }
+        // Region 2: step y
+        d = b2 * (2 * x + 1) * (2 * x + 1) + 4 * a2 * (y - 1) * (y - 1) - 4 * a2 * b2;
+        while (y >= 0) {
+            plot4(int(x), int(y));
+            if (d > 0) d += 4 * a2 * (3 - 2 * y);
+            else { d += 4 * b2 * (2 * x + 2) + 4 * a2 * (3 - 2 * y); ++x; }
+            --y;
+        }
+    }
+
+    // --- Fills ---
+    void solidRectangle(int l, int t, int r, int b) override {
+        if (l > r) { int s = l; l = r; r = s; }
+        if (t > b) { int s = t; t = b; b = s; }
+        if (t < clipT) t = clipT;
+        if (b > clipB) b = clipB;
+        for (int y = t; y <= b; ++y) span(l, r, y, fillPx);
+    }
+
+    void solidCircle(int cx, int cy, int r) override {
+        if (r < 0) return;
+        int dy0 = (cy - r < clipT) ? clipT - cy : -r;
+        int dy1 = (cy + r > clipB) ? clipB - cy : r;
+        const int* hw = discSpans(r);
+        long long r2 = (long long)r * r;
+        for (int dy = dy0; dy <= dy1; ++dy) {
+            int h = hw ? hw[dy < 0 ? -dy : dy] : isqrt(r2 - (long long)dy * dy);
+            span(cx - h, cx + h, cy + dy, fillPx);
+        }
+    }
+
+    // Even-odd scanline fill sampled at pixel centers (up to 64 vertices)
+    void solidPolygon(const POINT* pts, int n) override {
+        if (n < 3 || n > 64) return;
+        int minY = pts[0].y, maxY = pts[0].y;
+        for (int i = 1; i < n; ++i) {
+            if (pts[i].y < minY) minY = pts[i].y;
+            if (pts[i].y > maxY) maxY = pts[i].y;
+        }
+        if (minY < clipT) minY = clipT;
+        if (maxY > clipB) maxY = clipB;
+
+        // Per edge: x at y = 0 and dx/dy, so each row costs one multiply-add
+        double ex[64], es[64];
+        for (int i = 0, j = n - 1; i < n; j = i++) {
+            int y0 = pts[j].y, y1 = pts[i].y;
+            if (y0 == y1) continue;
+            es[i] = double(pts[i].x - pts[j].x) / (y1 - y0);
+            ex[i] = pts[j].x - y0 * es[i];
+        }
+
+        double xs[64];
+        for (int y = minY; y <= maxY; ++y) {
+            int k = 0;
+            for (int i = 0, j = n - 1; i < n; j = i++) {
+                if ((pts[j].y <= y) == (pts[i].y <= y)) continue;   // half-open: [min, max)
+                xs[k++] = ex[i] + y * es[i];
+            }
+            for (int a = 1; a < k; ++a) {               // insertion sort, k is tiny
+                double v = xs[a];
+                int b = a - 1;
+                while (b >= 0 && xs[b] > v) { xs[b + 1] = xs[b]; --b; }
+                xs[b + 1] = v;
+            }
+            for (int a = 0; a + 1 < k; a += 2)
+                span(int(std::ceil(xs[a])), int(std::floor(xs[a + 1])), y, fillPx);
+        }
+    }
+
+    // Edge functions w(x, y) = A*x + B*y + C, one per edge, all >= 0 inside.
+    // A center exactly on an edge is inside only for top and left edges
+    // (C is biased by -1 on the others), so triangles sharing an edge cover
+    // each pixel once. On row y an edge with A > 0 bounds x from below at
+    // -floor((B*y + C) / A), one with A < 0 from above at
+    // floor((B*y + C) / -A); those quotients are stepped row to row with a
+    // remainder, so the loop is integer adds and one span per row.
+    void solidTriangle(POINT a, POINT b, POINT c) override {
+        long long area = (long long)(b.x - a.x) * (c.y - a.y) - (long long)(b.y - a.y) * (c.x - a.x);
+        if (area == 0) return;
+        if (area < 0) { POINT t = b; b = c; c = t; }
+
+        int top = a.y, bot = a.y;
+        if (b.y < top) top = b.y;
+        if (c.y < top) top = c.y;
+        if (b.y > bot) bot = b.y;
+        if (c.y > bot) bot = c.y;
+        if (top < clipT) top = clipT;
+        if (bot > clipB) bot = clipB;
+        if (top > bot) return;
+
+        // Edge functions; horizontal ones (A == 0) only trim the row range
+        const POINT v[3] = { a, b, c };
+        long long A[3], B[3], C[3];
+        for (int i = 0; i < 3; ++i) {
+            const POINT& p = v[i];
+            const POINT& e = v[i == 2 ? 0 : i + 1];
+            long long dx = e.x - p.x, dy = e.y - p.y;
+            A[i] = -dy; B[i] = dx; C[i] = dy * p.x - dx * p.y;
+            if (!(dy < 0 || (dy == 0 && dx > 0))) C[i] -= 1;   // not top-left
+            if (A[i] != 0) continue;
+            if (B[i] > 0) { long long y0 = -floorDiv(C[i], B[i]); if (y0 > top) top = int(y0 > bot ? bot + 1 : y0); }
+            else          { long long y1 = floorDiv(C[i], -B[i]); if (y1 < bot) bot = int(y1 < top ? top - 1 : y1); }
+        }
+        if (top > bot) return;
+
+        // Bounds stepped row to row: x >= -q for left edges, x <= q for
+        // right edges. Unused slots stay at a bound that never binds.
+        struct EdgeStep { long long q, rem, stepQ, stepR, den; };
+        EdgeStep es[4];          // [0, 2) left, [2, 4) right
+        int nl = 0, nr = 2;
+        for (int i = 0; i < 3; ++i) {
+            if (A[i] == 0) continue;
+            EdgeStep& s = (A[i] > 0) ? es[nl++] : es[nr++];
+            s.den = (A[i] > 0) ? A[i] : -A[i];
+            long long n = B[i] * top + C[i];                   // B*y + C on the first row
+            s.q = floorDiv(n, s.den);
+            s.rem = n - s.q * s.den;
+            s.stepQ = floorDiv(B[i], s.den);
+            s.stepR = B[i] - s.stepQ * s.den;
+        }
+        const EdgeStep idle = { LLONG_MAX / 2, 0, 0, 0, 1 };
+        while (nl < 2) es[nl++] = idle;
+        while (nr < 4) es[nr++] = idle;
+
+        for (int y = top; y <= bot; ++y) {
+            long long lo = -es[0].q, hi = es[2].q;
+            if (-es[1].q > lo) lo = -es[1].q;
+            if (es[3].q < hi) hi = es[3].q;
+            if (lo < clipL) lo = clipL;
+            if (hi > clipR) hi = clipR;
+            if (lo <= hi) span(int(lo), int(hi), y, fillPx);
+            for (int i = 0; i < 4; ++i) {   // branch-free: the carry is data-dependent
+                long long r = es[i].rem + es[i].stepR;
+                long long carry = (r >= es[i].den);
+                es[i].q += es[i].stepQ + carry;
+                es[i].rem = r - (es[i].den & -carry);
+            }
+        }
+    }
+
+    // Per row, the capsule is convex, so its cover is one interval: the union
+    // of the two end discs (from the disc table) and the swept quad.
+    void solidCapsule(POINT a, POINT b, int r) override {
+        if (a.x == b.x && a.y == b.y) { solidCircle(a.x, a.y, r); return; }
+        const int* hw = discSpans(r);
+        long long r2 = (long long)r * r;
+
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double len = std::sqrt(dx * dx + dy * dy);
+        double nx = -dy / len * r, ny = dx / len * r;
+        double qx[4] = { a.x + nx, b.x + nx, b.x - nx, a.x - nx };
+        double qy[4] = { a.y + ny, b.y + ny, b.y - ny, a.y - ny };
+
+        int top = (a.y < b.y ? a.y : b.y) - r;
+        int bot = (a.y > b.y ? a.y : b.y) + r;
+        if (top < clipT) top = clipT;
+        if (bot > clipB) bot = clipB;
+
+        // The quad's long sides as x = ex + y * es over rows [ey0, ey1]. Its
+        // other two sides are diameters of the end discs, so never widen a
+        // row. The long sides are parallel: one bounds every row on the left,
+        // the other on the right.
+        double ex[2] = {}, es[2] = {};
+        int    ey0[2] = { 1, 1 }, ey1[2] = { 0, 0 };
+        if (qy[0] != qy[1]) {
+            for (int k = 0; k < 2; ++k) {
+                int i = 2 * k, j = i + 1;
+                es[k] = (qx[j] - qx[i]) / (qy[j] - qy[i]);
+                ex[k] = qx[i] - qy[i] * es[k];
+                ey0[k] = ceilI(qy[i] < qy[j] ? qy[i] : qy[j]);
+                ey1[k] = floorI(qy[i] < qy[j] ? qy[j] : qy[i]);
+            }
+            if (ex[0] > ex[1]) {
+                std::swap(ex[0], ex[1]);
+                std::swap(es[0], es[1]);
+                std::swap(ey0[0], ey0[1]);
+                std::swap(ey1[0], ey1[1]);
+            }
+        }
+
+        for (int y = top; y <= bot; ++y) {
+            int lo = INT_MAX, hi = INT_MIN;
+            int ea = y - a.y, eb = y - b.y;
+            if (ea >= -r && ea <= r) {
+                int h = hw ? hw[ea < 0 ? -ea : ea] : isqrt(r2 - (long long)ea * ea);
+                lo = a.x - h;
+                hi = a.x + h;
+            }
+            if (eb >= -r && eb <= r) {
+                int h = hw ? hw[eb < 0 ? -eb : eb] : isqrt(r2 - (long long)eb * eb);
+                if (b.x - h < lo) lo = b.x - h;
+                if (b.x + h > hi) hi = b.x + h;
+            }
+            if (y >= ey0[0] && y <= ey1[0]) {
+                int xl = ceilI(ex[0] + y * es[0]);
+                if (xl < lo) lo = xl;
+            }
+            if (y >= ey0[1] && y <= ey1[1]) {
+                int xr = floorI(ex[1] + y * es[1]);
+                if (xr > hi) hi = xr;
+            }
+            if (lo <= hi) span(lo, hi, y, fillPx);
+        }
+    }
+};
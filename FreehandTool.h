@@ -1,42 +1,120 @@
 #pragma once
-#include <graphics.h>
+#include "RenderBackend.h"
+#include <climits>
+#include <cmath>
 #include <cstdlib>      // malloc, realloc, free
+#include <cstring>      // memcpy, memmove
+#include <utility>      // swap
 #include "LineUtils.h"
+#include "RectUtils.h"
 
 // from main.cpp
 extern int gZCounter;
 
+// FreehandTool: one polyline record per pen-down. All vertices live in one
+// shared point pool; a stroke is a [first, first + count) slice of it.
 class FreehandTool {
 private:
     struct Stroke {
-        POINT start;
-        POINT end;
+        int   first;    // index of the first vertex in 'points'
+        int   count;    // number of vertices (>= 2)
         int   style;
         int   z;
+        RECT  box;      // cached bounds (vertices, grown by 1 for the pen)
     };
 
     Stroke* strokes = nullptr;   // dynamic array of strokes
     int     strokeCount = 0;     // number used
     int     capacity = 0;     // number allocated
 
+    POINT*  points = nullptr;    // shared vertex pool
+    int     pointCount = 0;
+    int     pointCap = 0;
+
+    bool    borrowed = false;    // strokes/points point into a mapped document (read-only)
+
+    bool    strokeOpen = false;  // last stroke is still receiving points (pen down)
+    int     segPhase = 0;        // dash phase at the start of the open stroke's newest segment
+    int     endPhase = 0;        // ... and after it
+    float   tolerance = 1.0f;    // simplification tolerance in pixels (0 = keep every sample)
+
 public:
     ~FreehandTool() { clearMemory(); }
 
-    // Add a small segment of a freehand path
+    // Add a small segment of a freehand path. Consecutive segments of one
+    // pen-down extend the same polyline; the first one opens a new stroke.
     void addStroke(const POINT& from, const POINT& to, int* style) {
-        ensureCapacity(strokeCount + 1);
+        bool extend = strokeOpen && strokes[strokeCount - 1].style == *style;
 
-        strokes[strokeCount].start = from;
-        strokes[strokeCount].end = to;
-        strokes[strokeCount].style = *style;
-        strokes[strokeCount].z = ++gZCounter;   // newest stroke on top
+        if (extend) {
+            if (!ensurePoints(pointCount + 1)) return;
+            segPhase = endPhase;
+            Stroke& s = strokes[strokeCount - 1];
+            points[pointCount++] = to;
+            ++s.count;
+            rectUnion(s.box, segmentBounds(to, to, 1));
+        }
+        else {
+            if (!ensureCapacity(strokeCount + 1) || !ensurePoints(pointCount + 2)) return;
+            Stroke& s = strokes[strokeCount];
+            s.first = pointCount;
+            s.count = 2;
+            s.style = *style;
+            s.z = ++gZCounter;   // newest stroke on top
+            s.box = segmentBounds(from, to, 1);
+            points[pointCount++] = from;
+            points[pointCount++] = to;
+            ++strokeCount;
+            strokeOpen = true;
+            segPhase = 0;
+        }
 
         // Draw immediately (interactive feel)
-        drawCustomLine(from, to, style);
+        drawOpenSegment();
+    }
+
+    // Draw the newest segment of the open stroke. Dashed strokes pick up the
+    // pattern where the previous segment left it, so the live stroke dashes
+    // the same as the finished polyline.
+    void drawOpenSegment() {
+        if (!strokeOpen) return;
+        const Stroke& s = strokes[strokeCount - 1];
+        const POINT* seg = &points[s.first + s.count - 2];
+        if (s.style == 0) {
+            int style = 0;
+            drawCustomLine(seg[0], seg[1], &style);
+            return;
+        }
+        endPhase = segPhase;
+        dashPolyline(seg, 2, endPhase, s.count > 2);
+    }
+
+    // Pen up: close the open stroke and simplify it. Returns true (and the
+    // stroke's bounds in 'changed') if vertices were dropped, so the caller
+    // can repaint what was drawn from the raw samples.
+    bool endStroke(RECT* changed = nullptr) {
+        if (!strokeOpen) return false;
+        strokeOpen = false;
+
+        Stroke& s = strokes[strokeCount - 1];
+        if (tolerance <= 0.0f || s.count <= 2) return false;
 
-        ++strokeCount;
+        int n = simplify(&points[s.first], s.count, tolerance);
+        if (n == s.count) return false;
+
+        s.count = n;
+        pointCount = s.first + n;   // the open stroke is always last in the pool
+        if (changed) *changed = s.box;
+        return true;
+    }
+
+    // z of the stroke still receiving points, or 0 if the pen is up
+    int openStrokeZ() const {
+        return strokeOpen ? strokes[strokeCount - 1].z : 0;
     }
 
+    void setTolerance(float px) { tolerance = (px < 0.0f) ? 0.0f : px; }
+
     // --- Z-order API ---
     size_t getCount() const { return static_cast<size_t>(strokeCount); }
 
@@ -44,10 +122,33 @@ public:
         return (i < static_cast<size_t>(strokeCount)) ? strokes[i].z : 0;
     }
 
+    RECT getBounds(size_t i) const {
+        if (i >= static_cast<size_t>(strokeCount)) return makeRect(0, 0, -1, -1);
+        return strokes[i].box;
+    }
+
+    // Index of the first stroke with z >= the given one (strokes are in z order)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (strokes[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the stroke with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && strokes[i].z == z) ? i : getCount();
+    }
+
     void drawAt(size_t i) const {
         if (i >= static_cast<size_t>(strokeCount)) return;
+        if (strokes[i].first < 0 || strokes[i].count > pointCount - strokes[i].first) return;   // bad mapped record
         int style = strokes[i].style;
-        drawCustomLine(strokes[i].start, strokes[i].end, &style);
+        drawCustomPolyline(&points[strokes[i].first], strokes[i].count, &style);
     }
 
     void drawCompleted() const {
@@ -56,34 +157,261 @@ public:
     }
 
     void reset() {
+        if (borrowed) clearMemory();   // never reuse mapped storage for new strokes
         strokeCount = 0; // reseting capasity
+        pointCount = 0;
+        strokeOpen = false;
     }
 
     void resetAll() {
         clearMemory();
-        strokes = nullptr;
         strokeCount = 0;
-        capacity = 0;
+        pointCount = 0;
+        strokeOpen = false;
+    }
+
+    // ---- Bulk access (document save/load) ----
+    typedef Stroke Record;
+    const Record* records() const { return strokes; }
+    const POINT*  pointPool() const { return points; }
+    size_t        pointPoolSize() const { return static_cast<size_t>(pointCount); }
+
+    // Drop everything and make room for nStrokes strokes over a pool of
+    // nPoints vertices, all marked as used; the caller fills both arrays.
+    // Returns false if either can't be allocated.
+    bool replaceRecords(size_t nStrokes, size_t nPoints, Record** outStrokes, POINT** outPoints) {
+        resetAll();
+        if (nStrokes > size_t(INT_MAX) || nPoints > size_t(INT_MAX)) return false;
+        if (!ensureCapacity(int(nStrokes)) || !ensurePoints(int(nPoints))) {
+            clearMemory();
+            return false;
+        }
+        strokeCount = int(nStrokes);
+        pointCount = int(nPoints);
+        *outStrokes = strokes;
+        *outPoints = points;
+        return true;
+    }
+
+    // Append a finished stroke and its vertices as is (journal replay); its z
+    // must be above every stored z
+    bool appendStroke(const Record& s, const POINT* pts) {
+        if (s.count < 2 || s.count > INT_MAX - pointCount) return false;
+        if (!ensureCapacity(strokeCount + 1) || !ensurePoints(pointCount + s.count)) return false;
+        Stroke& d = strokes[strokeCount++];
+        d = s;
+        d.first = pointCount;
+        std::memcpy(&points[pointCount], pts, static_cast<size_t>(s.count) * sizeof(POINT));
+        pointCount += s.count;
+        return true;
+    }
+
+    // Put back strokes taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order; pts holds their vertices one
+    // stroke after another. The pool stays in stroke order, so only strokes
+    // above the lowest inserted z (and their vertices) move. False if out of
+    // memory or a stroke is malformed.
+    bool insertStrokes(const Record* s, size_t n, const POINT* pts) {
+        if (n == 0) return true;
+        if (strokeOpen || n > size_t(INT_MAX - strokeCount)) return false;
+        long long total = 0;
+        for (size_t k = 0; k < n; ++k) {
+            if (s[k].count < 2) return false;
+            total += s[k].count;
+        }
+        if (total > INT_MAX - pointCount) return false;
+        if (!ensureCapacity(strokeCount + int(n)) || !ensurePoints(pointCount + int(total))) return false;
+
+        // Merge from the top down; every stored stroke only moves up
+        int lo = int(lowerBoundZ(s[0].z));
+        int src = strokeCount, dst = strokeCount + int(n), k = int(n);
+        int pw = pointCount + int(total);             // end of the next stroke's vertices
+        int pk = int(total);                          // end of s[k - 1]'s vertices in pts
+        while (k > 0) {
+            Stroke d;
+            if (src > lo && strokes[src - 1].z > s[k - 1].z) {
+                d = strokes[--src];
+                pw -= d.count;
+                std::memmove(&points[pw], &points[d.first], static_cast<size_t>(d.count) * sizeof(POINT));
+            }
+            else {
+                d = s[--k];
+                pk -= d.count;
+                pw -= d.count;
+                std::memcpy(&points[pw], &pts[pk], static_cast<size_t>(d.count) * sizeof(POINT));
+            }
+            d.first = pw;
+            strokes[--dst] = d;
+        }
+        strokeCount += int(n);
+        pointCount += int(total);
+        return true;
+    }
+
+    // Use strokes and points stored elsewhere (a mapped document) in place.
+    // The storage must stay valid until the next resetAll()/replaceRecords()/
+    // ownRecords(); the first edit copies both arrays to the heap.
+    void borrowRecords(const Record* s, size_t nStrokes, const POINT* p, size_t nPoints) {
+        resetAll();
+        if (nStrokes == 0 || nStrokes > size_t(INT_MAX) || nPoints > size_t(INT_MAX)) return;
+        strokes = const_cast<Record*>(s);
+        points = const_cast<POINT*>(p);
+        strokeCount = capacity = int(nStrokes);
+        pointCount = pointCap = int(nPoints);
+        borrowed = true;
+    }
+
+    // Copy borrowed strokes and points to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* ns = std::malloc(static_cast<size_t>(strokeCount) * sizeof(Stroke));
+        void* np = std::malloc(static_cast<size_t>(pointCount ? pointCount : 1) * sizeof(POINT));
+        if (!ns || !np) { std::free(ns); std::free(np); return false; }
+        std::memcpy(ns, strokes, static_cast<size_t>(strokeCount) * sizeof(Stroke));
+        std::memcpy(np, points, static_cast<size_t>(pointCount) * sizeof(POINT));
+        strokes = static_cast<Stroke*>(ns);
+        points = static_cast<POINT*>(np);
+        capacity = strokeCount;
+        pointCap = pointCount ? pointCount : 1;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange strokes and points with another tool (undo keeps whole scenes
+    // this way). Only between strokes: the pen must be up on both.
+    void swapRecords(FreehandTool& o) {
+        std::swap(strokes, o.strokes);
+        std::swap(strokeCount, o.strokeCount);
+        std::swap(capacity, o.capacity);
+        std::swap(points, o.points);
+        std::swap(pointCount, o.pointCount);
+        std::swap(pointCap, o.pointCap);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // --- Removal (undo) ---
+
+    // Removes every stroke whose z is listed in zs (ascending) and closes
+    // the gaps in the point pool. Strokes and vertices below the first match
+    // stay put, so dropping the newest stroke moves nothing.
+    // Returns how many strokes were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0 || strokeOpen) return 0;
+        if (!ownRecords()) return 0;
+        int lo = 0, hi = strokeCount;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (strokes[mid].z < zs[0]) lo = mid + 1;
+            else hi = mid;
+        }
+        int w = lo;
+        int pw = (lo < strokeCount) ? strokes[lo].first : pointCount;
+        size_t k = 0;
+        for (int r = lo; r < strokeCount; ++r) {
+            while (k < n && zs[k] < strokes[r].z) ++k;
+            if (k < n && zs[k] == strokes[r].z) { ++k; continue; }
+            Stroke s = strokes[r];
+            if (s.first != pw)
+                std::memmove(&points[pw], &points[s.first], static_cast<size_t>(s.count) * sizeof(POINT));
+            s.first = pw;
+            pw += s.count;
+            strokes[w++] = s;
+        }
+        size_t removed = static_cast<size_t>(strokeCount - w);
+        strokeCount = w;
+        pointCount = pw;
+        return removed;
     }
 
 private:
-    void ensureCapacity(int minNeeded) {
-        if (minNeeded <= capacity) return;
+    bool ensureCapacity(int minNeeded) {
+        if (minNeeded <= capacity) return true;
+        if (!ownRecords()) return false;
 
         int newCap = (capacity == 0) ? 16 : capacity * 2;
         if (newCap < minNeeded) newCap = minNeeded;
 
         void* newBuf = std::realloc(strokes, static_cast<size_t>(newCap) * sizeof(Stroke));
         if (!newBuf) {
-            return;
+            return false;
         }
         strokes = static_cast<Stroke*>(newBuf);
         capacity = newCap;
+        return true;
+    }
+
+    bool ensurePoints(int minNeeded) {
+        if (minNeeded <= pointCap) return true;
+        if (!ownRecords()) return false;
+
+        int newCap = (pointCap == 0) ? 256 : pointCap * 2;
+        if (newCap < minNeeded) newCap = minNeeded;
+
+        void* newBuf = std::realloc(points, static_cast<size_t>(newCap) * sizeof(POINT));
+        if (!newBuf) return false;
+        points = static_cast<POINT*>(newBuf);
+        pointCap = newCap;
+        return true;
     }
 
     void clearMemory() {
-        std::free(strokes);
+        if (!borrowed) {
+            std::free(strokes);
+            std::free(points);
+        }
         strokes = nullptr;
         capacity = 0;
+        points = nullptr;
+        pointCap = 0;
+        borrowed = false;
+    }
+
+    // Distance from p to segment ab
+    static double segmentDistance(POINT p, POINT a, POINT b) {
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double len2 = dx * dx + dy * dy;
+        double t = (len2 > 0.0) ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0.0;
+        if (t < 0.0) t = 0.0;
+        else if (t > 1.0) t = 1.0;
+        double ex = a.x + t * dx - p.x, ey = a.y + t * dy - p.y;
+        return std::sqrt(ex * ex + ey * ey);
+    }
+
+    // Ramer-Douglas-Peucker on pts[0, n), in place; keeps both endpoints.
+    // Iterative with an explicit range stack. Returns the new vertex count
+    // (n unchanged if scratch memory is unavailable).
+    static int simplify(POINT* pts, int n, float tol) {
+        unsigned char* keep = static_cast<unsigned char*>(std::calloc(size_t(n), 1));
+        int* stack = static_cast<int*>(std::malloc(size_t(n) * 2 * sizeof(int)));
+        if (!keep || !stack) { std::free(keep); std::free(stack); return n; }
+
+        keep[0] = keep[n - 1] = 1;
+        int top = 0;
+        stack[top++] = 0;
+        stack[top++] = n - 1;
+
+        while (top > 0) {
+            int hi = stack[--top];
+            int lo = stack[--top];
+            double worst = 0.0;
+            int    split = -1;
+            for (int k = lo + 1; k < hi; ++k) {
+                double d = segmentDistance(pts[k], pts[lo], pts[hi]);
+                if (d > worst) { worst = d; split = k; }
+            }
+            if (split >= 0 && worst > tol) {
+                keep[split] = 1;
+                stack[top++] = lo;    stack[top++] = split;
+                stack[top++] = split; stack[top++] = hi;
+            }
+        }
+
+        int w = 0;
+        for (int k = 0; k < n; ++k)
+            if (keep[k]) pts[w++] = pts[k];
+
+        std::free(keep);
+        std::free(stack);
+        return w;
     }
 };
@@ -0,0 +1,36 @@
+#pragma once
+
+// POINT / RECT / COLORREF come from <windows.h> on Windows. Headless builds
+// (no EasyX, e.g. the Linux batch renderer) get layout-compatible stand-ins so
+// the tools and the software framebuffer compile anywhere.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdint>
+
+typedef int32_t  LONG;
+typedef uint32_t DWORD;
+typedef uint32_t COLORREF;
+
+struct POINT { LONG x; LONG y; };
+struct RECT  { LONG left; LONG top; LONG right; LONG bottom; };
+
+#define RGB(r, g, b) ((COLORREF)((uint32_t)(uint8_t)(r) | ((uint32_t)(uint8_t)(g) << 8) | ((uint32_t)(uint8_t)(b) << 16)))
+#define GetRValue(c) ((uint8_t)(c))
+#define GetGValue(c) ((uint8_t)((c) >> 8))
+#define GetBValue(c) ((uint8_t)((c) >> 16))
+
+#define R2_XORPEN  7
+#define R2_COPYPEN 13
+#endif
+
+// EasyX color names (same values as graphics.h)
+#ifndef BLACK
+#define BLACK     0
+#endif
+#ifndef WHITE
+#define WHITE     0xFFFFFF
+#endif
+#ifndef LIGHTGRAY
+#define LIGHTGRAY 0xAAAAAA
+#endif
@@ -0,0 +1,382 @@
+#pragma once
+#include <windows.h>
+#include <tchar.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>      // malloc, realloc, free
+#include <cstring>
+#include <thread>
+#include "Crc32.h"
+
+// Raster export off the UI thread. start() copies the canvas pixels (one
+// memcpy) and returns; a worker encodes the copy as BMP or PNG and writes
+// the file while drawing carries on. The main loop polls progress() and
+// collects the result with poll().
+//
+// Pixels are 0x00RRGGBB rows (GetImageBuffer() layout).
+
+// Growable byte buffer the encoders write into
+struct ExportBuffer {
+    uint8_t* data = nullptr;
+    size_t   size = 0;
+    size_t   cap = 0;
+    bool     failed = false;
+
+    ~ExportBuffer() { std::free(data); }
+
+    uint8_t* grow(size_t n) {
+        if (failed) return nullptr;
+        if (size + n > cap) {
+            size_t newCap = cap ? cap * 2 : 64 * 1024;
+            while (newCap < size + n) newCap *= 2;
+            void* nb = std::realloc(data, newCap);
+            if (!nb) { failed = true; return nullptr; }
+            data = (uint8_t*)nb;
+            cap = newCap;
+        }
+        uint8_t* p = data + size;
+        size += n;
+        return p;
+    }
+    void put(const void* p, size_t n) {
+        uint8_t* d = grow(n);
+        if (d) std::memcpy(d, p, n);
+    }
+    void put8(uint8_t v) { put(&v, 1); }
+    void put16le(uint32_t v) { uint8_t b[2] = { uint8_t(v), uint8_t(v >> 8) }; put(b, 2); }
+    void put32le(uint32_t v) { uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) }; put(b, 4); }
+    void put32be(uint32_t v) { uint8_t b[4] = { uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v) }; put(b, 4); }
+};
+
+// ---- BMP: 24-bit, bottom-up ----
+
+inline bool encodeBMP(ExportBuffer& out, const uint32_t* px, int w, int h, std::atomic<int>* progress) {
+    const uint32_t rowBytes = (uint32_t(w) * 3 + 3) & ~3u;
+    const uint32_t imageBytes = rowBytes * uint32_t(h);
+
+    out.put8('B'); out.put8('M');
+    out.put32le(14 + 40 + imageBytes);
+    out.put32le(0);
+    out.put32le(14 + 40);
+    out.put32le(40);                    // BITMAPINFOHEADER
+    out.put32le(uint32_t(w));
+    out.put32le(uint32_t(h));
+    out.put16le(1);
+    out.put16le(24);
+    out.put32le(0);                     // BI_RGB
+    out.put32le(imageBytes);
+    out.put32le(2835); out.put32le(2835);   // 72 dpi
+    out.put32le(0); out.put32le(0);
+
+    for (int y = h - 1; y >= 0; --y) {
+        uint8_t* d = out.grow(rowBytes);
+        if (!d) return false;
+        const uint32_t* s = px + size_t(y) * w;
+        for (int x = 0; x < w; ++x) {
+            d[3 * x + 0] = uint8_t(s[x]);
+            d[3 * x + 1] = uint8_t(s[x] >> 8);
+            d[3 * x + 2] = uint8_t(s[x] >> 16);
+        }
+        std::memset(d + 3 * w, 0, rowBytes - 3 * w);
+        progress->store(100 * (h - y) / h, std::memory_order_relaxed);
+    }
+    return !out.failed;
+}
+
+// ---- PNG: RGB8, adaptive None/Sub/Up filters, fixed-Huffman deflate ----
+
+// Deflate with the fixed Huffman code (RFC 1951 3.2.6) and LZ77 matching
+// over hash chains. Drawings are mostly flat runs, which this handles well
+// without dynamic code tables.
+class FixedDeflate {
+private:
+    static const int WINDOW = 32768;
+    static const int HASH_BITS = 15;
+    static const int MAX_CHAIN = 16;
+    static const int MIN_MATCH = 3;
+    static const int MAX_MATCH = 258;
+
+    ExportBuffer& out;
+    uint64_t bits = 0;
+    int      bitCount = 0;
+
+    void putBits(uint32_t v, int n) {
+        bits |= uint64_t(v) << bitCount;
+        bitCount += n;
+        while (bitCount >= 8) {
+            out.put8(uint8_t(bits));
+            bits >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    static uint32_t reverse(uint32_t v, int n) {
+        uint32_t r = 0;
+        for (int i = 0; i < n; ++i) { r = (r << 1) | (v & 1); v >>= 1; }
+        return r;
+    }
+
+    // Huffman codes go out most-significant bit first
+    void putSymbol(int sym) {
+        if (sym < 144)      putBits(reverse(0x30 + sym, 8), 8);
+        else if (sym < 256) putBits(reverse(0x190 + sym - 144, 9), 9);
+        else if (sym < 280) putBits(reverse(sym - 256, 7), 7);
+        else                putBits(reverse(0xC0 + sym - 280, 8), 8);
+    }
+
+    void putMatch(int len, int dist) {
+        static const uint16_t lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t  lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                               3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                               257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                               8193, 12289, 16385, 24577 };
+        static const uint8_t  distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        int l = 28;
+        while (lenBase[l] > len) --l;
+        putSymbol(257 + l);
+        putBits(uint32_t(len - lenBase[l]), lenExtra[l]);
+
+        int d = 29;
+        while (distBase[d] > dist) --d;
+        putBits(reverse(uint32_t(d), 5), 5);
+        putBits(uint32_t(dist - distBase[d]), distExtra[d]);
+    }
+
+    static uint32_t hash3(const uint8_t* p) {
+        return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+public:
+    explicit FixedDeflate(ExportBuffer& o) : out(o) {}
+
+    // Compress in[0, n) as one final block. progress goes from 'from' to 'to'.
+    bool compress(const uint8_t* in, size_t n, std::atomic<int>* progress, int from, int to) {
+        int32_t* head = (int32_t*)std::malloc(sizeof(int32_t) << HASH_BITS);
+        int32_t* prev = (int32_t*)std::malloc(sizeof(int32_t) * WINDOW);
+        if (!head || !prev) { std::free(head); std::free(prev); return false; }
+        for (int i = 0; i < (1 << HASH_BITS); ++i) head[i] = -1;
+
+        putBits(1, 1);   // BFINAL
+        putBits(1, 2);   // BTYPE = fixed Huffman
+
+        auto insert = [&](size_t i) {
+            if (i + MIN_MATCH > n) return;
+            uint32_t hv = hash3(in + i);
+            prev[i & (WINDOW - 1)] = head[hv];
+            head[hv] = int32_t(i);
+        };
+
+        size_t i = 0, nextReport = 0;
+        while (i < n) {
+            int bestLen = 0, bestDist = 0;
+            if (i + MIN_MATCH <= n) {
+                size_t limit = (n - i < MAX_MATCH) ? n - i : MAX_MATCH;
+                int32_t cand = head[hash3(in + i)];
+                for (int chain = 0; cand >= 0 && chain < MAX_CHAIN; ++chain) {
+                    size_t dist = i - size_t(cand);
+                    if (dist > WINDOW - 1) break;
+                    size_t len = 0;
+                    while (len < limit && in[cand + len] == in[i + len]) ++len;
+                    if (int(len) > bestLen) {
+                        bestLen = int(len);
+                        bestDist = int(dist);
+                        if (len == limit) break;
+                    }
+                    int32_t p = prev[cand & (WINDOW - 1)];
+                    if (p >= cand) break;   // slot reused by a newer position
+                    cand = p;
+                }
+            }
+
+            if (bestLen >= MIN_MATCH) {
+                putMatch(bestLen, bestDist);
+                for (int k = 0; k < bestLen; ++k) insert(i + k);
+                i += bestLen;
+            }
+            else {
+                putSymbol(in[i]);
+                insert(i);
+                ++i;
+            }
+
+            if (i >= nextReport) {
+                progress->store(from + int((to - from) * (double(i) / double(n))), std::memory_order_relaxed);
+                nextReport = i + 65536;
+            }
+        }
+        putSymbol(256);   // end of block
+        if (bitCount > 0) putBits(0, 8 - bitCount);
+
+        std::free(head);
+        std::free(prev);
+        return !out.failed;
+    }
+};
+
+inline uint32_t adler32(const uint8_t* p, size_t n) {
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        size_t k = (n < 5552) ? n : 5552;   // largest run that can't overflow
+        n -= k;
+        while (k--) { a += *p++; b += a; }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+inline void pngChunk(ExportBuffer& out, const char type[4], const uint8_t* data, uint32_t n) {
+    out.put32be(n);
+    out.put(type, 4);
+    if (n) out.put(data, n);
+    uint32_t crc = crc32Update(0, (const uint8_t*)type, 4);
+    crc = crc32Update(crc, data, n);
+    out.put32be(crc);
+}
+
+inline bool encodePNG(ExportBuffer& out, const uint32_t* px, int w, int h, std::atomic<int>* progress) {
+    // Filtered scanlines: one filter byte + 3 bytes per pixel. Each row picks
+    // the filter with the smallest sum of absolute (signed) bytes.
+    const size_t stride = size_t(w) * 3 + 1;
+    uint8_t* raw = (uint8_t*)std::malloc(stride * h);
+    uint8_t* rgb = (uint8_t*)std::malloc(size_t(w) * 3 * 2);
+    uint8_t* cand = (uint8_t*)std::malloc(size_t(w) * 3 * 3);
+    if (!raw || !rgb || !cand) { std::free(raw); std::free(rgb); std::free(cand); return false; }
+
+    const size_t rowBytes = size_t(w) * 3;
+    for (int y = 0; y < h; ++y) {
+        uint8_t* cur = rgb + (y & 1) * rowBytes;
+        const uint8_t* up = (y > 0) ? rgb + ((y - 1) & 1) * rowBytes : nullptr;
+        const uint32_t* s = px + size_t(y) * w;
+        for (int x = 0; x < w; ++x) {
+            cur[3 * x + 0] = uint8_t(s[x] >> 16);
+            cur[3 * x + 1] = uint8_t(s[x] >> 8);
+            cur[3 * x + 2] = uint8_t(s[x]);
+        }
+
+        uint8_t* none = cand;
+        uint8_t* sub = cand + rowBytes;
+        uint8_t* upf = cand + 2 * rowBytes;
+        uint32_t costNone = 0, costSub = 0, costUp = 0;
+        for (size_t k = 0; k < rowBytes; ++k) {
+            none[k] = cur[k];
+            sub[k] = uint8_t(cur[k] - (k >= 3 ? cur[k - 3] : 0));
+            upf[k] = uint8_t(cur[k] - (up ? up[k] : 0));
+            costNone += (none[k] < 128) ? none[k] : 256 - none[k];
+            costSub += (sub[k] < 128) ? sub[k] : 256 - sub[k];
+            costUp += (upf[k] < 128) ? upf[k] : 256 - upf[k];
+        }
+        uint8_t* row = raw + size_t(y) * stride;
+        if (costUp <= costSub && costUp <= costNone) { row[0] = 2; std::memcpy(row + 1, upf, rowBytes); }
+        else if (costSub <= costNone)                { row[0] = 1; std::memcpy(row + 1, sub, rowBytes); }
+        else                                         { row[0] = 0; std::memcpy(row + 1, none, rowBytes); }
+        progress->store(10 * (y + 1) / h, std::memory_order_relaxed);
+    }
+    std::free(rgb);
+    std::free(cand);
+
+    // zlib stream: header, deflate, Adler-32
+    ExportBuffer z;
+    z.put8(0x78);
+    z.put8(0x01);
+    bool ok = FixedDeflate(z).compress(raw, stride * h, progress, 10, 95);
+    z.put32be(adler32(raw, stride * h));
+    std::free(raw);
+    if (!ok || z.failed) return false;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.put(signature, 8);
+    uint8_t ihdr[13] = {
+        uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w),
+        uint8_t(h >> 24), uint8_t(h >> 16), uint8_t(h >> 8), uint8_t(h),
+        8, 2, 0, 0, 0   // 8-bit RGB, deflate, adaptive filtering, no interlace
+    };
+    pngChunk(out, "IHDR", ihdr, 13);
+    pngChunk(out, "IDAT", z.data, uint32_t(z.size));
+    pngChunk(out, "IEND", nullptr, 0);
+    return !out.failed;
+}
+
+// ---- Worker ----
+
+class ImageExporter {
+public:
+    enum Format { EXPORT_BMP, EXPORT_PNG };
+
+private:
+    enum State { IDLE, RUNNING, DONE_OK, DONE_FAILED };
+
+    std::thread      worker;
+    std::atomic<int> state{ IDLE };
+    std::atomic<int> percent{ 0 };
+
+    TCHAR     path[MAX_PATH] = {};
+    Format    format = EXPORT_PNG;
+    uint32_t* pixels = nullptr;   // private copy of the canvas
+    int       width = 0, height = 0;
+
+    void run() {
+        ExportBuffer out;
+        bool ok = (format == EXPORT_BMP) ? encodeBMP(out, pixels, width, height, &percent)
+                                         : encodePNG(out, pixels, width, height, &percent);
+        std::free(pixels);
+        pixels = nullptr;
+
+        if (ok) {
+            FILE* f = nullptr;
+            ok = _tfopen_s(&f, path, _T("wb")) == 0 && f;
+            if (ok) {
+                ok = std::fwrite(out.data, 1, out.size, f) == out.size;
+                ok = (std::fclose(f) == 0) && ok;
+                if (!ok) _tremove(path);
+            }
+        }
+        percent = 100;
+        state = ok ? DONE_OK : DONE_FAILED;
+    }
+
+public:
+    ~ImageExporter() {
+        if (worker.joinable()) worker.join();
+        std::free(pixels);
+    }
+
+    // Copy w x h pixels (row stride in pixels) and encode them to 'file' on
+    // the worker. False if an export is still running or memory is short.
+    bool start(const TCHAR* file, Format f, const uint32_t* px, int w, int h, int stride) {
+        if (state != IDLE || w <= 0 || h <= 0) return false;
+        if (worker.joinable()) worker.join();
+
+        pixels = (uint32_t*)std::malloc(size_t(w) * h * sizeof(uint32_t));
+        if (!pixels) return false;
+        for (int y = 0; y < h; ++y)
+            std::memcpy(pixels + size_t(y) * w, px + size_t(y) * stride, size_t(w) * sizeof(uint32_t));
+
+        _tcscpy_s(path, MAX_PATH, file);
+        format = f;
+        width = w;
+        height = h;
+        percent = 0;
+        state = RUNNING;
+        worker = std::thread(&ImageExporter::run, this);
+        return true;
+    }
+
+    // An export is running or its result hasn't been collected yet
+    bool busy() const { return state != IDLE; }
+    int  progress() const { return percent; }
+
+    // Collect a finished export: returns true once per export, with *ok set
+    bool poll(bool* ok) {
+        int s = state;
+        if (s != DONE_OK && s != DONE_FAILED) return false;
+        worker.join();
+        *ok = (s == DONE_OK);
+        state = IDLE;
+        return true;
+    }
+};
@@ -0,0 +1,122 @@
+#pragma once
+#include <graphics.h>
+#include <windows.h>
+#include <chrono>
+#include "InputQueue.h"
+
+// Input capture for the main loop. EasyX is not thread-safe, so its message
+// queue is only read on the UI thread: pump() takes every waiting mouse/key
+// message, timestamps it and pushes it into an SPSC ring that drainInput()
+// empties. The window procedure hook (main.cpp) calls notify() after EasyX
+// has queued an input message, which is what wakes wait(). Windows coalesces
+// WM_MOUSEMOVE, so for moves pump() also recovers the in-between samples
+// from the system mouse history (GetMouseMovePointsEx) and queues them
+// first, oldest to newest.
+class InputCapture {
+private:
+    InputRing ring;
+    HANDLE    wake = NULL;        // auto-reset; set after every push
+    HWND      hwnd = NULL;
+
+    MOUSEMOVEPOINT lastMove = {}; // newest history sample already queued
+    bool           haveLastMove = false;
+    int64_t        lastMoveUs = 0;
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static InputEvent fromMessage(const ExMessage& m, int64_t t) {
+        InputEvent e = {};
+        e.timeUs = t;
+        e.message = m.message;
+        if (m.message == WM_KEYDOWN || m.message == WM_KEYUP) {
+            e.vkcode = m.vkcode;
+            e.prevdown = m.prevdown;
+            e.ctrl = (GetAsyncKeyState(VK_CONTROL) & 0x8000) != 0;   // ExMessage has no modifiers for keys
+        }
+        else {
+            e.x = m.x;
+            e.y = m.y;
+            e.lbutton = m.lbutton;
+        }
+        return e;
+    }
+
+    // Queue the samples the system saw between the previous move and this one.
+    // Their times are spread evenly between the two captured moves.
+    void pushCoalesced(const ExMessage& m, int64_t t) {
+        POINT cur = { m.x, m.y };
+        ClientToScreen(hwnd, &cur);
+
+        MOUSEMOVEPOINT q = {};
+        q.x = cur.x & 0xFFFF;
+        q.y = cur.y & 0xFFFF;
+        MOUSEMOVEPOINT hist[64];   // newest first; hist[0] matches q
+        int n = GetMouseMovePointsEx(sizeof(q), &q, hist, 64, GMMP_USE_DISPLAY_POINTS);
+        if (n <= 0) { haveLastMove = false; return; }
+
+        int k = 1;   // hist[1, k) are new
+        if (haveLastMove) {
+            while (k < n && !(hist[k].x == lastMove.x && hist[k].y == lastMove.y && hist[k].time == lastMove.time))
+                ++k;
+        }
+        for (int i = k - 1; i >= 1; --i) {
+            POINT p = { hist[i].x > 32767 ? hist[i].x - 65536 : hist[i].x,
+                        hist[i].y > 32767 ? hist[i].y - 65536 : hist[i].y };
+            ScreenToClient(hwnd, &p);
+            InputEvent e = {};
+            e.timeUs = lastMoveUs + (t - lastMoveUs) * (k - i) / k;
+            e.message = WM_MOUSEMOVE;
+            e.x = short(p.x);
+            e.y = short(p.y);
+            e.lbutton = m.lbutton;
+            ring.push(e);
+        }
+        lastMove = hist[0];
+        haveLastMove = true;
+        lastMoveUs = t;
+    }
+
+public:
+    ~InputCapture() { stop(); }
+
+    // Start capturing for the EasyX window
+    bool start() {
+        hwnd = GetHWnd();
+        wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+        return wake != NULL;
+    }
+
+    // Once nothing can call notify() any more (the hook is gone and the
+    // window closed)
+    void stop() {
+        if (wake) CloseHandle(wake);
+        wake = NULL;
+    }
+
+    // UI thread: move every message EasyX has queued into the ring
+    void pump() {
+        ExMessage m;
+        while (peekmessage(&m, EM_MOUSE | EM_KEY)) {
+            int64_t t = nowUs();
+            if (m.message == WM_MOUSEMOVE) pushCoalesced(m, t);
+            ring.push(fromMessage(m, t));
+        }
+    }
+
+    // Block until at most 'ms' milliseconds pass or new events arrive
+    void wait(DWORD ms = INFINITE) { WaitForSingleObject(wake, ms); }
+
+    // Wake a wait(): new input was queued, or a quit request. Safe from the
+    // window's thread.
+    void notify() { if (wake) SetEvent(wake); }
+
+    bool pop(InputEvent& e) { return ring.pop(e); }
+
+    // Metrics
+    uint32_t depth() const        { return ring.depth(); }
+    uint32_t peakDepth() const    { return ring.peakDepth(); }
+    uint32_t droppedCount() const { return ring.droppedCount(); }
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// One captured pointer/key event
+struct InputEvent {
+    int64_t  timeUs;     // capture time, steady clock (microseconds)
+    uint32_t message;    // WM_MOUSEMOVE, WM_LBUTTONDOWN, ..., WM_KEYDOWN
+    short    x, y;       // client coordinates (mouse messages)
+    uint8_t  vkcode;     // virtual key (key messages)
+    bool     lbutton;    // left button held (mouse messages)
+    bool     prevdown;   // key was already down, i.e. auto-repeat (key messages)
+    bool     ctrl;       // Ctrl held (key messages)
+};
+
+// Single-producer / single-consumer lock-free ring of InputEvents.
+// The producer (InputCapture::pump) only writes 'head', the consumer
+// (drainInput) only writes 'tail'; each side reads the other's index with
+// acquire so the slot contents are visible before the index that publishes
+// them, wherever the two run.
+class InputRing {
+private:
+    static const uint32_t CAPACITY = 4096;          // power of two
+    static const uint32_t MASK = CAPACITY - 1;
+
+    InputEvent slots[CAPACITY];
+    alignas(64) std::atomic<uint32_t> head{ 0 };    // next slot to write
+    alignas(64) std::atomic<uint32_t> tail{ 0 };    // next slot to read
+
+    // Metrics (written by the producer)
+    std::atomic<uint32_t> peak{ 0 };
+    std::atomic<uint32_t> dropped{ 0 };
+
+public:
+    // Producer side. Returns false (and counts a drop) if the ring is full.
+    bool push(const InputEvent& e) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        if (h - t == CAPACITY) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[h & MASK] = e;
+        head.store(h + 1, std::memory_order_release);
+        if (h + 1 - t > peak.load(std::memory_order_relaxed))
+            peak.store(h + 1 - t, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(InputEvent& e) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        if (t == h) return false;
+        e = slots[t & MASK];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Events waiting right now (either side; a snapshot)
+    uint32_t depth() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    uint32_t peakDepth() const    { return peak.load(std::memory_order_relaxed); }
+    uint32_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,810 @@
+#pragma once
+#include <windows.h>
+#include <tchar.h>
+#include <io.h>         // _commit
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>      // realloc, free
+#include <cstring>
+#include <mutex>
+#include <new>          // nothrow
+#include <thread>
+#include <vector>
+#include "Crc32.h"
+#include "DocumentIO.h"
+
+// Autosave journal. Every committed edit is appended as a small record, so a
+// crash loses at most the last flush interval instead of everything since
+// the last manual save.
+//
+//   base.dpad  snapshot: a .dpad document whose DocHeader::journalGen is G
+//   base.dpj   journal of generation g: JournalFileHeader, then batches
+//   base.tmp   the next snapshot while it is being written
+//
+// Recovery loads the snapshot and replays the journal on top if g >= G.
+//
+// The UI thread only copies a record into a preallocated chunk under a
+// short lock, at most INLINE_BYTES of it; anything larger (a background
+// layer, a big paste) is copied into its own block beforehand and queued by
+// pointer, and new chunks are allocated with the lock released. A writer
+// thread takes the filled chunks every FLUSH_MS (sooner once they hold
+// FLUSH_BYTES), writes them as one batch with a CRC and syncs it; a torn batch at the end of the journal fails its CRC and is
+// ignored. Once the journal passes COMPACT_BYTES the writer replays
+// snapshot + journal into its own tools, writes that as the snapshot of the
+// next generation and starts an empty journal, all off the UI thread.
+
+enum JournalOp : uint32_t {
+    J_ADD = 1,      // tool = DocSectionId (DOC_LINE..DOC_OVAL); records in ascending z, merged into place
+    J_STROKE,       // FreehandTool::Record, then its vertices; merged into place by z
+    J_CAPSULES,     // EraserTool::Record[] in ascending z, merged into place
+    J_ERASE,        // tool = DocSectionId (DOC_FHST..DOC_ERAS); ascending z values (int)
+    J_CLEAR,        // every tool emptied, background dropped
+    J_BACKGROUND,   // int32 w, h, then w * h pixels (w = 0: no background)
+    J_SWAP,         // tool = slot: exchange the scene with the one held there (an empty one if new)
+    J_DROP,         // tool = slot (0: every slot): forget a held scene
+    J_BASE,         // FILE* of a .dpad just loaded, open for reading; copied into the snapshot (writer only)
+    J_BLOCK,        // JournalBlock: payload of a record of op 'tool', written in its place (writer only)
+    J_BGRECT        // int32 layer w, h, rect x, y, w, h, then the rect's pixels; a white layer
+                    // of that size is made first if there is none
+};
+
+struct JournalRecord {
+    uint32_t op;
+    uint32_t tool;
+    uint32_t bytes;      // payload size; the next record starts 4-byte aligned
+    int32_t  zCounter;   // gZCounter when appended
+};
+
+struct JournalBatch {
+    uint32_t magic;      // JOURNAL_BATCH_MAGIC
+    uint32_t bytes;      // records that follow
+    uint32_t crc;        // CRC-32 of those bytes
+    uint32_t reserved;
+};
+
+struct JournalFileHeader {
+    char     magic[4];   // "DPJ1"
+    uint32_t gen;
+};
+
+// Data handed to the writer by pointer instead of being copied under the
+// lock. The writer frees it.
+struct JournalBlock {
+    uint8_t* data;
+    size_t   bytes;
+    uint32_t tool;   // of the record it stands for
+};
+
+// Scenes J_SWAP put aside during a replay, by slot. Undo history entries
+// that swap whole scenes own the slots; see UndoHistory.
+struct JournalSlot {
+    uint32_t       id;
+    DocSavedScene* scene;
+};
+typedef std::vector<JournalSlot> JournalSlots;
+
+static const uint32_t JOURNAL_BATCH_MAGIC = 0x4854414A;   // "JATH"
+static const uint32_t JOURNAL_MAX_BATCH = 1u << 30;
+
+class Journal {
+public:
+    static const int      FLUSH_MS = 250;
+    static const size_t   FLUSH_BYTES = size_t(1) << 20;
+    static const size_t   CHUNK_BYTES = size_t(1) << 20;    // pending records are kept in chunks this big
+    static const size_t   INLINE_BYTES = size_t(64) << 10;  // larger records go by JournalBlock
+    static const size_t   SPARE_CHUNKS = 2;                 // kept for reuse once written
+    static const uint64_t COMPACT_BYTES = uint64_t(64) << 20;
+
+private:
+    TCHAR base[MAX_PATH] = {};
+
+    // Pending records: the UI thread fills chunks, the writer takes them
+    // and hands them back empty
+    struct Chunk { uint8_t* p; size_t used; };
+    std::mutex              m;
+    std::condition_variable wake;
+    std::vector<Chunk>      pending;            // the last one is being filled
+    std::vector<uint8_t*>   spare;              // empty chunks
+    size_t                  used = 0;           // bytes in 'pending'
+    bool                    quitting = false;
+    int                     basesPending = 0;   // J_BASE records the writer hasn't copied yet
+    std::condition_variable baseDone;
+    std::thread             writer;
+    std::atomic<bool>       broken{ false };   // a write failed: autosave is off for this session
+
+    // Writer thread only
+    FILE*    file = nullptr;
+    uint32_t gen = 0;
+    uint64_t fileBytes = 0;
+    std::vector<Chunk> taken;   // chunks being written
+    uint8_t* batch = nullptr;   // scratch for the records a fold writes
+    size_t   batchCap = 0;
+
+    // Pieces of the next batch: runs of the swapped-out buffer and J_BLOCK
+    // payloads, which are freed once written
+    struct Piece { const uint8_t* p; size_t n; };
+    std::vector<Piece>    pieces;
+    std::vector<uint8_t*> blocks;
+    size_t                piecesBytes = 0;
+
+    static size_t align4(size_t n) { return (n + 3) & ~size_t(3); }
+
+    static void pathFor(TCHAR* out, const TCHAR* base, const TCHAR* ext) {
+        _tcscpy_s(out, MAX_PATH, base);
+        _tcscat_s(out, MAX_PATH, ext);
+    }
+
+    static bool sync(FILE* f) {
+        return std::fflush(f) == 0 && _commit(_fileno(f)) == 0;
+    }
+
+    // Add one record (payload a then b) to a growable buffer
+    static bool encode(uint8_t*& buf, size_t& used, size_t& cap, uint32_t op, uint32_t tool, int32_t z,
+                       const void* a, size_t an, const void* b = nullptr, size_t bn = 0) {
+        size_t bytes = an + bn, total = sizeof(JournalRecord) + align4(bytes);
+        JournalRecord r = { op, tool, uint32_t(bytes), z };
+        if (used + total > cap) {
+            size_t newCap = cap ? cap * 2 : 64 * 1024;
+            while (newCap < used + total) newCap *= 2;
+            void* nb = std::realloc(buf, newCap);
+            if (!nb) return false;
+            buf = (uint8_t*)nb;
+            cap = newCap;
+        }
+        uint8_t* p = buf + used;
+        std::memcpy(p, &r, sizeof(r));
+        if (an) std::memcpy(p + sizeof(r), a, an);
+        if (bn) std::memcpy(p + sizeof(r) + an, b, bn);
+        std::memset(p + sizeof(r) + bytes, 0, align4(bytes) - bytes);
+        used += total;
+        return true;
+    }
+
+    bool append(uint32_t op, uint32_t tool, const void* a, size_t an, const void* b = nullptr, size_t bn = 0) {
+        if (!writer.joinable() || broken) return false;
+        size_t total = sizeof(JournalRecord) + align4(an + bn);
+        if (total > INLINE_BYTES) return appendBlock(op, tool, a, an, b, bn);
+
+        std::unique_lock<std::mutex> lk(m);
+        while (pending.empty() || pending.back().used + total > CHUNK_BYTES) {
+            if (spare.empty()) {   // the writer is behind: one more chunk, allocated unlocked
+                lk.unlock();
+                uint8_t* c = (uint8_t*)std::malloc(CHUNK_BYTES);
+                lk.lock();
+                if (!c) {
+                    broken = true;   // out of memory: later edits would replay without this one
+                    return false;
+                }
+                spare.push_back(c);
+            }
+            pending.push_back({ spare.back(), 0 });
+            spare.pop_back();
+        }
+        Chunk& c = pending.back();
+        size_t chunkCap = CHUNK_BYTES, before = used;
+        encode(c.p, c.used, chunkCap, op, tool, gZCounter, a, an, b, bn);   // fits: never grows
+        used += total;
+        if (op == J_BASE) ++basesPending;
+        if (op == J_BASE || (used >= FLUSH_BYTES && before < FLUSH_BYTES)) wake.notify_one();
+        return true;
+    }
+
+    // A record too big to copy under the lock: its payload goes into a
+    // block first and only the block's pointer is queued
+    bool appendBlock(uint32_t op, uint32_t tool, const void* a, size_t an, const void* b, size_t bn) {
+        JournalBlock blk = { (uint8_t*)std::malloc(an + bn), an + bn, tool };
+        if (!blk.data) { broken = true; return false; }
+        if (an) std::memcpy(blk.data, a, an);
+        if (bn) std::memcpy(blk.data + an, b, bn);
+        if (append(J_BLOCK, op, &blk, sizeof(blk))) return true;
+        std::free(blk.data);
+        return false;
+    }
+
+    // ---- Replay ----
+
+    // Records are 4-byte aligned in the batch buffer, as every Record is
+    template <class T>
+    static void addRecords(T* tool, const JournalRecord& r, const uint8_t* p) {
+        typedef typename T::Record R;
+        if (r.bytes == 0 || r.bytes % sizeof(R) != 0) return;
+        const R* rec = (const R*)p;
+        size_t n = r.bytes / sizeof(R);
+        for (size_t i = 0; i < n; ++i)
+            if (!docRecordOk(rec[i])) return;   // same limits as a loaded document
+        tool->insertRecords(rec, n);
+    }
+
+    static void freeSlots(JournalSlots& slots, uint32_t id) {
+        for (size_t i = slots.size(); i-- > 0;) {
+            if (id != 0 && slots[i].id != id) continue;
+            delete slots[i].scene;
+            slots.erase(slots.begin() + i);
+        }
+    }
+
+    static void swapSlot(JournalSlots& slots, uint32_t id, DocScene& s) {
+        DocSavedScene* sc = nullptr;
+        for (const JournalSlot& k : slots)
+            if (k.id == id) sc = k.scene;
+        if (!sc) {
+            sc = new (std::nothrow) DocSavedScene;
+            if (!sc) return;
+            slots.push_back({ id, sc });
+        }
+        docSwapScene(*sc, s);
+    }
+
+    static void apply(const JournalRecord& r, const uint8_t* p, DocScene& s, JournalSlots& slots) {
+        switch (r.op) {
+        case J_ADD:
+            switch (r.tool) {
+            case DOC_LINE: addRecords(s.line, r, p);     break;
+            case DOC_TRI:  addRecords(s.triangle, r, p); break;
+            case DOC_SQR:  addRecords(s.square, r, p);   break;
+            case DOC_CIRC: addRecords(s.circle, r, p);   break;
+            case DOC_OVAL: addRecords(s.oval, r, p);     break;
+            }
+            break;
+        case J_STROKE: {
+            FreehandTool::Record st;
+            if (r.bytes < sizeof(st)) break;
+            std::memcpy(&st, p, sizeof(st));
+            if (st.count < 2 || r.bytes != sizeof(st) + uint64_t(st.count) * sizeof(POINT)) break;
+            const POINT* pts = (const POINT*)(p + sizeof(st));
+            if (!docRecordOk(st) || !docPointsOk(pts, size_t(st.count))) break;
+            s.freehand->insertStrokes(&st, 1, pts);
+            break;
+        }
+        case J_CAPSULES:
+            addRecords(s.eraser, r, p);
+            break;
+        case J_ERASE: {
+            const int* zs = (const int*)p;
+            size_t n = r.bytes / sizeof(int);
+            switch (r.tool) {
+            case DOC_FHST: s.freehand->eraseZs(zs, n); break;
+            case DOC_ERAS: s.eraser->eraseZs(zs, n);   break;
+            case DOC_LINE: s.line->eraseZs(zs, n);     break;
+            case DOC_TRI:  s.triangle->eraseZs(zs, n); break;
+            case DOC_SQR:  s.square->eraseZs(zs, n);   break;
+            case DOC_CIRC: s.circle->eraseZs(zs, n);   break;
+            case DOC_OVAL: s.oval->eraseZs(zs, n);     break;
+            }
+            break;
+        }
+        case J_CLEAR:
+            docClearTools(s);
+            s.background = nullptr;
+            s.bgWidth = s.bgHeight = 0;
+            break;
+        case J_BACKGROUND: {
+            int32_t wh[2];
+            if (r.bytes < sizeof(wh)) break;
+            std::memcpy(wh, p, sizeof(wh));
+            s.background = nullptr;
+            s.bgWidth = s.bgHeight = 0;
+            if (wh[0] <= 0 || wh[1] <= 0 || wh[0] > DOC_MAX_BACKGROUND || wh[1] > DOC_MAX_BACKGROUND) break;
+            if (r.bytes != sizeof(wh) + uint64_t(wh[0]) * wh[1] * sizeof(uint32_t)) break;
+            uint32_t* px = s.allocBackground ? s.allocBackground(wh[0], wh[1]) : nullptr;
+            if (!px) break;
+            std::memcpy(px, p + sizeof(wh), size_t(wh[0]) * wh[1] * sizeof(uint32_t));
+            s.background = px;
+            s.bgWidth = wh[0];
+            s.bgHeight = wh[1];
+            break;
+        }
+        case J_BGRECT: {
+            int32_t v[6];   // layer w, h, rect x, y, w, h
+            if (r.bytes < sizeof(v)) break;
+            std::memcpy(v, p, sizeof(v));
+            if (v[0] <= 0 || v[1] <= 0 || v[0] > DOC_MAX_BACKGROUND || v[1] > DOC_MAX_BACKGROUND) break;
+            if (v[2] < 0 || v[3] < 0 || v[4] <= 0 || v[5] <= 0 || v[4] > v[0] - v[2] || v[5] > v[1] - v[3]) break;
+            if (r.bytes != sizeof(v) + uint64_t(v[4]) * v[5] * sizeof(uint32_t)) break;
+            if (!s.background || s.bgWidth != v[0] || s.bgHeight != v[1]) {
+                uint32_t* px = s.allocBackground ? s.allocBackground(v[0], v[1]) : nullptr;
+                if (!px) break;
+                for (size_t i = 0, n = size_t(v[0]) * v[1]; i < n; ++i) px[i] = 0xFFFFFF;
+                s.background = px;
+                s.bgWidth = v[0];
+                s.bgHeight = v[1];
+            }
+            uint32_t* layer = const_cast<uint32_t*>(s.background);   // from allocBackground
+            for (int y = 0; y < v[5]; ++y)
+                std::memcpy(layer + size_t(v[3] + y) * v[0] + v[2],
+                    p + sizeof(v) + size_t(y) * v[4] * sizeof(uint32_t), size_t(v[4]) * sizeof(uint32_t));
+            break;
+        }
+        case J_SWAP:
+            swapSlot(slots, r.tool, s);
+            break;
+        case J_DROP:
+            freeSlots(slots, r.tool);
+            break;
+        }
+        if (r.zCounter > s.zCounter) s.zCounter = r.zCounter;
+    }
+
+    // Applies every intact batch; stops at the first torn or damaged one
+    static void replay(FILE* f, DocScene& s, JournalSlots& slots) {
+        uint8_t* buf = nullptr;
+        size_t   bufCap = 0;
+        JournalBatch b;
+        while (std::fread(&b, sizeof(b), 1, f) == 1 && b.magic == JOURNAL_BATCH_MAGIC) {
+            if (b.bytes > JOURNAL_MAX_BATCH) break;
+            if (b.bytes > bufCap) {
+                void* nb = std::realloc(buf, b.bytes);
+                if (!nb) break;
+                buf = (uint8_t*)nb;
+                bufCap = b.bytes;
+            }
+            if (std::fread(buf, 1, b.bytes, f) != b.bytes || crc32Update(0, buf, b.bytes) != b.crc) break;
+
+            for (size_t at = 0; at + sizeof(JournalRecord) <= b.bytes;) {
+                JournalRecord r;
+                std::memcpy(&r, buf + at, sizeof(r));
+                if (r.bytes > b.bytes - at - sizeof(r)) break;
+                apply(r, buf + at + sizeof(r), s, slots);
+                at += sizeof(r) + align4(r.bytes);
+            }
+        }
+        std::free(buf);
+    }
+
+    // ---- Writer thread ----
+
+    static std::vector<uint32_t>& foldPixels() {
+        static std::vector<uint32_t> px;   // writer thread only
+        return px;
+    }
+    static uint32_t* foldBackground(int w, int h) {
+        foldPixels().assign(size_t(w) * h, 0);
+        return foldPixels().data();
+    }
+
+    void openJournal() {
+        TCHAR path[MAX_PATH];
+        pathFor(path, base, _T(".dpj"));
+        fileBytes = 0;
+        if (_tfopen_s(&file, path, _T("wb")) != 0 || !file) { file = nullptr; fail(); return; }
+        JournalFileHeader h = { { 'D', 'P', 'J', '1' }, gen };
+        if (std::fwrite(&h, sizeof(h), 1, file) != 1 || !sync(file)) { fail(); return; }
+        fileBytes = sizeof(h);
+    }
+
+    void closeJournal() {
+        if (file) std::fclose(file);
+        file = nullptr;
+    }
+
+    // The journal can no longer be trusted to hold every edit: stop
+    // writing it and let the UI tell the user (failed())
+    void fail() {
+        closeJournal();
+        broken = true;
+    }
+
+    // Make base.tmp the snapshot of generation g and start an empty journal
+    // for it. The old journal (generation < g) is stale once the rename lands.
+    // False if it didn't: the old generation is still current.
+    bool installSnapshot(uint32_t g) {
+        TCHAR tmp[MAX_PATH], snap[MAX_PATH], jrn[MAX_PATH];
+        pathFor(tmp, base, _T(".tmp"));
+        pathFor(snap, base, _T(".dpad"));
+        pathFor(jrn, base, _T(".dpj"));
+        if (!MoveFileEx(tmp, snap, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            DeleteFile(tmp);
+            if (!file) reopenForAppend();   // keep journaling the old generation
+            return false;
+        }
+        closeJournal();
+        DeleteFile(jrn);
+        gen = g;
+        openJournal();
+        return true;
+    }
+
+    // The scenes a replay holds in slots, as records that rebuild them on
+    // top of any scene: [J_SWAP k] its records [J_SWAP k] for each slot
+    static bool encodeSlots(const JournalSlots& slots, int32_t z, uint8_t*& buf, size_t& used, size_t& cap) {
+        bool ok = true;
+        for (const JournalSlot& k : slots) {
+            const DocSavedScene& sc = *k.scene;
+            ok = ok && encode(buf, used, cap, J_SWAP, k.id, z, nullptr, 0);
+            if (sc.background) {
+                int32_t wh[2] = { sc.bgWidth, sc.bgHeight };
+                ok = ok && encode(buf, used, cap, J_BACKGROUND, 0, z, wh, sizeof(wh),
+                                  sc.background, size_t(sc.bgWidth) * sc.bgHeight * sizeof(uint32_t));
+            }
+            auto add = [&](int tool, const void* r, size_t bytes) {
+                ok = ok && (bytes == 0 || encode(buf, used, cap, J_ADD, uint32_t(tool), z, r, bytes));
+            };
+            add(DOC_LINE, sc.line.records(), sc.line.getCount() * sizeof(LineTool::Record));
+            add(DOC_TRI, sc.triangle.records(), sc.triangle.getCount() * sizeof(TriangleTool::Record));
+            add(DOC_SQR, sc.square.records(), sc.square.getCount() * sizeof(SquareTool::Record));
+            add(DOC_CIRC, sc.circle.records(), sc.circle.getCount() * sizeof(CircleTool::Record));
+            add(DOC_OVAL, sc.oval.records(), sc.oval.getCount() * sizeof(OvalTool::Record));
+            if (sc.eraser.getCount())
+                ok = ok && encode(buf, used, cap, J_CAPSULES, 0, z, sc.eraser.records(),
+                                  sc.eraser.getCount() * sizeof(EraserTool::Record));
+            for (size_t i = 0, n = sc.freehand.getCount(); i < n; ++i) {
+                const FreehandTool::Record& st = sc.freehand.records()[i];
+                ok = ok && encode(buf, used, cap, J_STROKE, 0, z, &st, sizeof(st),
+                                  sc.freehand.pointPool() + st.first, size_t(st.count) * sizeof(POINT));
+            }
+            ok = ok && encode(buf, used, cap, J_SWAP, k.id, z, nullptr, 0);
+        }
+        return ok;
+    }
+
+    // Fold snapshot + journal into the snapshot of the next generation.
+    // Records appended meanwhile wait in memory. Scenes the undo history
+    // holds (slots) aren't part of a snapshot: they are journaled again
+    // after it, or, from an earlier session (keepSlots false), dropped.
+    void fold(bool keepSlots) {
+        closeJournal();
+        FreehandTool fh; LineTool ln; TriangleTool tr; SquareTool sq; CircleTool ci; OvalTool ov; EraserTool er;
+        DocScene s = {};
+        s.freehand = &fh;
+        s.line = &ln;
+        s.triangle = &tr;
+        s.square = &sq;
+        s.circle = &ci;
+        s.oval = &ov;
+        s.eraser = &er;
+        s.allocBackground = foldBackground;
+        JournalSlots slots;
+        uint32_t g = 0;
+        bool found = recover(base, s, &g, &slots);
+        g = ((g > gen) ? g : gen) + 1;
+        if (!found) {   // nothing on disk yet
+            gen = g;
+            openJournal();
+            return;
+        }
+
+        TCHAR tmp[MAX_PATH];
+        pathFor(tmp, base, _T(".tmp"));
+        FILE* f = nullptr;
+        bool ok = _tfopen_s(&f, tmp, _T("wb")) == 0 && f;
+        if (ok) {
+            s.journalGen = g;
+            s.background = s.bgWidth > 0 ? foldPixels().data() : nullptr;
+            ok = saveDocument(f, s) && sync(f);
+            ok = (std::fclose(f) == 0) && ok;
+        }
+        std::vector<uint32_t>().swap(foldPixels());
+        bool fresh = ok && installSnapshot(g);
+        if (!ok) {
+            DeleteFile(tmp);
+            reopenForAppend();
+        }
+
+        // The old journal still holds its slots; a fresh one holds none
+        size_t n = 0;
+        if (fresh && keepSlots) ok = encodeSlots(slots, s.zCounter, batch, n, batchCap);
+        else if (!fresh && !keepSlots) ok = encode(batch, n, batchCap, J_DROP, 0, s.zCounter, nullptr, 0);
+        if (!ok) fail();
+        addPiece(batch, n);
+        writeBatch();
+        freeSlots(slots, 0);
+    }
+
+    // A document was loaded: a copy of it becomes the snapshot of the next
+    // generation. Without it later records would replay onto the old one.
+    void adoptDocument(FILE* doc) {
+        uint32_t g = gen + 1;
+        TCHAR tmp[MAX_PATH];
+        pathFor(tmp, base, _T(".tmp"));
+        DocHeader h;
+        FILE* out = nullptr;
+        bool ok = std::fread(&h, sizeof(h), 1, doc) == 1;
+        if (ok) {
+            h.journalGen = g;
+            ok = docCheckHeader(h) && _tfopen_s(&out, tmp, _T("wb")) == 0 && out;
+        }
+        if (ok) {
+            ok = std::fwrite(&h, sizeof(h), 1, out) == 1;
+            const size_t CHUNK = size_t(1) << 20;
+            uint8_t* buf = (uint8_t*)std::malloc(CHUNK);
+            ok = ok && buf;
+            for (size_t got; ok && (got = std::fread(buf, 1, CHUNK, doc)) > 0;)
+                ok = std::fwrite(buf, 1, got, out) == got;
+            ok = ok && !std::ferror(doc);
+            std::free(buf);
+            ok = sync(out) && ok;
+        }
+        if (out) ok = (std::fclose(out) == 0) && ok;
+        if (!ok) DeleteFile(tmp);
+        if (!ok || !installSnapshot(g)) fail();
+    }
+
+    // After a failed fold: keep adding batches to the existing journal
+    void reopenForAppend() {
+        TCHAR path[MAX_PATH];
+        pathFor(path, base, _T(".dpj"));
+        if (_tfopen_s(&file, path, _T("ab")) != 0 || !file) { file = nullptr; openJournal(); return; }
+        std::fseek(file, 0, SEEK_END);
+        fileBytes = uint64_t(std::ftell(file));
+    }
+
+    void addPiece(const uint8_t* p, size_t n) {
+        if (n == 0) return;
+        pieces.push_back({ p, n });
+        piecesBytes += n;
+    }
+
+    // Write the collected pieces as one batch
+    void writeBatch() {
+        size_t n = piecesBytes;
+        if (n && !broken && !file) openJournal();
+        if (n && !broken && file) {
+            uint32_t crc = 0;
+            for (const Piece& pc : pieces) crc = crc32Update(crc, pc.p, pc.n);
+            JournalBatch b = { JOURNAL_BATCH_MAGIC, uint32_t(n), crc, 0 };
+            bool ok = n <= JOURNAL_MAX_BATCH && std::fwrite(&b, sizeof(b), 1, file) == 1;
+            for (size_t i = 0; ok && i < pieces.size(); ++i)
+                ok = std::fwrite(pieces[i].p, 1, pieces[i].n, file) == pieces[i].n;
+            if (ok && sync(file)) fileBytes += sizeof(b) + n;
+            else fail();   // a torn batch fails its CRC on replay; nothing after it would be read
+        }
+        for (uint8_t* blk : blocks) std::free(blk);
+        blocks.clear();
+        pieces.clear();
+        piecesBytes = 0;
+    }
+
+    // Add records to the batch, splicing J_BLOCK payloads in place of their
+    // record and handing J_BASE files to adoptDocument(). The caller writes
+    // what is left with writeBatch() before 'p' is reused.
+    void writeRecords(uint8_t* p, size_t n) {
+        static const uint8_t zeros[4] = {};
+        size_t runStart = 0, at = 0;
+        if (piecesBytes + n > JOURNAL_MAX_BATCH) writeBatch();
+        while (at < n) {
+            JournalRecord r;
+            std::memcpy(&r, p + at, sizeof(r));
+            size_t next = at + sizeof(r) + align4(r.bytes);
+            if (r.op == J_BASE) {
+                FILE* doc;
+                std::memcpy(&doc, p + at + sizeof(r), sizeof(doc));
+                addPiece(p + runStart, at - runStart);
+                writeBatch();
+                if (!broken) adoptDocument(doc);
+                std::fclose(doc);
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    --basesPending;
+                }
+                baseDone.notify_all();
+                runStart = next;
+            }
+            else if (r.op == J_BLOCK) {
+                JournalBlock blk;
+                std::memcpy(&blk, p + at + sizeof(r), sizeof(blk));
+                if (piecesBytes + (at - runStart) + sizeof(r) + align4(blk.bytes) > JOURNAL_MAX_BATCH) {
+                    addPiece(p + runStart, at - runStart);
+                    writeBatch();
+                    runStart = at;
+                }
+                JournalRecord h = { r.tool, blk.tool, uint32_t(blk.bytes), r.zCounter };   // the real header, in place
+                std::memcpy(p + at, &h, sizeof(h));
+                addPiece(p + runStart, at - runStart + sizeof(h));
+                addPiece(blk.data, blk.bytes);
+                addPiece(zeros, align4(blk.bytes) - blk.bytes);
+                blocks.push_back(blk.data);
+                runStart = next;
+            }
+            at = next;
+        }
+        addPiece(p + runStart, n - runStart);
+    }
+
+    // Written chunks go back to the UI thread, beyond SPARE_CHUNKS freed
+    void returnChunks() {
+        size_t keep = 0;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            while (keep < taken.size() && spare.size() < SPARE_CHUNKS) spare.push_back(taken[keep++].p);
+        }
+        for (size_t i = keep; i < taken.size(); ++i) std::free(taken[i].p);
+        taken.clear();
+    }
+
+    void run() {
+        fold(false);   // this session starts a new generation on top of whatever is on disk
+        for (;;) {
+            bool quit;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                wake.wait_for(lk, std::chrono::milliseconds(int(FLUSH_MS)),
+                              [&] { return quitting || used >= FLUSH_BYTES || basesPending > 0; });
+                taken.swap(pending);
+                used = 0;
+                quit = quitting;
+            }
+            for (const Chunk& c : taken) writeRecords(c.p, c.used);
+            writeBatch();
+            returnChunks();
+            if (fileBytes > COMPACT_BYTES && !broken) fold(true);
+            if (quit) break;
+        }
+        closeJournal();
+    }
+
+public:
+    ~Journal() {
+        stop();
+        for (const Chunk& c : pending) std::free(c.p);
+        for (uint8_t* c : spare) std::free(c);
+        std::free(batch);
+    }
+
+    // Is there anything from an earlier session?
+    static bool exists(const TCHAR* base) {
+        TCHAR path[MAX_PATH];
+        pathFor(path, base, _T(".dpad"));
+        if (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES) return true;
+        pathFor(path, base, _T(".dpj"));
+        return GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
+    }
+
+    static void discard(const TCHAR* base) {
+        const TCHAR* exts[] = { _T(".dpad"), _T(".dpj"), _T(".tmp") };
+        TCHAR path[MAX_PATH];
+        for (const TCHAR* e : exts) {
+            pathFor(path, base, e);
+            DeleteFile(path);
+        }
+    }
+
+    // Rebuild the scene an earlier session left behind (snapshot + journal)
+    // into s; s.zCounter and the background are set as for loadDocument().
+    // *g receives the newest generation seen. Scenes the journal put aside
+    // for undo go to *slots (freed if nullptr). Returns false if there was
+    // nothing to recover.
+    static bool recover(const TCHAR* base, DocScene& s, uint32_t* g, JournalSlots* slots = nullptr) {
+        JournalSlots own;
+        if (!slots) slots = &own;
+        TCHAR path[MAX_PATH];
+        FILE* f = nullptr;
+        bool found = false;
+        uint32_t snapGen = 0;
+        *g = 0;
+        docClearTools(s);
+        s.zCounter = 0;
+        s.bgWidth = s.bgHeight = 0;
+
+        pathFor(path, base, _T(".dpad"));
+        if (_tfopen_s(&f, path, _T("rb")) == 0 && f) {
+            found = true;
+            if (loadDocument(f, s)) snapGen = s.journalGen;
+            std::fclose(f);
+        }
+
+        pathFor(path, base, _T(".dpj"));
+        if (_tfopen_s(&f, path, _T("rb")) == 0 && f) {
+            found = true;
+            JournalFileHeader h;
+            if (std::fread(&h, sizeof(h), 1, f) == 1 && std::memcmp(h.magic, "DPJ1", 4) == 0) {
+                if (h.gen >= snapGen) replay(f, s, *slots);   // older ones are already in the snapshot
+                *g = h.gen;
+            }
+            std::fclose(f);
+        }
+        if (snapGen > *g) *g = snapGen;
+        freeSlots(own, 0);
+        return found;
+    }
+
+    // Start journaling to base.dpj (base.dpad and base.tmp alongside).
+    // Whatever an earlier session left there is folded into the first
+    // snapshot, so call discard() first to start from nothing.
+    bool start(const TCHAR* path) {
+        if (writer.joinable()) return true;
+        _tcscpy_s(base, MAX_PATH, path);
+        pending.reserve(64);
+        taken.reserve(64);
+        spare.reserve(SPARE_CHUNKS);
+        while (spare.size() < SPARE_CHUNKS) {   // double buffered from the start
+            uint8_t* c = (uint8_t*)std::malloc(CHUNK_BYTES);
+            if (!c) break;
+            spare.push_back(c);
+        }
+        writer = std::thread(&Journal::run, this);
+        return true;
+    }
+
+    // Flush everything appended so far and stop the writer
+    void stop() {
+        if (!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            quitting = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+    // Clean exit: flush and stop, then remove base.dpad/.dpj/.tmp so the
+    // next launch has nothing to offer
+    void finish() {
+        if (!writer.joinable()) return;
+        stop();
+        discard(base);
+    }
+
+    // A journal write failed; later edits are not autosaved
+    bool failed() const { return broken; }
+
+    // ---- Edits (UI thread) ----
+    // One or more records of a shape tool, ascending z
+    void add(int tool, const void* records, size_t bytes) {
+        if (bytes) append(J_ADD, uint32_t(tool), records, bytes);
+    }
+
+    void addStroke(const FreehandTool::Record& s, const POINT* pts) {
+        append(J_STROKE, 0, &s, sizeof(s), pts, size_t(s.count) * sizeof(POINT));
+    }
+
+    void addCapsules(const EraserTool::Record* r, size_t n) {
+        if (n) append(J_CAPSULES, 0, r, n * sizeof(*r));
+    }
+
+    void erase(int tool, const int* zs, size_t n) {
+        if (n) append(J_ERASE, uint32_t(tool), zs, n * sizeof(int));
+    }
+
+    void clear() { append(J_CLEAR, 0, nullptr, 0); }
+
+    // The scene was exchanged with the one held in 'slot' (ids start at 1)
+    void swapScene(uint32_t slot) { append(J_SWAP, slot, nullptr, 0); }
+
+    // The scene held in 'slot' is gone
+    void dropScene(uint32_t slot) { append(J_DROP, slot, nullptr, 0); }
+
+    // New background layer (nullptr: none). Any real layer is past
+    // INLINE_BYTES, so its pixels go by block.
+    void background(const uint32_t* px, int w, int h) {
+        int32_t wh[2] = { px ? w : 0, px ? h : 0 };
+        size_t n = px ? size_t(w) * h * sizeof(uint32_t) : 0;
+        append(J_BACKGROUND, 0, wh, sizeof(wh), px, n);
+    }
+
+    // Rectangle r (inclusive) of the w x h background layer px was redrawn
+    // (the layer may be new). Only that rectangle is copied.
+    void backgroundRect(const uint32_t* px, int w, int h, RECT r) {
+        if (!writer.joinable() || broken) return;
+        int32_t v[6] = { w, h, r.left, r.top, r.right - r.left + 1, r.bottom - r.top + 1 };
+        if (v[4] <= 0 || v[5] <= 0) return;
+        size_t row = size_t(v[4]) * sizeof(uint32_t);
+        JournalBlock blk = { (uint8_t*)std::malloc(sizeof(v) + row * v[5]), sizeof(v) + row * v[5], 0 };
+        if (!blk.data) { broken = true; return; }
+        std::memcpy(blk.data, v, sizeof(v));
+        for (int y = 0; y < v[5]; ++y)
+            std::memcpy(blk.data + sizeof(v) + row * y, px + size_t(r.top + y) * w + r.left, row);
+        if (!append(J_BLOCK, J_BGRECT, &blk, sizeof(blk))) std::free(blk.data);
+    }
+
+    // The scene was replaced by the document at docPath. The file is only
+    // opened here; the writer copies it into the snapshot and closes it.
+    // While it is open nothing can overwrite it, so call waitBase() before
+    // saving to a path.
+    void rebase(const TCHAR* docPath) {
+        if (!writer.joinable() || broken) return;
+        FILE* f = nullptr;
+        if (_tfopen_s(&f, docPath, _T("rb")) != 0 || !f || !append(J_BASE, 0, &f, sizeof(f))) {
+            if (f) std::fclose(f);
+            broken = true;   // the journal would replay onto the wrong snapshot
+        }
+    }
+
+    // Block until every document handed to rebase() has been copied
+    void waitBase() {
+        std::unique_lock<std::mutex> lk(m);
+        baseDone.wait(lk, [&] { return basesPending == 0; });
+    }
+};
@@ -1,19 +1,24 @@
 ﻿#pragma once
 #define NOMINMAX
-#include <graphics.h>
-#include <windows.h>
+#include "RenderBackend.h"
 #include <algorithm>
 #include <cmath>
-#include <list>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 #include "LineUtils.h"
+#include "RectUtils.h"
 
 // global variables
 extern int gZCounter;
 
 class LineTool {
 private:
-    POINT* start = nullptr;
-    POINT* end = nullptr;
+    // In-progress endpoints (by value; pointCount says how many are set)
+    POINT start = { 0, 0 };
+    POINT end = { 0, 0 };
+    int   pointCount = 0;
 
     struct StyledLine {
         POINT start;
@@ -22,84 +27,209 @@ private:
         int   z;     // creation order
     };
 
-    std::list<StyledLine> completedLines;
-
-    std::list<StyledLine>::const_iterator itAt(size_t i) const {
-        auto it = completedLines.cbegin();
-        while (i-- && it != completedLines.cend()) ++it;
-        return it;
+    // Contiguous storage: O(1) getZ/drawAt during rebuilds
+    StyledLine* lines = nullptr;
+    int lineCount = 0;
+    int capacity = 0;
+    bool borrowed = false;   // lines points into a mapped document (read-only)
+
+    void ensureCapacity(int need) {
+        if (capacity >= need) return;
+        if (!ownRecords()) return;
+        int newCap = capacity ? capacity * 2 : 16;
+        if (newCap < need) newCap = need;
+        void* nb = std::realloc(lines, size_t(newCap) * sizeof(StyledLine));
+        if (!nb) return;
+        lines = (StyledLine*)nb;
+        capacity = newCap;
     }
 
 public:
-    ~LineTool() { reset(); }
+    ~LineTool() {
+        if (!borrowed) std::free(lines);
+    }
 
     void addPoint(POINT p) {
-        if (!start) {
-            start = new POINT{ p.x, p.y };
-        }
-        else if (!end) {
-            end = new POINT{ p.x, p.y };
-        }
+        if (pointCount == 0)      start = p;
+        else if (pointCount == 1) end = p;
+        else return;
+        ++pointCount;
     }
 
-    bool isReady() const { return start && end; }
+    bool isReady() const { return pointCount == 2; }
 
     void drawAndReset(int* style) {
         if (!isReady()) return;
 
-        drawCustomLine(*start, *end, style);
-        completedLines.push_back({ *start, *end, *style, ++gZCounter });
+        drawCustomLine(start, end, style);
+
+        ensureCapacity(lineCount + 1);
+        if (capacity >= lineCount + 1) {
+            lines[lineCount] = { start, end, *style, ++gZCounter };
+            ++lineCount;
+        }
         reset();
     }
 
     // ---- Z-ordered drawing API ----
-    size_t getCount() const { return completedLines.size(); }
+    size_t getCount() const { return size_t(lineCount); }
 
-    int getZ(size_t i) const {
-        auto it = itAt(i);
-        return (it == completedLines.cend()) ? 0 : it->z;
+    int getZ(size_t i) const { return (i < getCount()) ? lines[i].z : 0; }
+
+    RECT getBounds(size_t i) const {
+        if (i >= getCount()) return makeRect(0, 0, -1, -1);
+        return segmentBounds(lines[i].start, lines[i].end, 1);
     }
 
     void drawAt(size_t i) const {
-        auto it = itAt(i);
-        if (it == completedLines.cend()) return;
-        int style = it->style;
-        drawCustomLine(it->start, it->end, &style);
+        if (i >= getCount()) return;
+        int style = lines[i].style;
+        drawCustomLine(lines[i].start, lines[i].end, &style);
     }
 
     void drawCompleted() const {
-        for (const auto& line : completedLines) {
-            int style = line.style;
-            drawCustomLine(line.start, line.end, &style);
-        }
+        for (size_t i = 0; i < getCount(); ++i) drawAt(i);
     }
 
     void drawPreview(POINT mouse, int* style) const {
-        if (start && !end) {
-            drawCustomLine(*start, mouse, style);
+        if (pointCount == 1) {
+            drawCustomLine(start, mouse, style);
         }
     }
 
+    // Area drawPreview() touches (empty if nothing is previewed)
+    RECT previewBounds(POINT mouse) const {
+        if (pointCount != 1) return makeRect(0, 0, -1, -1);
+        return segmentBounds(start, mouse, 1);
+    }
+
     void reset() {
-        delete start;
-        delete end;
-        start = end = nullptr;
+        pointCount = 0;
     }
 
     void resetAll() {
         reset();
-        completedLines.clear();
+        if (!borrowed) std::free(lines);
+        lines = nullptr;
+        borrowed = false;
+        capacity = 0;
+        lineCount = 0;
+    }
+
+    // ---- Bulk access (document save/load) ----
+    typedef StyledLine Record;
+    const Record* records() const { return lines; }
+
+    // Drop everything and make room for n (> 0) records, marked
+    // as used; the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return nullptr;
+        ensureCapacity(int(n));
+        if (capacity < int(n)) return nullptr;
+        lineCount = int(n);
+        return lines;
+    }
+
+    // Append one record as is (journal replay); its z must be above every stored z
+    bool appendRecord(const Record& r) {
+        ensureCapacity(lineCount + 1);
+        if (capacity < lineCount + 1) return false;
+        lines[lineCount++] = r;
+        return true;
+    }
+
+    // Use n records stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return;
+        lines = const_cast<Record*>(r);
+        lineCount = capacity = int(n);
+        borrowed = true;
+    }
+
+    // Copy borrowed records to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* nb = std::malloc(size_t(lineCount) * sizeof(Record));
+        if (!nb) return false;
+        std::memcpy(nb, lines, size_t(lineCount) * sizeof(Record));
+        lines = (Record*)nb;
+        capacity = lineCount;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange stored records with another tool (undo keeps whole scenes
+    // this way); in-progress input stays where it is
+    void swapRecords(LineTool& o) {
+        std::swap(lines, o.lines);
+        std::swap(lineCount, o.lineCount);
+        std::swap(capacity, o.capacity);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // --- Right-click removal (main.cpp finds candidates through the spatial index) ---
+
+    // First index whose z is >= z (items are z-sorted)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (lines[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the item with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && lines[i].z == z) ? i : getCount();
+    }
+
+    // Is mouse within threshold of line i?
+    bool hitTest(size_t i, POINT mouse, int threshold = 10) const {
+        if (i >= getCount()) return false;
+        return pointToSegmentDistance(mouse, lines[i].start, lines[i].end) <= threshold;
+    }
+
+    // Removes every item whose z is listed in zs (ascending) with a single
+    // order-preserving compaction pass starting at the first match.
+    // Returns how many items were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t w = lowerBoundZ(zs[0]);
+        size_t k = 0;
+        for (size_t r = w; r < getCount(); ++r) {
+            while (k < n && zs[k] < lines[r].z) ++k;
+            if (k < n && zs[k] == lines[r].z) { ++k; continue; }
+            lines[w++] = lines[r];
+        }
+        size_t removed = getCount() - w;
+        lineCount = int(w);
+        return removed;
     }
 
-    bool deleteLineNear(POINT mouse, int threshold = 10) {
-        for (auto it = completedLines.begin(); it != completedLines.end(); ++it) {
-            double dist = pointToSegmentDistance(mouse, it->start, it->end);
-            if (dist <= threshold) {
-                completedLines.erase(it);
-                return true;
-            }
+    // Put back records taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the records above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (n > size_t(INT_MAX - lineCount)) return false;
+        ensureCapacity(lineCount + int(n));
+        if (capacity < lineCount + int(n)) return false;
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = getCount(), dst = getCount() + n, k = n;
+        while (k > 0) {
+            if (src > lo && lines[src - 1].z > r[k - 1].z) lines[--dst] = lines[--src];
+            else lines[--dst] = r[--k];
         }
-        return false;
+        lineCount += int(n);
+        return true;
     }
 
 private:
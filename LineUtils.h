@@ -1,10 +1,94 @@
 #pragma once
-#include <graphics.h>
+#include "RenderBackend.h"
 #include <cmath>
+#include <cstdlib>
+
+// Dash pattern of dashPolyline(): DASH_ON pixels on out of every DASH_PERIOD,
+// the same 18-on / 6-off that FramebufferBackend and GDI's PS_DASH use.
+static const int DASH_ON = 18;
+static const int DASH_PERIOD = 24;
 
 // 0 = solid, 1 = dashed
 inline void drawCustomLine(POINT a, POINT b, int* style) {
-    setlinestyle(*style == 0 ? PS_SOLID : PS_DASH, 1);
-    line(a.x, a.y, b.x, b.y);
-    setlinestyle(PS_SOLID, 1); // Reset to solid for future shapes
+    gRender->setLineStyle(*style);
+    gRender->line(a.x, a.y, b.x, b.y);
+    gRender->setLineStyle(0); // Reset to solid for future shapes
+}
+
+// Dashed polyline through pts[0, n) with the pattern running on across
+// vertices. 'phase' is the pattern position of the first pixel and comes back
+// as that of the next one, so a stroke drawn a segment at a time (skipFirst
+// after the first call: the shared vertex is already down) dashes exactly
+// like the whole polyline drawn at once. Pixels follow the backends' rounded
+// DDA; only the "on" runs are sent, each as one solid polyline with straight
+// stretches merged into a single vertex pair. A one-pixel run goes out as a
+// 1x1 fill in the line color: GDI drops a zero-length line entirely.
+inline void dashPolyline(const POINT* pts, int n, int& phase, bool skipFirst) {
+    POINT run[DASH_ON];
+    int nv = 0, ddx = 0, ddy = 0;
+    COLORREF oldFill = 0;
+    bool fillSet = false;   // fill color borrowed for one-pixel runs
+
+    auto flush = [&]() {
+        if (nv >= 2) gRender->polyline(run, nv);
+        else if (nv == 1) {
+            if (!fillSet) {
+                oldFill = gRender->getFillColor();
+                gRender->setFillColor(gRender->getLineColor());
+                fillSet = true;
+            }
+            gRender->solidRectangle(run[0].x, run[0].y, run[0].x, run[0].y);
+        }
+        nv = 0;
+    };
+    auto pixel = [&](int x, int y) {
+        if (phase < DASH_ON) {
+            if (nv >= 2 && x - run[nv - 1].x == ddx && y - run[nv - 1].y == ddy) {
+                run[nv - 1] = { x, y };     // same direction: stretch the last segment
+            }
+            else {
+                if (nv >= 1) { ddx = x - run[nv - 1].x; ddy = y - run[nv - 1].y; }
+                run[nv++] = { x, y };
+            }
+        }
+        else if (nv) flush();
+        if (++phase == DASH_PERIOD) phase = 0;
+    };
+
+    gRender->setLineStyle(0);
+    if (n == 1 && !skipFirst) pixel(pts[0].x, pts[0].y);
+    for (int k = 1; k < n; ++k) {
+        int x0 = pts[k - 1].x, y0 = pts[k - 1].y;
+        int dx = pts[k].x - x0, dy = pts[k].y - y0;
+        int adx = std::abs(dx), ady = std::abs(dy);
+        bool xMajor = adx >= ady;
+        int steps = xMajor ? adx : ady, minorLen = xMajor ? ady : adx;
+        int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -1 : 1;
+        // Step i at minor offset round(i * minorLen / steps), as in FramebufferBackend::stroke()
+        int off = 0;
+        long long rem = steps, den2 = 2LL * steps;
+        for (int i = 0; i <= steps; ++i) {
+            if (i > 0 || (k == 1 && !skipFirst)) {
+                if (xMajor) pixel(x0 + sx * i, y0 + sy * off);
+                else        pixel(x0 + sx * off, y0 + sy * i);
+            }
+            rem += 2 * minorLen;
+            if (rem >= den2) { rem -= den2; ++off; }
+        }
+    }
+    flush();
+    if (fillSet) gRender->setFillColor(oldFill);
+}
+
+// Polyline through pts[0, n). Solid runs go out as a single gRender->polyline() call;
+// dashed ones go through dashPolyline() so the dashes run on across vertices.
+inline void drawCustomPolyline(const POINT* pts, int n, int* style) {
+    if (n < 2) return;
+    if (*style == 0) {
+        gRender->setLineStyle(0);
+        gRender->polyline(pts, n);
+        return;
+    }
+    int phase = 0;
+    dashPolyline(pts, n, phase, false);
 }
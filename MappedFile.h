@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Opening only maps it; pages are read on
+// first touch, so the cost doesn't grow with the file. The file must not be
+// truncated or rewritten until close() (Windows refuses to; POSIX would fault).
+class MappedFile {
+private:
+    const uint8_t* base = nullptr;
+    size_t         length = 0;
+#ifdef _WIN32
+    HANDLE         mapping = NULL;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+#ifdef _WIN32
+    bool open(const TCHAR* path) {
+        close();
+        HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 ||
+            uint64_t(size.QuadPart) > uint64_t(SIZE_MAX)) {
+            CloseHandle(file);
+            return false;
+        }
+        mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);   // the mapping keeps the file open
+        if (!mapping) return false;
+
+        base = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!base) { close(); return false; }
+        length = size_t(size.QuadPart);
+        return true;
+    }
+
+    void close() {
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        base = nullptr;
+        mapping = NULL;
+        length = 0;
+    }
+#else
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) { ::close(fd); return false; }
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);   // the mapping keeps the file open
+        if (p == MAP_FAILED) return false;
+
+        base = (const uint8_t*)p;
+        length = size_t(st.st_size);
+        return true;
+    }
+
+    void close() {
+        if (base) munmap((void*)base, length);
+        base = nullptr;
+        length = 0;
+    }
+#endif
+
+    bool           isOpen() const { return base != nullptr; }
+    const uint8_t* data() const { return base; }
+    size_t         size() const { return length; }
+};
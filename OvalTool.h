@@ -1,10 +1,12 @@
 ﻿#pragma once
-#include <graphics.h>
-#include <windows.h>   // COLORREF
+#include "RenderBackend.h"
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <climits>
+#include <utility>
+#include "RectUtils.h"
+#include "ConicRaster.h"
 
 // Globals owned by main.cpp
 extern bool     fillEnabled;
@@ -14,12 +16,13 @@ extern COLORREF currentFillColor;   // ALWAYS set via RGB(r,g,b)
 // Oval uses: p1 = center, p2 = a point defining radii (rx = |dx|, ry = |dy|)
 class OvalTool {
 private:
-    // In-progress points
-    POINT* p1 = nullptr;  // center
-    POINT* p2 = nullptr;  // defines radii relative to center
+    // In-progress points (by value; pointCount says how many are set)
+    POINT p1 = { 0, 0 };  // center
+    POINT p2 = { 0, 0 };  // defines radii relative to center
+    int   pointCount = 0;
 
     struct StyledOval {
-        POINT* center;   // committed center
+        POINT    center;   // committed center
         int      rx;       // radius x
         int      ry;       // radius y
         int      style;    // 0 = solid, 1 = dashed
@@ -31,9 +34,11 @@ private:
     StyledOval* ovals = nullptr;
     int count = 0;
     int capacity = 0;
+    bool borrowed = false;   // ovals points into a mapped document (read-only)
 
     void ensureCapacity(int need) {
         if (capacity >= need) return;
+        if (!ownRecords()) return;
         int newCap = capacity ? capacity * 2 : 16;
         if (newCap < need) newCap = need;
         void* nb = std::realloc(ovals, size_t(newCap) * sizeof(StyledOval));
@@ -51,71 +56,32 @@ private:
 
     // --- OUTLINE DRAWING ---
 
-    // Outline drawer: solid uses EasyX ellipse(); dashed approximates with short chords.
+    // Outline drawer: solid uses the backend's ellipse(); dashed walks the
+    // integer quadrant table once around the rim (ConicRaster.h).
     // NOTE: This function DOES NOT change the line color — caller controls it.
     static void drawOvalOutline(int cx, int cy, int rx, int ry, int style) {
         if (rx <= 0 || ry <= 0) return;
 
         if (style == 0) {
-            ellipse(cx - rx, cy - ry, cx + rx, cy + ry);
+            gRender->ellipse(cx, cy, rx, ry);
             return;
         }
-
-        // dashed: draw small chord segments along the parametric ellipse
-        const double TWO_PI = 6.283185307179586;
-        const int    SEG_DEG = 6;  // chord step (degrees)
-        const int    DASH_RUN = 3;  // draw 3 segments, skip 3
-        const int    GAP_RUN = 3;
-
-        int segCount = int(std::ceil(360.0 / SEG_DEG));
-        int runLen = DASH_RUN + GAP_RUN;
-
-        for (int s = 0; s < segCount; ++s) {
-            int posInRun = s % runLen;
-            bool drawThis = posInRun < DASH_RUN;
-            if (!drawThis) continue;
-
-            double a0 = (s * SEG_DEG) * (TWO_PI / 360.0);
-            double a1 = ((s + 1) * SEG_DEG) * (TWO_PI / 360.0);
-
-            int x0 = cx + int(std::lround(rx * std::cos(a0)));
-            int y0 = cy + int(std::lround(ry * std::sin(a0)));
-            int x1 = cx + int(std::lround(rx * std::cos(a1)));
-            int y1 = cy + int(std::lround(ry * std::sin(a1)));
-
-            line(x0, y0, x1, y1);
-        }
+        dashConic(cx, cy, ellipseQuadrant(rx, ry));
     }
 
     // --- SOLID FILL (scanline) ---
 
-    // Fills the entire ellipse area using horizontal scanlines.
+    // Fills the entire ellipse area with row spans from the midpoint walk.
     // This ignores other outlines/shapes and paints every pixel inside.
+    // Leaves COPY mode and the fill color set, like drawAt()'s other state,
+    // so a batch of items doesn't flush on every save/restore.
     static void fillOvalSolid(int cx, int cy, int rx, int ry, COLORREF color) {
         if (rx <= 0 || ry <= 0) return;
 
-        COLORREF oldFill = getfillcolor();
-        int      oldRop = getrop2();
-
-        setrop2(R2_COPYPEN);     // overwrite pixels deterministically
-        setfillcolor(color);
-
-        // For each y, compute span width: xSpan = rx * sqrt(1 - ((y-cy)^2 / ry^2))
-        for (int y = cy - ry; y <= cy + ry; ++y) {
-            double ny = double(y - cy) / double(ry);
-            double inside = 1.0 - ny * ny;
-            if (inside < 0.0) continue; // numerical guard
-            int halfw = int(std::floor(double(rx) * std::sqrt(inside) + 0.5));
-            int x0 = cx - halfw;
-            int x1 = cx + halfw;
-            if (x1 >= x0) {
-                // 1-pixel tall solid rectangle (faster than drawing tons of tiny lines)
-                solidrectangle(x0, y, x1, y);
-            }
-        }
+        gRender->setRop(R2_COPYPEN);     // overwrite pixels deterministically
+        gRender->setFillColor(color);
 
-        setrop2(oldRop);
-        setfillcolor(oldFill);
+        fillConic(cx, cy, ellipseQuadrant(rx, ry));
     }
 
     // For deletion hit-test: distance from mouse to nearest point on ellipse boundary
@@ -138,50 +104,51 @@ private:
 
 public:
     ~OvalTool() {
-        reset();
-        for (int i = 0; i < count; ++i) {
-            delete ovals[i].center;
-        }
-        std::free(ovals);
+        if (!borrowed) std::free(ovals);
     }
 
     // --- Input handling ---
 
     void addPoint(POINT p) {
-        if (!p1)       p1 = new POINT{ p.x, p.y };
-        else if (!p2)  p2 = new POINT{ p.x, p.y };
+        if (pointCount == 0)      p1 = p;
+        else if (pointCount == 1) p2 = p;
+        else return;
+        ++pointCount;
     }
 
-    bool isReady() const { return p1 && p2; }
+    bool isReady() const { return pointCount == 2; }
 
     // Commit current oval; final draw in COPY mode; force BLACK edges; save/restore state.
     void drawAndReset(int* style) {
         if (!isReady()) return;
 
         int rx, ry;
-        radiiFromPoints(*p1, *p2, rx, ry);
+        radiiFromPoints(p1, p2, rx, ry);
+        if (rx <= 0 || ry <= 0) { reset(); return; }   // flat: nothing to draw or store
 
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);  // final render should not XOR
+        gRender->setRop(R2_COPYPEN);  // final render should not XOR
 
         if (fillEnabled) {
-            fillOvalSolid(p1->x, p1->y, rx, ry, currentFillColor);
+            fillOvalSolid(p1.x, p1.y, rx, ry, currentFillColor);
         }
 
-        setlinecolor(BLACK);  // deterministic outline color for final draw
-        drawOvalOutline(p1->x, p1->y, rx, ry, (style ? *style : 0));
+        gRender->setLineColor(BLACK);  // deterministic outline color for final draw
+        drawOvalOutline(p1.x, p1.y, rx, ry, (style ? *style : 0));
 
         // Restore state
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
 
         // Store committed oval
         ensureCapacity(count + 1);
         if (capacity >= count + 1) {
             ovals[count] = {
-                p1,                 // take ownership
+                p1,
                 rx,
                 ry,
                 (style ? *style : 0),
@@ -190,12 +157,9 @@ public:
                 currentFillColor
             };
             ++count;
-
-            delete p2; p2 = nullptr;  // not needed after commit
-            p1 = nullptr;             // ownership moved
         }
 
-        reset(); // paranoia
+        reset();
     }
 
     // --- Z / Drawing API ---
@@ -203,25 +167,26 @@ public:
     size_t getCount() const { return size_t(count); }
     int    getZ(size_t i) const { return (i < getCount()) ? ovals[i].z : 0; }
 
+    RECT getBounds(size_t i) const {
+        if (i >= getCount()) return makeRect(0, 0, -1, -1);
+        const auto& o = ovals[i];
+        return makeRect(o.center.x - o.rx - 1, o.center.y - o.ry - 1,
+                        o.center.x + o.rx + 1, o.center.y + o.ry + 1);
+    }
+
     void drawAt(size_t i) const {
         if (i >= getCount()) return;
 
         const auto& o = ovals[i];
 
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
-
-        setrop2(R2_COPYPEN);
+        gRender->setRop(R2_COPYPEN);
 
         if (o.fill) {
-            fillOvalSolid(o.center->x, o.center->y, o.rx, o.ry, o.fillColor);
+            fillOvalSolid(o.center.x, o.center.y, o.rx, o.ry, o.fillColor);
         }
 
-        setlinecolor(BLACK);
-        drawOvalOutline(o.center->x, o.center->y, o.rx, o.ry, o.style);
-
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setLineColor(BLACK);
+        drawOvalOutline(o.center.x, o.center.y, o.rx, o.ry, o.style);
     }
 
     void drawCompleted() const {
@@ -231,70 +196,168 @@ public:
 
     // Preview with COPY mode (no XOR) and LIGHTGRAY outline
     void drawPreview(POINT mouse, int* style) const {
-        if (!p1) return;
+        if (pointCount == 0) return;
 
         int rx, ry;
-        if (p2) {
-            radiiFromPoints(*p1, *p2, rx, ry);
+        if (pointCount >= 2) {
+            radiiFromPoints(p1, p2, rx, ry);
         }
         else {
-            radiiFromPoints(*p1, mouse, rx, ry);
+            radiiFromPoints(p1, mouse, rx, ry);
         }
         if (rx <= 0 || ry <= 0) return;
 
         int      s = (style ? *style : 0);
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);     // full-frame redraw => stable copy render
-        setlinecolor(LIGHTGRAY); // visible preview color
+        gRender->setRop(R2_COPYPEN);     // full-frame redraw => stable copy render
+        gRender->setLineColor(LIGHTGRAY); // visible preview color
 
-        drawOvalOutline(p1->x, p1->y, rx, ry, s);
+        drawOvalOutline(p1.x, p1.y, rx, ry, s);
 
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setLineColor(oldLine);
+    }
+
+    // Area drawPreview() touches (empty if nothing is previewed)
+    RECT previewBounds(POINT mouse) const {
+        if (pointCount == 0) return makeRect(0, 0, -1, -1);
+        int rx, ry;
+        radiiFromPoints(p1, (pointCount >= 2) ? p2 : mouse, rx, ry);
+        if (rx <= 0 || ry <= 0) return makeRect(0, 0, -1, -1);
+        return makeRect(p1.x - rx - 1, p1.y - ry - 1, p1.x + rx + 1, p1.y + ry + 1);
     }
 
     // --- Memory management ---
 
     void reset() {
-        delete p1; delete p2;
-        p1 = p2 = nullptr;
+        pointCount = 0;
     }
 
     void resetAll() {
         reset();
-        for (int i = 0; i < count; ++i) {
-            delete ovals[i].center;
-        }
-        std::free(ovals);
+        if (!borrowed) std::free(ovals);
         ovals = nullptr;
+        borrowed = false;
         capacity = 0;
         count = 0;
     }
 
-    // --- Deletion ---
-
-    bool deleteOvalNear(POINT mouse, int threshold = 10) {
-        for (int i = 0; i < count; ++i) {
-            int cx = ovals[i].center->x;
-            int cy = ovals[i].center->y;
-            int rx = ovals[i].rx;
-            int ry = ovals[i].ry;
-
-            int d = distanceToEllipseEdge(mouse, cx, cy, rx, ry);
-            if (d <= threshold) {
-                delete ovals[i].center;
-
-                if (i < count - 1) {
-                    std::memmove(&ovals[i],
-                        &ovals[i + 1],
-                        size_t(count - i - 1) * sizeof(StyledOval));
-                }
-                --count;
-                return true;
-            }
+    // ---- Bulk access (document save/load) ----
+    typedef StyledOval Record;
+    const Record* records() const { return ovals; }
+
+    // Drop everything and make room for n (> 0) records, marked
+    // as used; the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return nullptr;
+        ensureCapacity(int(n));
+        if (capacity < int(n)) return nullptr;
+        count = int(n);
+        return ovals;
+    }
+
+    // Append one record as is (journal replay); its z must be above every stored z
+    bool appendRecord(const Record& r) {
+        ensureCapacity(count + 1);
+        if (capacity < count + 1) return false;
+        ovals[count++] = r;
+        return true;
+    }
+
+    // Use n records stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return;
+        ovals = const_cast<Record*>(r);
+        count = capacity = int(n);
+        borrowed = true;
+    }
+
+    // Copy borrowed records to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* nb = std::malloc(size_t(count) * sizeof(Record));
+        if (!nb) return false;
+        std::memcpy(nb, ovals, size_t(count) * sizeof(Record));
+        ovals = (Record*)nb;
+        capacity = count;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange stored records with another tool (undo keeps whole scenes
+    // this way); in-progress input stays where it is
+    void swapRecords(OvalTool& o) {
+        std::swap(ovals, o.ovals);
+        std::swap(count, o.count);
+        std::swap(capacity, o.capacity);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // --- Right-click removal (main.cpp finds candidates through the spatial index) ---
+
+    // First index whose z is >= z (items are z-sorted)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (ovals[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the item with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && ovals[i].z == z) ? i : getCount();
+    }
+
+    // Is mouse within threshold of the rim of oval i?
+    bool hitTest(size_t i, POINT mouse, int threshold = 10) const {
+        if (i >= getCount()) return false;
+        const auto& o = ovals[i];
+        return distanceToEllipseEdge(mouse, o.center.x, o.center.y, o.rx, o.ry) <= threshold;
+    }
+
+    // Removes every item whose z is listed in zs (ascending) with a single
+    // order-preserving compaction pass starting at the first match.
+    // Returns how many items were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t w = lowerBoundZ(zs[0]);
+        size_t k = 0;
+        for (size_t r = w; r < getCount(); ++r) {
+            while (k < n && zs[k] < ovals[r].z) ++k;
+            if (k < n && zs[k] == ovals[r].z) { ++k; continue; }
+            ovals[w++] = ovals[r];
+        }
+        size_t removed = getCount() - w;
+        count = int(w);
+        return removed;
+    }
+
+    // Put back records taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the records above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (n > size_t(INT_MAX - count)) return false;
+        ensureCapacity(count + int(n));
+        if (capacity < count + int(n)) return false;
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = getCount(), dst = getCount() + n, k = n;
+        while (k > 0) {
+            if (src > lo && ovals[src - 1].z > r[k - 1].z) ovals[--dst] = ovals[--src];
+            else ovals[--dst] = r[--k];
         }
-        return false;
+        count += int(n);
+        return true;
     }
 };
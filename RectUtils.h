@@ -0,0 +1,41 @@
+#pragma once
+#include "GfxTypes.h"    // POINT, RECT
+
+// Bounding boxes are inclusive on all four sides, matching solidrectangle(L, T, R, B).
+
+inline RECT makeRect(int L, int T, int R, int B) {
+    RECT r;
+    r.left = L; r.top = T; r.right = R; r.bottom = B;
+    return r;
+}
+
+// Box around segment ab, grown by pad pixels on every side
+inline RECT segmentBounds(POINT a, POINT b, int pad) {
+    int L = (a.x < b.x) ? a.x : b.x;
+    int R = (a.x > b.x) ? a.x : b.x;
+    int T = (a.y < b.y) ? a.y : b.y;
+    int B = (a.y > b.y) ? a.y : b.y;
+    return makeRect(L - pad, T - pad, R + pad, B + pad);
+}
+
+inline bool rectsOverlap(const RECT& a, const RECT& b) {
+    return a.left <= b.right && b.left <= a.right &&
+           a.top <= b.bottom && b.top <= a.bottom;
+}
+
+// Grow 'into' to cover 'r'
+inline void rectUnion(RECT& into, const RECT& r) {
+    if (r.left < into.left)     into.left = r.left;
+    if (r.top < into.top)       into.top = r.top;
+    if (r.right > into.right)   into.right = r.right;
+    if (r.bottom > into.bottom) into.bottom = r.bottom;
+}
+
+// Clamp to [0, w) x [0, h); returns false if nothing is left
+inline bool rectClip(RECT& r, int w, int h) {
+    if (r.left < 0)       r.left = 0;
+    if (r.top < 0)        r.top = 0;
+    if (r.right > w - 1)  r.right = w - 1;
+    if (r.bottom > h - 1) r.bottom = h - 1;
+    return r.left <= r.right && r.top <= r.bottom;
+}
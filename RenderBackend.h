@@ -0,0 +1,40 @@
+#pragma once
+#include "GfxTypes.h"
+
+// Drawing interface every tool renders through. It mirrors the small EasyX
+// subset the tools use: colors, ROP and pen style are sticky state, exactly
+// like setlinecolor()/setrop2()/setlinestyle().
+//
+//   EasyXBackend       - GDI via EasyX, draws on the current working image
+//   FramebufferBackend - pure CPU, writes 32-bit pixels directly (headless)
+class RenderBackend {
+public:
+    virtual ~RenderBackend() {}
+
+    // --- State ---
+    virtual void     setLineColor(COLORREF c) = 0;
+    virtual COLORREF getLineColor() const = 0;
+    virtual void     setFillColor(COLORREF c) = 0;
+    virtual COLORREF getFillColor() const = 0;
+    virtual void     setRop(int rop) = 0;            // R2_COPYPEN or R2_XORPEN
+    virtual int      getRop() const = 0;
+    virtual void     setLineStyle(int style) = 0;    // 0 = solid, 1 = dashed (1 px pen)
+    virtual void     setClip(const RECT* clip) = 0;  // inclusive rect; nullptr = whole target
+
+    // --- Outlines (line color + line style) ---
+    virtual void line(int x0, int y0, int x1, int y1) = 0;
+    virtual void polyline(const POINT* pts, int n) = 0;
+    virtual void circle(int cx, int cy, int r) = 0;
+    virtual void ellipse(int cx, int cy, int rx, int ry) = 0;
+
+    // --- Fills (fill color, no outline) ---
+    virtual void solidRectangle(int left, int top, int right, int bottom) = 0;   // inclusive
+    virtual void solidCircle(int cx, int cy, int r) = 0;
+    virtual void solidPolygon(const POINT* pts, int n) = 0;
+    virtual void solidTriangle(POINT a, POINT b, POINT c) = 0;   // top-left fill rule
+    virtual void solidCapsule(POINT a, POINT b, int r) = 0;   // disc of radius r swept from a to b
+};
+
+// Current target for tool drawing (owned by main.cpp or the headless driver).
+// Per thread, so tile workers can each draw into their own backend.
+extern thread_local RenderBackend* gRender;
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdlib>      // realloc, free
+#include "RenderBackend.h"
+
+// RenderBackend in front of another one that only passes on what changes.
+//
+// State setters are recorded, not forwarded: a primitive sends the target
+// just the state it reads (outlines: line color, ROP, style; fills: fill
+// color, ROP) and only where it differs from what the target already has.
+// The save/set/restore pairs the tools do around every item, and
+// drawCustomLine()'s per-segment style reset, never reach GDI.
+//
+// Solid COPY outlines that continue where the previous one ended, under the
+// same state, are held as one open run and sent as a single polyline when
+// anything else comes along. Only consecutive calls are joined, so draw
+// order (and with it z order) is untouched. XOR runs are not joined (shared
+// vertices would cancel), nor are dashed ones (the pattern restarts per call).
+class RenderBatch : public RenderBackend {
+private:
+    RenderBackend* target = nullptr;
+
+    struct State {
+        COLORREF line, fill;
+        int      rop, style;
+    };
+    State want = { 0, 0, R2_COPYPEN, 0 };   // what the caller set
+    State sent = { 0, 0, R2_COPYPEN, 0 };   // what the target has
+
+    POINT* run = nullptr;   // open polyline, run[0, runLen)
+    int    runLen = 0;
+    int    runCap = 0;
+
+    // Counters since begin()
+    unsigned long primitives = 0, calls = 0, stateCalls = 0;
+
+    bool push(POINT p) {
+        if (runLen == runCap) {
+            int newCap = runCap ? runCap * 2 : 256;
+            void* nb = std::realloc(run, size_t(newCap) * sizeof(POINT));
+            if (!nb) return false;
+            run = (POINT*)nb;
+            runCap = newCap;
+        }
+        run[runLen++] = p;
+        return true;
+    }
+
+    void sendOutlineState() {
+        if (sent.rop != want.rop)     { target->setRop(want.rop); sent.rop = want.rop; ++stateCalls; }
+        if (sent.line != want.line)   { target->setLineColor(want.line); sent.line = want.line; ++stateCalls; }
+        if (sent.style != want.style) { target->setLineStyle(want.style); sent.style = want.style; ++stateCalls; }
+    }
+
+    void sendFillState() {
+        if (sent.rop != want.rop)   { target->setRop(want.rop); sent.rop = want.rop; ++stateCalls; }
+        if (sent.fill != want.fill) { target->setFillColor(want.fill); sent.fill = want.fill; ++stateCalls; }
+    }
+
+    // Will an outline from 'from' extend the open run?
+    bool joins(POINT from) const {
+        return runLen > 0 && want.rop == sent.rop && want.line == sent.line && want.style == sent.style &&
+               run[runLen - 1].x == from.x && run[runLen - 1].y == from.y;
+    }
+
+    static bool joinable(const State& s) { return s.rop == R2_COPYPEN && s.style == 0; }
+
+    void beforeFill()    { flush(); sendFillState(); ++primitives; ++calls; }
+    void beforeOutline() { flush(); sendOutlineState(); ++primitives; ++calls; }
+
+public:
+    ~RenderBatch() { std::free(run); }
+
+    // Start batching into t, taking its current state as the baseline
+    void begin(RenderBackend* t) {
+        target = t;
+        want.line = sent.line = t->getLineColor();
+        want.fill = sent.fill = t->getFillColor();
+        want.rop = sent.rop = t->getRop();
+        want.style = sent.style = 0;
+        t->setLineStyle(0);   // backends don't report their style
+        runLen = 0;
+        primitives = calls = stateCalls = 0;
+    }
+
+    // Send the open run and leave the target in the caller's state
+    void end() {
+        flush();
+        sendOutlineState();
+        sendFillState();
+        target = nullptr;
+    }
+
+    void flush() {
+        if (runLen >= 3)      target->polyline(run, runLen);
+        else if (runLen == 2) target->line(run[0].x, run[0].y, run[1].x, run[1].y);
+        if (runLen) ++calls;
+        runLen = 0;
+    }
+
+    unsigned long primitiveCount() const { return primitives; }   // calls made on the batch
+    unsigned long drawCount() const      { return calls; }        // draw calls reaching the target
+    unsigned long stateCount() const     { return stateCalls; }   // state calls reaching the target
+
+    // --- State ---
+    void     setLineColor(COLORREF c) override { want.line = c; }
+    COLORREF getLineColor() const override { return want.line; }
+    void     setFillColor(COLORREF c) override { want.fill = c; }
+    COLORREF getFillColor() const override { return want.fill; }
+    void     setRop(int rop) override { want.rop = rop; }
+    int      getRop() const override { return want.rop; }
+    void     setLineStyle(int style) override { want.style = style; }
+    void     setClip(const RECT* clip) override { flush(); target->setClip(clip); }
+
+    // --- Outlines ---
+    void line(int x0, int y0, int x1, int y1) override {
+        ++primitives;
+        POINT a = { x0, y0 }, b = { x1, y1 };
+        if (joinable(want) && joins(a) && push(b)) return;
+        flush();
+        sendOutlineState();
+        if (joinable(want) && push(a) && push(b)) return;
+        runLen = 0;
+        target->line(x0, y0, x1, y1);
+        ++calls;
+    }
+
+    void polyline(const POINT* pts, int n) override {
+        if (n < 2) { ++primitives; return; }
+        if (joinable(want)) {
+            ++primitives;
+            int i = 1;
+            if (!joins(pts[0])) {
+                flush();
+                sendOutlineState();
+                i = 0;
+            }
+            for (; i < n; ++i) if (!push(pts[i])) break;
+            if (i == n) return;
+            flush();                           // out of memory: send what fits
+            target->polyline(pts + i - 1, n - i + 1);
+            ++calls;
+            return;
+        }
+        beforeOutline();
+        target->polyline(pts, n);
+    }
+
+    void circle(int cx, int cy, int r) override { beforeOutline(); target->circle(cx, cy, r); }
+    void ellipse(int cx, int cy, int rx, int ry) override { beforeOutline(); target->ellipse(cx, cy, rx, ry); }
+
+    // --- Fills ---
+    void solidRectangle(int l, int t, int r, int b) override { beforeFill(); target->solidRectangle(l, t, r, b); }
+    void solidCircle(int cx, int cy, int r) override { beforeFill(); target->solidCircle(cx, cy, r); }
+    void solidPolygon(const POINT* pts, int n) override { beforeFill(); target->solidPolygon(pts, n); }
+    void solidTriangle(POINT a, POINT b, POINT c) override { beforeFill(); target->solidTriangle(a, b, c); }
+    void solidCapsule(POINT a, POINT b, int r) override { beforeFill(); target->solidCapsule(a, b, r); }
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+
+// Horizontal span writers for 32-bit pixel rows, picked once at startup from
+// what the CPU supports: AVX2, then SSE2, then plain loops. Every fill in
+// FramebufferBackend ends up here, so this is where the stores are widened.
+//
+//   spanCopy(d, n, px) - d[0, n) = px
+//   spanXor(d, n, px)  - d[0, n) ^= px
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SPAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SPAN_TARGET_AVX2
+#define SPAN_TARGET_SSE2
+#else
+#include <cpuid.h>
+#define SPAN_TARGET_AVX2 __attribute__((target("avx2")))
+#define SPAN_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+typedef void (*SpanFn)(uint32_t* d, int n, uint32_t px);
+
+inline void spanCopyScalar(uint32_t* d, int n, uint32_t px) {
+    for (int i = 0; i < n; ++i) d[i] = px;
+}
+
+inline void spanXorScalar(uint32_t* d, int n, uint32_t px) {
+    for (int i = 0; i < n; ++i) d[i] ^= px;
+}
+
+#ifdef SPAN_X86
+// Copies may overlap their last store with the previous one; XOR may not.
+SPAN_TARGET_SSE2 inline void spanCopySSE2(uint32_t* d, int n, uint32_t px) {
+    if (n < 4) { spanCopyScalar(d, n, px); return; }
+    __m128i v = _mm_set1_epi32(int(px));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(d + i), v);
+    if (i < n) _mm_storeu_si128((__m128i*)(d + n - 4), v);
+}
+
+SPAN_TARGET_SSE2 inline void spanXorSSE2(uint32_t* d, int n, uint32_t px) {
+    __m128i v = _mm_set1_epi32(int(px));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*)(d + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), v));
+    }
+    for (; i < n; ++i) d[i] ^= px;
+}
+
+SPAN_TARGET_AVX2 inline void spanCopyAVX2(uint32_t* d, int n, uint32_t px) {
+    if (n < 8) { spanCopySSE2(d, n, px); return; }
+    __m256i v = _mm256_set1_epi32(int(px));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(d + i), v);
+    if (i < n) _mm256_storeu_si256((__m256i*)(d + n - 8), v);
+}
+
+SPAN_TARGET_AVX2 inline void spanXorAVX2(uint32_t* d, int n, uint32_t px) {
+    __m256i v = _mm256_set1_epi32(int(px));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*)(d + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), v));
+    }
+    spanXorSSE2(d + i, n - i, px);
+}
+
+// 2 = AVX2, 1 = SSE2, 0 = neither
+inline int spanCpuLevel() {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    int maxLeaf = r[0];
+    __cpuid(r, 1);
+    int level = (r[3] & (1 << 26)) ? 1 : 0;
+    bool osxsave = (r[2] & (1 << 27)) != 0;
+    if (level && osxsave && maxLeaf >= 7 && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(r, 7, 0);
+        if (r[1] & (1 << 5)) level = 2;
+    }
+    return level;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 2;
+    return __builtin_cpu_supports("sse2") ? 1 : 0;
+#endif
+}
+#endif
+
+struct SpanKernels {
+    SpanFn copy;
+    SpanFn xorWith;
+};
+
+inline const SpanKernels& spanKernels() {
+    static const SpanKernels k = []() {
+        SpanKernels s = { spanCopyScalar, spanXorScalar };
+#ifdef SPAN_X86
+        int level = spanCpuLevel();
+        if (level >= 2)      { s.copy = spanCopyAVX2; s.xorWith = spanXorAVX2; }
+        else if (level == 1) { s.copy = spanCopySSE2; s.xorWith = spanXorSSE2; }
+#endif
+        return s;
+    }();
+    return k;
+}
+
+inline void spanCopy(uint32_t* d, int n, uint32_t px) { spanKernels().copy(d, n, px); }
+inline void spanXor(uint32_t* d, int n, uint32_t px)  { spanKernels().xorWith(d, n, px); }
@@ -0,0 +1,131 @@
+#pragma once
+#include "GfxTypes.h"    // RECT
+#include <cstdlib>      // malloc, realloc, free
+#include <utility>      // swap
+#include "RectUtils.h"
+
+// Uniform grid of shape bounding boxes for right-click hit-testing.
+// Each entry is (tag, z): tag names the owning tool, z identifies the item
+// (z values are unique and never reused, unlike array indices). An entry is
+// stored in every cell its box touches; boxes outside the grid are clamped
+// onto the border cells.
+class SpatialGrid {
+private:
+    struct Entry {
+        RECT box;
+        int  z;
+        int  tag;
+    };
+
+    struct Cell {
+        Entry* items;
+        int    count;
+        int    cap;
+    };
+
+    static const int CELL_SIZE = 32;   // pixels per cell side
+
+    Cell* cells = nullptr;
+    int   cols = 0;
+    int   rows = 0;
+
+    int colOf(int x) const {
+        int c = x / CELL_SIZE;
+        return (x < 0) ? 0 : (c >= cols ? cols - 1 : c);
+    }
+    int rowOf(int y) const {
+        int r = y / CELL_SIZE;
+        return (y < 0) ? 0 : (r >= rows ? rows - 1 : r);
+    }
+
+    static bool push(Cell& c, const Entry& e) {
+        if (c.count == c.cap) {
+            int newCap = c.cap ? c.cap * 2 : 8;
+            void* nb = std::realloc(c.items, size_t(newCap) * sizeof(Entry));
+            if (!nb) return false;
+            c.items = (Entry*)nb;
+            c.cap = newCap;
+        }
+        c.items[c.count++] = e;
+        return true;
+    }
+
+public:
+    SpatialGrid(int width, int height) {
+        cols = (width + CELL_SIZE - 1) / CELL_SIZE;
+        rows = (height + CELL_SIZE - 1) / CELL_SIZE;
+        cells = (Cell*)std::calloc(size_t(cols) * rows, sizeof(Cell));
+        if (!cells) cols = rows = 0;
+    }
+
+    ~SpatialGrid() {
+        clear();
+        std::free(cells);
+    }
+
+    SpatialGrid(const SpatialGrid&) = delete;
+    SpatialGrid& operator=(const SpatialGrid&) = delete;
+
+    // Covered area, rounded up to whole cells (0 x 0 if allocation failed)
+    int width() const  { return cols * CELL_SIZE; }
+    int height() const { return rows * CELL_SIZE; }
+
+    // Exchange contents with another grid, e.g. one indexing a scene put aside
+    void swap(SpatialGrid& o) {
+        std::swap(cells, o.cells);
+        std::swap(cols, o.cols);
+        std::swap(rows, o.rows);
+    }
+
+    void insert(int tag, int z, const RECT& box) {
+        Entry e = { box, z, tag };
+        for (int r = rowOf(box.top); r <= rowOf(box.bottom); ++r)
+            for (int c = colOf(box.left); c <= colOf(box.right); ++c)
+                push(cells[r * cols + c], e);
+    }
+
+    // 'box' must be the one the item was inserted with
+    void remove(int tag, int z, const RECT& box) {
+        for (int r = rowOf(box.top); r <= rowOf(box.bottom); ++r) {
+            for (int c = colOf(box.left); c <= colOf(box.right); ++c) {
+                Cell& cell = cells[r * cols + c];
+                for (int i = 0; i < cell.count; ++i) {
+                    if (cell.items[i].z == z && cell.items[i].tag == tag) {
+                        cell.items[i] = cell.items[--cell.count];   // order inside a cell is irrelevant
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    void clear() {
+        for (int i = 0; i < cols * rows; ++i) {
+            std::free(cells[i].items);
+            cells[i].items = nullptr;
+            cells[i].count = 0;
+            cells[i].cap = 0;
+        }
+    }
+
+    // Calls fn(tag, z) once for every item whose box overlaps 'area'.
+    // fn returns false to stop early. Duplicates across cells are skipped by
+    // reporting an item only from the cell holding the top-left corner of
+    // the overlap of box and area.
+    template <class Fn>
+    void query(const RECT& area, Fn fn) const {
+        for (int r = rowOf(area.top); r <= rowOf(area.bottom); ++r) {
+            for (int c = colOf(area.left); c <= colOf(area.right); ++c) {
+                const Cell& cell = cells[r * cols + c];
+                for (int i = 0; i < cell.count; ++i) {
+                    const Entry& e = cell.items[i];
+                    if (!rectsOverlap(e.box, area)) continue;
+                    int ox = (e.box.left > area.left) ? e.box.left : area.left;
+                    int oy = (e.box.top > area.top) ? e.box.top : area.top;
+                    if (colOf(ox) != c || rowOf(oy) != r) continue;
+                    if (!fn(e.tag, e.z)) return;
+                }
+            }
+        }
+    }
+};
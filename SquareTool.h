@@ -1,10 +1,12 @@
 #pragma once
-#include <graphics.h>
-#include <windows.h>    // COLORREF
+#include "RenderBackend.h"
 #include <cmath>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 #include "LineUtils.h"
+#include "RectUtils.h"
 
 // Globals variables
 extern bool     fillEnabled;
@@ -15,13 +17,14 @@ extern COLORREF currentFillColor;
 
 class SquareTool {
 private:
-    // In-progress corners
-    POINT* p1 = nullptr;
-    POINT* p2 = nullptr;
+    // In-progress corners (by value; pointCount says how many are set)
+    POINT p1 = { 0, 0 };
+    POINT p2 = { 0, 0 };
+    int   pointCount = 0;
 
     struct StyledSquare {
-        POINT* a;           // corner 1 
-        POINT* b;           // corner 2 (opposite)
+        POINT    a;           // corner 1 
+        POINT    b;           // corner 2 (opposite)
         int      style;       // 0 = solid, 1 = dashed
         bool     fill;        // draw filled rectangle or not
         int      z;           // creation order
@@ -31,9 +34,11 @@ private:
     StyledSquare* squares = nullptr;
     int count = 0;
     int capacity = 0;
+    bool borrowed = false;   // squares points into a mapped document (read-only)
 
     void ensureCapacity(int need) {
         if (capacity >= need) return;
+        if (!ownRecords()) return;
         int newCap = capacity ? capacity * 2 : 16;
         if (newCap < need) newCap = need;
         void* nb = std::realloc(squares, size_t(newCap) * sizeof(StyledSquare));
@@ -52,41 +57,38 @@ private:
 
 public:
     ~SquareTool() {
-        reset();
-        for (int i = 0; i < count; ++i) {
-            delete squares[i].a;
-            delete squares[i].b;
-        }
-        std::free(squares);
+        if (!borrowed) std::free(squares);
     }
 
     void addPoint(POINT p) {
-        if (!p1)       p1 = new POINT{ p.x, p.y };
-        else if (!p2)  p2 = new POINT{ p.x, p.y };
+        if (pointCount == 0)      p1 = p;
+        else if (pointCount == 1) p2 = p;
+        else return;
+        ++pointCount;
     }
 
-    bool isReady() const { return p1 && p2; }
+    bool isReady() const { return pointCount == 2; }
 
     // Commit current rect; final draw in copy mode; force black edges; save/restore state.
     void drawAndReset(int* style, bool fill) {
         if (!isReady()) return;
 
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);  // never XOR on final draw
+        gRender->setRop(R2_COPYPEN);  // never XOR on final draw
 
         int L, T, R, B;
-        rectBounds(*p1, *p2, L, T, R, B);
+        rectBounds(p1, p2, L, T, R, B);
 
         if (fill) {
-            setfillcolor(currentFillColor);
-            solidrectangle(L, T, R, B);
+            gRender->setFillColor(currentFillColor);
+            gRender->solidRectangle(L, T, R, B);
         }
 
         // Outline in deterministic color
-        setlinecolor(BLACK);
+        gRender->setLineColor(BLACK);
         // Use your dashed/solid logic via drawCustomLine on the 4 edges
         drawCustomLine({ L, T }, { R, T }, style); // top
         drawCustomLine({ R, T }, { R, B }, style); // right
@@ -94,9 +96,9 @@ public:
         drawCustomLine({ L, B }, { L, T }, style); // left
 
         // Restore
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
 
         // Store the committed rect
         ensureCapacity(count + 1);
@@ -109,10 +111,9 @@ public:
                 currentFillColor
             };
             ++count;
-            p1 = p2 = nullptr; // ownership transferred
         }
 
-        reset(); // paranoia
+        reset();
     }
 
     // --- Z / Drawing API ---
@@ -121,36 +122,33 @@ public:
 
     int getZ(size_t i) const { return (i < getCount()) ? squares[i].z : 0; }
 
+    RECT getBounds(size_t i) const {
+        if (i >= getCount()) return makeRect(0, 0, -1, -1);
+        return segmentBounds(squares[i].a, squares[i].b, 1);
+    }
+
     void drawAt(size_t i) const {
         if (i >= getCount()) return;
 
         const auto& s = squares[i];
 
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
-
-        setrop2(R2_COPYPEN); 
+        gRender->setRop(R2_COPYPEN); 
 
         int L, T, R, B;
-        rectBounds(*s.a, *s.b, L, T, R, B);
+        rectBounds(s.a, s.b, L, T, R, B);
 
         if (s.fill) {
-            setfillcolor(s.fillColor);
-            solidrectangle(L, T, R, B);
+            gRender->setFillColor(s.fillColor);
+            gRender->solidRectangle(L, T, R, B);
         }
 
         
-        setlinecolor(BLACK);
+        gRender->setLineColor(BLACK);
         int st = s.style;
         drawCustomLine({ L, T }, { R, T }, &st);
         drawCustomLine({ R, T }, { R, B }, &st);
         drawCustomLine({ R, B }, { L, B }, &st);
         drawCustomLine({ L, B }, { L, T }, &st);
-
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
     }
 
     void drawCompleted() const {
@@ -159,73 +157,168 @@ public:
 
     
     void drawPreview(POINT mouse, int* style) const {
-        if (!p1) return;
+        if (pointCount == 0) return;
 
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setlinecolor(LIGHTGRAY);
-        setrop2(R2_XORPEN);
+        gRender->setLineColor(LIGHTGRAY);
+        gRender->setRop(R2_XORPEN);
 
-        if (p1 && !p2) {
+        if (pointCount == 1) {
             // live rectangle from p1 to mouse
             int L, T, R, B;
-            rectBounds(*p1, mouse, L, T, R, B);
+            rectBounds(p1, mouse, L, T, R, B);
             drawCustomLine({ L, T }, { R, T }, style);
             drawCustomLine({ R, T }, { R, B }, style);
             drawCustomLine({ R, B }, { L, B }, style);
             drawCustomLine({ L, B }, { L, T }, style);
         }
 
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setLineColor(oldLine);
+    }
+
+    // Area drawPreview() touches (empty if nothing is previewed)
+    RECT previewBounds(POINT mouse) const {
+        if (pointCount != 1) return makeRect(0, 0, -1, -1);
+        return segmentBounds(p1, mouse, 1);
     }
 
     
 
     void reset() {
-        delete p1; delete p2;
-        p1 = p2 = nullptr;
+        pointCount = 0;
     }
 
     void resetAll() {
         reset();
-        for (int i = 0; i < count; ++i) {
-            delete squares[i].a;
-            delete squares[i].b;
-        }
-        std::free(squares);
+        if (!borrowed) std::free(squares);
         squares = nullptr;
+        borrowed = false;
         capacity = 0;
         count = 0;
     }
 
-    // --- Deletion ---
+    // ---- Bulk access (document save/load) ----
+    typedef StyledSquare Record;
+    const Record* records() const { return squares; }
+
+    // Drop everything and make room for n (> 0) records, marked
+    // as used; the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return nullptr;
+        ensureCapacity(int(n));
+        if (capacity < int(n)) return nullptr;
+        count = int(n);
+        return squares;
+    }
 
-    bool deleteSquareNear(POINT mouse, int threshold = 10) {
-        for (int i = 0; i < count; ++i) {
-            int L, T, R, B;
-            rectBounds(*squares[i].a, *squares[i].b, L, T, R, B);
+    // Append one record as is (journal replay); its z must be above every stored z
+    bool appendRecord(const Record& r) {
+        ensureCapacity(count + 1);
+        if (capacity < count + 1) return false;
+        squares[count++] = r;
+        return true;
+    }
 
-            if (pointNearSegment(mouse, { L, T }, { R, T }, threshold) ||
-                pointNearSegment(mouse, { R, T }, { R, B }, threshold) ||
-                pointNearSegment(mouse, { R, B }, { L, B }, threshold) ||
-                pointNearSegment(mouse, { L, B }, { L, T }, threshold)) {
+    // Use n records stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return;
+        squares = const_cast<Record*>(r);
+        count = capacity = int(n);
+        borrowed = true;
+    }
 
-                delete squares[i].a;
-                delete squares[i].b;
+    // Copy borrowed records to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* nb = std::malloc(size_t(count) * sizeof(Record));
+        if (!nb) return false;
+        std::memcpy(nb, squares, size_t(count) * sizeof(Record));
+        squares = (Record*)nb;
+        capacity = count;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange stored records with another tool (undo keeps whole scenes
+    // this way); in-progress input stays where it is
+    void swapRecords(SquareTool& o) {
+        std::swap(squares, o.squares);
+        std::swap(count, o.count);
+        std::swap(capacity, o.capacity);
+        std::swap(borrowed, o.borrowed);
+    }
+
+    // --- Right-click removal (main.cpp finds candidates through the spatial index) ---
+
+    // First index whose z is >= z (items are z-sorted)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (squares[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
 
-                if (i < count - 1) {
-                    std::memmove(&squares[i],
-                        &squares[i + 1],
-                        size_t(count - i - 1) * sizeof(StyledSquare));
-                }
+    // Index of the item with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && squares[i].z == z) ? i : getCount();
+    }
+
+    // Is mouse within threshold of any edge of rect i?
+    bool hitTest(size_t i, POINT mouse, int threshold = 10) const {
+        if (i >= getCount()) return false;
+        int L, T, R, B;
+        rectBounds(squares[i].a, squares[i].b, L, T, R, B);
+        return pointNearSegment(mouse, { L, T }, { R, T }, threshold) ||
+               pointNearSegment(mouse, { R, T }, { R, B }, threshold) ||
+               pointNearSegment(mouse, { R, B }, { L, B }, threshold) ||
+               pointNearSegment(mouse, { L, B }, { L, T }, threshold);
+    }
+
+    // Removes every item whose z is listed in zs (ascending) with a single
+    // order-preserving compaction pass starting at the first match.
+    // Returns how many items were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t w = lowerBoundZ(zs[0]);
+        size_t k = 0;
+        for (size_t r = w; r < getCount(); ++r) {
+            while (k < n && zs[k] < squares[r].z) ++k;
+            if (k < n && zs[k] == squares[r].z) { ++k; continue; }
+            squares[w++] = squares[r];
+        }
+        size_t removed = getCount() - w;
+        count = int(w);
+        return removed;
+    }
 
-                --count;
-                return true;
-            }
+    // Put back records taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the records above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (n > size_t(INT_MAX - count)) return false;
+        ensureCapacity(count + int(n));
+        if (capacity < count + int(n)) return false;
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = getCount(), dst = getCount() + n, k = n;
+        while (k > 0) {
+            if (src > lo && squares[src - 1].z > r[k - 1].z) squares[--dst] = squares[--src];
+            else squares[--dst] = r[--k];
         }
-        return false;
+        count += int(n);
+        return true;
     }
 
 private:
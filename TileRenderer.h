@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>      // realloc, free
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FramebufferBackend.h"
+#include "RectUtils.h"
+
+// Full-canvas rasterization split into TILE x TILE tiles.
+//
+// Items are binned, in z order, into every tile their bounds touch. render()
+// then draws the tiles on a persistent worker pool (the caller helps too):
+// each worker owns a FramebufferBackend clipped to its current tile and pulls
+// the next tile index from a shared counter, so slow tiles never hold up the
+// rest. Framebuffer primitives produce the same pixels whatever the clip is,
+// so the result is bit-identical to one serial pass.
+class TileRenderer {
+public:
+    typedef void (*DrawFn)(int tag, size_t index);   // draws one item through gRender
+    static const int TILE = 64;
+
+private:
+    struct Item {
+        int    tag;
+        size_t index;
+    };
+
+    struct Bin {
+        Item* items;
+        int   count;
+        int   cap;
+    };
+
+    Bin* bins = nullptr;
+    int  binCap = 0;            // bins allocated
+    int  cols = 0, rows = 0;
+    int  width = 0, height = 0;
+
+    // Current job (written under 'm' before the workers are woken)
+    uint32_t*       target = nullptr;
+    int             stride = 0;
+    const uint32_t* bg = nullptr;
+    int             bgW = 0, bgH = 0;
+    DrawFn          draw = nullptr;
+    std::atomic<int> nextTile{ 0 };
+
+    // Pool
+    int                       threadCount;   // participants including the caller
+    std::vector<std::thread>  workers;
+    FramebufferBackend*       fbs = nullptr; // one per participant
+    std::mutex                m;
+    std::condition_variable   wake, done;
+    unsigned                  generation = 0;
+    int                       busy = 0;
+    bool                      quitting = false;
+
+    static bool push(Bin& b, const Item& it) {
+        if (b.count == b.cap) {
+            int newCap = b.cap ? b.cap * 2 : 16;
+            void* nb = std::realloc(b.items, size_t(newCap) * sizeof(Item));
+            if (!nb) return false;
+            b.items = (Item*)nb;
+            b.cap = newCap;
+        }
+        b.items[b.count++] = it;
+        return true;
+    }
+
+    void start() {
+        fbs = new FramebufferBackend[threadCount];
+        for (int i = 1; i < threadCount; ++i)
+            workers.emplace_back(&TileRenderer::workerLoop, this, i);
+    }
+
+    void workerLoop(int slot) {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(m);
+                wake.wait(lk, [&] { return quitting || generation != seen; });
+                if (quitting) return;
+                seen = generation;
+            }
+            drawTiles(fbs[slot]);
+            {
+                std::lock_guard<std::mutex> lk(m);
+                if (--busy == 0) done.notify_one();
+            }
+        }
+    }
+
+    void drawTiles(FramebufferBackend& fb) {
+        RenderBackend* prev = gRender;
+        gRender = &fb;
+        fb.attach(target, width, height, stride);
+
+        const int tiles = cols * rows;
+        for (int t = nextTile.fetch_add(1); t < tiles; t = nextTile.fetch_add(1)) {
+            int x = (t % cols) * TILE, y = (t / cols) * TILE;
+            RECT clip = makeRect(x, y, x + TILE - 1, y + TILE - 1);
+            fb.setClip(&clip);
+
+            fb.clear(WHITE);
+            if (bg) fb.blit(bg, bgW, bgH, bgW);
+
+            fb.setRop(R2_COPYPEN);
+            fb.setLineColor(BLACK);
+            fb.setLineStyle(0);
+            const Bin& b = bins[t];
+            for (int i = 0; i < b.count; ++i) draw(b.items[i].tag, b.items[i].index);
+        }
+
+        fb.release();
+        gRender = prev;
+    }
+
+public:
+    // threads = 0 uses every hardware thread. Workers start on first render().
+    explicit TileRenderer(int threads = 0) {
+        if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+        threadCount = (threads > 0) ? threads : 1;
+    }
+
+    ~TileRenderer() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+        delete[] fbs;
+        for (int i = 0; i < binCap; ++i) std::free(bins[i].items);
+        std::free(bins);
+    }
+
+    // Start a new frame of w x h pixels; empties every bin (keeps capacity)
+    bool begin(int w, int h) {
+        width = w; height = h;
+        cols = (w + TILE - 1) / TILE;
+        rows = (h + TILE - 1) / TILE;
+        if (cols * rows > binCap) {
+            void* nb = std::realloc(bins, size_t(cols) * rows * sizeof(Bin));
+            if (!nb) { cols = rows = 0; return false; }
+            bins = (Bin*)nb;
+            for (int i = binCap; i < cols * rows; ++i) bins[i] = { nullptr, 0, 0 };
+            binCap = cols * rows;
+        }
+        for (int i = 0; i < cols * rows; ++i) bins[i].count = 0;
+        return true;
+    }
+
+    // Add an item; calls must come in z order (bottom first). False if a bin
+    // couldn't grow: the frame is incomplete, so don't render() it.
+    bool add(int tag, size_t index, RECT bounds) {
+        if (!rectClip(bounds, width, height)) return true;
+        Item it = { tag, index };
+        for (int r = bounds.top / TILE; r <= bounds.bottom / TILE; ++r)
+            for (int c = bounds.left / TILE; c <= bounds.right / TILE; ++c)
+                if (!push(bins[r * cols + c], it)) return false;
+        return true;
+    }
+
+    // Rasterize every tile into 'pixels' (row stride in pixels): white, then
+    // the optional background image at (0, 0), then the binned items.
+    // Blocks until all tiles are done.
+    void render(uint32_t* pixels, int pixelStride,
+                const uint32_t* background, int backgroundW, int backgroundH, DrawFn fn) {
+        if (!fbs) start();
+        {
+            std::lock_guard<std::mutex> lk(m);
+            target = pixels;
+            stride = pixelStride;
+            bg = background;
+            bgW = backgroundW;
+            bgH = backgroundH;
+            draw = fn;
+            nextTile = 0;
+            busy = int(workers.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        drawTiles(fbs[0]);   // the caller is participant 0
+
+        std::unique_lock<std::mutex> lk(m);
+        done.wait(lk, [&] { return busy == 0; });
+    }
+};
@@ -1,10 +1,12 @@
 ﻿#pragma once
-#include <graphics.h>
-#include <windows.h>    // COLORREF
+#include "RenderBackend.h"
 #include <cmath>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 #include "LineUtils.h"
+#include "RectUtils.h"
 
 // Globals owned by main.cpp
 extern bool     fillEnabled;
@@ -13,16 +15,17 @@ extern COLORREF currentFillColor;
 
 class TriangleTool {
 private:
-    // pointers
-    POINT* p1 = nullptr;
-    POINT* p2 = nullptr;
-    POINT* p3 = nullptr;
+    // In-progress vertices (by value; pointCount says how many are set)
+    POINT p1 = { 0, 0 };
+    POINT p2 = { 0, 0 };
+    POINT p3 = { 0, 0 };
+    int   pointCount = 0;
 
-    // Stored triangle
+    // Stored triangle (vertices inline: one record, no per-vertex allocation)
     struct StyledTriangle {
-        POINT* a;
-        POINT* b;
-        POINT* c;
+        POINT    a;
+        POINT    b;
+        POINT    c;
         int      style;       // 0 = solid, 1 = dashed
         bool     fill;        // draw filled polygon or not
         int      z;           // creation order
@@ -33,9 +36,11 @@ private:
     StyledTriangle* triangles = nullptr;
     int triangleCount = 0;
     int capacity = 0;
+    bool borrowed = false;   // triangles points into a mapped document (read-only)
 
     void ensureCapacity(int need) {
         if (capacity >= need) return;
+        if (!ownRecords()) return;
         int newCap = capacity ? capacity * 2 : 16;
         if (newCap < need) newCap = need;
         void* nb = std::realloc(triangles, size_t(newCap) * sizeof(StyledTriangle));
@@ -46,24 +51,20 @@ private:
 
 public:
     ~TriangleTool() {
-        reset();
-        for (int i = 0; i < triangleCount; ++i) {
-            delete triangles[i].a;
-            delete triangles[i].b;
-            delete triangles[i].c;
-        }
-        std::free(triangles);
+        if (!borrowed) std::free(triangles);
     }
 
     // --- Input handling ---
 
     void addPoint(POINT p) {
-        if (!p1)       p1 = new POINT{ p.x, p.y };
-        else if (!p2)  p2 = new POINT{ p.x, p.y };
-        else if (!p3)  p3 = new POINT{ p.x, p.y };
+        if (pointCount == 0)      p1 = p;
+        else if (pointCount == 1) p2 = p;
+        else if (pointCount == 2) p3 = p;
+        else return;
+        ++pointCount;
     }
 
-    bool isReady() const { return p1 && p2 && p3; }
+    bool isReady() const { return pointCount == 3; }
 
     // Commit current triangle and clear in-progress points
     // Final draw is COPY mode; force BLACK edges; save/restore state.
@@ -71,38 +72,36 @@ public:
         if (!isReady()) return;
 
         // Save global state
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setrop2(R2_COPYPEN);  // never XOR on final draw
+        gRender->setRop(R2_COPYPEN);  // never XOR on final draw
 
         if (fill) {
-            POINT pts[3] = { *p1, *p2, *p3 };
-            setfillcolor(currentFillColor);
-            solidpolygon(pts, 3);
+            gRender->setFillColor(currentFillColor);
+            gRender->solidTriangle(p1, p2, p3);
         }
 
         // Force a deterministic edge color (BLACK), then draw edges
-        setlinecolor(BLACK);
-        drawCustomLine(*p1, *p2, style);
-        drawCustomLine(*p2, *p3, style);
-        drawCustomLine(*p3, *p1, style);
+        gRender->setLineColor(BLACK);
+        drawCustomLine(p1, p2, style);
+        drawCustomLine(p2, p3, style);
+        drawCustomLine(p3, p1, style);
 
         // Restore state
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
 
         // Store the committed triangle
         ensureCapacity(triangleCount + 1);
         if (capacity >= triangleCount + 1) {
             triangles[triangleCount] = { p1, p2, p3, *style, fill, ++gZCounter, currentFillColor };
             ++triangleCount;
-            p1 = p2 = p3 = nullptr; // ownership transferred
         }
 
-        reset(); // paranoia
+        reset();
     }
 
     // --- Z / Drawing API ---
@@ -111,34 +110,34 @@ public:
 
     int getZ(size_t i) const { return (i < getCount()) ? triangles[i].z : 0; }
 
-    // Draw a stored triangle (also preserves global colors and ROP)
+    RECT getBounds(size_t i) const {
+        if (i >= getCount()) return makeRect(0, 0, -1, -1);
+        const auto& t = triangles[i];
+        RECT r = segmentBounds(t.a, t.b, 1);
+        rectUnion(r, segmentBounds(t.c, t.c, 1));
+        return r;
+    }
+
+    // Draw a stored triangle. Sets COPY, fill and line color and leaves them
+    // set; the caller owns the render state around a batch of items.
     void drawAt(size_t i) const {
         if (i >= getCount()) return;
 
         const auto& t = triangles[i];
 
-        COLORREF oldFill = getfillcolor();
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
-
-        setrop2(R2_COPYPEN); // final render: copy, not XOR
+        gRender->setRop(R2_COPYPEN); // final render: copy, not XOR
 
         if (t.fill) {
-            POINT pts[3] = { *t.a, *t.b, *t.c };
-            setfillcolor(t.fillColor);
-            solidpolygon(pts, 3);
+            gRender->setFillColor(t.fillColor);
+            gRender->solidTriangle(t.a, t.b, t.c);
         }
 
         // Force BLACK for edges so UI colors don't leak in
-        setlinecolor(BLACK);
+        gRender->setLineColor(BLACK);
         int st = t.style;
-        drawCustomLine(*t.a, *t.b, &st);
-        drawCustomLine(*t.b, *t.c, &st);
-        drawCustomLine(*t.c, *t.a, &st);
-
-        setrop2(oldRop);
-        setfillcolor(oldFill);
-        setlinecolor(oldLine);
+        drawCustomLine(t.a, t.b, &st);
+        drawCustomLine(t.b, t.c, &st);
+        drawCustomLine(t.c, t.a, &st);
     }
 
     void drawCompleted() const {
@@ -147,66 +146,164 @@ public:
 
     // Preview current triangle (fixed LIGHTGRAY + XOR)
     void drawPreview(POINT mouse, int* style) const {
-        COLORREF oldLine = getlinecolor();
-        int      oldRop = getrop2();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
 
-        setlinecolor(LIGHTGRAY);
-        setrop2(R2_XORPEN);
+        gRender->setLineColor(LIGHTGRAY);
+        gRender->setRop(R2_XORPEN);
 
-        if (p1 && p2 && !p3) {
-            drawCustomLine(*p1, *p2, style);
-            drawCustomLine(*p2, mouse, style);
-            drawCustomLine(mouse, *p1, style);
+        if (pointCount == 2) {
+            drawCustomLine(p1, p2, style);
+            drawCustomLine(p2, mouse, style);
+            drawCustomLine(mouse, p1, style);
         }
-        else if (p1 && !p2) {
-            drawCustomLine(*p1, mouse, style);
+        else if (pointCount == 1) {
+            drawCustomLine(p1, mouse, style);
         }
 
-        setrop2(oldRop);
-        setlinecolor(oldLine);
+        gRender->setRop(oldRop);
+        gRender->setLineColor(oldLine);
+    }
+
+    // Area drawPreview() touches (empty if nothing is previewed)
+    RECT previewBounds(POINT mouse) const {
+        if (pointCount == 1) return segmentBounds(p1, mouse, 1);
+        if (pointCount != 2) return makeRect(0, 0, -1, -1);
+        RECT r = segmentBounds(p1, p2, 1);
+        rectUnion(r, segmentBounds(mouse, mouse, 1));
+        return r;
     }
 
     void reset() {
-        delete p1; delete p2; delete p3;
-        p1 = p2 = p3 = nullptr;
+        pointCount = 0;
     }
 
     void resetAll() {
         reset();
-        for (int i = 0; i < triangleCount; ++i) {
-            delete triangles[i].a;
-            delete triangles[i].b;
-            delete triangles[i].c;
-        }
-        std::free(triangles);
+        if (!borrowed) std::free(triangles);
         triangles = nullptr;
+        borrowed = false;
         capacity = 0;
         triangleCount = 0;
     }
 
-    // --- Right click Deletion ---
+    // ---- Bulk access (document save/load) ----
+    typedef StyledTriangle Record;
+    const Record* records() const { return triangles; }
+
+    // Drop everything and make room for n (> 0) records, marked
+    // as used; the caller fills them. nullptr if they can't be allocated.
+    Record* replaceRecords(size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return nullptr;
+        ensureCapacity(int(n));
+        if (capacity < int(n)) return nullptr;
+        triangleCount = int(n);
+        return triangles;
+    }
+
+    // Append one record as is (journal replay); its z must be above every stored z
+    bool appendRecord(const Record& r) {
+        ensureCapacity(triangleCount + 1);
+        if (capacity < triangleCount + 1) return false;
+        triangles[triangleCount++] = r;
+        return true;
+    }
+
+    // Use n records stored elsewhere (a mapped document) in place. The storage
+    // must stay valid until the next resetAll()/replaceRecords()/ownRecords();
+    // the first edit copies it to the heap.
+    void borrowRecords(const Record* r, size_t n) {
+        resetAll();
+        if (n == 0 || n > size_t(INT_MAX)) return;
+        triangles = const_cast<Record*>(r);
+        triangleCount = capacity = int(n);
+        borrowed = true;
+    }
+
+    // Copy borrowed records to the heap. False if out of memory.
+    bool ownRecords() {
+        if (!borrowed) return true;
+        void* nb = std::malloc(size_t(triangleCount) * sizeof(Record));
+        if (!nb) return false;
+        std::memcpy(nb, triangles, size_t(triangleCount) * sizeof(Record));
+        triangles = (Record*)nb;
+        capacity = triangleCount;
+        borrowed = false;
+        return true;
+    }
+
+    // Exchange stored records with another tool (undo keeps whole scenes
+    // this way); in-progress input stays where it is
+    void swapRecords(TriangleTool& o) {
+        std::swap(triangles, o.triangles);
+        std::swap(triangleCount, o.triangleCount);
+        std::swap(capacity, o.capacity);
+        std::swap(borrowed, o.borrowed);
+    }
 
-    bool deleteTriangleNear(POINT mouse, int threshold = 10) {
-        for (int i = 0; i < triangleCount; ++i) {
-            if (pointNearSegment(mouse, *triangles[i].a, *triangles[i].b, threshold) ||
-                pointNearSegment(mouse, *triangles[i].b, *triangles[i].c, threshold) ||
-                pointNearSegment(mouse, *triangles[i].c, *triangles[i].a, threshold)) {
+    // --- Right-click removal (main.cpp finds candidates through the spatial index) ---
 
-                delete triangles[i].a;
-                delete triangles[i].b;
-                delete triangles[i].c;
+    // First index whose z is >= z (items are z-sorted)
+    size_t lowerBoundZ(int z) const {
+        size_t lo = 0, hi = getCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (triangles[mid].z < z) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
 
-                if (i < triangleCount - 1) {
-                    std::memmove(&triangles[i],
-                        &triangles[i + 1],
-                        size_t(triangleCount - i - 1) * sizeof(StyledTriangle));
-                }
+    // Index of the item with this z, or getCount() if absent
+    size_t findZ(int z) const {
+        size_t i = lowerBoundZ(z);
+        return (i < getCount() && triangles[i].z == z) ? i : getCount();
+    }
+
+    // Is mouse within threshold of any edge of triangle i?
+    bool hitTest(size_t i, POINT mouse, int threshold = 10) const {
+        if (i >= getCount()) return false;
+        const auto& t = triangles[i];
+        return pointNearSegment(mouse, t.a, t.b, threshold) ||
+               pointNearSegment(mouse, t.b, t.c, threshold) ||
+               pointNearSegment(mouse, t.c, t.a, threshold);
+    }
+
+    // Removes every item whose z is listed in zs (ascending) with a single
+    // order-preserving compaction pass starting at the first match.
+    // Returns how many items were removed.
+    size_t eraseZs(const int* zs, size_t n) {
+        if (n == 0) return 0;
+        if (!ownRecords()) return 0;
+        size_t w = lowerBoundZ(zs[0]);
+        size_t k = 0;
+        for (size_t r = w; r < getCount(); ++r) {
+            while (k < n && zs[k] < triangles[r].z) ++k;
+            if (k < n && zs[k] == triangles[r].z) { ++k; continue; }
+            triangles[w++] = triangles[r];
+        }
+        size_t removed = getCount() - w;
+        triangleCount = int(w);
+        return removed;
+    }
 
-                --triangleCount;
-                return true;
-            }
+    // Put back records taken out by eraseZs() (ascending z, none of them
+    // stored), each at its place in z order. Only the records above the
+    // lowest inserted z move. False if out of memory.
+    bool insertRecords(const Record* r, size_t n) {
+        if (n == 0) return true;
+        if (n > size_t(INT_MAX - triangleCount)) return false;
+        ensureCapacity(triangleCount + int(n));
+        if (capacity < triangleCount + int(n)) return false;
+        size_t lo = lowerBoundZ(r[0].z);
+        size_t src = getCount(), dst = getCount() + n, k = n;
+        while (k > 0) {
+            if (src > lo && triangles[src - 1].z > r[k - 1].z) triangles[--dst] = triangles[--src];
+            else triangles[--dst] = r[--k];
         }
-        return false;
+        triangleCount += int(n);
+        return true;
     }
 
 private:
@@ -0,0 +1,755 @@
+#pragma once
+#include <windows.h>
+#include <cstdint>
+#include <cstdlib>      // malloc, realloc, free
+#include <cstring>
+#include <new>          // nothrow
+#include "DocumentIO.h"
+#include "Journal.h"
+#include "RectUtils.h"
+#include "SpatialIndex.h"
+
+// Undo/redo as a command log. Every committed edit is logged as a small
+// command that can take itself back out of the tools and put itself back:
+//
+//   H_ADD       a shape record (by z); the record is held while undone
+//   H_STROKE    a freehand stroke (by z); stroke and vertices held while undone
+//   H_CAPSULES  one eraser stroke's capsules (the newest 'count')
+//   H_ERASE     right-click deleted records, held to put them back
+//   H_SWAP      a whole scene (tools and background) replaced by Clear, a
+//               whole-scene bake or opening an image; undo swaps it back
+//   H_BAKE      records a raster erase drew into a rectangle of the
+//               background layer; undo puts them back and swaps the
+//               rectangle's old pixels in (or drops a layer the bake made)
+//
+// Undone adds are always the newest items of their tool, so undo and redo
+// only move the records involved, never the rest of the scene. Each step is
+// journaled like any other edit; a swap as a J_SWAP of its entry's slot,
+// which the journal's replay holds the other scene in, and J_DROP once the
+// entry is forgotten. The shape hit-test index (DocScene::index) is updated
+// for the records a step moves; a swap exchanges it with the saved scene's.
+//
+// The canvas comes back from raster checkpoints: a copy of the composited
+// canvas taken every CHECKPOINT_EVERY commands. restoreCanvas() copies the
+// newest checkpoint at or before the current state and reports what is left
+// to redraw: items above the checkpoint's z (UI: appendToCanvas) and the
+// area H_ERASE and H_BAKE commands since then changed (UI: a dirty repair).
+// A scene swap in between makes a checkpoint useless.
+//
+// Memory is capped twice. Checkpoints over their budget are thinned (the one
+// whose neighbours are closest goes), so coverage degrades evenly instead
+// of ending abruptly. The log over its budget forgets its oldest commands.
+class UndoHistory {
+public:
+    static const int CHECKPOINT_EVERY = 32;
+
+private:
+    enum Op : uint8_t { H_ADD, H_STROKE, H_CAPSULES, H_ERASE, H_SWAP, H_BAKE };
+
+    typedef DocSavedScene SavedScene;
+
+    struct Entry {
+        uint8_t     op;
+        uint8_t     section;   // DocSectionId of the records (H_ADD, H_ERASE)
+        bool        joined;    // undone and redone together with the entry before it
+        int         z;         // H_ADD, H_STROKE: the item's z
+        uint32_t    slot;      // H_SWAP: journal slot of the other scene
+        size_t      count;     // H_ADD, H_CAPSULES, H_ERASE: records
+        RECT        bounds;    // H_ERASE: area the removed records covered; H_BAKE: layer rectangle
+        void*       payload;   // records held outside the scene; H_BAKE: the rectangle's other pixels
+        size_t      bytes;     // payload (or H_SWAP scene) size
+        SavedScene* scene;     // H_SWAP: the other side of the swap; H_BAKE: the baked records
+        SpatialGrid* index;    // H_SWAP: its hit-test index, or nullptr
+        bool        indexStale;
+        int         layerW, layerH;   // H_BAKE: size of the layer it made (0: there was one)
+    };
+
+    struct Checkpoint {
+        uint64_t  seq;      // state it shows
+        int       z;        // highest z in the scene: items above it are not on it
+        uint32_t* pixels;
+        int       w, h;
+    };
+
+    // States are numbered by commands applied since the history started.
+    // Command q (state q - 1 -> q) is entries[head + q - firstSeq - 1].
+    Entry*   entries = nullptr;
+    size_t   head = 0, entryCount = 0, entryCap = 0;
+    uint64_t firstSeq = 0;     // oldest reachable state
+    uint64_t cur = 0;          // current state
+
+    Checkpoint* cps = nullptr; // ascending seq
+    size_t      cpCount = 0, cpCap = 0;
+
+    Journal& journal;
+    uint32_t nextSlot = 1;
+
+    size_t checkpointBudget, logBudget;
+    size_t checkpointBytes = 0, logBytes = 0;
+
+    int*   zbuf = nullptr;     // scratch z list for eraseZs/journal
+    size_t zbufCap = 0;
+
+    Entry& at(uint64_t seq) { return entries[head + size_t(seq - firstSeq - 1)]; }
+    const Entry& at(uint64_t seq) const { return entries[head + size_t(seq - firstSeq - 1)]; }
+    uint64_t lastSeq() const { return firstSeq + entryCount; }
+
+    // ---- Log ----
+
+    void freeEntry(Entry& e) {
+        std::free(e.payload);
+        if (e.op == H_SWAP) journal.dropScene(e.slot);
+        delete e.scene;
+        delete e.index;
+        logBytes -= sizeof(Entry) + e.bytes;
+    }
+
+    bool hold(Entry& e, const void* a, size_t an, const void* b = nullptr, size_t bn = 0) {
+        void* p = std::malloc(an + bn);
+        if (!p) return false;
+        std::memcpy(p, a, an);
+        if (bn) std::memcpy((uint8_t*)p + an, b, bn);
+        e.payload = p;
+        e.bytes = an + bn;
+        logBytes += e.bytes;
+        return true;
+    }
+
+    void release(Entry& e) {
+        std::free(e.payload);
+        logBytes -= e.bytes;
+        e.payload = nullptr;
+        e.bytes = 0;
+    }
+
+    // Forget every undone command (a new edit replaces them)
+    void truncateRedo() {
+        while (lastSeq() > cur) {
+            freeEntry(at(lastSeq()));
+            --entryCount;
+        }
+        while (cpCount > 0 && cps[cpCount - 1].seq > cur) dropCheckpoint(cpCount - 1);
+    }
+
+    // Forget the oldest commands (whole joined groups) while over budget
+    void trimLog() {
+        while (logBytes > logBudget && firstSeq < cur) {
+            do {
+                freeEntry(entries[head]);
+                ++head;
+                --entryCount;
+                ++firstSeq;
+            } while (firstSeq < cur && at(firstSeq + 1).joined);
+        }
+        while (cpCount > 0 && cps[0].seq < firstSeq) dropCheckpoint(0);
+    }
+
+    bool push(const Entry& e) {
+        truncateRedo();
+        if (head + entryCount == entryCap) {
+            if (head > 0 && head * 2 >= entryCap) {
+                std::memmove(entries, entries + head, entryCount * sizeof(Entry));
+                head = 0;
+            }
+            else {
+                size_t newCap = entryCap ? entryCap * 2 : 256;
+                void* nb = std::realloc(entries, newCap * sizeof(Entry));
+                if (!nb) return false;
+                entries = (Entry*)nb;
+                entryCap = newCap;
+            }
+        }
+        entries[head + entryCount++] = e;
+        ++cur;
+        logBytes += sizeof(Entry) + e.bytes;
+        trimLog();
+        return true;
+    }
+
+    static Entry makeEntry(Op op, int section, bool joined) {
+        Entry e = {};
+        e.op = op;
+        e.section = uint8_t(section);
+        e.joined = joined;
+        return e;
+    }
+
+    int* zScratch(size_t n) {
+        if (n > zbufCap) {
+            void* nb = std::realloc(zbuf, n * sizeof(int));
+            if (!nb) return nullptr;
+            zbuf = (int*)nb;
+            zbufCap = n;
+        }
+        return zbuf;
+    }
+
+    // ---- Steps ----
+
+    // Index (or unindex) the records with these z, with the bounds the tool
+    // reports for them now
+    template <class T>
+    static void indexZs(T* tool, const DocScene& s, int section, const int* zs, size_t n, bool add) {
+        if (!s.index || s.indexStale) return;
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = tool->findZ(zs[k]);
+            if (i == tool->getCount()) continue;
+            if (add) s.index->insert(section, zs[k], tool->getBounds(i));
+            else s.index->remove(section, zs[k], tool->getBounds(i));
+        }
+    }
+
+    // H_ADD and H_ERASE on one shape tool. Undoing an add and redoing an
+    // erase take records out; the other two put them back.
+    template <class T>
+    bool stepShape(T* tool, Entry& e, DocScene& s, Journal& j, bool undo) {
+        typedef typename T::Record R;
+        if ((e.op == H_ADD) == undo) {
+            if (e.op == H_ADD) {
+                size_t i = tool->findZ(e.z);
+                if (i == tool->getCount() || !hold(e, &tool->records()[i], sizeof(R))) return false;
+            }
+            int* zs = zScratch(e.count);
+            if (!zs) return false;
+            for (size_t k = 0; k < e.count; ++k) zs[k] = ((const R*)e.payload)[k].z;
+            indexZs(tool, s, e.section, zs, e.count, false);
+            tool->eraseZs(zs, e.count);
+            j.erase(e.section, zs, e.count);
+        }
+        else {
+            int* zs = zScratch(e.count);
+            if (!zs || !tool->insertRecords((const R*)e.payload, e.count)) return false;
+            for (size_t k = 0; k < e.count; ++k) zs[k] = ((const R*)e.payload)[k].z;
+            indexZs(tool, s, e.section, zs, e.count, true);
+            j.add(e.section, e.payload, e.bytes);
+            if (e.op == H_ADD) release(e);
+        }
+        return true;
+    }
+
+    bool stepStroke(FreehandTool* tool, Entry& e, Journal& j, bool undo) {
+        typedef FreehandTool::Record R;
+        if (undo) {
+            size_t n = tool->getCount();   // the stroke is the newest one
+            if (n == 0 || tool->getZ(n - 1) != e.z) return false;
+            const R& s = tool->records()[n - 1];
+            if (!hold(e, &s, sizeof(R), tool->pointPool() + s.first, size_t(s.count) * sizeof(POINT))) return false;
+            tool->eraseZs(&e.z, 1);
+            j.erase(DOC_FHST, &e.z, 1);
+        }
+        else {
+            const R& s = *(const R*)e.payload;
+            const POINT* pts = (const POINT*)((const uint8_t*)e.payload + sizeof(R));
+            if (!tool->appendStroke(s, pts)) return false;
+            j.addStroke(s, pts);
+            release(e);
+        }
+        return true;
+    }
+
+    bool stepCapsules(EraserTool* tool, Entry& e, Journal& j, bool undo) {
+        typedef EraserTool::Record R;
+        if (undo) {
+            size_t n = tool->getCount();   // the stroke's capsules are the newest ones
+            if (n < e.count) return false;
+            const R* r = tool->records() + (n - e.count);
+            int* zs = zScratch(e.count);
+            if (!zs || !hold(e, r, e.count * sizeof(R))) return false;
+            for (size_t k = 0; k < e.count; ++k) zs[k] = r[k].z;
+            tool->eraseZs(zs, e.count);
+            j.erase(DOC_ERAS, zs, e.count);
+        }
+        else {
+            if (!tool->appendRecords((const R*)e.payload, e.count)) return false;
+            j.addCapsules((const R*)e.payload, e.count);
+            release(e);
+        }
+        return true;
+    }
+
+    static size_t sceneBytes(const SavedScene& sc) {
+        return sc.freehand.getCount() * sizeof(FreehandTool::Record) +
+               sc.freehand.pointPoolSize() * sizeof(POINT) +
+               sc.line.getCount() * sizeof(LineTool::Record) +
+               sc.triangle.getCount() * sizeof(TriangleTool::Record) +
+               sc.square.getCount() * sizeof(SquareTool::Record) +
+               sc.circle.getCount() * sizeof(CircleTool::Record) +
+               sc.oval.getCount() * sizeof(OvalTool::Record) +
+               sc.eraser.getCount() * sizeof(EraserTool::Record) +
+               size_t(sc.bgWidth) * sc.bgHeight * sizeof(uint32_t);
+    }
+
+    static void swapTools(SavedScene& sc, DocScene& s) {
+        s.freehand->swapRecords(sc.freehand);
+        s.line->swapRecords(sc.line);
+        s.triangle->swapRecords(sc.triangle);
+        s.square->swapRecords(sc.square);
+        s.circle->swapRecords(sc.circle);
+        s.oval->swapRecords(sc.oval);
+        s.eraser->swapRecords(sc.eraser);
+    }
+
+    // H_SWAP, either way: exchange the live scene with the saved one
+    bool stepSwap(Entry& e, DocScene& s, Journal& j) {
+        if (!docSwapScene(*e.scene, s)) return false;
+        if (s.index && e.index) {
+            s.index->swap(*e.index);
+            std::swap(s.indexStale, e.indexStale);
+        }
+        else if (s.index) s.indexStale = true;
+        logBytes -= e.bytes;
+        e.bytes = sceneBytes(*e.scene);
+        logBytes += e.bytes;
+        j.swapScene(e.slot);
+        return true;
+    }
+
+    // Put records held in 'saved' back into a tool, or take them out again
+    template <class T>
+    bool putBaked(T* tool, const T& saved, DocScene& s, int section, Journal& j) {
+        size_t n = saved.getCount();
+        if (n == 0) return true;
+        int* zs = zScratch(n);
+        if (!zs || !tool->insertRecords(saved.records(), n)) return false;
+        for (size_t k = 0; k < n; ++k) zs[k] = saved.records()[k].z;
+        indexZs(tool, s, section, zs, n, true);
+        j.add(section, saved.records(), n * sizeof(typename T::Record));
+        return true;
+    }
+
+    bool putBaked(FreehandTool* tool, const FreehandTool& saved, DocScene&, int, Journal& j) {
+        size_t n = saved.getCount();
+        if (!tool->insertStrokes(saved.records(), n, saved.pointPool())) return false;
+        for (size_t k = 0; k < n; ++k)
+            j.addStroke(saved.records()[k], saved.pointPool() + saved.records()[k].first);
+        return true;
+    }
+
+    bool putBaked(EraserTool* tool, const EraserTool& saved, DocScene&, int, Journal& j) {
+        if (!tool->insertRecords(saved.records(), saved.getCount())) return false;
+        j.addCapsules(saved.records(), saved.getCount());
+        return true;
+    }
+
+    template <class T>
+    bool takeBaked(T* tool, const T& saved, DocScene& s, int section, Journal& j) {
+        size_t n = saved.getCount();
+        if (n == 0) return true;
+        int* zs = zScratch(n);
+        if (!zs) return false;
+        for (size_t k = 0; k < n; ++k) zs[k] = saved.records()[k].z;
+        if (section != DOC_FHST && section != DOC_ERAS) indexZs(tool, s, section, zs, n, false);
+        tool->eraseZs(zs, n);
+        j.erase(section, zs, n);
+        return true;
+    }
+
+    // Exchange rectangle r of the live layer with the pixels in px (packed)
+    static void swapRect(DocScene& s, RECT r, uint32_t* px) {
+        uint32_t* layer = const_cast<uint32_t*>(s.background);   // from allocBackground
+        int w = r.right - r.left + 1;
+        for (int y = r.top; y <= r.bottom; ++y) {
+            uint32_t* a = layer + size_t(y) * s.bgWidth + r.left;
+            uint32_t* b = px + size_t(y - r.top) * w;
+            for (int x = 0; x < w; ++x) std::swap(a[x], b[x]);
+        }
+    }
+
+    // H_BAKE. Undo puts the records back and the rectangle's old pixels (or
+    // no layer at all); redo takes them out and brings the baked pixels back.
+    bool stepBake(Entry& e, DocScene& s, Journal& j, bool undo) {
+        SavedScene& sc = *e.scene;
+        RECT r = e.bounds;
+        int w = r.right - r.left + 1, h = r.bottom - r.top + 1;
+        size_t bytes = size_t(w) * h * sizeof(uint32_t);
+        if (undo) {
+            if (!s.background || r.right >= s.bgWidth || r.bottom >= s.bgHeight) return false;
+            if (e.layerW) {   // keep the baked pixels for redo, then drop the layer
+                if (!e.payload) {
+                    e.payload = std::malloc(bytes);
+                    if (!e.payload) return false;
+                    e.bytes += bytes;
+                    logBytes += bytes;
+                }
+                for (int y = 0; y < h; ++y)
+                    std::memcpy((uint32_t*)e.payload + size_t(y) * w,
+                        s.background + size_t(r.top + y) * s.bgWidth + r.left, size_t(w) * sizeof(uint32_t));
+            }
+            if (!putBaked(s.freehand, sc.freehand, s, DOC_FHST, j) ||
+                !putBaked(s.line, sc.line, s, DOC_LINE, j) ||
+                !putBaked(s.triangle, sc.triangle, s, DOC_TRI, j) ||
+                !putBaked(s.square, sc.square, s, DOC_SQR, j) ||
+                !putBaked(s.circle, sc.circle, s, DOC_CIRC, j) ||
+                !putBaked(s.oval, sc.oval, s, DOC_OVAL, j) ||
+                !putBaked(s.eraser, sc.eraser, s, DOC_ERAS, j)) return false;
+            if (e.layerW) {
+                s.background = nullptr;
+                s.bgWidth = s.bgHeight = 0;
+                j.background(nullptr, 0, 0);
+            }
+            else {
+                swapRect(s, r, (uint32_t*)e.payload);
+                j.backgroundRect(s.background, s.bgWidth, s.bgHeight, r);
+            }
+        }
+        else {
+            if (e.layerW) {
+                uint32_t* px = (e.payload && s.allocBackground) ? s.allocBackground(e.layerW, e.layerH) : nullptr;
+                if (!px) return false;
+                for (size_t i = 0, n = size_t(e.layerW) * e.layerH; i < n; ++i) px[i] = 0xFFFFFF;
+                for (int y = 0; y < h; ++y)
+                    std::memcpy(px + size_t(r.top + y) * e.layerW + r.left,
+                        (const uint32_t*)e.payload + size_t(y) * w, size_t(w) * sizeof(uint32_t));
+                s.background = px;
+                s.bgWidth = e.layerW;
+                s.bgHeight = e.layerH;
+            }
+            else {
+                if (!s.background || r.right >= s.bgWidth || r.bottom >= s.bgHeight) return false;
+                swapRect(s, r, (uint32_t*)e.payload);
+            }
+            j.backgroundRect(s.background, s.bgWidth, s.bgHeight, r);
+            if (!takeBaked(s.freehand, sc.freehand, s, DOC_FHST, j) ||
+                !takeBaked(s.line, sc.line, s, DOC_LINE, j) ||
+                !takeBaked(s.triangle, sc.triangle, s, DOC_TRI, j) ||
+                !takeBaked(s.square, sc.square, s, DOC_SQR, j) ||
+                !takeBaked(s.circle, sc.circle, s, DOC_CIRC, j) ||
+                !takeBaked(s.oval, sc.oval, s, DOC_OVAL, j) ||
+                !takeBaked(s.eraser, sc.eraser, s, DOC_ERAS, j)) return false;
+        }
+        return true;
+    }
+
+    bool step(Entry& e, DocScene& s, Journal& j, bool undo) {
+        switch (e.op) {
+        case H_ADD:
+        case H_ERASE:
+            switch (e.section) {
+            case DOC_LINE: return stepShape(s.line, e, s, j, undo);
+            case DOC_TRI:  return stepShape(s.triangle, e, s, j, undo);
+            case DOC_SQR:  return stepShape(s.square, e, s, j, undo);
+            case DOC_CIRC: return stepShape(s.circle, e, s, j, undo);
+            case DOC_OVAL: return stepShape(s.oval, e, s, j, undo);
+            default:       return false;
+            }
+        case H_STROKE:   return stepStroke(s.freehand, e, j, undo);
+        case H_CAPSULES: return stepCapsules(s.eraser, e, j, undo);
+        case H_SWAP:     return stepSwap(e, s, j);
+        case H_BAKE:     return stepBake(e, s, j, undo);
+        default:         return false;
+        }
+    }
+
+    template <class T>
+    bool holdZs(T* tool, Entry& e, const int* zs, size_t n) {
+        typedef typename T::Record R;
+        R* r = (R*)std::malloc(n * sizeof(R));
+        if (!r) return false;
+        size_t m = 0;
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = tool->findZ(zs[k]);
+            if (i < tool->getCount()) r[m++] = tool->records()[i];
+        }
+        e.payload = r;
+        e.count = m;
+        e.bytes = m * sizeof(R);
+        return true;
+    }
+
+    // Copy the records with these z from a live tool into a saved one
+    template <class T>
+    static bool holdBaked(const T* tool, T& saved, const int* zs, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = tool->findZ(zs[k]);
+            if (i < tool->getCount() && !saved.insertRecords(&tool->records()[i], 1)) return false;
+        }
+        return true;
+    }
+
+    static bool holdBaked(const FreehandTool* tool, FreehandTool& saved, const int* zs, size_t n) {
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = tool->findZ(zs[k]);
+            if (i == tool->getCount()) continue;
+            const FreehandTool::Record& st = tool->records()[i];
+            if (!saved.insertStrokes(&st, 1, tool->pointPool() + st.first)) return false;
+        }
+        return true;
+    }
+
+    // ---- Checkpoints ----
+
+    void dropCheckpoint(size_t i) {
+        std::free(cps[i].pixels);
+        checkpointBytes -= size_t(cps[i].w) * cps[i].h * sizeof(uint32_t);
+        std::memmove(cps + i, cps + i + 1, (cpCount - i - 1) * sizeof(Checkpoint));
+        --cpCount;
+    }
+
+    // Newest checkpoint state 'seq' can be redrawn from: at or before it with
+    // no scene swap in between. -1 if there is none.
+    long usableCheckpoint(uint64_t seq) const {
+        for (size_t i = cpCount; i-- > 0;) {
+            if (cps[i].seq > seq) continue;
+            for (uint64_t q = seq; q > cps[i].seq; --q)
+                if (at(q).op == H_SWAP) return -1;   // older checkpoints are behind it too
+            return long(i);
+        }
+        return -1;
+    }
+
+    // Over budget: drop the checkpoint (other than 'keep') whose neighbours
+    // are closest together, until back under it
+    void thinCheckpoints(size_t keep) {
+        while (checkpointBytes > checkpointBudget && cpCount > 1) {
+            size_t best = cpCount;
+            uint64_t bestGap = 0;
+            for (size_t i = 0; i < cpCount; ++i) {
+                if (i == keep) continue;
+                uint64_t prev = (i > 0) ? cps[i - 1].seq : firstSeq;
+                uint64_t next = (i + 1 < cpCount) ? cps[i + 1].seq : lastSeq();
+                if (best == cpCount || next - prev < bestGap) { best = i; bestGap = next - prev; }
+            }
+            dropCheckpoint(best);
+            if (best < keep) --keep;
+        }
+    }
+
+public:
+    // checkpointBudget: bytes of canvas copies; logBudget: bytes the command
+    // log may hold (records and scenes kept for undo). Undo and redo steps
+    // are journaled to 'journal'.
+    UndoHistory(Journal& journal, size_t checkpointBudget, size_t logBudget)
+        : journal(journal), checkpointBudget(checkpointBudget), logBudget(logBudget) {}
+
+    ~UndoHistory() {
+        reset();
+        std::free(entries);
+        std::free(cps);
+        std::free(zbuf);
+    }
+
+    UndoHistory(const UndoHistory&) = delete;
+    UndoHistory& operator=(const UndoHistory&) = delete;
+
+    void setBudget(size_t checkpoints, size_t log) {
+        checkpointBudget = checkpoints;
+        logBudget = log;
+        trimLog();
+        thinCheckpoints(cpCount);
+    }
+
+    // Forget everything (the current scene becomes the oldest state)
+    void reset() {
+        for (size_t i = 0; i < entryCount; ++i) freeEntry(entries[head + i]);
+        head = entryCount = 0;
+        firstSeq = cur;
+        while (cpCount > 0) dropCheckpoint(cpCount - 1);
+    }
+
+    bool canUndo() const { return cur > firstSeq; }
+    bool canRedo() const { return cur < lastSeq(); }
+
+    // ---- Logging: call right after the edit (before it for erasing/replacing) ----
+
+    // A shape record with this z was committed
+    void added(int section, int z) {
+        Entry e = makeEntry(H_ADD, section, false);
+        e.z = z;
+        e.count = 1;
+        push(e);
+    }
+
+    // A freehand stroke with this z was finished
+    void addedStroke(int z) {
+        Entry e = makeEntry(H_STROKE, DOC_FHST, false);
+        e.z = z;
+        push(e);
+    }
+
+    // An eraser stroke added the newest n capsules
+    void addedCapsules(size_t n) {
+        if (n == 0) return;
+        Entry e = makeEntry(H_CAPSULES, DOC_ERAS, false);
+        e.count = n;
+        push(e);
+    }
+
+    // The records with these z (ascending) are about to be deleted from a shape
+    // tool; 'bounds' covers them. 'joined' undoes it with the previous command.
+    void erasing(DocScene& s, int section, const int* zs, size_t n, RECT bounds, bool joined) {
+        Entry e = makeEntry(H_ERASE, section, joined);
+        e.bounds = bounds;
+        bool ok = false;
+        switch (section) {
+        case DOC_LINE: ok = holdZs(s.line, e, zs, n);     break;
+        case DOC_TRI:  ok = holdZs(s.triangle, e, zs, n); break;
+        case DOC_SQR:  ok = holdZs(s.square, e, zs, n);   break;
+        case DOC_CIRC: ok = holdZs(s.circle, e, zs, n);   break;
+        case DOC_OVAL: ok = holdZs(s.oval, e, zs, n);     break;
+        }
+        if (ok && e.count == 0) { std::free(e.payload); return; }   // nothing stored under those z
+        if (!ok || !push(e)) { std::free(e.payload); reset(); }
+    }
+
+    // The scene is about to be replaced: takes every record out of the tools
+    // (they are left empty) and copies the background. Tools must own their
+    // records (nothing borrowed from a mapped document).
+    void replacing(DocScene& s, bool joined) {
+        Entry e = makeEntry(H_SWAP, 0, joined);
+        e.scene = new (std::nothrow) SavedScene;
+        if (e.scene) {
+            e.scene->background = docCopyBackground(s);
+            if (!e.scene->background && s.background && s.bgWidth > 0 && s.bgHeight > 0) {
+                delete e.scene;
+                e.scene = nullptr;
+            }
+        }
+        if (!e.scene) { reset(); return; }
+        if (e.scene->background) {
+            e.scene->bgWidth = s.bgWidth;
+            e.scene->bgHeight = s.bgHeight;
+        }
+        swapTools(*e.scene, s);
+        e.bytes = sceneBytes(*e.scene);
+        if (s.index) {   // the live index goes with the scene; the tools are empty now
+            e.index = new (std::nothrow) SpatialGrid(s.index->width(), s.index->height());
+            if (e.index && e.index->width() == s.index->width()) {
+                s.index->swap(*e.index);
+                e.indexStale = s.indexStale;
+            }
+            else {
+                delete e.index;
+                e.index = nullptr;
+                s.index->clear();
+            }
+            s.indexStale = false;
+        }
+        e.slot = nextSlot++;
+        journal.swapScene(e.slot);
+        if (!push(e)) {
+            journal.dropScene(e.slot);
+            delete e.scene;
+            delete e.index;
+            reset();
+        }
+    }
+
+    // The records with these z (per DocSectionId, ascending) are about to be
+    // drawn into rectangle 'area' (inclusive) of the background layer and taken out of
+    // their tools. If s has no layer, a white layerW x layerH one is made for
+    // it. Call before changing anything; the caller journals the bake.
+    void baking(DocScene& s, const int* const* zs, const size_t* n, RECT area,
+                int layerW, int layerH, bool joined) {
+        Entry e = makeEntry(H_BAKE, 0, joined);
+        e.bounds = area;
+        e.scene = new (std::nothrow) SavedScene;
+        bool ok = e.scene != nullptr;
+        if (ok && s.background) {
+            int w = area.right - area.left + 1, h = area.bottom - area.top + 1;
+            e.payload = std::malloc(size_t(w) * h * sizeof(uint32_t));
+            ok = e.payload && area.right < s.bgWidth && area.bottom < s.bgHeight;
+            for (int y = 0; ok && y < h; ++y)
+                std::memcpy((uint32_t*)e.payload + size_t(y) * w,
+                    s.background + size_t(area.top + y) * s.bgWidth + area.left, size_t(w) * sizeof(uint32_t));
+            e.bytes = size_t(w) * h * sizeof(uint32_t);
+        }
+        else {
+            e.layerW = layerW;
+            e.layerH = layerH;
+        }
+        ok = ok && holdBaked(s.freehand, e.scene->freehand, zs[DOC_FHST], n[DOC_FHST]) &&
+                   holdBaked(s.line, e.scene->line, zs[DOC_LINE], n[DOC_LINE]) &&
+                   holdBaked(s.triangle, e.scene->triangle, zs[DOC_TRI], n[DOC_TRI]) &&
+                   holdBaked(s.square, e.scene->square, zs[DOC_SQR], n[DOC_SQR]) &&
+                   holdBaked(s.circle, e.scene->circle, zs[DOC_CIRC], n[DOC_CIRC]) &&
+                   holdBaked(s.oval, e.scene->oval, zs[DOC_OVAL], n[DOC_OVAL]) &&
+                   holdBaked(s.eraser, e.scene->eraser, zs[DOC_ERAS], n[DOC_ERAS]);
+        if (ok) e.bytes += sceneBytes(*e.scene);
+        if (!ok || !push(e)) {
+            std::free(e.payload);
+            delete e.scene;
+            reset();
+        }
+    }
+
+    // ---- Undo / redo: step the scene (tools and background of 's') ----
+    // Returns true if the scene changed; s.background/bgWidth/bgHeight then
+    // describe the live background. On a failure part way (out of memory) the
+    // history is dropped.
+
+    bool undo(DocScene& s) {
+        if (!canUndo()) return false;
+        for (;;) {
+            Entry& e = at(cur);
+            if (!step(e, s, journal, true)) { reset(); return true; }
+            --cur;
+            if (!e.joined || cur == firstSeq) return true;
+        }
+    }
+
+    bool redo(DocScene& s) {
+        if (!canRedo()) return false;
+        do {
+            if (!step(at(cur + 1), s, journal, false)) { reset(); return true; }
+            ++cur;
+        } while (cur < lastSeq() && at(cur + 1).joined);
+        return true;
+    }
+
+    // ---- Canvas checkpoints ----
+
+    // The current state is due a checkpoint
+    bool needsCheckpoint() const {
+        if (checkpointBudget == 0) return false;
+        long c = usableCheckpoint(cur);
+        return c < 0 || cur - cps[c].seq >= uint64_t(CHECKPOINT_EVERY);
+    }
+
+    // Copy the composited canvas (w x h, tightly packed) for the current state.
+    // topZ is the highest z in the scene; not gZCounter, which redone items
+    // sit below.
+    void checkpoint(const uint32_t* px, int w, int h, int topZ) {
+        size_t bytes = size_t(w) * h * sizeof(uint32_t);
+        if (w <= 0 || h <= 0 || bytes > checkpointBudget) return;
+
+        size_t i = cpCount;
+        while (i > 0 && cps[i - 1].seq >= cur) --i;
+        if (i < cpCount && cps[i].seq == cur) dropCheckpoint(i);   // stale copy of this state
+
+        if (cpCount == cpCap) {
+            size_t newCap = cpCap ? cpCap * 2 : 16;
+            void* nb = std::realloc(cps, newCap * sizeof(Checkpoint));
+            if (!nb) return;
+            cps = (Checkpoint*)nb;
+            cpCap = newCap;
+        }
+        uint32_t* copy = (uint32_t*)std::malloc(bytes);
+        if (!copy) return;
+        std::memcpy(copy, px, bytes);
+
+        std::memmove(cps + i + 1, cps + i, (cpCount - i) * sizeof(Checkpoint));
+        cps[i] = { cur, topZ, copy, w, h };
+        ++cpCount;
+        checkpointBytes += bytes;
+        thinCheckpoints(i);
+    }
+
+    // Bring the canvas (w x h, tightly packed) back to the current state from
+    // a checkpoint. On success *canvasZ is the checkpoint's z (everything above
+    // it still has to be drawn) and *dirty, if *hasDirty, has to be repaired.
+    // False if no checkpoint fits: rebuild the canvas instead.
+    bool restoreCanvas(uint32_t* px, int w, int h, int* canvasZ, RECT* dirty, bool* hasDirty) const {
+        long c = usableCheckpoint(cur);
+        if (c < 0 || cps[c].w != w || cps[c].h != h) return false;
+        std::memcpy(px, cps[c].pixels, size_t(w) * h * sizeof(uint32_t));
+        *canvasZ = cps[c].z;
+        *hasDirty = false;
+        for (uint64_t q = cps[c].seq + 1; q <= cur; ++q) {
+            const Entry& e = at(q);
+            if (e.op != H_ERASE && e.op != H_BAKE) continue;
+            if (*hasDirty) rectUnion(*dirty, e.bounds);
+            else { *dirty = e.bounds; *hasDirty = true; }
+        }
+        return true;
+    }
+};
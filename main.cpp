@@ -1,10 +1,14 @@
-﻿#include <graphics.h>
+#include <graphics.h>
 #include <conio.h>
 #include <windows.h>
 #include <commdlg.h>    // file dialogs
+#include <timeapi.h>    // timeBeginPeriod
+#include <tchar.h>
+#include <chrono>
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include "LineTool.h"
 #include "TriangleTool.h"
 #include "SquareTool.h"
@@ -12,14 +16,28 @@
 #include "OvalTool.h"
 #include "FreehandTool.h"
 #include "EraserTool.h"
+#include "RectUtils.h"
+#include "SpatialIndex.h"
+#include "EasyXBackend.h"
+#include "FramebufferBackend.h"
+#include "RenderBatch.h"
+#include "TileRenderer.h"
+#include "InputCapture.h"
+#include "DocumentIO.h"
+#include "MappedFile.h"
+#include "Journal.h"
+#include "ImageExport.h"
+#include "UndoHistory.h"
+#include "CanvasCompositor.h"
+
+#pragma comment(lib, "winmm.lib")   // timeBeginPeriod
 
 // defining min and max
 static inline int iabs(int v) { return (v < 0) ? -v : v; }
 static inline int iRound(float v) { return (int)(v + (v >= 0.0f ? 0.5f : -0.5f)); }
 
-void rebuildCanvas();
+static void historyReplacing(bool joined);
 
-enum Tool { TOOL_FREEHAND, TOOL_LINE, TOOL_TRIANGLE, TOOL_SQUARE, TOOL_CIRCLE, TOOL_OVAL, TOOL_ERASER };
 Tool currentTool = TOOL_FREEHAND;
 
 FreehandTool freehandTool;
@@ -30,23 +48,66 @@ CircleTool   circleTool;
 OvalTool     ovalTool;
 EraserTool   eraserTool;
 
+// Bounding boxes of the deletable shapes (line..oval), tagged with their
+// DocSectionId (toolSection) so the undo history can keep them in step
+SpatialGrid  gShapeIndex(800, 600);
+bool         gShapeIndexStale = false;    // rebuilt on the next pick (after loading a document)
+static const int kDeleteThreshold = 10;   // right-click pick radius (pixels)
+
 int  solidMode = 0;
 int  dashedMode = 1;
 int* currentLineMode = &solidMode;
 
 // Defind global variables
 bool     fillEnabled = true;                        // toggle
+bool     rasterErase = false;                       // toggle: bake finished eraser strokes into the background
 int      gZCounter = 0;                             // z-order counter (tools extern this)
 COLORREF currentFillColor = RGB(200, 220, 255);     // palette-selected (tools may extern this)
 
 
 IMAGE gCanvas;                  
-bool  gNeedsRebuild = true;
+bool  gNeedsRebuild = true;     // full rebuild (deletions, loads, clears)
+int   gCanvasZ = 0;             // highest z already composited into gCanvas
+RECT  gDirty;                   // region to repaint after deletions
+bool  gHasDirty = false;
 
 // Background layer loaded from disk
 IMAGE gBackground;
 bool  gHasBackground = false;
 
+// Mapped .dpad document; the tools borrow their records from it until edited
+MappedFile gDocMap;
+
+// Autosave: every commit is journaled next to the working directory
+static const TCHAR* kAutosaveBase = _T("drawpad-autosave");
+Journal gJournal;
+ImageExporter gExport;      // PNG/BMP encoding off the UI thread
+
+// Undo/redo: command log plus canvas checkpoints, each under a memory budget
+static const size_t kUndoCheckpointBudget = size_t(64) << 20;   // ~33 canvases of 800x600
+static const size_t kUndoLogBudget = size_t(256) << 20;
+UndoHistory gHistory(gJournal, kUndoCheckpointBudget, kUndoLogBudget);
+
+// Tool drawing goes through gRender: GDI for the window, and either the CPU
+// rasterizer (over gCanvas's pixel buffer) or GDI for canvas compositing.
+EasyXBackend       gEasyX;
+FramebufferBackend gCanvasFb;
+thread_local RenderBackend* gRender = &gEasyX;
+RenderBatch        gCanvasBatch;            // canvas draws go through it (drops redundant state)
+bool               gSoftwareCanvas = true;
+TileRenderer       gTiles;                  // parallel full rebuilds (software canvas only)
+
+// Present damage: window areas that changed since the last present
+RECT gPresentDamage;            // gCanvas pixels changed
+bool gHasPresentDamage = false;
+bool gFullPresent = true;       // whole window (first frame, rebuilds, clears)
+bool gToolbarDirty = true;      // toolbar / palette need repainting
+
+// Frame pacing: present at most gTargetHz times a second, or right after every
+// input batch in low-latency mode ('L' toggles)
+int  gTargetHz = 60;
+bool gLowLatency = false;
+
 static inline bool ImageReady(const IMAGE* img) {
     return img && img->getwidth() > 0 && img->getheight() > 0;
 }
@@ -65,6 +126,9 @@ static const RECT BTN_SOLID_DASH = { 10, 45, 110, 75 };
 static const RECT BTN_FILL_TOG = { 120, 45, 220, 75 };
 static const RECT BTN_SAVE = { 230, 45, 330, 75 };
 static const RECT BTN_LOAD = { 340, 45, 440, 75 };
+static const RECT BTN_ERASE_MODE = { 450, 45, 550, 75 };
+static const RECT BTN_UNDO = { 560, 45, 630, 75 };
+static const RECT BTN_REDO = { 640, 45, 710, 75 };
 
 // color creation
 static const COLORREF kPalette[] = {
@@ -100,6 +164,7 @@ static bool ShowSaveDialog(TCHAR* outPath, DWORD outPathCount) {
     ofn.hwndOwner = GetHWnd();
     ofn.lpstrFilter =
         _T("PNG Images (*.png)\0*.png\0")
+        _T("Drawing Pad Documents (*.dpad)\0*.dpad\0")
         _T("Bitmap Images (*.bmp)\0*.bmp\0")
         _T("JPEG Images (*.jpg;*.jpeg)\0*.jpg;*.jpeg\0")
         _T("All Files (*.*)\0*.*\0");
@@ -116,6 +181,7 @@ static bool ShowOpenDialog(TCHAR* outPath, DWORD outPathCount) {
     ofn.hwndOwner = GetHWnd();
     ofn.lpstrFilter =
         _T("Image Files (*.png;*.bmp;*.jpg;*.jpeg)\0*.png;*.bmp;*.jpg;*.jpeg\0")
+        _T("Drawing Pad Documents (*.dpad)\0*.dpad\0")
         _T("All Files (*.*)\0*.*\0");
     ofn.lpstrFile = outPath;
     ofn.nMaxFile = (DWORD)outPathCount;
@@ -124,38 +190,208 @@ static bool ShowOpenDialog(TCHAR* outPath, DWORD outPathCount) {
 }
 
 
+// Drop every committed item (and its index entries)
+static void resetAllTools() {
+    freehandTool.resetAll();
+    lineTool.resetAll();
+    triangleTool.resetAll();
+    squareTool.resetAll();
+    circleTool.resetAll();
+    ovalTool.resetAll();
+    eraserTool.resetAll();
+    gShapeIndex.clear();
+    gShapeIndexStale = false;
+    gDocMap.close();   // nothing borrows from it any more
+}
+
+// Journal a scene reset to just the current background layer
+static void journalReset() {
+    gJournal.clear();
+    if (gHasBackground && ImageReady(&gBackground))
+        gJournal.background((const uint32_t*)GetImageBuffer(&gBackground),
+                            gBackground.getwidth(), gBackground.getheight());
+}
+
+// Raster erase fallback: flatten everything composited so far into
+// gBackground and drop the vector items (undo swaps the scene back). Used
+// when the layer isn't canvas-sized or records are still mapped.
+static void flattenIntoBackground(bool joined) {
+    updateCanvas();
+    historyReplacing(joined);
+    gBackground = gCanvas;
+    gHasBackground = ImageReady(&gBackground);
+    resetAllTools();
+    journalReset();
+    gCanvasZ = gZCounter;
+}
+
+// .dpad files hold the vector scene (DocumentIO.h); anything else is a raster
+static bool hasExtension(const TCHAR* path, const TCHAR* ext) {
+    const TCHAR* dot = _tcsrchr(path, _T('.'));
+    return dot && _tcsicmp(dot, ext) == 0;
+}
+
+static bool isDocumentPath(const TCHAR* path) { return hasExtension(path, _T(".dpad")); }
+
+static DocScene sceneForIO() {
+    DocScene s = {};
+    s.freehand = &freehandTool;
+    s.line = &lineTool;
+    s.triangle = &triangleTool;
+    s.square = &squareTool;
+    s.circle = &circleTool;
+    s.oval = &ovalTool;
+    s.eraser = &eraserTool;
+    s.zCounter = gZCounter;
+    s.index = &gShapeIndex;
+    s.indexStale = gShapeIndexStale;
+    return s;
+}
+
+static uint32_t* allocBackground(int w, int h) {
+    gBackground.Resize(w, h);
+    if (gBackground.getwidth() != w || gBackground.getheight() != h) return nullptr;
+    return (uint32_t*)GetImageBuffer(&gBackground);
+}
+
+// sceneForIO() plus the live background layer
+static DocScene sceneWithBackground() {
+    DocScene s = sceneForIO();
+    s.allocBackground = allocBackground;
+    if (gHasBackground && ImageReady(&gBackground)) {
+        s.background = (const uint32_t*)GetImageBuffer(&gBackground);
+        s.bgWidth = gBackground.getwidth();
+        s.bgHeight = gBackground.getheight();
+    }
+    return s;
+}
+
+// Copy every borrowed record to the heap and unmap the document, so the file
+// can be overwritten
+static bool releaseDocMap() {
+    if (!gDocMap.isOpen()) return true;
+    bool ok = freehandTool.ownRecords() && lineTool.ownRecords() &&
+              triangleTool.ownRecords() && squareTool.ownRecords() &&
+              circleTool.ownRecords() && ovalTool.ownRecords() && eraserTool.ownRecords();
+    if (ok) gDocMap.close();
+    return ok;
+}
+
+// Hand the whole scene to the undo history before it is replaced (the
+// tools come back empty). If it can't be kept, the history is dropped.
+static void historyReplacing(bool joined) {
+    if (!releaseDocMap()) { gHistory.reset(); return; }
+    DocScene s = sceneWithBackground();
+    gHistory.replacing(s, joined);
+    gShapeIndexStale = s.indexStale;
+}
+
+static void SaveDocument(const TCHAR* path) {
+    if (!releaseDocMap()) {
+        MessageBox(GetHWnd(), _T("Not enough memory to save the drawing."), _T("Save"), MB_OK | MB_ICONERROR);
+        return;
+    }
+    DocScene s = sceneWithBackground();
+    gJournal.waitBase();   // the journal may still be copying the file loaded last
+
+    FILE* f = nullptr;
+    bool ok = _tfopen_s(&f, path, _T("wb")) == 0 && f;
+    if (ok) {
+        ok = saveDocument(f, s);
+        ok = (std::fclose(f) == 0) && ok;
+    }
+    if (!ok) MessageBox(GetHWnd(), _T("Could not save the drawing."), _T("Save"), MB_OK | MB_ICONERROR);
+}
+
+static void LoadDocument(const TCHAR* path) {
+    gHistory.reset();  // a document starts a new history
+    resetAllTools();   // also unmaps the previous document
+    gHasBackground = false;
+    DocScene s = sceneForIO();
+    s.allocBackground = allocBackground;
+
+    // Map the file and draw from its records in place; read it if that fails.
+    // The records are checked by worker threads while the rest is set up.
+    DocCheck check;
+    bool mapped = gDocMap.open(path) && mapDocument(gDocMap.data(), gDocMap.size(), s, &check);
+    bool ok = mapped && check.wait();
+    if (mapped && !ok) resetAllTools();   // also unmaps it
+    if (!mapped) {
+        gDocMap.close();
+        FILE* f = nullptr;
+        if (_tfopen_s(&f, path, _T("rb")) != 0 || !f) {
+            MessageBox(GetHWnd(), _T("Could not open the drawing."), _T("Load"), MB_OK | MB_ICONERROR);
+            gNeedsRebuild = true;
+            return;
+        }
+        ok = loadDocument(f, s);
+        std::fclose(f);
+    }
+
+    if (ok) {
+        gZCounter = s.zCounter;
+        gHasBackground = s.bgWidth > 0 && ImageReady(&gBackground);
+        gShapeIndexStale = true;   // built on the first right-click instead of now
+        gJournal.rebase(path);
+    }
+    else {
+        gJournal.clear();
+        MessageBox(GetHWnd(), _T("Not a valid drawing file (or it is damaged)."), _T("Load"), MB_OK | MB_ICONERROR);
+    }
+    gNeedsRebuild = true;
+}
+
+// Bring back the scene the autosave journal holds (before journaling starts)
+static void recoverAutosave() {
+    resetAllTools();
+    gHasBackground = false;
+    DocScene s = sceneForIO();
+    s.allocBackground = allocBackground;
+    uint32_t gen = 0;
+    Journal::recover(kAutosaveBase, s, &gen);
+    gZCounter = s.zCounter;
+    gHasBackground = s.bgWidth > 0 && ImageReady(&gBackground);
+    gShapeIndexStale = true;
+    gNeedsRebuild = true;
+}
+
 static void SaveCanvasToFile() {
     TCHAR path[MAX_PATH] = _T("");
     if (!ShowSaveDialog(path, MAX_PATH)) return;
-
-    if (!ImageReady(&gCanvas)) {
-        getimage(&gCanvas, 0, 0, 800, 600);
-        SetWorkingImage(&gCanvas);
-        setbkcolor(WHITE);
-        cleardevice();
-        SetWorkingImage();
+    if (isDocumentPath(path)) { SaveDocument(path); return; }
+
+    if (!ImageReady(&gCanvas)) createCanvas();
+    updateCanvas();
+
+    // PNG/BMP are encoded from a copy on the export thread; other formats go
+    // through EasyX, which must stay on this thread
+    bool png = hasExtension(path, _T(".png"));
+    if (png || hasExtension(path, _T(".bmp"))) {
+        if (gExport.busy()) {
+            MessageBox(GetHWnd(), _T("An export is still running."), _T("Save"), MB_OK | MB_ICONINFORMATION);
+            return;
+        }
+        if (!gExport.start(path, png ? ImageExporter::EXPORT_PNG : ImageExporter::EXPORT_BMP,
+                           (const uint32_t*)GetImageBuffer(&gCanvas),
+                           gCanvas.getwidth(), gCanvas.getheight(), gCanvas.getwidth()))
+            MessageBox(GetHWnd(), _T("Not enough memory to export the image."), _T("Save"), MB_OK | MB_ICONERROR);
+        return;
     }
-    if (gNeedsRebuild) rebuildCanvas();
-
     saveimage(path, &gCanvas);  // saves background + shapes
 }
 
 static void LoadCanvasFromFile() {
     TCHAR path[MAX_PATH] = _T("");
     if (!ShowOpenDialog(path, MAX_PATH)) return;
+    if (isDocumentPath(path)) { LoadDocument(path); return; }
 
+    historyReplacing(false);   // undo brings the previous scene back
     loadimage(&gBackground, path);
     gHasBackground = ImageReady(&gBackground);
 
     // Reset model so the scene equals background
-    freehandTool.resetAll();
-    lineTool.resetAll();
-    triangleTool.resetAll();
-    squareTool.resetAll();
-    circleTool.resetAll();
-    ovalTool.resetAll();
-    eraserTool.resetAll();
-
+    resetAllTools();
+    journalReset();
 
     gNeedsRebuild = true; 
 }
@@ -206,6 +442,18 @@ void drawToolbar() {
     solidrectangle(BTN_LOAD.left, BTN_LOAD.top, BTN_LOAD.right, BTN_LOAD.bottom);
     outtextxy(BTN_LOAD.left + 28, BTN_LOAD.top + 7, _T("Load"));
 
+    // Eraser mode toggle (vector replay vs. raster bake)
+    setfillcolor(rasterErase ? RGB(255, 220, 180) : RGB(255, 255, 255));
+    solidrectangle(BTN_ERASE_MODE.left, BTN_ERASE_MODE.top, BTN_ERASE_MODE.right, BTN_ERASE_MODE.bottom);
+    outtextxy(BTN_ERASE_MODE.left + 10, BTN_ERASE_MODE.top + 7, rasterErase ? _T("Erase:Ras") : _T("Erase:Vec"));
+
+    // Undo / Redo buttons (also Ctrl+Z / Ctrl+Y)
+    setfillcolor(RGB(200, 220, 255));
+    solidrectangle(BTN_UNDO.left, BTN_UNDO.top, BTN_UNDO.right, BTN_UNDO.bottom);
+    outtextxy(BTN_UNDO.left + 15, BTN_UNDO.top + 7, _T("Undo"));
+    solidrectangle(BTN_REDO.left, BTN_REDO.top, BTN_REDO.right, BTN_REDO.bottom);
+    outtextxy(BTN_REDO.left + 15, BTN_REDO.top + 7, _T("Redo"));
+
     // Palette
     drawPalette();
 }
@@ -232,341 +480,680 @@ bool handlePaletteClick(int mx, int my) {
     return false;
 }
 
-// -------------------- Render model rebuild -------------------
-struct RenderRef { int z; Tool tool; size_t index; };
-static inline bool byZ(const RenderRef& a, const RenderRef& b) { return a.z < b.z; }
-
-void rebuildCanvas() {
-    // Ensure canvas exists
-    if (!ImageReady(&gCanvas)) {
-        getimage(&gCanvas, 0, 0, 800, 600);
-        SetWorkingImage(&gCanvas);
-        setbkcolor(WHITE);
-        cleardevice();
-        SetWorkingImage();
-    }
+// -------------------- Canvas device (CanvasCompositor.h) -------------------
+bool canvasReady() { return ImageReady(&gCanvas); }
+int  canvasWidth() { return gCanvas.getwidth(); }
+int  canvasHeight() { return gCanvas.getheight(); }
 
+void createCanvas() {
+    getimage(&gCanvas, 0, 0, 800, 600);
     SetWorkingImage(&gCanvas);
-    // Start clean
     setbkcolor(WHITE);
     cleardevice();
+    SetWorkingImage();
+}
 
-    // 1) Background layer (if any)
-    if (gHasBackground && ImageReady(&gBackground)) {
-        putimage(0, 0, &gBackground);
+// Point gRender at gCanvas (or the background layer) through gCanvasBatch
+// until endCanvas()
+void beginCanvas(bool background) {
+    IMAGE* target = background ? &gBackground : &gCanvas;
+    if (gSoftwareCanvas) {
+        GdiFlush();   // finish pending GDI work on the DIB before touching its pixels
+        gCanvasFb.attach((uint32_t*)GetImageBuffer(target), target->getwidth(), target->getheight(), target->getwidth());
+        gCanvasBatch.begin(&gCanvasFb);
     }
+    else {
+        SetWorkingImage(target);
+        gCanvasBatch.begin(&gEasyX);
+    }
+    gRender = &gCanvasBatch;
+}
 
-    // 2) Vector model on top
-    setrop2(R2_COPYPEN);
-    setlinecolor(BLACK);
+void endCanvas() {
+    gRender->setClip(nullptr);
+    gCanvasBatch.end();
+    gRender = &gEasyX;
+    SetWorkingImage();
+}
 
-    std::vector<RenderRef> refs;
-    refs.reserve(
-        freehandTool.getCount() + lineTool.getCount() +
-        triangleTool.getCount() + squareTool.getCount() +
-        circleTool.getCount() + ovalTool.getCount() +
-        eraserTool.getCount()
-    );
-
-    for (size_t i = 0; i < freehandTool.getCount(); ++i) refs.push_back({ (int)freehandTool.getZ(i), TOOL_FREEHAND, i });
-    for (size_t i = 0; i < lineTool.getCount(); ++i)      refs.push_back({ (int)lineTool.getZ(i), TOOL_LINE, i });
-    for (size_t i = 0; i < triangleTool.getCount(); ++i)  refs.push_back({ (int)triangleTool.getZ(i), TOOL_TRIANGLE, i });
-    for (size_t i = 0; i < squareTool.getCount(); ++i)    refs.push_back({ (int)squareTool.getZ(i), TOOL_SQUARE, i });
-    for (size_t i = 0; i < circleTool.getCount(); ++i)    refs.push_back({ (int)circleTool.getZ(i), TOOL_CIRCLE, i });
-    for (size_t i = 0; i < ovalTool.getCount(); ++i)      refs.push_back({ (int)ovalTool.getZ(i), TOOL_OVAL, i });
-    for (size_t i = 0; i < eraserTool.getCount(); ++i)    refs.push_back({ (int)eraserTool.getZ(i), TOOL_ERASER, i });
-
-    std::sort(refs.begin(), refs.end(), byZ);
-
-    for (const auto& r : refs) {
-        switch (r.tool) {
-        case TOOL_FREEHAND: freehandTool.drawAt(r.index); break;
-        case TOOL_LINE:     lineTool.drawAt(r.index);     break;
-        case TOOL_TRIANGLE: triangleTool.drawAt(r.index); break;
-        case TOOL_SQUARE:   squareTool.drawAt(r.index);   break;
-        case TOOL_CIRCLE:   circleTool.drawAt(r.index);   break;
-        case TOOL_OVAL:     ovalTool.drawAt(r.index);     break;
-        case TOOL_ERASER:   eraserTool.drawAt(r.index);   break;
-        default: break;
-        }
+// Background (or white) under the current clip of the canvas target
+void paintCanvasBase(const RECT& area) {
+    bool bg = gHasBackground && ImageReady(&gBackground);
+    if (gSoftwareCanvas) {
+        gCanvasFb.clear(WHITE);
+        if (bg) gCanvasFb.blit((const uint32_t*)GetImageBuffer(&gBackground),
+                               gBackground.getwidth(), gBackground.getheight(), gBackground.getwidth());
+        return;
     }
+    setbkcolor(WHITE);
+    clearrectangle(area.left, area.top, area.right, area.bottom);
+    if (bg) putimage(area.left, area.top, area.right - area.left + 1, area.bottom - area.top + 1,
+                     &gBackground, area.left, area.top);
+}
 
-    SetWorkingImage();
-    gNeedsRebuild = false;
+// Full rebuilds go to the tile pool, straight into gCanvas's pixels
+bool rebuildCanvasTiled() {
+    if (!gSoftwareCanvas) return false;
+    bool bg = gHasBackground && ImageReady(&gBackground);
+    GdiFlush();
+    return renderTiled(gTiles, (uint32_t*)GetImageBuffer(&gCanvas), gCanvas.getwidth(), gCanvas.getheight(),
+                       bg ? (const uint32_t*)GetImageBuffer(&gBackground) : nullptr,
+                       bg ? gBackground.getwidth() : 0, bg ? gBackground.getheight() : 0);
 }
 
-static bool deleteAnythingAt(POINT mouse) {
-    bool deleted = false;
-    deleted = deleted || lineTool.deleteLineNear(mouse);
-    deleted = deleted || triangleTool.deleteTriangleNear(mouse);
-    deleted = deleted || squareTool.deleteSquareNear(mouse);
-    deleted = deleted || circleTool.deleteCircleNear(mouse);
-    deleted = deleted || ovalTool.deleteOvalNear(mouse);
-    if (deleted) gNeedsRebuild = true;
-    return deleted;
+// Index the newest item of a deletable tool right after it was committed
+static void indexNewest(Tool t) {
+    if (gShapeIndexStale) return;   // the rebuild will pick it up
+    size_t n = toolCount(t);
+    if (n == 0 || toolZ(t, n - 1) != gZCounter) return;   // commit failed to store
+    gShapeIndex.insert(toolSection(t), toolZ(t, n - 1), toolBounds(t, n - 1));
 }
 
-int main() {
-    initgraph(800, 600);
-    setbkcolor(WHITE);
-    cleardevice();
+// Autosave the newest item of a shape tool right after it was committed,
+// and log it for undo
+static void recordNewest(Tool t) {
+    size_t n = toolCount(t);
+    if (n == 0 || toolZ(t, n - 1) != gZCounter) return;   // commit failed to store
+    switch (t) {
+    case TOOL_LINE:     gJournal.add(DOC_LINE, &lineTool.records()[n - 1], sizeof(LineTool::Record));         break;
+    case TOOL_TRIANGLE: gJournal.add(DOC_TRI, &triangleTool.records()[n - 1], sizeof(TriangleTool::Record)); break;
+    case TOOL_SQUARE:   gJournal.add(DOC_SQR, &squareTool.records()[n - 1], sizeof(SquareTool::Record));     break;
+    case TOOL_CIRCLE:   gJournal.add(DOC_CIRC, &circleTool.records()[n - 1], sizeof(CircleTool::Record));    break;
+    case TOOL_OVAL:     gJournal.add(DOC_OVAL, &ovalTool.records()[n - 1], sizeof(OvalTool::Record));        break;
+    default: return;
+    }
+    gHistory.added(toolSection(t), gZCounter);
+}
 
-    // Ensure gCanvas owns a valid bitmap
-    getimage(&gCanvas, 0, 0, 800, 600);
-    SetWorkingImage(&gCanvas);
-    setbkcolor(WHITE);
-    cleardevice();
-    SetWorkingImage();
+// Rebuild the delete-pick index from scratch (after loading a document)
+static void reindexShapes() {
+    gShapeIndex.clear();
+    gShapeIndexStale = false;
+    for (int t = TOOL_LINE; t <= TOOL_OVAL; ++t) {
+        Tool tool = static_cast<Tool>(t);
+        for (size_t i = 0, n = toolCount(tool); i < n; ++i)
+            gShapeIndex.insert(toolSection(tool), toolZ(tool, i), toolBounds(tool, i));
+    }
+}
 
-    setlinecolor(BLACK);
-    settextstyle(16, 0, _T("Consolas"));
-    settextcolor(BLACK);
+static size_t toolFindZ(Tool t, int z) {
+    switch (t) {
+    case TOOL_LINE:     return lineTool.findZ(z);
+    case TOOL_TRIANGLE: return triangleTool.findZ(z);
+    case TOOL_SQUARE:   return squareTool.findZ(z);
+    case TOOL_CIRCLE:   return circleTool.findZ(z);
+    case TOOL_OVAL:     return ovalTool.findZ(z);
+    default:            return toolCount(t);
+    }
+}
 
-    drawToolbarAndResetState();
+static bool toolHitTest(Tool t, size_t i, POINT mouse) {
+    switch (t) {
+    case TOOL_LINE:     return lineTool.hitTest(i, mouse, kDeleteThreshold);
+    case TOOL_TRIANGLE: return triangleTool.hitTest(i, mouse, kDeleteThreshold);
+    case TOOL_SQUARE:   return squareTool.hitTest(i, mouse, kDeleteThreshold);
+    case TOOL_CIRCLE:   return circleTool.hitTest(i, mouse, kDeleteThreshold);
+    case TOOL_OVAL:     return ovalTool.hitTest(i, mouse, kDeleteThreshold);
+    default:            return false;
+    }
+}
 
-    POINT lastPoint = { -1, -1 };
-    bool mouseReleased = true;
-    bool eraserDown = false;
-    int  eraserRadius = 16;
+// Deletes every shape near mouse in one sweep. Candidates come from the grid
+// cells around the cursor; the hits are then removed with one compaction pass
+// per tool and repainted as a single dirty region.
+static bool deleteAllAt(POINT mouse) {
+    struct Hit { int z; RECT box; };
+    static std::vector<Hit> hits[TOOL_COUNT];   // reused across clicks
+    static std::vector<int> zs;
+
+    if (gShapeIndexStale) reindexShapes();
+
+    RECT pick = makeRect(mouse.x - kDeleteThreshold, mouse.y - kDeleteThreshold,
+                         mouse.x + kDeleteThreshold, mouse.y + kDeleteThreshold);
+    bool any = false;
+
+    gShapeIndex.query(pick, [&](int tag, int z) {
+        Tool t = sectionTool(tag);
+        size_t i = toolFindZ(t, z);
+        if (i < toolCount(t) && toolHitTest(t, i, mouse)) {
+            hits[t].push_back({ z, toolBounds(t, i) });
+            any = true;
+        }
+        return true;
+    });
+    if (!any) return false;
+
+    DocScene scene = sceneForIO();
+    bool joined = false;   // one click is one undo step
+    for (int t = 0; t < TOOL_COUNT; ++t) {
+        if (hits[t].empty()) continue;
+        zs.clear();
+        RECT area = hits[t][0].box;
+        for (const Hit& h : hits[t]) {
+            gShapeIndex.remove(toolSection(static_cast<Tool>(t)), h.z, h.box);
+            markDirty(h.box);
+            rectUnion(area, h.box);
+            zs.push_back(h.z);
+        }
+        std::sort(zs.begin(), zs.end());
+        gHistory.erasing(scene, toolSection(static_cast<Tool>(t)), zs.data(), zs.size(), area, joined);
+        joined = true;
+        toolEraseZs(static_cast<Tool>(t), zs.data(), zs.size());
+        gJournal.erase(toolSection(static_cast<Tool>(t)), zs.data(), zs.size());
+        hits[t].clear();
+    }
+    return true;
+}
 
-    bool plusHeld = false, minusHeld = false;
+// Raster erase mode: draw the eraser stroke that just ended (capsules from
+// 'first' on) into gBackground with every item its pixels depend on
+// (selectBake()), and drop those items. Only the rectangle covering the
+// baked items changes, so the cost of a bake follows the stroke, not the
+// drawing. Undo brings the items back.
+static void bakeErasedArea(size_t first) {
+    static std::vector<RenderRef> baked;
+    static std::vector<int> zs[DOC_KNOWN];
+
+    updateCanvas();
+    const int w = gCanvas.getwidth(), h = gCanvas.getheight();
+    bool newLayer = !(gHasBackground && ImageReady(&gBackground));
+    if ((!newLayer && (gBackground.getwidth() != w || gBackground.getheight() != h)) || !releaseDocMap()) {
+        flattenIntoBackground(true);
+        return;
+    }
 
-    // Batch once; flush per frame
-    BeginBatchDraw();
+    RECT area;
+    if (!selectBake(first, w, h, baked, area)) return;
+
+    const int* zp[DOC_KNOWN];
+    size_t zn[DOC_KNOWN];
+    for (int k = 0; k < DOC_KNOWN; ++k) zs[k].clear();
+    for (size_t i = baked.size(); i-- > 0;) zs[toolSection(baked[i].tool)].push_back(baked[i].z);
+    for (int k = 0; k < DOC_KNOWN; ++k) { zp[k] = zs[k].data(); zn[k] = zs[k].size(); }
+    DocScene s = sceneWithBackground();
+    gHistory.baking(s, zp, zn, area, w, h, true);
+
+    if (newLayer) {
+        uint32_t* px = allocBackground(w, h);
+        if (!px) { gHistory.reset(); return; }
+        for (size_t i = 0, n = size_t(w) * h; i < n; ++i) px[i] = WHITE;
+        gHasBackground = true;
+    }
+    drawBaked(baked, area);
+
+    if (!gShapeIndexStale)
+        for (const RenderRef& it : baked)
+            if (it.tool >= TOOL_LINE && it.tool <= TOOL_OVAL)
+                gShapeIndex.remove(toolSection(it.tool), it.z, toolBounds(it.tool, it.index));
+    for (int t = 0; t < TOOL_COUNT; ++t) {
+        const std::vector<int>& z = zs[toolSection(static_cast<Tool>(t))];
+        if (z.empty()) continue;
+        toolEraseZs(static_cast<Tool>(t), z.data(), z.size());
+        gJournal.erase(toolSection(static_cast<Tool>(t)), z.data(), z.size());
+    }
+    gJournal.backgroundRect((const uint32_t*)GetImageBuffer(&gBackground), w, h, area);
+}
+
+// -------------- Input handling --------------
+// Mouse/key events, pumped from EasyX into gInput's queue (client coordinates).
+
+InputCapture gInput;
+
+// Closing the window ends the event loop instead of the process, so the
+// autosave journal gets finished rather than left for recovery. Input
+// messages wake the loop once EasyX has queued them. Runs on EasyX's window
+// thread, so it only touches the event.
+static std::atomic<bool> gQuit(false);
+static WNDPROC gEasyXProc = nullptr;
 
-    while (true) {
-        // Delete on right-click
-        if (GetAsyncKeyState(VK_RBUTTON) & 0x8000) {
-            POINT mouse;
-            GetCursorPos(&mouse);
-            ScreenToClient(GetHWnd(), &mouse);
-            while (deleteAnythingAt(mouse)) {}
-            Sleep(150);
+static LRESULT CALLBACK windowHookProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    if (msg == WM_CLOSE) {
+        gQuit = true;
+        gInput.notify();
+        return 0;
+    }
+    LRESULT r = CallWindowProc(gEasyXProc, hwnd, msg, wp, lp);
+    if ((msg >= WM_MOUSEFIRST && msg <= WM_MOUSELAST) || msg == WM_KEYDOWN || msg == WM_KEYUP) gInput.notify();
+    return r;
+}
+
+static POINT gMouse = { -1, -1 };      // last known cursor position
+static POINT lastPoint = { -1, -1 };   // previous freehand / eraser sample
+static bool  leftDown = false;         // a canvas drag is in progress
+static int   eraserRadius = 16;
+static size_t eraserFirst = 0;         // first capsule of the eraser stroke in progress
+
+// Step the scene back (or forward) one command. The model change only moves
+// the records involved; the canvas comes back from the nearest checkpoint
+// plus the commands after it, or from a full rebuild if none fits.
+static void undoRedo(bool redo) {
+    if (leftDown) return;   // a stroke is still open
+    DocScene s = sceneWithBackground();
+    if (!(redo ? gHistory.redo(s) : gHistory.undo(s))) return;
+
+    gHasBackground = s.bgWidth > 0 && ImageReady(&gBackground);
+    gShapeIndexStale = s.indexStale;   // the steps kept it in step unless it was stale already
+
+    int  z = 0;
+    RECT dirty;
+    bool hasDirty = false;
+    GdiFlush();
+    if (!gNeedsRebuild && ImageReady(&gCanvas) &&
+        gHistory.restoreCanvas((uint32_t*)GetImageBuffer(&gCanvas), gCanvas.getwidth(), gCanvas.getheight(),
+                               &z, &dirty, &hasDirty)) {
+        gCanvasZ = z;   // updateCanvas() draws everything above it
+        if (hasDirty) markDirty(dirty);
+        gFullPresent = true;
+    }
+    else {
+        gNeedsRebuild = true;
+    }
+}
+
+// Toolbar row (y <= 80): tool buttons, Clear, toggles, Save/Load
+static void handleToolbarClick(POINT p) {
+    for (int i = 0; i < 7; ++i) {
+        int L = TB_BTN_X(i), R = L + TB_BTN_W;
+        if (inRect(p.x, p.y, L, TB_Y1, R, TB_Y2)) {
+            currentTool = static_cast<Tool>(i);
+
+            // Popup if eraser selected
+            if (currentTool == TOOL_ERASER) {
+                MessageBox(GetHWnd(), _T("Eraser: click +/- to resize"), _T("Tool Selected"), MB_OK | MB_ICONINFORMATION);
+            }
+            return;
         }
+    }
 
-        // Resizing with +/-
-        SHORT sPlus = GetAsyncKeyState(VK_OEM_PLUS);
-        SHORT sAdd = GetAsyncKeyState(VK_ADD);
-        SHORT sMinus = GetAsyncKeyState(VK_OEM_MINUS);
-        SHORT sSub = GetAsyncKeyState(VK_SUBTRACT);
+    int clearL = 800 - 90, clearR = 799;
+    // Clear
+    if (inRect(p.x, p.y, clearL, TB_Y1, clearR, TB_Y2)) {
+        historyReplacing(false);
+        resetAllTools();
 
-        bool plusNow = (sPlus & 0x8000) || (sAdd & 0x8000);
-        bool minusNow = (sMinus & 0x8000) || (sSub & 0x8000);
+        gHasBackground = false; // also clear background layer
+        gJournal.clear();
 
-        if (plusNow && !plusHeld) {
-            eraserRadius += 2;
-            if (eraserRadius > 100) eraserRadius = 100;
-            eraserTool.setRadius(eraserRadius);
+        SetWorkingImage(&gCanvas);
+        setbkcolor(WHITE);
+        cleardevice();
+        SetWorkingImage();
+
+        gNeedsRebuild = false;
+        gHasDirty = false;
+        gCanvasZ = gZCounter;
+        gFullPresent = true;
+        lastPoint = POINT{ -1, -1 };
+        return;
+    }
+
+    // Solid/Dashed toggle
+    if (inRect(p.x, p.y, BTN_SOLID_DASH.left, BTN_SOLID_DASH.top, BTN_SOLID_DASH.right, BTN_SOLID_DASH.bottom)) {
+        currentLineMode = (*currentLineMode == 0) ? &dashedMode : &solidMode;
+        return;
+    }
+
+    // Fill toggle
+    if (inRect(p.x, p.y, BTN_FILL_TOG.left, BTN_FILL_TOG.top, BTN_FILL_TOG.right, BTN_FILL_TOG.bottom)) {
+        fillEnabled = !fillEnabled;
+        return;
+    }
+
+    // Eraser mode toggle
+    if (inRect(p.x, p.y, BTN_ERASE_MODE.left, BTN_ERASE_MODE.top, BTN_ERASE_MODE.right, BTN_ERASE_MODE.bottom)) {
+        rasterErase = !rasterErase;
+        return;
+    }
+
+    // Undo / Redo
+    if (inRect(p.x, p.y, BTN_UNDO.left, BTN_UNDO.top, BTN_UNDO.right, BTN_UNDO.bottom)) {
+        undoRedo(false);
+        return;
+    }
+    if (inRect(p.x, p.y, BTN_REDO.left, BTN_REDO.top, BTN_REDO.right, BTN_REDO.bottom)) {
+        undoRedo(true);
+        return;
+    }
+
+    // Save
+    if (inRect(p.x, p.y, BTN_SAVE.left, BTN_SAVE.top, BTN_SAVE.right, BTN_SAVE.bottom)) {
+        SaveCanvasToFile();
+        return;
+    }
+
+    // Load
+    if (inRect(p.x, p.y, BTN_LOAD.left, BTN_LOAD.top, BTN_LOAD.right, BTN_LOAD.bottom)) {
+        LoadCanvasFromFile();
+        return;
+    }
+}
+
+static void handleLeftDown(POINT p) {
+    if (p.y <= 80) { handleToolbarClick(p); gToolbarDirty = true; return; }
+    if (handlePaletteClick(p.x, p.y)) { gToolbarDirty = true; return; }
+
+    switch (currentTool) {
+    case TOOL_ERASER:
+        eraserTool.beginStroke(eraserRadius);
+        eraserFirst = eraserTool.getCount();
+        eraserTool.addDab(p);
+        lastPoint = p;
+        leftDown = true;
+        break;
+    case TOOL_FREEHAND:
+        lastPoint = p;
+        leftDown = true;
+        break;
+    case TOOL_LINE:
+        lineTool.addPoint(p);
+        if (lineTool.isReady()) {
+            lineTool.drawAndReset(currentLineMode);
+            indexNewest(TOOL_LINE);
+            recordNewest(TOOL_LINE);
         }
-        if (minusNow && !minusHeld) {
-            eraserRadius -= 2;
-            if (eraserRadius < 1) eraserRadius = 1;
-            eraserTool.setRadius(eraserRadius);
+        break;
+    case TOOL_TRIANGLE:
+        triangleTool.addPoint(p);
+        if (triangleTool.isReady()) {
+            triangleTool.drawAndReset(currentLineMode, fillEnabled);
+            indexNewest(TOOL_TRIANGLE);
+            recordNewest(TOOL_TRIANGLE);
         }
-        plusHeld = plusNow;
-        minusHeld = minusNow;
-
-        // Left click handling
-        if (GetAsyncKeyState(VK_LBUTTON) & 0x8000) {
-            POINT p;
-            GetCursorPos(&p);
-            ScreenToClient(GetHWnd(), &p);
-
-            if (p.y <= 80) {
-                bool hit = false;
-                for (int i = 0; i < 7; ++i) {
-                    int L = TB_BTN_X(i), R = L + TB_BTN_W;
-                    if (inRect(p.x, p.y, L, TB_Y1, R, TB_Y2)) {
-                        currentTool = static_cast<Tool>(i);
-                        hit = true;
-
-                        // Popup if eraser selected
-                        if (currentTool == TOOL_ERASER) {
-                            MessageBox(GetHWnd(), _T("Eraser: click +/- to resize"), _T("Tool Selected"), MB_OK | MB_ICONINFORMATION);
-                        }
-                        break;
-                    }
-                }
-
-                if (!hit) {
-                    int clearL = 800 - 90, clearR = 799;
-                    // Clear
-                    if (inRect(p.x, p.y, clearL, TB_Y1, clearR, TB_Y2)) {
-                        freehandTool.resetAll();
-                        lineTool.resetAll();
-                        triangleTool.resetAll();
-                        squareTool.resetAll();
-                        circleTool.resetAll();
-                        ovalTool.resetAll();
-                        eraserTool.resetAll();
-
-                        gHasBackground = false; // also clear background layer
-
-                        SetWorkingImage(&gCanvas);
-                        setbkcolor(WHITE);
-                        cleardevice();
-                        SetWorkingImage();
-
-                        gNeedsRebuild = false;
-                        lastPoint = POINT{ -1, -1 };
-                        mouseReleased = false;
-                        drawToolbarAndResetState();
-                        Sleep(150);
-                        continue;
-                    }
-
-                    // Solid/Dashed toggle
-                    if (inRect(p.x, p.y, BTN_SOLID_DASH.left, BTN_SOLID_DASH.top, BTN_SOLID_DASH.right, BTN_SOLID_DASH.bottom)) {
-                        currentLineMode = (*currentLineMode == 0) ? &dashedMode : &solidMode;
-                        gNeedsRebuild = true;
-                        drawToolbarAndResetState();
-                        Sleep(150);
-                        continue;
-                    }
-
-                    // Fill toggle
-                    if (inRect(p.x, p.y, BTN_FILL_TOG.left, BTN_FILL_TOG.top, BTN_FILL_TOG.right, BTN_FILL_TOG.bottom)) {
-                        fillEnabled = !fillEnabled;
-                        gNeedsRebuild = true;
-                        drawToolbarAndResetState();
-                        Sleep(150);
-                        continue;
-                    }
-
-                    // Save
-                    if (inRect(p.x, p.y, BTN_SAVE.left, BTN_SAVE.top, BTN_SAVE.right, BTN_SAVE.bottom)) {
-                        if (gNeedsRebuild) rebuildCanvas();
-                        SaveCanvasToFile();
-                        drawToolbarAndResetState();
-                        Sleep(150);
-                        continue;
-                    }
-
-                    // Load
-                    if (inRect(p.x, p.y, BTN_LOAD.left, BTN_LOAD.top, BTN_LOAD.right, BTN_LOAD.bottom)) {
-                        LoadCanvasFromFile();
-                        drawToolbarAndResetState();
-                        Sleep(150);
-                        continue;
-                    }
-                }
-
-                drawToolbarAndResetState();
-                Sleep(150);
-            }
-            else {
-                if (handlePaletteClick(p.x, p.y)) {
-                    drawToolbarAndResetState();
-                    gNeedsRebuild = true;
-                    Sleep(150);
-                }
-                else {
-                    if (currentTool == TOOL_ERASER) {
-                        static POINT lastPointLocal = { -1, -1 };
-                        if (!eraserDown) {
-                            eraserTool.beginStroke(eraserRadius);
-                            eraserTool.addDab(p);
-                            eraserDown = true;
-                            gNeedsRebuild = true;
-                        }
-                        else {
-                            eraserTool.addInterpolatedDabs(lastPointLocal, p);
-                            gNeedsRebuild = true;
-                        }
-                        lastPointLocal = p;
-                    }
-                    else if (currentTool == TOOL_FREEHAND) {
-                        if (lastPoint.x != -1)
-                            freehandTool.addStroke(lastPoint, p, currentLineMode);
-                        lastPoint = p;
-                        mouseReleased = false;
-                        gNeedsRebuild = true;
-                    }
-                    else {
-                        lastPoint = POINT{ -1, -1 };
-                        if (mouseReleased) {
-                            if (currentTool == TOOL_LINE) {
-                                lineTool.addPoint(p);
-                                if (lineTool.isReady()) {
-                                    lineTool.drawAndReset(currentLineMode);
-                                    gNeedsRebuild = true;
-                                }
-                            }
-                            else if (currentTool == TOOL_TRIANGLE) {
-                                triangleTool.addPoint(p);
-                                if (triangleTool.isReady()) {
-                                    triangleTool.drawAndReset(currentLineMode, fillEnabled);
-                                    gNeedsRebuild = true;
-                                }
-                            }
-                            else if (currentTool == TOOL_SQUARE) {
-                                squareTool.addPoint(p);
-                                if (squareTool.isReady()) {
-                                    squareTool.drawAndReset(currentLineMode, fillEnabled);
-                                    gNeedsRebuild = true;
-                                }
-                            }
-                            else if (currentTool == TOOL_CIRCLE) {
-                                circleTool.addPoint(p);
-                                if (circleTool.isReady()) {
-                                    circleTool.drawAndReset(currentLineMode);
-                                    gNeedsRebuild = true;
-                                }
-                            }
-                            else if (currentTool == TOOL_OVAL) {
-                                ovalTool.addPoint(p);
-                                if (ovalTool.isReady()) {
-                                    ovalTool.drawAndReset(currentLineMode);
-                                    gNeedsRebuild = true;
-                                }
-                            }
-                            mouseReleased = false;
-                        }
-                    }
-                }
-            }
+        break;
+    case TOOL_SQUARE:
+        squareTool.addPoint(p);
+        if (squareTool.isReady()) {
+            squareTool.drawAndReset(currentLineMode, fillEnabled);
+            indexNewest(TOOL_SQUARE);
+            recordNewest(TOOL_SQUARE);
         }
-        else {
-            if (eraserDown) { eraserTool.endStroke(); eraserDown = false; }
-            if (currentTool == TOOL_FREEHAND) { lastPoint = POINT{ -1, -1 }; }
-            mouseReleased = true;
+        break;
+    case TOOL_CIRCLE:
+        circleTool.addPoint(p);
+        if (circleTool.isReady()) {
+            circleTool.drawAndReset(currentLineMode);
+            indexNewest(TOOL_CIRCLE);
+            recordNewest(TOOL_CIRCLE);
         }
+        break;
+    case TOOL_OVAL:
+        ovalTool.addPoint(p);
+        if (ovalTool.isReady()) {
+            ovalTool.drawAndReset(currentLineMode);
+            indexNewest(TOOL_OVAL);
+            recordNewest(TOOL_OVAL);
+        }
+        break;
+    default:
+        break;
+    }
+}
 
-        // --------- Render pass ----------
-        POINT mouse;
-        GetCursorPos(&mouse);
-        ScreenToClient(GetHWnd(), &mouse);
+// Mouse moved with the left button held
+static void handleDrag(POINT p) {
+    if (!leftDown || (p.x == lastPoint.x && p.y == lastPoint.y)) return;
 
-        if (gNeedsRebuild) rebuildCanvas();
+    if (currentTool == TOOL_ERASER) {
+        eraserTool.addSegment(lastPoint, p);
+    }
+    else if (currentTool == TOOL_FREEHAND) {
+        freehandTool.addStroke(lastPoint, p, currentLineMode);
+        // Extending a stroke that is already on gCanvas: draw just the new segment
+        int openZ = freehandTool.openStrokeZ();
+        if (openZ != 0 && openZ <= gCanvasZ) compositeSegment(lastPoint, p);
+    }
+    lastPoint = p;
+}
 
-        if (!ImageReady(&gCanvas)) {
-            // Failsafe: never blit an invalid image
-            getimage(&gCanvas, 0, 0, 800, 600);
-            SetWorkingImage(&gCanvas);
-            setbkcolor(WHITE);
-            cleardevice();
-            SetWorkingImage();
-        }
+static void handleLeftUp() {
+    if (!leftDown) return;
+    leftDown = false;
+    lastPoint = POINT{ -1, -1 };
+
+    if (currentTool == TOOL_ERASER) {
+        eraserTool.endStroke();
+        size_t n = eraserTool.getCount() - eraserFirst;
+        gHistory.addedCapsules(n);
+        gJournal.addCapsules(eraserTool.records() + eraserFirst, n);
+        if (rasterErase && n > 0) bakeErasedArea(eraserFirst);   // one undo step with the stroke
+    }
+    bool stroke = freehandTool.openStrokeZ() != 0;
+    RECT simplified;
+    if (freehandTool.endStroke(&simplified)) markDirty(simplified);
+    if (stroke) {
+        const FreehandTool::Record& s = freehandTool.records()[freehandTool.getCount() - 1];
+        gJournal.addStroke(s, freehandTool.pointPool() + s.first);
+        gHistory.addedStroke(s.z);
+    }
+}
 
-        putimage(0, 0, &gCanvas);
-        drawToolbarAndResetState();
-        setrop2(R2_COPYPEN);
-        setlinecolor(BLACK);
+static void handleKey(BYTE vk, bool ctrl) {
+    if (ctrl && vk == 'Z') {
+        undoRedo(false);
+    }
+    else if (ctrl && vk == 'Y') {
+        undoRedo(true);
+    }
+    else if (vk == VK_OEM_PLUS || vk == VK_ADD) {
+        eraserRadius += 2;
+        if (eraserRadius > ERASER_MAX_RADIUS) eraserRadius = ERASER_MAX_RADIUS;
+        eraserTool.setRadius(eraserRadius);
+    }
+    else if (vk == VK_OEM_MINUS || vk == VK_SUBTRACT) {
+        eraserRadius -= 2;
+        if (eraserRadius < 1) eraserRadius = 1;
+        eraserTool.setRadius(eraserRadius);
+    }
+    else if (vk == 'L') {
+        gLowLatency = !gLowLatency;
+    }
+}
 
-        switch (currentTool) {
-        case TOOL_LINE:     lineTool.drawPreview(mouse, currentLineMode);     break;
-        case TOOL_TRIANGLE: triangleTool.drawPreview(mouse, currentLineMode); break;
-        case TOOL_SQUARE:   squareTool.drawPreview(mouse, currentLineMode);   break;
-        case TOOL_CIRCLE:   circleTool.drawPreview(mouse, currentLineMode);   break;
-        case TOOL_OVAL:     ovalTool.drawPreview(mouse, currentLineMode);     break;
-        default: break;
-        }
+// Applies one event; returns true if the frame needs presenting
+static bool handleEvent(const InputEvent& msg) {
+    switch (msg.message) {
+    case WM_LBUTTONDOWN:
+        gMouse = POINT{ msg.x, msg.y };
+        handleLeftDown(gMouse);
+        return true;
+    case WM_MOUSEMOVE:
+        gMouse = POINT{ msg.x, msg.y };
+        if (leftDown && !msg.lbutton) { handleLeftUp(); return true; }   // released outside the window
+        if (leftDown) { handleDrag(gMouse); return true; }
+        return currentTool != TOOL_FREEHAND && currentTool != TOOL_ERASER;   // shape previews follow the cursor
+    case WM_LBUTTONUP:
+        gMouse = POINT{ msg.x, msg.y };
+        handleLeftUp();
+        return true;
+    case WM_RBUTTONDOWN:
+        deleteAllAt(POINT{ msg.x, msg.y });
+        return true;
+    case WM_KEYDOWN:
+        if (msg.prevdown) return false;   // ignore auto-repeat
+        handleKey(msg.vkcode, msg.ctrl);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Input queue metrics: depth seen at the start of the last drain, and the
+// ring's own peak depth / drop count
+static uint32_t gInputDepth = 0;
+
+// Applies every queued event; returns true if the frame needs presenting
+static bool drainInput() {
+    gInput.pump();
+    gInputDepth = gInput.depth();
+    bool changed = false;
+    InputEvent ev;
+    while (gInput.pop(ev)) changed |= handleEvent(ev);
+    return changed;
+}
+
+// Queue metrics (and export progress) in the window title, refreshed at
+// most once a second unless forced
+static void showInputStats(bool force = false) {
+    static DWORD lastShown = 0;
+    DWORD now = GetTickCount();
+    if (!force && now - lastShown < 1000) return;
+    lastShown = now;
+
+    TCHAR title[128];
+    int n = _stprintf_s(title, sizeof(title) / sizeof(title[0]), _T("Drawing Pad  [input queue %u, peak %u, dropped %u]"),
+                        gInputDepth, gInput.peakDepth(), gInput.droppedCount());
+    if (gExport.busy() && n > 0)
+        _stprintf_s(title + n, sizeof(title) / sizeof(title[0]) - n, _T("  exporting %d%%"), gExport.progress());
+    SetWindowText(GetHWnd(), title);
+}
+
+// Report a finished background export
+static void pollExport() {
+    bool ok = false;
+    if (!gExport.poll(&ok)) return;
+    if (!ok) MessageBox(GetHWnd(), _T("Could not write the image file."), _T("Save"), MB_OK | MB_ICONERROR);
+    showInputStats(true);
+}
+
+// Tell the user once if the autosave journal could not be written
+static void pollJournal() {
+    static bool told = false;
+    if (told || !gJournal.failed()) return;
+    told = true;
+    MessageBox(GetHWnd(), _T("Autosave could not write its files and is off for this session.\nSave your drawing manually."),
+               _T("Autosave"), MB_OK | MB_ICONWARNING);
+}
+
+// -------------- Present --------------
+// The batch-draw back buffer keeps last frame's pixels, so a present only
+// refreshes what changed: canvas damage, the area last frame's preview
+// covered, and this frame's preview. The toolbar and palette are repainted
+// when their state changed or a refreshed area overlaps them.
+
+static const RECT kToolbarRect = { 0, 0, 799, 80 };
+static const RECT kPaletteRect = {
+    PALETTE_X - 2, PALETTE_Y0 - 2,
+    PALETTE_X + SWATCH_W + 2, PALETTE_Y0 + kPaletteCount * (SWATCH_H + SWATCH_GAP) - SWATCH_GAP + 2
+};
+
+static RECT gShownPreview;            // window area holding last frame's preview
+static bool gHasShownPreview = false;
+
+static void flushRect(const RECT& r) { FlushBatchDraw(r.left, r.top, r.right, r.bottom); }
+
+static void presentFrame() {
+    // Commits only bump gZCounter; they are composited here without a rebuild
+    updateCanvas();
+
+    // Undo checkpoint, only between commands (an open stroke is already on gCanvas)
+    if (!leftDown && ImageReady(&gCanvas) && gHistory.needsCheckpoint()) {
+        GdiFlush();
+        gHistory.checkpoint((const uint32_t*)GetImageBuffer(&gCanvas), gCanvas.getwidth(), gCanvas.getheight(), sceneTopZ());
+    }
+
+    if (!ImageReady(&gCanvas)) {
+        createCanvas();   // failsafe: never blit an invalid image
+        gFullPresent = true;
+    }
+
+    RECT preview = toolPreviewBounds(currentTool, gMouse);
+    bool hasPreview = rectClip(preview, 800, 600);
+
+    // Window areas to restore from gCanvas
+    RECT areas[3];
+    int  n = presentAreas(gHasShownPreview ? &gShownPreview : nullptr, hasPreview ? &preview : nullptr, 800, 600, areas);
 
+    bool toolbar = gToolbarDirty;
+    for (int i = 0; i < n; ++i) {
+        const RECT& a = areas[i];
+        putimage(a.left, a.top, a.right - a.left + 1, a.bottom - a.top + 1, &gCanvas, a.left, a.top);
+        if (rectsOverlap(a, kToolbarRect) || rectsOverlap(a, kPaletteRect)) toolbar = true;
+    }
+
+    if (toolbar) drawToolbarAndResetState();
+    setrop2(R2_COPYPEN);
+    setlinecolor(BLACK);
+    toolDrawPreview(currentTool, gMouse, currentLineMode);
+
+    if (gFullPresent) {
         FlushBatchDraw();
-        Sleep(10);
+    }
+    else {
+        for (int i = 0; i < n; ++i) flushRect(areas[i]);
+        if (toolbar) { flushRect(kToolbarRect); flushRect(kPaletteRect); }
+    }
+
+    gShownPreview = preview;
+    gHasShownPreview = hasPreview;
+    gHasPresentDamage = false;
+    gFullPresent = false;
+    gToolbarDirty = false;
+}
+
+int main() {
+    initgraph(800, 600);
+    setbkcolor(WHITE);
+    cleardevice();
+
+    createCanvas();   // gCanvas owns a valid bitmap from the start
+
+    setlinecolor(BLACK);
+    settextstyle(16, 0, _T("Consolas"));
+    settextcolor(BLACK);
+
+    drawToolbarAndResetState();
+
+    // Autosave: offer what the last session left behind, then journal this one
+    if (Journal::exists(kAutosaveBase)) {
+        if (MessageBox(GetHWnd(), _T("Restore the drawing from the last session?"), _T("Autosave"),
+                       MB_YESNO | MB_ICONQUESTION) == IDYES)
+            recoverAutosave();
+        else
+            Journal::discard(kAutosaveBase);
+    }
+    gJournal.start(kAutosaveBase);
+
+    // Batch once; flush per presented frame
+    BeginBatchDraw();
+    timeBeginPeriod(1);   // 1 ms Sleep granularity for frame pacing
+
+    // Event loop: block while idle, apply every queued event as soon as it
+    // arrives, and present only when something changed. Paced mode caps the
+    // present rate at gTargetHz and folds input that arrives before the next
+    // frame slot into that frame; low-latency mode presents after every batch.
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point lastPresent = Clock::now();
+    bool pending = true;   // first frame
+
+    gInput.start();
+    gEasyXProc = (WNDPROC)SetWindowLongPtr(GetHWnd(), GWLP_WNDPROC, (LONG_PTR)windowHookProc);
+    while (!gQuit) {
+        if (!pending) gInput.wait(gExport.busy() ? 100 : INFINITE);   // wakes to show export progress
+        pending |= drainInput();
+        pollExport();
+        pollJournal();
+        if (!pending) { showInputStats(); continue; }
+
+        if (!gLowLatency) {
+            Clock::time_point due = lastPresent + std::chrono::microseconds(1000000 / gTargetHz);
+            Clock::time_point now = Clock::now();
+            if (now < due) {
+                gInput.wait(DWORD(std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count()));
+                drainInput();                        // latest input goes into this frame
+            }
+        }
+
+        presentFrame();
+        lastPresent = Clock::now();
+        pending = false;
+        showInputStats();
     }
 
+    gJournal.finish();   // clean exit: nothing to recover next launch
+    timeEndPeriod(1);
     EndBatchDraw();
+    SetWindowLongPtr(GetHWnd(), GWLP_WNDPROC, (LONG_PTR)gEasyXProc);
     closegraph();
+    gInput.stop();   // the window thread is gone: nothing can notify() now
     return 0;
 }
@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Shared by the benchmarks: a stopwatch and the size argument. Each
+// benchmark takes an optional item count on the command line; ctest runs
+// them with a small one so they keep building and running, and the numbers
+// quoted in the history come from the default size on a release build.
+
+struct BenchTimer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    void reset() { start = std::chrono::steady_clock::now(); }
+};
+
+inline long benchSize(int argc, char** argv, long fallback) {
+    if (argc < 2) return fallback;
+    long n = std::strtol(argv[1], nullptr, 10);
+    return n > 0 ? n : fallback;
+}
+
+// Best of 'runs' timings of f(), in milliseconds
+template <class F>
+double benchBest(int runs, F f) {
+    double best = 1e300;
+    for (int i = 0; i < runs; ++i) {
+        BenchTimer t;
+        f();
+        double ms = t.ms();
+        if (ms < best) best = ms;
+    }
+    return best;
+}
@@ -0,0 +1,124 @@
+#include <cmath>
+#include "Bench.h"
+#include "TestScene.h"
+
+// Eraser replay: N capsules (default 200000) at radius 4, 16 (the default
+// eraser) and 40, a third of them single dabs, the rest short strokes, on
+// an 800 x 600 framebuffer. FramebufferBackend::solidCapsule() against the
+// sqrt-per-row version and scalar span loop it replaced; both must leave
+// the same pixels.
+
+// The old software capsule, reduced to a raw pixel buffer
+struct OldCapsules {
+    uint32_t* px;
+    int       w, h;
+    uint32_t  fill;
+
+    void span(int x0, int x1, int y) {
+        if (y < 0 || y >= h) return;
+        if (x0 < 0) x0 = 0;
+        if (x1 > w - 1) x1 = w - 1;
+        for (int x = x0; x <= x1; ++x) px[size_t(y) * w + x] = fill;
+    }
+
+    static int isqrt(long long v) {
+        if (v <= 0) return 0;
+        long long r = (long long)std::sqrt((double)v);
+        while (r * r > v) --r;
+        while ((r + 1) * (r + 1) <= v) ++r;
+        return int(r);
+    }
+
+    void solidCircle(int cx, int cy, int r) {
+        long long r2 = (long long)r * r;
+        int dy0 = (cy - r < 0) ? -cy : -r;
+        int dy1 = (cy + r > h - 1) ? h - 1 - cy : r;
+        for (int dy = dy0; dy <= dy1; ++dy) {
+            int hw = isqrt(r2 - (long long)dy * dy);
+            span(cx - hw, cx + hw, cy + dy);
+        }
+    }
+
+    void solidCapsule(POINT a, POINT b, int r) {
+        if (a.x == b.x && a.y == b.y) { solidCircle(a.x, a.y, r); return; }
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double len = std::sqrt(dx * dx + dy * dy);
+        double nx = -dy / len * r, ny = dx / len * r;
+        double qx[4] = { a.x + nx, b.x + nx, b.x - nx, a.x - nx };
+        double qy[4] = { a.y + ny, b.y + ny, b.y - ny, a.y - ny };
+
+        int top = (a.y < b.y ? a.y : b.y) - r;
+        int bot = (a.y > b.y ? a.y : b.y) + r;
+        if (top < 0) top = 0;
+        if (bot > h - 1) bot = h - 1;
+
+        double ex[4], es[4];
+        for (int i = 0, j = 3; i < 4; j = i++) {
+            if (qy[i] == qy[j]) continue;
+            es[i] = (qx[i] - qx[j]) / (qy[i] - qy[j]);
+            ex[i] = qx[j] - qy[j] * es[i];
+        }
+
+        double r2 = double(r) * r;
+        for (int y = top; y <= bot; ++y) {
+            double lo = 1e30, hi = -1e30;
+            const POINT ends[2] = { a, b };
+            for (int e = 0; e < 2; ++e) {
+                double ey = double(y - ends[e].y);
+                if (ey * ey > r2) continue;
+                double hw = std::sqrt(r2 - ey * ey);
+                if (ends[e].x - hw < lo) lo = ends[e].x - hw;
+                if (ends[e].x + hw > hi) hi = ends[e].x + hw;
+            }
+            for (int i = 0, j = 3; i < 4; j = i++) {
+                double y0 = qy[j], y1 = qy[i];
+                if ((y < y0 && y < y1) || (y > y0 && y > y1) || y0 == y1) continue;
+                double x = ex[i] + y * es[i];
+                if (x < lo) lo = x;
+                if (x > hi) hi = x;
+            }
+            if (lo <= hi) span(int(std::ceil(lo)), int(std::floor(hi)), y);
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 200000);
+    const int W = 800, H = 600;
+    FramebufferBackend fb(W, H);
+    std::vector<uint32_t> oldPx(size_t(W) * H);
+    OldCapsules old = { oldPx.data(), W, H, 0 };
+    TestRandom rnd(22);
+
+    std::printf("%ld capsules\n", n);
+    for (int r : { 4, 16, 40 }) {
+        std::vector<POINT> ends(size_t(n) * 2);
+        POINT p = { W / 2, H / 2 };
+        for (long i = 0; i < n; ++i) {
+            if (i % 24 == 0) p = POINT{ LONG(rnd.next(W)), LONG(rnd.next(H)) };   // a new stroke
+            POINT q = p;
+            if (rnd.next(3) != 0) q = POINT{ p.x + rnd.next(2 * r + 1) - r, p.y + rnd.next(2 * r + 1) - r };
+            ends[size_t(i) * 2] = p;
+            ends[size_t(i) * 2 + 1] = q;
+            p = q;
+        }
+
+        fb.clear(WHITE);
+        std::copy(fb.data(), fb.data() + oldPx.size(), oldPx.begin());
+        int grey = 0;   // the same pixel whichever way round COLORREF is
+        double oldMs = benchBest(3, [&] {
+            ++grey;
+            old.fill = RGB(grey, grey, grey);
+            for (long i = 0; i < n; ++i) old.solidCapsule(ends[size_t(i) * 2], ends[size_t(i) * 2 + 1], r);
+        });
+        grey = 0;
+        double newMs = benchBest(3, [&] {
+            ++grey;
+            fb.setFillColor(RGB(grey, grey, grey));
+            for (long i = 0; i < n; ++i) fb.solidCapsule(ends[size_t(i) * 2], ends[size_t(i) * 2 + 1], r);
+        });
+        CHECK(std::equal(oldPx.begin(), oldPx.end(), fb.data()));
+        std::printf("  r=%-3d old %8.2f ms   new %8.2f ms   %.1fx\n", r, oldMs, newMs, oldMs / newMs);
+    }
+    return testResult("capsule bench");
+}
@@ -0,0 +1,141 @@
+#include <cmath>
+#include "Bench.h"
+#include "TestScene.h"
+
+// The integer conic kernels (ConicRaster.h) against the code they replaced,
+// drawing N ovals and N circles (default 5000 each) through drawAt() the way
+// a rebuild does, on an 800 x 600 framebuffer. Radii 1..200, where the
+// pixel stores dominate, then 1..16, where the per-row and per-chord math
+// does:
+//   oval fill    - filled, solid outline: row spans vs sqrt per scanline
+//   oval dash    - dashed, no fill: one walk of the rim vs cos/sin chords
+//   circle dash  - the same for circles
+//   mixed        - random style and fill, ovals then circles
+
+// The old drawing, reduced to what drawAt() did with it
+struct OldConics {
+    static void dashChords(int cx, int cy, int rx, int ry) {
+        const double TWO_PI = 6.283185307179586;
+        const int    SEG_DEG = 6;  // chord step (degrees)
+        const int    DASH_RUN = 3;  // draw 3 segments, skip 3
+        const int    GAP_RUN = 3;
+
+        int segCount = int(std::ceil(360.0 / SEG_DEG));
+        int runLen = DASH_RUN + GAP_RUN;
+        for (int s = 0; s < segCount; ++s) {
+            if (s % runLen >= DASH_RUN) continue;
+            double a0 = (s * SEG_DEG) * (TWO_PI / 360.0);
+            double a1 = ((s + 1) * SEG_DEG) * (TWO_PI / 360.0);
+            int x0 = cx + int(std::lround(rx * std::cos(a0)));
+            int y0 = cy + int(std::lround(ry * std::sin(a0)));
+            int x1 = cx + int(std::lround(rx * std::cos(a1)));
+            int y1 = cy + int(std::lround(ry * std::sin(a1)));
+            gRender->line(x0, y0, x1, y1);
+        }
+    }
+
+    static void fillOval(int cx, int cy, int rx, int ry, COLORREF color) {
+        COLORREF oldFill = gRender->getFillColor();
+        int      oldRop = gRender->getRop();
+        gRender->setRop(R2_COPYPEN);
+        gRender->setFillColor(color);
+        for (int y = cy - ry; y <= cy + ry; ++y) {
+            double ny = double(y - cy) / double(ry);
+            double inside = 1.0 - ny * ny;
+            if (inside < 0.0) continue;
+            int halfw = int(std::floor(double(rx) * std::sqrt(inside) + 0.5));
+            if (halfw >= 0) gRender->solidRectangle(cx - halfw, y, cx + halfw, y);
+        }
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+    }
+
+    static void drawOval(const OvalTool::Record& o) {
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
+        gRender->setRop(R2_COPYPEN);
+        if (o.fill) fillOval(o.center.x, o.center.y, o.rx, o.ry, o.fillColor);
+        gRender->setLineColor(BLACK);
+        if (o.style == 0) gRender->ellipse(o.center.x, o.center.y, o.rx, o.ry);
+        else dashChords(o.center.x, o.center.y, o.rx, o.ry);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
+    }
+
+    static void drawCircle(const CircleTool::Record& c) {
+        COLORREF oldFill = gRender->getFillColor();
+        COLORREF oldLine = gRender->getLineColor();
+        int      oldRop = gRender->getRop();
+        gRender->setRop(R2_COPYPEN);
+        if (c.fill) {
+            gRender->setFillColor(c.fillColor);
+            gRender->solidCircle(c.center.x, c.center.y, c.radius);
+        }
+        gRender->setLineColor(BLACK);
+        if (c.style == 0) gRender->circle(c.center.x, c.center.y, c.radius);
+        else dashChords(c.center.x, c.center.y, c.radius, c.radius);
+        gRender->setRop(oldRop);
+        gRender->setFillColor(oldFill);
+        gRender->setLineColor(oldLine);
+    }
+};
+
+// style/fill < 0: random
+static void makeConics(TestScene& s, size_t n, int maxR, int style, int fill, TestRandom& rnd) {
+    OvalTool::Record* o = s.oval.replaceRecords(n);
+    CircleTool::Record* c = s.circle.replaceRecords(n);
+    if (!o || !c) return;
+    int z = 0;
+    auto pick = [&](int v) { return v < 0 ? rnd.next(2) : v; };
+    for (size_t i = 0; i < n; ++i) {
+        POINT p = { LONG(rnd.next(800)), LONG(rnd.next(600)) };
+        COLORREF col = RGB(rnd.next(256), rnd.next(256), rnd.next(256));
+        o[i] = { p, 1 + rnd.next(maxR), 1 + rnd.next(maxR), pick(style), pick(fill) != 0, ++z, col };
+        c[i] = { p, 1 + rnd.next(maxR), pick(style), pick(fill) != 0, ++z, col };
+    }
+}
+
+struct Timing { double oldMs, newMs; };
+
+static Timing run(const TestScene& s, bool ovals, bool circles) {
+    Timing t;
+    t.oldMs = benchBest(3, [&] {
+        if (ovals) for (size_t i = 0; i < s.oval.getCount(); ++i) OldConics::drawOval(s.oval.records()[i]);
+        if (circles) for (size_t i = 0; i < s.circle.getCount(); ++i) OldConics::drawCircle(s.circle.records()[i]);
+    });
+    t.newMs = benchBest(3, [&] {
+        if (ovals) for (size_t i = 0; i < s.oval.getCount(); ++i) s.oval.drawAt(i);
+        if (circles) for (size_t i = 0; i < s.circle.getCount(); ++i) s.circle.drawAt(i);
+    });
+    return t;
+}
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 5000);
+    FramebufferBackend fb(800, 600);
+    gRender = &fb;
+    TestRandom rnd(21);
+    TestScene s;
+
+    std::printf("%ld ovals, %ld circles\n", n, n);
+    for (int maxR : { 200, 16 }) {
+        makeConics(s, size_t(n), maxR, 0, 1, rnd);
+        Timing fill = run(s, true, false);
+        makeConics(s, size_t(n), maxR, 1, 0, rnd);
+        Timing ovalDash = run(s, true, false);
+        Timing circleDash = run(s, false, true);
+        makeConics(s, size_t(n), maxR, -1, -1, rnd);
+        Timing mixed = run(s, true, true);
+        CHECK(s.oval.getCount() == size_t(n) && s.circle.getCount() == size_t(n));
+
+        std::printf(" radii 1..%d\n", maxR);
+        std::printf("  oval fill:   old %8.2f ms   new %8.2f ms\n", fill.oldMs, fill.newMs);
+        std::printf("  oval dash:   old %8.2f ms   new %8.2f ms\n", ovalDash.oldMs, ovalDash.newMs);
+        std::printf("  circle dash: old %8.2f ms   new %8.2f ms\n", circleDash.oldMs, circleDash.newMs);
+        std::printf("  mixed:       old %8.2f ms   new %8.2f ms\n", mixed.oldMs, mixed.newMs);
+    }
+    gRender = nullptr;
+    return testResult("conic bench");
+}
@@ -0,0 +1,103 @@
+#include "Bench.h"
+#include "MappedFile.h"
+#include "TestScene.h"
+
+// .dpad throughput on N records (default 4M) spread evenly over the seven
+// tools, freehand strokes with 4 vertices each:
+//   save  - saveDocument() to a fresh file
+//   load  - loadDocument(), every section read into tool storage
+//   map   - MappedFile + mapDocument() with a DocCheck: header, section
+//           table and borrowing only, what a load waits for before the
+//           records' checks
+//   check - DocCheck::wait(), the records checked on every hardware thread
+
+static const char* kPath = "doc_bench.dpad";
+
+static void fillScene(TestScene& s, size_t n, TestRandom& rnd) {
+    size_t per = n / T_COUNT + 1;
+    auto pt = [&]() { return POINT{ LONG(rnd.next(4000)), LONG(rnd.next(4000)) }; };
+    int z = 0;
+
+    FreehandTool::Record* st = nullptr;
+    POINT* pts = nullptr;
+    s.freehand.replaceRecords(per, per * 4, &st, &pts);
+    LineTool::Record* l = s.line.replaceRecords(per);
+    TriangleTool::Record* t = s.triangle.replaceRecords(per);
+    SquareTool::Record* q = s.square.replaceRecords(per);
+    CircleTool::Record* c = s.circle.replaceRecords(per);
+    OvalTool::Record* o = s.oval.replaceRecords(per);
+    EraserTool::Record* e = s.eraser.replaceRecords(per);
+    if (!st || !l || !t || !q || !c || !o || !e) return;
+
+    for (size_t i = 0; i < per; ++i) {   // z interleaved across the tools, as drawing leaves it
+        for (int k = 0; k < 4; ++k) pts[i * 4 + k] = pt();
+        st[i] = FreehandTool::Record();
+        st[i].first = int(i * 4);
+        st[i].count = 4;
+        st[i].style = 0;
+        st[i].z = ++z;
+        st[i].box = makeRect(0, 0, 4000, 4000);
+        l[i] = { pt(), pt(), 0, ++z };
+        t[i] = { pt(), pt(), pt(), 1, true, ++z, RGB(1, 2, 3) };
+        q[i] = { pt(), pt(), 0, false, ++z, RGB(4, 5, 6) };
+        c[i] = { pt(), 1 + rnd.next(200), 0, true, ++z, RGB(7, 8, 9) };
+        o[i] = { pt(), 1 + rnd.next(200), 1 + rnd.next(200), 1, false, ++z, RGB(10, 11, 12) };
+        e[i] = { pt(), pt(), 1 + rnd.next(40), ++z };
+    }
+    gZCounter = z;
+}
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 4000000);
+    TestRandom rnd(16);
+    TestScene scene;
+    fillScene(scene, size_t(n), rnd);
+    CHECK(scene.line.getCount() > 0);
+
+    double save = 0, load = 0, map = 0, check = 0;
+    {
+        DocScene s = scene.doc();
+        BenchTimer t;
+        FILE* f = std::fopen(kPath, "wb");
+        CHECK(f && saveDocument(f, s));
+        if (f) CHECK(std::fclose(f) == 0);
+        save = t.ms();
+    }
+    FILE* f = std::fopen(kPath, "rb");
+    uint64_t bytes = 0;
+    CHECK(f && docFileSize(f, &bytes));
+    if (f) std::fclose(f);
+    {
+        TestScene loaded;
+        DocScene d = loaded.doc();
+        BenchTimer t;
+        f = std::fopen(kPath, "rb");
+        CHECK(f && loadDocument(f, d));
+        if (f) std::fclose(f);
+        load = t.ms();
+        CHECK(sameScene(scene, loaded));
+    }
+    {
+        TestScene mapped;
+        DocScene d = mapped.doc();
+        MappedFile m;
+        DocCheck c;
+        BenchTimer t;
+        CHECK(m.open(kPath) && mapDocument(m.data(), m.size(), d, &c));
+        map = t.ms();
+        t.reset();
+        CHECK(c.wait());
+        check = t.ms();
+        CHECK(sameScene(scene, mapped));
+        docClearTools(d);
+    }
+    std::remove(kPath);
+
+    double mb = double(bytes) / (1024.0 * 1024.0);
+    std::printf("%ld records, %.1f MB\n", n, mb);
+    std::printf("  save:  %8.2f ms  %7.0f MB/s\n", save, mb / (save / 1000.0));
+    std::printf("  load:  %8.2f ms  %7.0f MB/s\n", load, mb / (load / 1000.0));
+    std::printf("  map:   %8.2f ms\n", map);
+    std::printf("  check: %8.2f ms\n", check);
+    return testResult("document bench");
+}
@@ -0,0 +1,270 @@
+#include <cstddef>
+#include "MappedFile.h"
+#include "TestScene.h"
+
+// .dpad round trip: a saved scene comes back record for record, both when
+// the tools borrow from the mapped file and when it is read with fread.
+// Saving is deterministic and damaged files are refused, as are records
+// out of range, whichever path reads them.
+
+static const int W = 800, H = 600;
+static const char* kPath = "document_test.dpad";
+
+static std::vector<uint32_t> gLoaded;
+static uint32_t* allocLoaded(int w, int h) {
+    gLoaded.assign(size_t(w) * h, 0);
+    return gLoaded.data();
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+    std::vector<uint8_t> bytes;
+    FILE* f = std::fopen(path, "rb");
+    if (!f) return bytes;
+    std::fseek(f, 0, SEEK_END);
+    bytes.resize(size_t(std::ftell(f)));
+    std::fseek(f, 0, SEEK_SET);
+    if (std::fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) bytes.clear();
+    std::fclose(f);
+    return bytes;
+}
+
+static void writeFile(const char* path, const std::vector<uint8_t>& bytes) {
+    FILE* f = std::fopen(path, "wb");
+    if (!f) return;
+    std::fwrite(bytes.data(), 1, bytes.size(), f);
+    std::fclose(f);
+}
+
+static void testRoundTrip(TestScene& scene, const std::vector<uint32_t>& layer, int lw, int lh) {
+    DocScene s = scene.doc();
+    if (!layer.empty()) {
+        s.background = layer.data();
+        s.bgWidth = lw;
+        s.bgHeight = lh;
+    }
+    FILE* f = std::fopen(kPath, "wb");
+    CHECK(f && saveDocument(f, s));
+    if (f) CHECK(std::fclose(f) == 0);
+
+    // fread path
+    {
+        TestScene loaded;
+        DocScene d = loaded.doc(allocLoaded);
+        gLoaded.clear();
+        f = std::fopen(kPath, "rb");
+        CHECK(f && loadDocument(f, d));
+        if (f) std::fclose(f);
+        CHECK(d.zCounter == gZCounter);
+        CHECK(sameScene(scene, loaded));
+        CHECK(d.bgWidth == (layer.empty() ? 0 : lw) && d.bgHeight == (layer.empty() ? 0 : lh));
+        CHECK(layer.empty() ? d.background == nullptr : gLoaded == layer);
+    }
+
+    // mapped path: the tools borrow their records until the first edit
+    {
+        MappedFile map;
+        CHECK(map.open(kPath));
+        TestScene mapped;
+        DocScene d = mapped.doc(allocLoaded);
+        gLoaded.clear();
+        CHECK(mapDocument(map.data(), map.size(), d));
+        CHECK(d.zCounter == gZCounter);
+        CHECK(sameScene(scene, mapped));
+        CHECK(layer.empty() ? d.background == nullptr : gLoaded == layer);
+        const uint8_t* lines = (const uint8_t*)mapped.line.records();
+        CHECK(mapped.line.getCount() == 0 || (lines >= map.data() && lines < map.data() + map.size()));
+        CHECK(mapped.freehand.ownRecords() && mapped.line.ownRecords() && mapped.triangle.ownRecords() &&
+              mapped.square.ownRecords() && mapped.circle.ownRecords() && mapped.oval.ownRecords() &&
+              mapped.eraser.ownRecords());
+        map.close();
+        CHECK(sameScene(scene, mapped));
+    }
+}
+
+// Fill the padding after 'fill' in every shape record with junk
+template <class R>
+static void scramblePadding(const R* records, size_t n, uint8_t junk) {
+    const size_t from = offsetof(R, fill) + sizeof(bool), to = offsetof(R, z);
+    for (size_t i = 0; i < n; ++i) std::memset((uint8_t*)&records[i] + from, junk, to - from);
+}
+
+// The same scene saved twice gives the same bytes, whatever the records'
+// padding holds
+static void testSameBytes(TestScene& scene) {
+    DocScene s = scene.doc();
+    FILE* f = std::fopen(kPath, "wb");
+    CHECK(f && saveDocument(f, s));
+    if (f) std::fclose(f);
+    std::vector<uint8_t> first = readFile(kPath);
+
+    scramblePadding(scene.triangle.records(), scene.triangle.getCount(), 0xA5);
+    scramblePadding(scene.square.records(), scene.square.getCount(), 0x5A);
+    scramblePadding(scene.circle.records(), scene.circle.getCount(), 0xFF);
+    scramblePadding(scene.oval.records(), scene.oval.getCount(), 0x77);
+    f = std::fopen(kPath, "wb");
+    CHECK(f && saveDocument(f, s));
+    if (f) std::fclose(f);
+    CHECK(!first.empty() && readFile(kPath) == first);
+}
+
+static void testDamaged() {
+    std::vector<uint8_t> good = readFile(kPath);
+    CHECK(good.size() > 64);
+    TestScene t;
+    DocScene d = t.doc(allocLoaded);
+
+    std::vector<uint8_t> bad(good.begin(), good.begin() + good.size() / 2);   // truncated
+    CHECK(!mapDocument(bad.data(), bad.size(), d));
+    writeFile(kPath, bad);
+    FILE* f = std::fopen(kPath, "rb");
+    CHECK(f && !loadDocument(f, d));
+    if (f) std::fclose(f);
+
+    bad = good;
+    bad[0] ^= 0xFF;   // magic
+    CHECK(!mapDocument(bad.data(), bad.size(), d));
+    writeFile(kPath, bad);
+    f = std::fopen(kPath, "rb");
+    CHECK(f && !loadDocument(f, d));
+    if (f) std::fclose(f);
+}
+
+// One record of each tool, all in range. 'bad' (a DocSectionId, or none)
+// spoils one field of that tool's record the way 'how' says.
+static void oneOfEach(TestScene& s, int bad, int how) {
+    const POINT far = { DOC_MAX_COORD + 1, 5 }, ok = { 10, 20 };
+    FreehandTool::Record* st = nullptr;
+    POINT* pts = nullptr;
+    s.freehand.replaceRecords(1, 2, &st, &pts);
+    LineTool::Record* l = s.line.replaceRecords(1);
+    TriangleTool::Record* t = s.triangle.replaceRecords(1);
+    SquareTool::Record* q = s.square.replaceRecords(1);
+    CircleTool::Record* c = s.circle.replaceRecords(1);
+    OvalTool::Record* o = s.oval.replaceRecords(1);
+    EraserTool::Record* e = s.eraser.replaceRecords(1);
+    CHECK(st && l && t && q && c && o && e);
+    if (!st || !l || !t || !q || !c || !o || !e) return;
+
+    pts[0] = ok;
+    pts[1] = { 30, 40 };
+    st[0] = FreehandTool::Record();
+    st[0].first = 0;
+    st[0].count = 2;
+    st[0].z = 1;
+    st[0].box = makeRect(9, 19, 31, 41);
+    l[0] = { ok, ok, 0, 2 };
+    t[0] = { ok, ok, ok, 0, true, 3, RGB(1, 2, 3) };
+    q[0] = { ok, ok, 0, false, 4, RGB(4, 5, 6) };
+    c[0] = { ok, 50, 0, true, 5, RGB(7, 8, 9) };
+    o[0] = { ok, 50, 60, 0, false, 6, RGB(10, 11, 12) };
+    e[0] = { ok, ok, 8, 7 };
+    gZCounter = 7;
+
+    switch (bad) {
+    case DOC_FHST: if (how) st[0].box.right = DOC_MAX_COORD + 2; else st[0].box.left = 40; break;
+    case DOC_FHPT: pts[1] = far; break;
+    case DOC_LINE: l[0].end = far; break;
+    case DOC_TRI:  if (!how) t[0].c.y = -DOC_MAX_COORD - 1; break;
+    case DOC_SQR:  if (!how) q[0].a = far; break;
+    case DOC_CIRC: if (how) c[0].radius = CONIC_MAX_RADIUS + 1; else c[0].center = far; break;
+    case DOC_OVAL: if (!how) o[0].ry = 0; break;
+    case DOC_ERAS: if (how) e[0].radius = ERASER_MAX_RADIUS + 1; else e[0].b = far; break;
+    }
+}
+
+// Saving writes 'fill' as a bool, so a fill byte of 2 is put in the file
+// afterwards: into the first record of section 'bad', if it has a fill
+static void spoilFill(int bad) {
+    size_t at;
+    switch (bad) {
+    case DOC_TRI:  at = offsetof(TriangleTool::Record, fill); break;
+    case DOC_SQR:  at = offsetof(SquareTool::Record, fill); break;
+    case DOC_OVAL: at = offsetof(OvalTool::Record, fill); break;
+    default: return;
+    }
+    std::vector<uint8_t> bytes = readFile(kPath);
+    DocHeader h;
+    DocSection sec[DOC_MAX_SECTIONS];
+    const DocSection* known[DOC_KNOWN];
+    CHECK(bytes.size() >= sizeof(h));
+    std::memcpy(&h, bytes.data(), sizeof(h));
+    CHECK(h.sectionCount <= DOC_MAX_SECTIONS);
+    std::memcpy(sec, bytes.data() + sizeof(h), h.sectionCount * sizeof(DocSection));
+    CHECK(docIndex(h, sec, bytes.size(), known) && known[bad]);
+    bytes[size_t(known[bad]->offset) + at] = 2;
+    writeFile(kPath, bytes);
+}
+
+// Which paths take the saved scene: fread, mapped and checked in place,
+// mapped and checked by a DocCheck's workers
+static void expectLoads(bool good) {
+    TestScene t;
+    DocScene d = t.doc(allocLoaded);
+    FILE* f = std::fopen(kPath, "rb");
+    CHECK(f && loadDocument(f, d) == good);
+    if (f) std::fclose(f);
+
+    MappedFile map;
+    CHECK(map.open(kPath));
+    CHECK(mapDocument(map.data(), map.size(), d) == good);
+    {
+        DocCheck check;
+        CHECK(mapDocument(map.data(), map.size(), d, &check));   // the records aren't looked at yet
+        CHECK(check.wait() == good);
+    }
+    docClearTools(d);
+}
+
+static void testBadRecords() {
+    TestScene s;
+    DocScene d = s.doc();
+    for (int bad = DOC_FHST - 1; bad < DOC_KNOWN; ++bad) {   // DOC_FHST - 1: none
+        for (int how = 0; how < 2; ++how) {
+            oneOfEach(s, bad, how);
+            d.zCounter = gZCounter;
+            FILE* f = std::fopen(kPath, "wb");
+            CHECK(f && saveDocument(f, d));
+            if (f) std::fclose(f);
+            if (how) spoilFill(bad);
+            expectLoads(bad < DOC_FHST);
+        }
+    }
+
+    // Enough lines for several check jobs: a bad one in the last finds its
+    // way out of whichever worker runs it, and z order holds across jobs
+    const size_t n = 200000;
+    docClearTools(d);
+    LineTool::Record* l = s.line.replaceRecords(n);
+    CHECK(l != nullptr);
+    if (!l) return;
+    for (size_t i = 0; i < n; ++i) l[i] = { POINT{ LONG(i % 800), 1 }, POINT{ 2, 3 }, 0, int(i) + 1 };
+    d.zCounter = gZCounter = int(n);
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass) l[n - 10].start.x = -DOC_MAX_COORD - 1;
+        FILE* f = std::fopen(kPath, "wb");
+        CHECK(f && saveDocument(f, d));
+        if (f) std::fclose(f);
+        expectLoads(pass == 0);
+    }
+    docClearTools(d);
+}
+
+int main() {
+    TestRandom rnd(11);
+    FramebufferBackend scratch(W, H);
+    TestScene scene;
+
+    testRoundTrip(scene, std::vector<uint32_t>(), 0, 0);   // empty
+    scene.addRandom(rnd, 600, W, H, scratch);
+    testRoundTrip(scene, std::vector<uint32_t>(), 0, 0);
+
+    std::vector<uint32_t> layer;
+    randomLayer(layer, 320, 200, rnd);
+    testRoundTrip(scene, layer, 320, 200);
+    testSameBytes(scene);
+    testDamaged();
+    testBadRecords();
+
+    std::remove(kPath);
+    return testResult("document");
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include "Bench.h"
+#include "ImageExport.h"
+#include "TestCanvas.h"
+
+// UI frame times while ImageExporter writes an N x 3N/4 drawing (default
+// N = 4000) as PNG. A frame is what a freehand drag costs the UI thread:
+// four segments composited, the canvas updated and copied to the window.
+//   sync   - encodePNG() on the calling thread: how long Save used to block
+//   start  - ImageExporter::start(): the snapshot copy the UI thread pays
+//   frames - median / 99th percentile / worst, idle and during the export
+
+static const char* kPath = "export_bench.png";
+
+struct FrameTimes {
+    std::vector<double> ms;
+
+    void report(const char* what) {
+        std::sort(ms.begin(), ms.end());
+        size_t n = ms.size();
+        if (n == 0) return;
+        std::printf("  %-12s %5zu frames  median %6.3f ms  p99 %6.3f ms  worst %6.3f ms\n", what, n,
+                    ms[n / 2], ms[std::min(n - 1, n * 99 / 100)], ms[n - 1]);
+    }
+};
+
+struct Drag {
+    TestRandom&           rnd;
+    FramebufferBackend&   preview;
+    std::vector<uint32_t> window;
+    POINT                 last = { CANVAS_W / 2, CANVAS_H / 2 };
+    int                   frames = 0;
+
+    Drag(TestRandom& r, FramebufferBackend& p) : rnd(r), preview(p), window(size_t(CANVAS_W) * CANVAS_H) {}
+
+    double frame() {
+        BenchTimer t;
+        int style = 0;
+        auto step = [&](LONG v, int hi) { return LONG(std::min(std::max(int(v) + rnd.next(41) - 20, 0), hi - 1)); };
+        for (int e = 0; e < 4; ++e) {
+            POINT p = { step(last.x, CANVAS_W), step(last.y, CANVAS_H) };
+            gRender = &preview;
+            freehandTool.addStroke(last, p, &style);
+            gRender = nullptr;
+            int openZ = freehandTool.openStrokeZ();
+            if (openZ != 0 && openZ <= gCanvasZ) compositeSegment(last, p);
+            last = p;
+        }
+        if (++frames % 30 == 0) {   // pen up now and then
+            RECT simplified;
+            if (freehandTool.endStroke(&simplified)) markDirty(simplified);
+        }
+        updateCanvas();
+        std::copy(gCanvasPx.begin(), gCanvasPx.end(), window.begin());
+        return t.ms();
+    }
+};
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 4000);
+    const int w = int(n), h = int(n * 3 / 4);
+    TestRandom rnd(19);
+
+    // The drawing to export, and a scene on the canvas to draw over
+    FramebufferBackend picture(w, h);
+    picture.clear(WHITE);
+    TestScene shapes;
+    shapes.addRandom(rnd, 3000, w, h, picture);
+    FramebufferBackend preview(CANVAS_W, CANVAS_H);
+    gScene.addRandom(rnd, 300, CANVAS_W, CANVAS_H, preview);
+    updateCanvas();
+
+    ExportBuffer out;
+    std::atomic<int> percent{ 0 };
+    BenchTimer t;
+    CHECK(encodePNG(out, picture.data(), w, h, &percent));
+    double sync = t.ms();
+    size_t pngBytes = out.size;
+
+    Drag drag(rnd, preview);
+    FrameTimes idle, busy;
+    for (int i = 0; i < 300; ++i) idle.ms.push_back(drag.frame());
+
+    ImageExporter exporter;
+    t.reset();
+    CHECK(exporter.start(kPath, ImageExporter::EXPORT_PNG, picture.data(), w, h, w));
+    double start = t.ms();
+    bool ok = false;
+    while (!exporter.poll(&ok)) busy.ms.push_back(drag.frame());
+    double total = t.ms();
+    CHECK(ok);
+
+    FILE* f = std::fopen(kPath, "rb");
+    uint64_t bytes = 0;
+    CHECK(f && docFileSize(f, &bytes) && bytes == pngBytes);
+    if (f) std::fclose(f);
+    std::remove(kPath);
+
+    std::printf("%d x %d PNG, %.1f MB\n", w, h, double(pngBytes) / (1024.0 * 1024.0));
+    std::printf("  sync:  %8.2f ms on the UI thread\n", sync);
+    std::printf("  start: %8.2f ms, then %.2f ms on the worker\n", start, total - start);
+    idle.report("idle:");
+    busy.report("exporting:");
+    return testResult("export bench");
+}
@@ -0,0 +1,283 @@
+#include "UndoHistory.h"
+#include "TestScene.h"
+
+// Autosave journal: whatever mix of commits, deletes, undo/redo steps,
+// clears, image and document loads and raster erase bakes came before, recovering the
+// snapshot plus journal gives back the live scene. Also across a restart
+// (the old journal is folded into the next snapshot), with records too big
+// to copy under the lock and bursts that fill several chunks, and with a
+// torn batch at the end of the file.
+
+static const int W = 800, H = 600;
+static const char* kBase = "journal_test_autosave";
+static const char* kDoc = "journal_test_open.dpad";
+static const int kSection[T_COUNT] = { DOC_FHST, DOC_LINE, DOC_TRI, DOC_SQR, DOC_CIRC, DOC_OVAL, DOC_ERAS };
+
+static std::vector<uint32_t> gLayer;      // live background layer (empty: none)
+static std::vector<uint32_t> gRecovered;
+static uint32_t* allocLayer(int w, int h) { gLayer.assign(size_t(w) * h, 0); return gLayer.data(); }
+static uint32_t* allocRecovered(int w, int h) { gRecovered.assign(size_t(w) * h, 0); return gRecovered.data(); }
+
+struct Session {
+    TestScene&          scene;
+    TestRandom&         rnd;
+    FramebufferBackend& scratch;
+    Journal&            journal;
+    UndoHistory&        history;
+
+    DocScene doc() {
+        DocScene s = scene.doc(allocLayer);
+        if (!gLayer.empty()) {
+            s.background = gLayer.data();
+            s.bgWidth = W;
+            s.bgHeight = H;
+        }
+        return s;
+    }
+
+    template <class T>
+    void journalNewest(T& tool, int section) {
+        size_t n = tool.getCount();
+        journal.add(section, &tool.records()[n - 1], sizeof(typename T::Record));
+        history.added(section, tool.getZ(n - 1));
+    }
+
+    // One random commit, journaled and logged the way main.cpp does it
+    void commit() {
+        size_t before[T_COUNT];
+        for (int t = 0; t < T_COUNT; ++t) before[t] = scene.count(t);
+        scene.addRandom(rnd, 1, W, H, scratch);
+        for (int t = 0; t < T_COUNT; ++t) {
+            size_t n = scene.count(t);
+            if (n == before[t]) continue;
+            switch (t) {
+            case T_FREEHAND: {
+                const FreehandTool::Record& s = scene.freehand.records()[n - 1];
+                journal.addStroke(s, scene.freehand.pointPool() + s.first);
+                history.addedStroke(s.z);
+                break;
+            }
+            case T_LINE:     journalNewest(scene.line, DOC_LINE);     break;
+            case T_TRIANGLE: journalNewest(scene.triangle, DOC_TRI);  break;
+            case T_SQUARE:   journalNewest(scene.square, DOC_SQR);    break;
+            case T_CIRCLE:   journalNewest(scene.circle, DOC_CIRC);   break;
+            case T_OVAL:     journalNewest(scene.oval, DOC_OVAL);     break;
+            default:
+                journal.addCapsules(scene.eraser.records() + before[t], n - before[t]);
+                history.addedCapsules(n - before[t]);
+                break;
+            }
+        }
+    }
+
+    // Right-click delete of a few lines
+    void eraseLines() {
+        std::vector<int> zs;
+        RECT area = makeRect(0, 0, -1, -1);
+        for (size_t i = 0, n = scene.line.getCount(); i < n; i += 1 + rnd.next(5)) {
+            if (zs.empty()) area = scene.line.getBounds(i);
+            else rectUnion(area, scene.line.getBounds(i));
+            zs.push_back(scene.line.getZ(i));
+        }
+        if (zs.empty()) return;
+        DocScene s = doc();
+        history.erasing(s, DOC_LINE, zs.data(), zs.size(), area, false);
+        scene.line.eraseZs(zs.data(), zs.size());
+        journal.erase(DOC_LINE, zs.data(), zs.size());
+    }
+
+    // Clear, or opening an image: the scene is swapped out for undo
+    void replace(bool image) {
+        DocScene s = doc();
+        history.replacing(s, false);
+        gLayer.clear();
+        journal.clear();
+        if (image) {
+            randomLayer(gLayer, W, H, rnd);
+            journal.background(gLayer.data(), W, H);
+        }
+    }
+
+    // Opening a .dpad: a new history, the scene read from the file and the
+    // journal rebased onto it. Saving over the file waits for the copy.
+    void open() {
+        TestScene other;
+        other.addRandom(rnd, 1 + rnd.next(40), W, H, scratch);
+        DocScene o = other.doc();
+        FILE* f = std::fopen(kDoc, "wb");
+        CHECK(f && saveDocument(f, o));
+        if (f) std::fclose(f);
+
+        history.reset();
+        gLayer.clear();
+        DocScene s = scene.doc(allocLayer);
+        f = std::fopen(kDoc, "rb");
+        CHECK(f && loadDocument(f, s));
+        if (f) std::fclose(f);
+        journal.rebase(kDoc);
+        if (rnd.next(2)) {
+            journal.waitBase();
+            f = std::fopen(kDoc, "wb");
+            CHECK(f && saveDocument(f, o));
+            if (f) std::fclose(f);
+        }
+    }
+
+    // Raster erase bake of a random part of the scene into a rectangle
+    void bake() {
+        std::vector<int> zs[DOC_KNOWN];
+        const int* zp[DOC_KNOWN];
+        size_t zn[DOC_KNOWN];
+        for (const TestRef& r : scene.refs())
+            if (rnd.next(3) == 0) zs[kSection[r.tool]].push_back(r.z);
+        for (int k = 0; k < DOC_KNOWN; ++k) { zp[k] = zs[k].data(); zn[k] = zs[k].size(); }
+        int x = rnd.next(W - 50), y = rnd.next(H - 50);
+        RECT area = makeRect(x, y, x + rnd.next(50), y + rnd.next(50));
+
+        DocScene s = doc();
+        history.baking(s, zp, zn, area, W, H, false);
+        if (gLayer.empty()) gLayer.assign(size_t(W) * H, 0xFFFFFF);
+        uint32_t px = uint32_t(rnd.next(0x1000000));
+        for (int yy = area.top; yy <= area.bottom; ++yy)
+            for (int xx = area.left; xx <= area.right; ++xx) gLayer[size_t(yy) * W + xx] = px;
+        scene.freehand.eraseZs(zp[DOC_FHST], zn[DOC_FHST]);
+        scene.line.eraseZs(zp[DOC_LINE], zn[DOC_LINE]);
+        scene.triangle.eraseZs(zp[DOC_TRI], zn[DOC_TRI]);
+        scene.square.eraseZs(zp[DOC_SQR], zn[DOC_SQR]);
+        scene.circle.eraseZs(zp[DOC_CIRC], zn[DOC_CIRC]);
+        scene.oval.eraseZs(zp[DOC_OVAL], zn[DOC_OVAL]);
+        scene.eraser.eraseZs(zp[DOC_ERAS], zn[DOC_ERAS]);
+        for (int k = 0; k < DOC_KNOWN; ++k) journal.erase(k, zp[k], zn[k]);
+        journal.backgroundRect(gLayer.data(), W, H, area);
+    }
+
+    void step(bool redo) {
+        DocScene s = doc();
+        if (redo) history.redo(s);
+        else history.undo(s);
+        if (!s.background) gLayer.clear();
+    }
+
+    void run(int steps) {
+        for (int i = 0; i < steps; ++i) {
+            int op = rnd.next(100);
+            if (op < 60)      commit();
+            else if (op < 72) step(false);
+            else if (op < 80) step(true);
+            else if (op < 86) eraseLines();
+            else if (op < 94) bake();
+            else if (op < 96) replace(false);
+            else if (op < 98) replace(true);
+            else              open();
+        }
+    }
+};
+
+// The scene recovered from disk matches the live one
+static void checkRecovery(const TestScene& live) {
+    TestScene got;
+    DocScene d = got.doc(allocRecovered);
+    gRecovered.clear();
+    uint32_t gen = 0;
+    CHECK(Journal::recover(kBase, d, &gen));
+    CHECK(sameScene(live, got));
+    CHECK(d.zCounter == gZCounter);
+    if (gLayer.empty()) CHECK(d.background == nullptr);
+    else CHECK(d.background && d.bgWidth == W && d.bgHeight == H && gRecovered == gLayer);
+}
+
+int main() {
+    Journal::discard(kBase);
+    TestRandom rnd(5);
+    FramebufferBackend scratch(W, H);
+    TestScene scene;
+
+    // A bake on its own, then one undone: the layer rect and the records
+    // put back between the others
+    for (int undo = 0; undo < 2; ++undo) {
+        Journal journal;
+        UndoHistory history(journal, size_t(8) << 20, size_t(64) << 20);
+        CHECK(journal.start(kBase));
+        Session s = { scene, rnd, scratch, journal, history };
+        for (int i = 0; i < 30; ++i) s.commit();
+        s.bake();
+        if (undo) s.step(false);
+        journal.stop();
+        CHECK(!journal.failed());
+        checkRecovery(scene);
+    }
+
+    {
+        Journal journal;
+        UndoHistory history(journal, size_t(8) << 20, size_t(64) << 20);
+        CHECK(journal.start(kBase));
+        Session s = { scene, rnd, scratch, journal, history };
+        for (int i = 0; i < 20; ++i) s.commit();
+        s.bake();
+        s.step(false);   // the bake comes back out: records and layer
+        s.step(true);
+        s.replace(false);
+        s.step(false);   // the cleared scene comes back through its slot
+        s.run(400);
+        journal.stop();
+        CHECK(!journal.failed());
+    }
+    checkRecovery(scene);
+
+    // Restart: the journal above is folded into a new snapshot first
+    {
+        Journal journal;
+        UndoHistory history(journal, size_t(8) << 20, size_t(64) << 20);
+        CHECK(journal.start(kBase));
+        Session s = { scene, rnd, scratch, journal, history };
+        s.run(200);
+        journal.stop();
+        CHECK(!journal.failed());
+    }
+    checkRecovery(scene);
+
+    // Records past INLINE_BYTES (a pasted run of lines, a long stroke)
+    // go by block and keep their tool; a burst of small ones fills several
+    // chunks before the writer takes them
+    {
+        Journal journal;
+        CHECK(journal.start(kBase));
+        std::vector<LineTool::Record> paste(4000);
+        for (LineTool::Record& l : paste)
+            l = { POINT{ LONG(rnd.next(W)), LONG(rnd.next(H)) }, POINT{ LONG(rnd.next(W)), 5 }, 0, ++gZCounter };
+        CHECK(scene.line.insertRecords(paste.data(), paste.size()));
+        journal.add(DOC_LINE, paste.data(), paste.size() * sizeof(LineTool::Record));
+
+        std::vector<POINT> pts(12000);
+        for (size_t i = 0; i < pts.size(); ++i) pts[i] = { LONG(i % W), LONG(i / W) };
+        FreehandTool::Record st = FreehandTool::Record();
+        st.count = int(pts.size());
+        st.z = ++gZCounter;
+        st.box = makeRect(-1, -1, W, int(pts.size() / W) + 1);
+        CHECK(scene.freehand.insertStrokes(&st, 1, pts.data()));
+        journal.addStroke(st, pts.data());
+
+        for (int i = 0; i < 60000; ++i) {
+            LineTool::Record l = { POINT{ LONG(i % W), 7 }, POINT{ 9, LONG(i % H) }, 1, ++gZCounter };
+            CHECK(scene.line.insertRecords(&l, 1));
+            journal.add(DOC_LINE, &l, sizeof(l));
+        }
+        journal.stop();
+        CHECK(!journal.failed());
+    }
+    checkRecovery(scene);
+
+    // A torn batch at the end (its header and a few bytes) is ignored
+    FILE* f = std::fopen("journal_test_autosave.dpj", "ab");
+    CHECK(f != nullptr);
+    if (f) {
+        static const uint8_t torn[] = { 'J', 'A', 'T', 'H', 64, 0, 0, 0, 1, 2, 3, 4, 0, 0, 0, 0, 1, 0, 0 };
+        std::fwrite(torn, 1, sizeof(torn), f);
+        std::fclose(f);
+    }
+    checkRecovery(scene);
+
+    Journal::discard(kBase);
+    std::remove(kDoc);
+    return testResult("journal");
+}
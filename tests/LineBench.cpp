@@ -0,0 +1,112 @@
+#include <list>
+#include "Bench.h"
+#include "TestScene.h"
+
+// LineTool's contiguous records against the std::list + itAt() storage they
+// replaced, on N committed lines (default 20000). Both go through the
+// per-index API a rebuild uses:
+//   walk  - getZ(i) and getBounds(i) for every i (the merge's view)
+//   draw  - drawAt(i) for every i onto the framebuffer
+//   erase - removing every 16th line by z
+
+// The old storage, reduced to the calls the bench makes
+struct ListLines {
+    struct StyledLine {
+        POINT start;
+        POINT end;
+        int   style;
+        int   z;
+    };
+    std::list<StyledLine> completedLines;
+
+    std::list<StyledLine>::const_iterator itAt(size_t i) const {
+        auto it = completedLines.cbegin();
+        while (i-- && it != completedLines.cend()) ++it;
+        return it;
+    }
+    size_t getCount() const { return completedLines.size(); }
+    int getZ(size_t i) const {
+        auto it = itAt(i);
+        return (it == completedLines.cend()) ? 0 : it->z;
+    }
+    RECT getBounds(size_t i) const {
+        auto it = itAt(i);
+        if (it == completedLines.cend()) return makeRect(0, 0, -1, -1);
+        return segmentBounds(it->start, it->end, 1);
+    }
+    void drawAt(size_t i) const {
+        auto it = itAt(i);
+        if (it == completedLines.cend()) return;
+        int style = it->style;
+        drawCustomLine(it->start, it->end, &style);
+    }
+    // One list erase per z, the way deleteLineNear() removed them
+    void eraseZs(const int* zs, size_t n) {
+        auto it = completedLines.begin();
+        for (size_t k = 0; k < n && it != completedLines.end();) {
+            if (it->z == zs[k]) { it = completedLines.erase(it); ++k; }
+            else ++it;
+        }
+    }
+};
+
+template <class Lines>
+static long walk(const Lines& l) {
+    long sum = 0;
+    for (size_t i = 0, n = l.getCount(); i < n; ++i) sum += l.getZ(i) + l.getBounds(i).left;
+    return sum;
+}
+
+template <class Lines>
+static void drawAll(const Lines& l) {
+    for (size_t i = 0, n = l.getCount(); i < n; ++i) l.drawAt(i);
+}
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 20000);
+    const int W = 800, H = 600;
+    FramebufferBackend fb(W, H);
+    gRender = &fb;
+
+    TestRandom rnd(4);
+    LineTool lines;
+    ListLines list;
+    for (long k = 0; k < n; ++k) {
+        POINT a = { LONG(rnd.next(W)), LONG(rnd.next(H)) };
+        POINT b = { a.x + rnd.next(41) - 20, a.y + rnd.next(41) - 20 };
+        int style = rnd.next(3);
+        lines.addPoint(a);
+        lines.addPoint(b);
+        lines.drawAndReset(&style);
+        list.completedLines.push_back({ a, b, style, gZCounter });
+    }
+    std::vector<int> zs;
+    for (size_t i = 0; i < lines.getCount(); i += 16) zs.push_back(lines.getZ(i));
+
+    volatile long sink = 0;
+    double listWalk = benchBest(3, [&] { sink = sink + walk(list); });
+    double arrayWalk = benchBest(3, [&] { sink = sink + walk(lines); });
+    CHECK(walk(list) == walk(lines));
+
+    fb.clear(WHITE);
+    double listDraw = benchBest(3, [&] { drawAll(list); });
+    std::vector<uint32_t> listPx(fb.data(), fb.data() + size_t(W) * H);
+    fb.clear(WHITE);
+    double arrayDraw = benchBest(3, [&] { drawAll(lines); });
+    CHECK(std::equal(listPx.begin(), listPx.end(), fb.data()));
+
+    BenchTimer t;
+    list.eraseZs(zs.data(), zs.size());
+    double listErase = t.ms();
+    t.reset();
+    lines.eraseZs(zs.data(), zs.size());
+    double arrayErase = t.ms();
+    CHECK(list.getCount() == lines.getCount() && walk(list) == walk(lines));
+
+    gRender = nullptr;
+    std::printf("%ld lines\n", n);
+    std::printf("  walk:  list %9.2f ms   array %8.3f ms\n", listWalk, arrayWalk);
+    std::printf("  draw:  list %9.2f ms   array %8.3f ms\n", listDraw, arrayDraw);
+    std::printf("  erase: list %9.2f ms   array %8.3f ms\n", listErase, arrayErase);
+    return testResult("line bench");
+}
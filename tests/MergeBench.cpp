@@ -0,0 +1,119 @@
+#include <algorithm>
+#include "Bench.h"
+#include "TestCanvas.h"
+
+// ZMerge against the gather-and-sort drawItems() it replaced, on a scene of
+// N small items spread over the seven tools (default 1M):
+//   order  - producing the global z order alone
+//   area   - the same with a dirty rectangle filter
+//   full   - a whole serial rebuild (order + drawing) on the framebuffer
+
+static void addSmall(TestRandom& rnd, long n) {
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    gRender = &scratch;
+    int style = 0;
+    fillEnabled = false;
+    for (long k = 0; k < n; ++k) {
+        POINT p = { LONG(rnd.next(CANVAS_W)), LONG(rnd.next(CANVAS_H)) };
+        POINT q = { p.x + rnd.next(17) - 8, p.y + rnd.next(17) - 8 };
+        switch (rnd.next(TOOL_COUNT)) {
+        case TOOL_FREEHAND:
+            freehandTool.addStroke(p, q, &style);
+            freehandTool.endStroke();
+            break;
+        case TOOL_LINE:
+            lineTool.addPoint(p); lineTool.addPoint(q);
+            lineTool.drawAndReset(&style);
+            break;
+        case TOOL_TRIANGLE:
+            triangleTool.addPoint(p); triangleTool.addPoint(q); triangleTool.addPoint(POINT{ p.x, q.y });
+            triangleTool.drawAndReset(&style, false);
+            break;
+        case TOOL_SQUARE:
+            squareTool.addPoint(p); squareTool.addPoint(q);
+            squareTool.drawAndReset(&style, false);
+            break;
+        case TOOL_CIRCLE:
+            circleTool.addPoint(p); circleTool.addPoint(POINT{ p.x + 1 + rnd.next(8), p.y });
+            circleTool.drawAndReset(&style);
+            break;
+        case TOOL_OVAL:
+            ovalTool.addPoint(p); ovalTool.addPoint(POINT{ p.x + 1 + rnd.next(10), p.y + 1 + rnd.next(6) });
+            ovalTool.drawAndReset(&style);
+            break;
+        default:
+            eraserTool.beginStroke(2 + rnd.next(4));
+            eraserTool.addDab(p);
+            eraserTool.endStroke();
+            break;
+        }
+    }
+    gRender = nullptr;
+}
+
+// The pre-ZMerge drawItems() order: gather every candidate, then sort by z
+static void gatherSorted(std::vector<RenderRef>& refs, int minZ, const RECT* area) {
+    refs.clear();
+    for (int t = 0; t < TOOL_COUNT; ++t) {
+        Tool tool = static_cast<Tool>(t);
+        size_t i = toolCount(tool);
+        while (i > 0 && toolZ(tool, i - 1) > minZ) --i;
+        for (size_t n = toolCount(tool); i < n; ++i) {
+            if (area && !rectsOverlap(toolBounds(tool, i), *area)) continue;
+            refs.push_back({ toolZ(tool, i), tool, i });
+        }
+    }
+    std::sort(refs.begin(), refs.end(), [](const RenderRef& a, const RenderRef& b) { return a.z < b.z; });
+}
+
+static size_t walkMerge(const RECT* area) {
+    size_t sum = 0;
+    ZMerge merge(0, area);
+    RenderRef r;
+    while (merge.next(r)) sum += r.index;
+    return sum;
+}
+
+static size_t walkSorted(const RECT* area) {
+    static std::vector<RenderRef> refs;   // kept across runs, like a warm heap
+    gatherSorted(refs, 0, area);
+    size_t sum = 0;
+    for (const RenderRef& r : refs) sum += r.index;
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    long n = benchSize(argc, argv, 1000000);
+    TestRandom rnd(3);
+    resetCanvasScene();
+    addSmall(rnd, n);
+    createCanvas();
+
+    volatile size_t sink = 0;
+    RECT area = makeRect(300, 200, 499, 399);
+    double sortOrder = benchBest(5, [&] { sink = sink + walkSorted(nullptr); });
+    double mergeOrder = benchBest(5, [&] { sink = sink + walkMerge(nullptr); });
+    double sortArea = benchBest(5, [&] { sink = sink + walkSorted(&area); });
+    double mergeArea = benchBest(5, [&] { sink = sink + walkMerge(&area); });
+
+    // Whole serial rebuild: the old order feeding the same draws, then the compositor's own
+    static std::vector<RenderRef> refs;
+    double sortFull = benchBest(3, [&] {
+        beginCanvas();
+        paintCanvasBase(makeRect(0, 0, CANVAS_W - 1, CANVAS_H - 1));
+        gRender->setRop(R2_COPYPEN);
+        gRender->setLineColor(BLACK);
+        gatherSorted(refs, 0, nullptr);
+        for (const RenderRef& r : refs) toolDrawAt(r.tool, r.index);
+        endCanvas();
+    });
+    std::vector<uint32_t> sorted = gCanvasPx;
+    double mergeFull = benchBest(3, [&] { gNeedsRebuild = true; rebuildCanvas(); });
+    CHECK(gCanvasPx == sorted);
+
+    std::printf("%ld items\n", n);
+    std::printf("  order: sort %8.2f ms   merge %8.2f ms\n", sortOrder, mergeOrder);
+    std::printf("  area:  sort %8.2f ms   merge %8.2f ms\n", sortArea, mergeArea);
+    std::printf("  full:  sort %8.2f ms   merge %8.2f ms\n", sortFull, mergeFull);
+    return testResult("merge bench");
+}
@@ -0,0 +1,307 @@
+#include "ImageExport.h"
+#include "TestScene.h"
+
+// PNG export: what encodePNG writes decodes back to the same pixels. The
+// decoder below is written from the PNG and deflate specs (stored, fixed and
+// dynamic blocks, all five row filters) so it shares nothing with the
+// encoder, and it checks every chunk CRC and the Adler-32.
+
+static uint32_t be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+// ---- Inflate ----
+
+struct Inflate {
+    const uint8_t* in;
+    size_t size, pos = 0;
+    uint32_t bitBuf = 0;
+    int bitCount = 0;
+    bool bad = false;
+    std::vector<uint8_t> out;
+
+    Inflate(const uint8_t* p, size_t n) : in(p), size(n) {}
+
+    int bits(int n) {
+        uint32_t v = bitBuf;
+        while (bitCount < n) {
+            if (pos >= size) { bad = true; return 0; }
+            v |= uint32_t(in[pos++]) << bitCount;
+            bitCount += 8;
+        }
+        bitBuf = v >> n;
+        bitCount -= n;
+        return int(v & ((1u << n) - 1));
+    }
+
+    // Canonical Huffman code: how many codes of each length, symbols by code
+    struct Huffman { short count[16]; short symbol[288]; };
+
+    static bool build(Huffman& hf, const short* lengths, int n) {
+        std::memset(hf.count, 0, sizeof(hf.count));
+        for (int s = 0; s < n; ++s) hf.count[lengths[s]]++;
+        if (hf.count[0] == n) return true;   // no codes: only bad if used
+        int left = 1;
+        for (int len = 1; len < 16; ++len) {
+            left = 2 * left - hf.count[len];
+            if (left < 0) return false;      // over-subscribed
+        }
+        short offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; ++len) offs[len + 1] = short(offs[len] + hf.count[len]);
+        for (int s = 0; s < n; ++s)
+            if (lengths[s]) hf.symbol[offs[lengths[s]]++] = short(s);
+        return true;
+    }
+
+    int decode(const Huffman& hf) {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; ++len) {
+            code |= bits(1);
+            int count = hf.count[len];
+            if (code - count < first) return hf.symbol[index + (code - first)];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        bad = true;
+        return 0;
+    }
+
+    bool stored() {
+        bitBuf = 0;
+        bitCount = 0;
+        if (pos + 4 > size) return false;
+        unsigned len = in[pos] | (in[pos + 1] << 8);
+        unsigned nlen = in[pos + 2] | (in[pos + 3] << 8);
+        pos += 4;
+        if (len != (~nlen & 0xFFFF) || pos + len > size) return false;
+        out.insert(out.end(), in + pos, in + pos + len);
+        pos += len;
+        return true;
+    }
+
+    bool codes(const Huffman& lit, const Huffman& dist) {
+        static const short lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const short lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const short dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                         257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                         8193, 12289, 16385, 24577 };
+        static const short dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        for (;;) {
+            int sym = decode(lit);
+            if (bad) return false;
+            if (sym < 256) { out.push_back(uint8_t(sym)); continue; }
+            if (sym == 256) return true;
+            sym -= 257;
+            if (sym >= 29) return false;
+            size_t len = size_t(lbase[sym] + bits(lext[sym]));
+            int d = decode(dist);
+            if (bad || d >= 30) return false;
+            size_t back = size_t(dbase[d] + bits(dext[d]));
+            if (bad || back > out.size()) return false;
+            for (size_t i = 0; i < len; ++i) out.push_back(out[out.size() - back]);
+        }
+    }
+
+    bool fixed() {
+        short lengths[288];
+        int s = 0;
+        for (; s < 144; ++s) lengths[s] = 8;
+        for (; s < 256; ++s) lengths[s] = 9;
+        for (; s < 280; ++s) lengths[s] = 7;
+        for (; s < 288; ++s) lengths[s] = 8;
+        Huffman lit, dist;
+        build(lit, lengths, 288);
+        for (s = 0; s < 30; ++s) lengths[s] = 5;
+        build(dist, lengths, 30);
+        return codes(lit, dist);
+    }
+
+    bool dynamic() {
+        static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        int nlen = bits(5) + 257, ndist = bits(5) + 1, ncode = bits(4) + 4;
+        if (bad || nlen > 286 || ndist > 30) return false;
+        short lengths[320] = {};
+        for (int i = 0; i < ncode; ++i) lengths[order[i]] = short(bits(3));
+        Huffman lencode, lit, dist;
+        if (!build(lencode, lengths, 19)) return false;
+        for (int i = 0; i < nlen + ndist;) {
+            int sym = decode(lencode);
+            if (bad) return false;
+            if (sym < 16) { lengths[i++] = short(sym); continue; }
+            short len = 0;
+            int rep;
+            if (sym == 16) {
+                if (i == 0) return false;
+                len = lengths[i - 1];
+                rep = 3 + bits(2);
+            }
+            else if (sym == 17) rep = 3 + bits(3);
+            else                rep = 11 + bits(7);
+            if (i + rep > nlen + ndist) return false;
+            while (rep--) lengths[i++] = len;
+        }
+        if (lengths[256] == 0) return false;
+        return build(lit, lengths, nlen) && build(dist, lengths + nlen, ndist) && codes(lit, dist);
+    }
+
+    bool run() {
+        int last;
+        do {
+            last = bits(1);
+            int type = bits(2);
+            bool ok = type == 0 ? stored() : type == 1 ? fixed() : type == 2 ? dynamic() : false;
+            if (!ok || bad) return false;
+        } while (!last);
+        bitBuf = 0;   // the rest of the byte is padding
+        bitCount = 0;
+        return true;
+    }
+};
+
+// ---- PNG ----
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+// 8-bit RGB PNG back to 0x00RRGGBB pixels; false on anything malformed
+static bool decodePNG(const uint8_t* p, size_t n, std::vector<uint32_t>& px, int& w, int& h) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (n < 8 || std::memcmp(p, signature, 8) != 0) return false;
+    std::vector<uint8_t> idat;
+    bool header = false, end = false;
+    for (size_t pos = 8; !end;) {
+        if (pos + 12 > n) return false;
+        uint32_t len = be32(p + pos);
+        if (len > n - pos - 12) return false;
+        const uint8_t* type = p + pos + 4;
+        const uint8_t* data = type + 4;
+        if (crc32Update(0, type, len + 4) != be32(data + len)) return false;
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            if (header || len != 13) return false;
+            w = int(be32(data));
+            h = int(be32(data + 4));
+            if (w <= 0 || h <= 0 || data[8] != 8 || data[9] != 2 || data[10] || data[11] || data[12]) return false;
+            header = true;
+        }
+        else if (std::memcmp(type, "IDAT", 4) == 0) idat.insert(idat.end(), data, data + len);
+        else if (std::memcmp(type, "IEND", 4) == 0) end = true;
+        else if (!(type[0] & 0x20)) return false;   // unknown critical chunk
+        pos += 12 + len;
+    }
+    if (!header || idat.size() < 6) return false;
+
+    // zlib: CMF/FLG, deflate, Adler-32
+    if ((idat[0] & 0x0F) != 8 || ((idat[0] << 8) | idat[1]) % 31 != 0 || (idat[1] & 0x20)) return false;
+    Inflate z(idat.data() + 2, idat.size() - 2);
+    if (!z.run() || z.pos + 4 != z.size) return false;
+    if (be32(z.in + z.pos) != adler32(z.out.data(), z.out.size())) return false;
+
+    const size_t rowBytes = size_t(w) * 3;
+    if (z.out.size() != (rowBytes + 1) * h) return false;
+    std::vector<uint8_t> prev(rowBytes, 0), cur(rowBytes);
+    px.assign(size_t(w) * h, 0);
+    for (int y = 0; y < h; ++y) {
+        const uint8_t* row = z.out.data() + size_t(y) * (rowBytes + 1);
+        int filter = row[0];
+        for (size_t k = 0; k < rowBytes; ++k) {
+            int a = k >= 3 ? cur[k - 3] : 0, b = prev[k], c = k >= 3 ? prev[k - 3] : 0;
+            int pred;
+            switch (filter) {
+            case 0:  pred = 0; break;
+            case 1:  pred = a; break;
+            case 2:  pred = b; break;
+            case 3:  pred = (a + b) / 2; break;
+            case 4:  pred = paeth(a, b, c); break;
+            default: return false;
+            }
+            cur[k] = uint8_t(row[1 + k] + pred);
+        }
+        for (int x = 0; x < w; ++x)
+            px[size_t(y) * w + x] = (uint32_t(cur[3 * x]) << 16) | (uint32_t(cur[3 * x + 1]) << 8) | cur[3 * x + 2];
+        prev.swap(cur);
+    }
+    return true;
+}
+
+// ---- Images ----
+
+static void testImage(const char* name, const std::vector<uint32_t>& px, int w, int h) {
+    ExportBuffer out;
+    std::atomic<int> progress(0);
+    bool ok = encodePNG(out, px.data(), w, h, &progress);
+    CHECK(ok);
+    if (!ok) return;
+    std::vector<uint32_t> back;
+    int bw = 0, bh = 0;
+    bool decoded = decodePNG(out.data, out.size, back, bw, bh);
+    if (!decoded || bw != w || bh != h || back != px)
+        std::printf("png: %s (%dx%d) did not round-trip\n", name, w, h);
+    CHECK(decoded && bw == w && bh == h && back == px);
+}
+
+int main() {
+    // The decoder itself: a stored block and a dynamic block from zlib
+    {
+        static const uint8_t stored[] = { 0x01, 0x03, 0x00, 0xFC, 0xFF, 'a', 'b', 'c' };
+        Inflate z(stored, sizeof(stored));
+        CHECK(z.run() && z.out.size() == 3 && std::memcmp(z.out.data(), "abc", 3) == 0);
+    }
+    {
+        static const uint8_t dynamic[] = {
+            0xC5, 0xCC, 0x81, 0x0D, 0xC0, 0x20, 0x08, 0x00, 0xB0, 0x5B, 0xD9, 0x44, 0x20, 0x0A, 0x62, 0x50,
+            0x78, 0x7F, 0x67, 0xAC, 0x07, 0x14, 0xB8, 0x47, 0xFA, 0x03, 0x16, 0x56, 0xB0, 0xCE, 0x6E, 0x78,
+            0x1B, 0xE8, 0x62, 0xB7, 0x97, 0x40, 0x24, 0xDF, 0x64, 0x2E, 0x84, 0xA9, 0x38, 0xE5, 0x94, 0x57,
+            0x0E, 0x93, 0xED, 0x34, 0xBA, 0x3B, 0xA9, 0xC4, 0xD5, 0xD8, 0x48, 0xF0, 0x7F, 0xF2, 0x01
+        };
+        std::vector<uint8_t> expect(200);
+        for (int i = 0; i < 200; ++i) expect[i] = uint8_t((i * i * 7 + i / 3) % 23 + 'a');
+        Inflate z(dynamic, sizeof(dynamic));
+        CHECK(z.run() && z.out == expect);
+    }
+
+    TestRandom rnd(3);
+    std::vector<uint32_t> px;
+
+    px.assign(1, 0x123456);
+    testImage("single pixel", px, 1, 1);
+
+    px.assign(size_t(97) * 61, 0xFFFFFF);
+    testImage("flat white", px, 97, 61);
+
+    px.resize(size_t(257) * 131);
+    for (int y = 0; y < 131; ++y)
+        for (int x = 0; x < 257; ++x) px[size_t(y) * 257 + x] = (uint32_t(x & 0xFF) << 16) | (uint32_t((y * 2) & 0xFF) << 8) | uint32_t((x + y) & 0xFF);
+    testImage("gradient", px, 257, 131);
+
+    px.resize(size_t(203) * 77);
+    for (uint32_t& p : px) p = uint32_t(rnd.next(0x1000000));
+    testImage("noise", px, 203, 77);
+
+    px.resize(size_t(1) * 300);
+    for (uint32_t& p : px) p = uint32_t(rnd.next(4)) * 0x3F3F3F;
+    testImage("one column", px, 1, 300);
+
+    // A drawn canvas: long runs, repeats and edges, like a real export
+    const int W = 640, H = 480;
+    FramebufferBackend canvas(W, H), scratch(W, H);
+    TestScene scene;
+    scene.addRandom(rnd, 300, W, H, scratch);
+    gRender = &canvas;
+    canvas.clear(WHITE);
+    canvas.setRop(R2_COPYPEN);
+    canvas.setLineColor(BLACK);
+    for (const TestRef& r : scene.refs()) scene.drawAt(r.tool, r.index);
+    px.assign(canvas.data(), canvas.data() + size_t(W) * H);
+    for (uint32_t& p : px) p &= 0xFFFFFF;
+    testImage("canvas", px, W, H);
+
+    return testResult("png");
+}
@@ -0,0 +1,277 @@
+#include "TestCanvas.h"
+
+// Canvas compositing (CanvasCompositor.h): every shortcut updateCanvas()
+// takes has to leave exactly the pixels a full serial rebuild gives.
+
+// appendToCanvas(): batches of new commits drawn straight onto the cached
+// canvas, one update per batch like one presented frame
+static void testIncremental(TestRandom& rnd) {
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    updateCanvas();   // first frame: a rebuild
+    for (int round = 0; round < 12; ++round) {
+        gScene.addRandom(rnd, 1 + rnd.next(40), CANVAS_W, CANVAS_H, scratch);
+        CHECK(gCanvasZ < gZCounter);
+        updateCanvas();
+        CHECK(gCanvasZ == gZCounter && !gNeedsRebuild);
+        CHECK(gCanvasPx == fullRebuild());
+    }
+}
+
+// repairDirty(): right-click deletes mark the deleted shapes' bounds dirty
+// and only that rectangle is repainted
+static void testDirtyRepair(TestRandom& rnd) {
+    static const Tool shapes[] = { TOOL_LINE, TOOL_TRIANGLE, TOOL_SQUARE, TOOL_CIRCLE, TOOL_OVAL };
+    for (int round = 0; round < 10; ++round) {
+        updateCanvas();
+        Tool t = shapes[rnd.next(5)];
+        std::vector<int> zs;
+        for (size_t i = 0, n = toolCount(t); i < n && zs.size() < 4; i += 1 + rnd.next(9)) {
+            markDirty(toolBounds(t, i));
+            zs.push_back(toolZ(t, i));
+        }
+        if (zs.empty()) continue;
+        toolEraseZs(t, zs.data(), zs.size());
+        CHECK(gHasDirty);
+        updateCanvas();
+        CHECK(!gHasDirty && !gNeedsRebuild);
+        CHECK(gCanvasPx == fullRebuild());
+    }
+}
+
+// The event loop's freehand path: one frame per batch of drag events. Once
+// the open stroke is on the canvas its new segments go through
+// compositeSegment() rather than a rebuild; pen-up replaces the polyline
+// with its simplified form through a dirty repaint.
+static void testOpenStroke(TestRandom& rnd) {
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    for (int stroke = 0; stroke < 6; ++stroke) {
+        int style = stroke % 2;
+        POINT last = { LONG(rnd.next(CANVAS_W)), LONG(rnd.next(CANVAS_H)) };
+        for (int frame = 0; frame < 15; ++frame) {
+            for (int e = 0, n = 1 + rnd.next(4); e < n; ++e) {
+                POINT p = { last.x + rnd.next(41) - 20, last.y + rnd.next(41) - 20 };
+                gRender = &scratch;   // the live preview
+                freehandTool.addStroke(last, p, &style);
+                gRender = nullptr;
+                int openZ = freehandTool.openStrokeZ();
+                if (openZ != 0 && openZ <= gCanvasZ) compositeSegment(last, p);
+                last = p;
+            }
+            updateCanvas();
+            CHECK(gCanvasZ == gZCounter);
+            CHECK(gCanvasPx == fullRebuild());
+        }
+        RECT simplified;
+        if (freehandTool.endStroke(&simplified)) markDirty(simplified);
+        updateCanvas();
+        CHECK(gCanvasPx == fullRebuild());
+        gScene.addRandom(rnd, rnd.next(5), CANVAS_W, CANVAS_H, scratch);
+    }
+}
+
+// presentAreas(): a window that only gets the damaged areas restored from the
+// canvas, plus the preview drawn on top, has to show what a full blit plus
+// the preview would. Shape clicks, rubber-band moves, deletions and rebuilds
+// come in random order, one frame each.
+static void testPresent(TestRandom& rnd) {
+    static const Tool shapes[] = { TOOL_LINE, TOOL_TRIANGLE, TOOL_SQUARE, TOOL_CIRCLE, TOOL_OVAL };
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    std::vector<uint32_t> window(size_t(CANVAS_W) * CANVAS_H, 0);
+    std::vector<uint32_t> full;
+    FramebufferBackend windowFb, fullFb;
+    windowFb.attach(window.data(), CANVAS_W, CANVAS_H, CANVAS_W);
+    gFullPresent = true;
+    Tool tool = TOOL_LINE;
+    POINT mouse = { 400, 300 };
+    RECT shown;
+    bool hasShown = false;
+    int style = 0;
+
+    for (int frame = 0; frame < 300; ++frame) {
+        int action = rnd.next(10);
+        if (action < 5) {   // the cursor moves; any preview follows it
+            mouse = POINT{ LONG(rnd.next(CANVAS_W + 40) - 20), LONG(rnd.next(CANVAS_H + 40) - 20) };
+        }
+        else if (action < 8) {   // click: the next point, committing when the shape is complete
+            if (rnd.next(2))     // moved there within the same frame: never previewed
+                mouse = POINT{ LONG(rnd.next(CANVAS_W)), LONG(rnd.next(CANVAS_H)) };
+            gRender = &scratch;
+            switch (tool) {
+            case TOOL_LINE:     lineTool.addPoint(mouse);     if (lineTool.isReady()) lineTool.drawAndReset(&style); break;
+            case TOOL_TRIANGLE: triangleTool.addPoint(mouse); if (triangleTool.isReady()) triangleTool.drawAndReset(&style, rnd.next(2) != 0); break;
+            case TOOL_SQUARE:   squareTool.addPoint(mouse);   if (squareTool.isReady()) squareTool.drawAndReset(&style, rnd.next(2) != 0); break;
+            case TOOL_CIRCLE:   circleTool.addPoint(mouse);   if (circleTool.isReady()) circleTool.drawAndReset(&style); break;
+            default:            ovalTool.addPoint(mouse);     if (ovalTool.isReady()) ovalTool.drawAndReset(&style); break;
+            }
+            gRender = nullptr;
+        }
+        else if (action == 8) {   // right-click delete of a random shape
+            Tool t = shapes[rnd.next(5)];
+            if (toolCount(t) > 0) {
+                size_t i = rnd.next(int(toolCount(t)));
+                int z = toolZ(t, i);
+                markDirty(toolBounds(t, i));
+                toolEraseZs(t, &z, 1);
+            }
+        }
+        else if (rnd.next(4) == 0) {   // clear / load: a full rebuild
+            gNeedsRebuild = true;
+        }
+        else {   // another tool, another line mode
+            tool = shapes[rnd.next(5)];
+            style = rnd.next(2);
+        }
+
+        updateCanvas();
+        RECT preview = toolPreviewBounds(tool, mouse);
+        bool hasPreview = rectClip(preview, CANVAS_W, CANVAS_H);
+        RECT areas[3];
+        int n = presentAreas(hasShown ? &shown : nullptr, hasPreview ? &preview : nullptr, CANVAS_W, CANVAS_H, areas);
+        for (int i = 0; i < n; ++i)
+            for (int y = areas[i].top; y <= areas[i].bottom; ++y)
+                std::copy(&gCanvasPx[size_t(y) * CANVAS_W + areas[i].left],
+                          &gCanvasPx[size_t(y) * CANVAS_W + areas[i].right] + 1,
+                          &window[size_t(y) * CANVAS_W + areas[i].left]);
+        gRender = &windowFb;
+        gRender->setRop(R2_COPYPEN);
+        gRender->setLineColor(BLACK);
+        toolDrawPreview(tool, mouse, &style);
+        shown = preview;
+        hasShown = hasPreview;
+        gHasPresentDamage = false;
+        gFullPresent = false;
+
+        full = gCanvasPx;   // the old present: all of the canvas, then the preview
+        fullFb.attach(full.data(), CANVAS_W, CANVAS_H, CANVAS_W);
+        gRender = &fullFb;
+        gRender->setRop(R2_COPYPEN);
+        gRender->setLineColor(BLACK);
+        toolDrawPreview(tool, mouse, &style);
+        gRender = nullptr;
+        CHECK(window == full);
+    }
+    lineTool.reset();
+    triangleTool.reset();
+    squareTool.reset();
+    circleTool.reset();
+    ovalTool.reset();
+}
+
+// ZMerge: the global z order of a plain sort, with the minZ cut and the
+// area filter applied
+static void testMergeOrder(TestRandom& rnd) {
+    for (int round = 0; round < 20; ++round) {
+        int minZ = rnd.next(gZCounter + 1);
+        int x = rnd.next(CANVAS_W), y = rnd.next(CANVAS_H);
+        RECT area = makeRect(x, y, x + rnd.next(200), y + rnd.next(200));
+        const RECT* filter = round % 2 ? &area : nullptr;
+
+        std::vector<TestRef> want;
+        for (const TestRef& r : gScene.refs(minZ))
+            if (!filter || rectsOverlap(gScene.bounds(r.tool, r.index), area)) want.push_back(r);
+        std::vector<TestRef> got;
+        ZMerge merge(minZ, filter);
+        RenderRef r;
+        while (merge.next(r)) got.push_back({ r.z, int(r.tool), r.index });
+
+        bool same = got.size() == want.size();
+        for (size_t i = 0; same && i < got.size(); ++i)
+            same = got[i].z == want[i].z && got[i].tool == want[i].tool && got[i].index == want[i].index;
+        CHECK(same);
+    }
+}
+
+// renderTiled(): the pool rasterizes 64x64 tiles in parallel, each clipped to
+// its own items; the result must match one serial pass
+static void testTiled(TestRandom& rnd) {
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    TileRenderer tiles(4);
+    gCanvasTiles = &tiles;
+    for (int round = 0; round < 6; ++round) {
+        gScene.addRandom(rnd, 1 + rnd.next(150), CANVAS_W, CANVAS_H, scratch);
+        gNeedsRebuild = true;
+        updateCanvas();
+        CHECK(!gNeedsRebuild && gCanvasZ == gZCounter);
+        CHECK(gCanvasPx == fullRebuild());
+    }
+    gCanvasTiles = nullptr;
+}
+
+// selectBake() + drawBaked(): a raster erase stroke goes into the background
+// layer along with what lies under it, and the canvas has to come back the
+// same from the layer plus the items left vector.
+static void testBake(TestRandom& rnd) {
+    FramebufferBackend scratch(CANVAS_W, CANVAS_H);
+    for (int round = 0; round < 8; ++round) {
+        gScene.addRandom(rnd, 20 + rnd.next(40), CANVAS_W, CANVAS_H, scratch);
+        size_t first = eraserTool.getCount();
+        POINT p = { LONG(rnd.next(CANVAS_W)), LONG(rnd.next(CANVAS_H)) };
+        eraserTool.beginStroke(4 + rnd.next(30));
+        eraserTool.addDab(p);
+        for (int j = 0, m = rnd.next(12); j < m; ++j) {
+            POINT q = { p.x + rnd.next(81) - 40, p.y + rnd.next(81) - 40 };
+            eraserTool.addSegment(p, q);
+            p = q;
+        }
+        eraserTool.endStroke();
+        gScene.addRandom(rnd, rnd.next(10), CANVAS_W, CANVAS_H, scratch);   // above the stroke
+        std::vector<uint32_t> before = fullRebuild();
+        size_t total = gScene.refs().size();
+
+        size_t strokeLen = eraserTool.getCount() - first;
+        std::vector<RenderRef> baked;
+        RECT area;
+        CHECK(selectBake(first, CANVAS_W, CANVAS_H, baked, area));
+        drawBaked(baked, area);
+        std::vector<std::pair<int, RECT>> boxes;
+        std::vector<int> zs[TOOL_COUNT];
+        size_t strokeBaked = 0;
+        for (size_t i = baked.size(); i-- > 0;) {
+            boxes.push_back({ baked[i].z, toolBounds(baked[i].tool, baked[i].index) });
+            zs[baked[i].tool].push_back(baked[i].z);
+            strokeBaked += baked[i].tool == TOOL_ERASER && baked[i].index >= first;
+        }
+        CHECK(strokeBaked == strokeLen);
+        for (int t = 0; t < TOOL_COUNT; ++t)
+            if (!zs[t].empty()) toolEraseZs(static_cast<Tool>(t), zs[t].data(), zs[t].size());
+
+        // Whatever stays vector is clear of every baked item above it
+        CHECK(gScene.refs().size() == total - baked.size());
+        for (const TestRef& r : gScene.refs()) {
+            RECT b = gScene.bounds(r.tool, r.index);
+            for (const auto& k : boxes) CHECK(k.first < r.z || !rectsOverlap(b, k.second));
+        }
+        CHECK(fullRebuild() == before);
+    }
+}
+
+int main() {
+    TestRandom rnd(7);
+    resetCanvasScene();
+    testIncremental(rnd);
+    testDirtyRepair(rnd);
+    testMergeOrder(rnd);
+    testTiled(rnd);
+    testOpenStroke(rnd);
+    testPresent(rnd);
+
+    // Baking needs a canvas-sized layer, as in main.cpp
+    resetCanvasScene();
+    gLayerW = CANVAS_W;
+    gLayerH = CANVAS_H;
+    randomLayer(gLayerPx, gLayerW, gLayerH, rnd);
+    testBake(rnd);
+    testTiled(rnd);
+
+    // Again over a background layer smaller than the canvas
+    resetCanvasScene();
+    gLayerW = 500;
+    gLayerH = 400;
+    randomLayer(gLayerPx, gLayerW, gLayerH, rnd);
+    testIncremental(rnd);
+    testDirtyRepair(rnd);
+    testTiled(rnd);
+    testOpenStroke(rnd);
+    testPresent(rnd);
+    return testResult("render");
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "CanvasCompositor.h"
+#include "RenderBatch.h"
+#include "TestScene.h"
+
+// Headless canvas device for CanvasCompositor.h: the canvas and the
+// background layer are plain pixel vectors drawn through a
+// FramebufferBackend, the way main.cpp's software canvas draws on gCanvas.
+// The compositor's scene is the global tools below (gScene wraps them).
+
+FreehandTool freehandTool;
+LineTool     lineTool;
+TriangleTool triangleTool;
+SquareTool   squareTool;
+CircleTool   circleTool;
+OvalTool     ovalTool;
+EraserTool   eraserTool;
+
+bool gNeedsRebuild = true;
+int  gCanvasZ = 0;
+RECT gDirty;
+bool gHasDirty = false;
+RECT gPresentDamage;
+bool gHasPresentDamage = false;
+bool gFullPresent = true;
+
+static TestScene gScene(freehandTool, lineTool, triangleTool, squareTool, circleTool, ovalTool, eraserTool);
+
+static const int CANVAS_W = 800, CANVAS_H = 600;
+static std::vector<uint32_t> gCanvasPx;           // empty: no canvas yet
+static std::vector<uint32_t> gLayerPx;            // background layer (empty: none)
+static int                   gLayerW = 0, gLayerH = 0;
+static FramebufferBackend    gCanvasFb;
+static RenderBatch           gCanvasBatch;
+static TileRenderer*         gCanvasTiles = nullptr;   // set: full rebuilds go to the pool
+
+bool canvasReady() { return !gCanvasPx.empty(); }
+void createCanvas() { gCanvasPx.assign(size_t(CANVAS_W) * CANVAS_H, WHITE); }
+int  canvasWidth() { return CANVAS_W; }
+int  canvasHeight() { return CANVAS_H; }
+
+void beginCanvas(bool background) {
+    if (background) gCanvasFb.attach(gLayerPx.data(), gLayerW, gLayerH, gLayerW);
+    else gCanvasFb.attach(gCanvasPx.data(), CANVAS_W, CANVAS_H, CANVAS_W);
+    gCanvasBatch.begin(&gCanvasFb);
+    gRender = &gCanvasBatch;
+}
+
+void endCanvas() {
+    gRender->setClip(nullptr);
+    gCanvasBatch.end();
+    gRender = nullptr;
+}
+
+void paintCanvasBase(const RECT&) {
+    gCanvasFb.clear(WHITE);
+    if (!gLayerPx.empty()) gCanvasFb.blit(gLayerPx.data(), gLayerW, gLayerH, gLayerW);
+}
+
+bool rebuildCanvasTiled() {
+    if (!gCanvasTiles) return false;
+    return renderTiled(*gCanvasTiles, gCanvasPx.data(), CANVAS_W, CANVAS_H,
+                       gLayerPx.empty() ? nullptr : gLayerPx.data(), gLayerW, gLayerH);
+}
+
+// What one serial rebuildCanvas() gives for the scene as it is now. The
+// canvas and the compositor state are left as they were.
+inline std::vector<uint32_t> fullRebuild() {
+    std::vector<uint32_t> kept;
+    kept.swap(gCanvasPx);
+    bool needsRebuild = gNeedsRebuild, hasDirty = gHasDirty, fullPresent = gFullPresent;
+    int canvasZ = gCanvasZ;
+    RECT dirty = gDirty;
+    TileRenderer* tiles = gCanvasTiles;
+    gCanvasTiles = nullptr;
+
+    rebuildCanvas();
+
+    std::vector<uint32_t> out;
+    out.swap(gCanvasPx);
+    gCanvasPx.swap(kept);
+    gNeedsRebuild = needsRebuild;
+    gHasDirty = hasDirty;
+    gFullPresent = fullPresent;
+    gCanvasZ = canvasZ;
+    gDirty = dirty;
+    gCanvasTiles = tiles;
+    return out;
+}
+
+// Start over: no items, no layer, no canvas
+inline void resetCanvasScene() {
+    freehandTool.resetAll();
+    lineTool.resetAll();
+    triangleTool.resetAll();
+    squareTool.resetAll();
+    circleTool.resetAll();
+    ovalTool.resetAll();
+    eraserTool.resetAll();
+    gLayerPx.clear();
+    gLayerW = gLayerH = 0;
+    gCanvasPx.clear();
+    gNeedsRebuild = true;
+    gHasDirty = false;
+    gCanvasZ = 0;
+}
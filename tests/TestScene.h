@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "DocumentIO.h"
+#include "FramebufferBackend.h"
+
+// Shared by the headless tests (one per executable): the globals the tools
+// extern, a CHECK macro, and a scene of all seven tools filled with random
+// items through the same calls the UI makes.
+
+int      gZCounter = 0;
+bool     fillEnabled = true;
+COLORREF currentFillColor = RGB(200, 220, 255);
+thread_local RenderBackend* gRender = nullptr;
+
+static int gFailures = 0;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++gFailures; } } while (0)
+
+static int testResult(const char* name) {
+    if (gFailures) std::printf("%s: %d failure(s)\n", name, gFailures);
+    else std::printf("%s: ok\n", name);
+    return gFailures ? 1 : 0;
+}
+
+// Deterministic across platforms, unlike rand()
+struct TestRandom {
+    uint32_t state;
+    explicit TestRandom(uint32_t seed) : state(seed ? seed : 1) {}
+    int next(int n) {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        return int(state % uint32_t(n));
+    }
+};
+
+// Item tags, in the order of main.cpp's Tool enum
+enum TestTool { T_FREEHAND, T_LINE, T_TRIANGLE, T_SQUARE, T_CIRCLE, T_OVAL, T_ERASER, T_COUNT };
+
+struct TestRef { int z; int tool; size_t index; };
+
+// The tools of a scene that owns them
+struct TestTools {
+    FreehandTool freehand;
+    LineTool     line;
+    TriangleTool triangle;
+    SquareTool   square;
+    CircleTool   circle;
+    OvalTool     oval;
+    EraserTool   eraser;
+};
+
+struct TestScene {
+    TestTools*    owned;
+    FreehandTool& freehand;
+    LineTool&     line;
+    TriangleTool& triangle;
+    SquareTool&   square;
+    CircleTool&   circle;
+    OvalTool&     oval;
+    EraserTool&   eraser;
+
+    // A scene with tools of its own
+    TestScene() : TestScene(new TestTools) {}
+
+    // A scene over existing tools (e.g. the globals CanvasCompositor.h draws)
+    TestScene(FreehandTool& f, LineTool& l, TriangleTool& t, SquareTool& s, CircleTool& c, OvalTool& o, EraserTool& e)
+        : owned(nullptr), freehand(f), line(l), triangle(t), square(s), circle(c), oval(o), eraser(e) {}
+
+    ~TestScene() { delete owned; }
+    TestScene(const TestScene&) = delete;
+    TestScene& operator=(const TestScene&) = delete;
+
+    explicit TestScene(TestTools* t)
+        : owned(t), freehand(t->freehand), line(t->line), triangle(t->triangle), square(t->square),
+          circle(t->circle), oval(t->oval), eraser(t->eraser) {}
+
+    DocScene doc(uint32_t* (*allocBackground)(int, int) = nullptr) {
+        DocScene s = {};
+        s.freehand = &freehand;
+        s.line = &line;
+        s.triangle = &triangle;
+        s.square = &square;
+        s.circle = &circle;
+        s.oval = &oval;
+        s.eraser = &eraser;
+        s.zCounter = gZCounter;
+        s.allocBackground = allocBackground;
+        return s;
+    }
+
+    size_t count(int t) const {
+        switch (t) {
+        case T_FREEHAND: return freehand.getCount();
+        case T_LINE:     return line.getCount();
+        case T_TRIANGLE: return triangle.getCount();
+        case T_SQUARE:   return square.getCount();
+        case T_CIRCLE:   return circle.getCount();
+        case T_OVAL:     return oval.getCount();
+        default:         return eraser.getCount();
+        }
+    }
+
+    int z(int t, size_t i) const {
+        switch (t) {
+        case T_FREEHAND: return freehand.getZ(i);
+        case T_LINE:     return line.getZ(i);
+        case T_TRIANGLE: return triangle.getZ(i);
+        case T_SQUARE:   return square.getZ(i);
+        case T_CIRCLE:   return circle.getZ(i);
+        case T_OVAL:     return oval.getZ(i);
+        default:         return eraser.getZ(i);
+        }
+    }
+
+    RECT bounds(int t, size_t i) const {
+        switch (t) {
+        case T_FREEHAND: return freehand.getBounds(i);
+        case T_LINE:     return line.getBounds(i);
+        case T_TRIANGLE: return triangle.getBounds(i);
+        case T_SQUARE:   return square.getBounds(i);
+        case T_CIRCLE:   return circle.getBounds(i);
+        case T_OVAL:     return oval.getBounds(i);
+        default:         return eraser.getBounds(i);
+        }
+    }
+
+    void drawAt(int t, size_t i) const {
+        switch (t) {
+        case T_FREEHAND: freehand.drawAt(i); break;
+        case T_LINE:     line.drawAt(i);     break;
+        case T_TRIANGLE: triangle.drawAt(i); break;
+        case T_SQUARE:   square.drawAt(i);   break;
+        case T_CIRCLE:   circle.drawAt(i);   break;
+        case T_OVAL:     oval.drawAt(i);     break;
+        default:         eraser.drawAt(i);   break;
+        }
+    }
+
+    // Every item with z > minZ, in z order
+    std::vector<TestRef> refs(int minZ = 0) const {
+        std::vector<TestRef> r;
+        for (int t = 0; t < T_COUNT; ++t)
+            for (size_t i = 0, n = count(t); i < n; ++i)
+                if (z(t, i) > minZ) r.push_back({ z(t, i), t, i });
+        std::sort(r.begin(), r.end(), [](const TestRef& a, const TestRef& b) { return a.z < b.z; });
+        return r;
+    }
+
+    // n random commits, drawn into 'scratch' as the UI would preview them.
+    // Coordinates reach past a w x h canvas on every side.
+    void addRandom(TestRandom& rnd, int n, int w, int h, FramebufferBackend& scratch) {
+        RenderBackend* saved = gRender;
+        gRender = &scratch;
+        auto pt = [&]() { return POINT{ LONG(rnd.next(w + 100) - 50), LONG(rnd.next(h + 100) - 50) }; };
+        for (int k = 0; k < n; ++k) {
+            int style = rnd.next(2);
+            fillEnabled = rnd.next(2) != 0;
+            currentFillColor = RGB(rnd.next(256), rnd.next(256), rnd.next(256));
+            switch (rnd.next(T_COUNT)) {
+            case T_FREEHAND: {
+                POINT p = pt();
+                for (int j = 0, m = 2 + rnd.next(30); j < m; ++j) {
+                    POINT q = { p.x + rnd.next(21) - 10, p.y + rnd.next(21) - 10 };
+                    freehand.addStroke(p, q, &style);
+                    p = q;
+                }
+                freehand.endStroke();
+                break;
+            }
+            case T_LINE:
+                line.addPoint(pt()); line.addPoint(pt());
+                line.drawAndReset(&style);
+                break;
+            case T_TRIANGLE:
+                triangle.addPoint(pt()); triangle.addPoint(pt()); triangle.addPoint(pt());
+                triangle.drawAndReset(&style, fillEnabled);
+                break;
+            case T_SQUARE:
+                square.addPoint(pt()); square.addPoint(pt());
+                square.drawAndReset(&style, fillEnabled);
+                break;
+            case T_CIRCLE: {
+                POINT c = pt();
+                circle.addPoint(c);
+                circle.addPoint(POINT{ c.x + rnd.next(120), c.y + rnd.next(50) });
+                circle.drawAndReset(&style);
+                break;
+            }
+            case T_OVAL: {
+                POINT c = pt();
+                oval.addPoint(c);
+                oval.addPoint(POINT{ c.x + rnd.next(150), c.y + rnd.next(90) });
+                oval.drawAndReset(&style);
+                break;
+            }
+            default: {
+                eraser.beginStroke(3 + rnd.next(20));
+                POINT p = pt();
+                eraser.addDab(p);
+                for (int j = 0, m = rnd.next(4); j < m; ++j) {
+                    POINT q = { p.x + rnd.next(61) - 30, p.y + rnd.next(61) - 30 };
+                    eraser.addSegment(p, q);
+                    p = q;
+                }
+                eraser.endStroke();
+                break;
+            }
+            }
+        }
+        gRender = saved;
+    }
+};
+
+// ---- Comparing scenes record for record ----
+
+// Field by field: the shape records' padding is not part of them (saving
+// zeroes it, see docPackRecord())
+template <class R>
+inline bool sameRecord(const R& a, const R& b) {
+    R pa, pb;
+    docPackRecords<R>(&a, 1, &pa);
+    docPackRecords<R>(&b, 1, &pb);
+    return std::memcmp(&pa, &pb, sizeof(R)) == 0;
+}
+
+inline bool sameRecord(const LineTool::Record& a, const LineTool::Record& b) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+inline bool sameRecord(const EraserTool::Record& a, const EraserTool::Record& b) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+template <class T>
+inline bool sameRecords(const T& a, const T& b) {
+    if (a.getCount() != b.getCount()) return false;
+    for (size_t i = 0; i < a.getCount(); ++i)
+        if (!sameRecord(a.records()[i], b.records()[i])) return false;
+    return true;
+}
+
+inline bool sameStrokes(const FreehandTool& a, const FreehandTool& b) {
+    if (a.getCount() != b.getCount()) return false;
+    for (size_t i = 0; i < a.getCount(); ++i) {
+        const FreehandTool::Record& s = a.records()[i];
+        const FreehandTool::Record& t = b.records()[i];
+        if (s.count != t.count || s.style != t.style || s.z != t.z ||
+            std::memcmp(&s.box, &t.box, sizeof(RECT)) != 0 ||
+            std::memcmp(a.pointPool() + s.first, b.pointPool() + t.first, size_t(s.count) * sizeof(POINT)) != 0)
+            return false;
+    }
+    return true;
+}
+
+inline bool sameScene(const TestScene& a, const TestScene& b) {
+    return sameStrokes(a.freehand, b.freehand) && sameRecords(a.line, b.line) &&
+           sameRecords(a.triangle, b.triangle) && sameRecords(a.square, b.square) &&
+           sameRecords(a.circle, b.circle) && sameRecords(a.oval, b.oval) &&
+           sameRecords(a.eraser, b.eraser);
+}
+
+// Fill a w x h background layer with blocks of color (0x00RRGGBB)
+inline void randomLayer(std::vector<uint32_t>& px, int w, int h, TestRandom& rnd) {
+    px.assign(size_t(w) * h, 0);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            px[size_t(y) * w + x] = ((x / 16 + y / 16) % 3 == 0) ? uint32_t(rnd.next(0x1000000)) : 0xFFFFFFu;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdio>
+#include <unistd.h>
+
+inline int _fileno(FILE* f) { return fileno(f); }
+inline int _commit(int fd) { return fsync(fd); }
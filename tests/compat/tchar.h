@@ -0,0 +1,28 @@
+#pragma once
+// Narrow-character versions of the <tchar.h> routines the headers use
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#define _T(x) x
+
+inline size_t _tcslen(const char* s) { return std::strlen(s); }
+
+inline int _tcscpy_s(char* d, size_t n, const char* s) {
+    if (std::strlen(s) >= n) { if (n) d[0] = 0; return ERANGE; }
+    std::strcpy(d, s);
+    return 0;
+}
+
+inline int _tcscat_s(char* d, size_t n, const char* s) {
+    if (std::strlen(d) + std::strlen(s) >= n) return ERANGE;
+    std::strcat(d, s);
+    return 0;
+}
+
+inline int _tfopen_s(FILE** f, const char* path, const char* mode) {
+    *f = std::fopen(path, mode);
+    return *f ? 0 : errno;
+}
+
+inline int _tremove(const char* path) { return std::remove(path); }
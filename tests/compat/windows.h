@@ -0,0 +1,25 @@
+#pragma once
+// Linux stand-ins for the few Win32 calls the headless headers make, so the
+// tests can include them unchanged. Not used on Windows.
+#include <cstdio>
+#include <sys/stat.h>
+#include "../../GfxTypes.h"
+
+typedef char TCHAR;
+typedef int  BOOL;
+
+#define MAX_PATH 260
+#define MOVEFILE_REPLACE_EXISTING 1
+#define MOVEFILE_WRITE_THROUGH    8
+#define INVALID_FILE_ATTRIBUTES   ((DWORD)-1)
+
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+
+inline BOOL MoveFileEx(const TCHAR* from, const TCHAR* to, DWORD) { return std::rename(from, to) == 0; }
+inline BOOL DeleteFile(const TCHAR* path) { return std::remove(path) == 0; }
+
+inline DWORD GetFileAttributes(const TCHAR* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? 0 : INVALID_FILE_ATTRIBUTES;
+}